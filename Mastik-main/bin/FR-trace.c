@@ -28,6 +28,7 @@
 #include <mastik/pda.h>
 #include <mastik/util.h>
 #include <mastik/symbol.h>
+#include <mastik/topology.h>
 #include <time.h>
 #include <sys/utsname.h>
 
@@ -44,7 +45,7 @@
 
 void usage(char *p) {
   fprintf(stderr, "Usage: %s [-s <slotlen>] [-c <maxsamplecount>] [-h <threshold>] [-i <idlecount>]\n"
-      		  "                [-p <pdacount>] [-H] [-f <file>] [-S <debugfile>] [-a cpu]\n"
+      		  "                [-p <pdacount>] [-H] [-f <file>] [-S <debugfile>] [-a cpu] [-P]\n"
 		  "                [-F <outputFileNameFormat>] [-r <runs] [-l <minlen>]\n"
 		  "                [-m <monitoraddress>] [-e <evictaddress>] [-t <pdatarget>] ...\n", p);
   exit(1);
@@ -76,6 +77,8 @@ struct config {
   int runs;
   int minlen;
   int affinity;
+  int autoplace;
+  int victim;
 };
 
 
@@ -90,7 +93,7 @@ void fill_map_entry(struct map_entry *e) {
     exit(1);
   }
 
-  e->map_address = map_offset(e->file, e->offset);
+  e->map_address = map_offset_flags(e->file, e->offset, MAPOFFSET_PREFAULT);
   if (e->map_address == NULL) {
     perror(e->file);
     exit(1);
@@ -135,8 +138,10 @@ void readargs(struct config *c, int ac, char **av) {
   c->runs = 0;
   c->minlen = 0;
   c->affinity = -1;
+  c->autoplace = 0;
+  c->victim = -1;
 
-  while ((ch = getopt(ac, av, "Ha:f:S:s:c:h:i:p:t:m:e:r:F:l:")) != -1) {
+  while ((ch = getopt(ac, av, "HPa:f:S:s:c:h:i:p:t:m:e:r:F:l:")) != -1) {
     switch (ch) {
       case 'H': 
 	c->printheader = 1;
@@ -150,6 +155,9 @@ void readargs(struct config *c, int ac, char **av) {
       case 'a':
 	c->affinity = atoi(optarg);
 	break;
+      case 'P':
+	c->autoplace = 1;
+	break;
       case 'h':
 	c->threshold = atoi(optarg);
 	break;
@@ -263,6 +271,8 @@ void printheader(FILE *f, struct config *c, int lines, int run, fr_t fr) {
     fprintf(f, "all\n");
   else
     fprintf(f, "%d\n", c->affinity);
+  if (c->autoplace)
+    fprintf(f, "# victim=%d\n", c->victim);
   fprintf(f, "############## SYSTEM INFO ###############\n");
   fprintf(f, "# mastik_version=%s\n", mastik_version());
   printuname(f);
@@ -306,12 +316,31 @@ int main(int ac, char **av) {
     res[i] = 1;
   fr_probe(fr, res);
 
+  // The prober gets a core of the caller's LLC, and the attack processes,
+  // which inherit the affinity at fork, the other cores
+  struct tpplacement placement;
+  placement.ncontention = 0;
+  if (c.autoplace) {
+    topology_t tp = tp_discover();
+    if (tp == NULL || !tp_place(tp, -1, 0, c.pdacount, &placement)) {
+      fprintf(stderr, "Cannot read the CPU topology\n");
+      exit(1);
+    }
+    tp_release(tp);
+    if (c.affinity == -1)
+      c.affinity = placement.prober;
+    c.victim = placement.victim;
+    fprintf(stderr, "Prober on CPU %d, run the victim on CPU %d\n", c.affinity, c.victim);
+  }
+
   if (c.pdacount > 0) {
     pdas = calloc(c.pdacount, sizeof(pda_t));
     for (int i = 0; i < c.pdacount; i++) {
       pdas[i] = pda_prepare();
       for (int j = 0; j < c.npdatargets; j++)
 	pda_target(pdas[i], c.pda_targets[j].map_address);
+      if (placement.ncontention > 0)
+	setaffinity(placement.contention[i % placement.ncontention]);
       pda_activate(pdas[i]);
     }
   }
@@ -20,14 +20,29 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <mastik/util.h>
 #include <mastik/l3.h>
 
 #define SAMPLES 1000
 
+// L3-capturecount [-b 1|4|5]
+//
+// -b stores the counts packed into that many bits per set during the
+// capture, see mastik/pack.h.  1 keeps only whether the set missed.
 
 int main(int ac, char **av) {
+  int bits = 0;
+  int opt;
+  while ((opt = getopt(ac, av, "b:")) != -1) {
+    if (opt != 'b' || !pk_valid(atoi(optarg))) {
+      fprintf(stderr, "Usage: %s [-b 1|4|5]\n", av[0]);
+      exit(1);
+    }
+    bits = atoi(optarg);
+  }
+
   delayloop(3000000000U);
 
   l3pp_t l3 = l3_prepare(NULL, NULL);
@@ -39,6 +54,25 @@ int main(int ac, char **av) {
     l3_monitor(l3, i);
 
 
+  if (bits) {
+    size_t size = pk_recordsize(nmonitored, bits);
+    char *packed = malloc(SAMPLES * size);
+    for (size_t i = 0; i < SAMPLES * size; i += 4096)
+      packed[i] = 1;
+
+    l3_repeatedprobecountpacked(l3, SAMPLES, packed, bits, 0, 0);
+
+    for (int i = 0; i < SAMPLES; i++) {
+      for (int j = 0; j < nmonitored; j++) {
+	printf("%4d ", pk_get(packed + i * size, j, bits));
+      }
+      putchar('\n');
+    }
+    free(packed);
+    l3_release(l3);
+    return 0;
+  }
+
   uint16_t *res = calloc(SAMPLES * nmonitored, sizeof(uint16_t));
   for (int i = 0; i < SAMPLES * nmonitored; i+= 4096/sizeof(uint16_t))
     res[i] = 1;
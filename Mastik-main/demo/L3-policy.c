@@ -0,0 +1,193 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <mastik/l3.h>
+#include <mastik/mm.h>
+#include <mastik/sim.h>
+#include <mastik/policy.h>
+
+// Characterises the LLC replacement policy from the eviction sets of the
+// map: infers the policy of a sample of sets, looks for set-dueling
+// leaders among the first sets and prints the cheapest prime pattern for
+// each policy seen.
+//
+//   L3-policy [-s lru|plru|qlru|random|dueling] [-n sets] [-t target]
+//
+// -s runs on a small simulated LLC with the given policy.  -n is the
+// number of sets searched for leaders, -t the reliability a prime pattern
+// must reach, per thousand.
+
+#define SAMPLES 8
+#define SCRUB_LINES 256
+
+static const char *simpolicies[] = { "lru", "plru", "random", "qlru", "dueling", NULL };
+
+// The first associativity lines of the eviction set of set, topped up
+// with lines from the mm to nlines.  The mm keeps the eviction sets for
+// itself, so it does not hand out their lines.
+static int setlines(l3pp_t l3, int set, void **lines, int nlines) {
+  int assoc = l3_getAssociativity(l3);
+  if (l3_getevictionset(l3, set, lines, assoc) < assoc)
+    return 0;
+  mm_requestlines(l3_getmm(l3), L3, set, lines + assoc, nlines - assoc);
+  return lines[nlines - 1] != NULL;
+}
+
+// Lines of other sets at the same page offset, which share the L1 set
+static int scrublines(l3pp_t l3, int set, void **scrub) {
+  int assoc = l3_getAssociativity(l3);
+  int nsets = l3_getSets(l3);
+  int n = 0;
+  for (int s = set % L3_SETS_PER_PAGE; s < nsets && n + assoc <= SCRUB_LINES; s += L3_SETS_PER_PAGE) {
+    if (s == set)
+      continue;
+    int len = l3_getevictionset(l3, s, scrub + n, assoc);
+    n += len < assoc ? len : assoc;
+  }
+  return n;
+}
+
+int main(int ac, char **av) {
+  int simpolicy = -1;
+  int leadersets = 1024;
+  int target = 990;
+  int opt;
+  while ((opt = getopt(ac, av, "s:n:t:")) != -1) {
+    switch (opt) {
+    case 's':
+      for (simpolicy = 0; simpolicies[simpolicy] && strcmp(simpolicies[simpolicy], optarg); simpolicy++)
+	;
+      if (simpolicies[simpolicy] == NULL) {
+	fprintf(stderr, "Unknown policy %s\n", optarg);
+	exit(1);
+      }
+      break;
+    case 'n':
+      leadersets = atoi(optarg);
+      break;
+    case 't':
+      target = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s policy] [-n sets] [-t target]\n", av[0]);
+      exit(1);
+    }
+  }
+
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  mm_t mm = NULL;
+  sim_t sim = NULL;
+  if (simpolicy >= 0) {
+    l3info.flags = L3FLAG_NOHUGEPAGES;
+    l3info.associativity = 12;
+    l3info.setsperslice = 1024;
+    l3info.slices = 2;
+    struct siminfo si;
+    bzero(&si, sizeof(si));
+    si.associativity = l3info.associativity;
+    si.setsperslice = l3info.setsperslice;
+    si.slices = l3info.slices;
+    si.policy = simpolicy;
+    sim = sim_new(&si);
+    mm = mm_prepare(NULL, NULL, (lxinfo_t)&l3info);
+    mm_setsim(mm, sim);
+  }
+  l3pp_t l3 = l3_prepare(&l3info, mm);
+  if (l3 == NULL) {
+    fprintf(stderr, "Cannot map the LLC\n");
+    exit(1);
+  }
+  int nsets = l3_getSets(l3);
+  int assoc = l3_getAssociativity(l3);
+  int nlines = assoc * 2;
+  printf("# %d sets of %d ways%s\n", nsets, assoc, sim ? ", simulated" : "");
+
+  struct policyinfo pi;
+  bzero(&pi, sizeof(pi));
+  pi.associativity = assoc;
+  pi.sim = sim;
+  void **scrub = malloc(SCRUB_LINES * sizeof(void *));
+  pi.scrub = scrub;
+
+  int seen[POLICY_NTYPES];
+  bzero(seen, sizeof(seen));
+  void **lines = malloc(nlines * sizeof(void *));
+  for (int i = 0; i < SAMPLES; i++) {
+    int set = (int)((long)i * nsets / SAMPLES) + i;
+    if (!setlines(l3, set, lines, nlines))
+      continue;
+    pi.nscrub = sim ? 0 : scrublines(l3, set, scrub);
+    struct policyresult res;
+    pl_infer(lines, nlines, &pi, &res);
+    seen[res.policy]++;
+    printf("Set %5d: %-9s agreement %4d stability %4d\n", set, pl_name(res.policy), res.agreement, res.stability);
+  }
+  free(lines);
+
+  if (leadersets > nsets)
+    leadersets = nsets;
+  void **all = calloc((size_t)leadersets * nlines, sizeof(void *));
+  int nready = 0;
+  for (int s = 0; s < leadersets; s++)
+    if (setlines(l3, s, all + (size_t)s * nlines, nlines))
+      nready++;
+  if (nready == leadersets) {
+    // The scrub lines of set 0 serve all sets, at the cost of missing
+    // some of the private-cache sets
+    pi.nscrub = sim ? 0 : scrublines(l3, 0, scrub);
+    int *roles = malloc(leadersets * sizeof(int));
+    int nleaders = pl_findleaders(all, leadersets, nlines, &pi, roles);
+    if (nleaders < 0) {
+      printf("No set dueling in the first %d sets\n", leadersets);
+    } else {
+      printf("%d leaders in the first %d sets:", nleaders, leadersets);
+      for (int s = 0; s < leadersets; s++)
+	if (roles[s] != PL_FOLLOWER)
+	  printf(" %d%s", s, roles[s] == PL_LEADER_THRASHING ? "t" : "r");
+      printf("\n");
+    }
+    free(roles);
+  }
+  free(all);
+  free(scrub);
+
+  for (int p = POLICY_LRU; p < POLICY_NTYPES; p++) {
+    if (!seen[p])
+      continue;
+    struct primeinfo prime;
+    bzero(&prime, sizeof(prime));
+    int rel = pl_primepattern(p, assoc, target, &prime);
+    printf("Prime for %s: repeats %d touches %d %s, reliability %d\n", pl_name(p),
+	prime.repeats, prime.touches, prime.direction == PRIMEDIR_ZIGZAG ? "zigzag" : "forward", rel);
+  }
+
+  l3_release(l3);
+  if (mm)
+    mm_release(mm);
+  if (sim)
+    sim_release(sim);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <mastik/stream.h>
+
+// Attaches to a live stream and prints its frames as text, one row per
+// line, until the publisher closes it.  Frames lost because the viewer
+// fell behind are reported on stderr.
+
+#define BATCH 64
+
+int main(int ac, char **av) {
+  if (ac != 2) {
+    fprintf(stderr, "Usage: %s socket\n", av[0]);
+    exit(1);
+  }
+  stream_t s = ms_attach(av[1]);
+  if (s == NULL) {
+    fprintf(stderr, "Cannot attach to %s\n", av[1]);
+    exit(1);
+  }
+  int width = ms_getwidth(s);
+  struct ms_frame frames[BATCH];
+  uint16_t *rows = malloc(BATCH * width * sizeof(uint16_t));
+  uint64_t dropped = 0;
+
+  for (;;) {
+    int n = ms_read(s, frames, rows, BATCH);
+    if (n < 0)
+      break;
+    if (n == 0) {
+      usleep(1000);
+      continue;
+    }
+    for (int i = 0; i < n; i++) {
+      printf("%lu %u:", (unsigned long)frames[i].index, frames[i].tag);
+      for (int j = 0; j < frames[i].len; j++)
+	printf(" %4d", rows[i * width + j]);
+      putchar('\n');
+    }
+    fflush(stdout);
+    if (ms_dropped(s) != dropped) {
+      fprintf(stderr, "# %lu frames dropped\n", (unsigned long)(ms_dropped(s) - dropped));
+      dropped = ms_dropped(s);
+    }
+  }
+  free(rows);
+  ms_detach(s);
+}
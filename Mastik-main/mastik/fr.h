@@ -20,6 +20,8 @@
 #ifndef __FR_H__
 #define __FR_H__ 1
 
+#include <mastik/stream.h>
+
 typedef struct fr *fr_t;
 
 
@@ -64,6 +66,10 @@ int fr_trace(fr_t fr, int max_records, uint16_t *results, int slot, int threshol
 
 int fr_repeatedprobe(fr_t fr, int max_records, uint16_t *results, int slot);
 
+// Publish each captured record of fr_trace and fr_repeatedprobe to a live
+// stream, see mastik/stream.h.  NULL stops publishing.
+void fr_setstream(fr_t fr, stream_t stream);
+
 
 
 #endif // __FR_H__
@@ -24,6 +24,9 @@
 #include <unistd.h>
 
 #include <mastik/lx.h>
+#include <mastik/pmu.h>
+#include <mastik/taint.h>
+#include <mastik/tlb.h>
 
 #define LNEXT(t) (*(void **)(t))
 #define OFFSET(p, o) ((void *)((uintptr_t)(p) + (o)))
@@ -38,6 +41,9 @@
 #define LXFLAG_NOPROBE		0x04
 #define LXFLAG_QUADRATICMAP	0x08	// Defaults to this if huge pages is specified
 #define LXFLAG_LINEARMAP	0x10	// Defaults to this if small pages is specified
+#define LXFLAG_SLICEHASH	0x20	// Learn the slice hash when probing and reuse it for this CPU model
+#define LXFLAG_SIMULATE		0x40	// Use a simulated cache, see mastik/sim.h
+#define LXFLAG_NUMALOCAL	0x80	// Pin to the caller's LLC and bind the buffers to its nodes, see mm_setsocket
 
 #define LX_CACHELINE 0x40
 
@@ -49,8 +55,44 @@ void lx_bprobe(lxpp_t lx, uint16_t *results);
 void lx_probecount(lxpp_t lx, uint16_t *results);
 void lx_bprobecount(lxpp_t lx, uint16_t *results);
 
+// Probe each set between two reads of a hardware counter, see l3_pmuprobe
+int lx_pmuprobe(lxpp_t lx, pmu_t pmu, pmuevent_e event, int count, uint16_t *results, uint16_t *counts);
+
+// Publish every record of the repeated probes to a live stream, see
+// mastik/stream.h.  NULL stops publishing.
+void lx_setstream(lxpp_t lx, stream_t stream);
+
+// Prime the monitored sets with a primer per set, see mastik/prime.h.
+// The sim field of info is taken from the mm.  NULL restores the default
+// of walking each set once, as a probe does.
+void lx_setprime(lxpp_t lx, primeinfo_t info);
+void lx_prime(lxpp_t lx);
+
+// Reject probes of sets that took longer than a gap, see mastik/taint.h.
+// Covers the probes on the hardware without interleaving.  NULL turns
+// detection off.  lx_gettaintstats returns 0 if it is off.
+// lx_taintrecord ends a record, after the probe that measures it, and
+// returns the number of results flagged in it.
+void lx_settaint(lxpp_t lx, taintinfo_t info);
+int lx_gettaintstats(lxpp_t lx, taintstats_t stats);
+int lx_taintrecord(lxpp_t lx, uint16_t *results);
+
+// Lay out the monitored sets for the TLB and warm it up before each
+// set's probe, see mastik/tlb.h.  NULL turns both off but keeps the
+// layout.  lx_gettlbstats returns 0 if it is off.
+void lx_settlb(lxpp_t lx, tlbinfo_t info);
+int lx_gettlbstats(lxpp_t lx, tlbstats_t stats);
+
 int lx_repeatedprobe(lxpp_t lx, int nrecords, uint16_t *results, int slot);
 int lx_repeatedprobecount(lxpp_t lx, int nrecords, uint16_t *results, int slot);
+// As lx_repeatedprobecount, with records packed as in mastik/pack.h
+int lx_repeatedprobecountpacked(lxpp_t lx, int nrecords, void *results, int bits, uint16_t threshold, int slot);
+
+// Time only the eviction candidate of each set and prime again the sets
+// whose candidate missed, see l3_scope
+void lx_scopeprime(lxpp_t lx);
+void lx_scope(lxpp_t lx, uint16_t *results);
+int lx_repeatedscope(lxpp_t lx, int nrecords, uint16_t *results, int slot);
 
 void lx_randomise(lxpp_t lx);
 int lx_getmonitoredset(lxpp_t lx, int *lines, int nlines); 
@@ -62,6 +62,11 @@ void l1_bprobe(l1pp_t l1, uint16_t *results);
 
 // Slot is currently not implemented
 int l1_repeatedprobe(l1pp_t l1, int nrecords, uint16_t *results, int slot);
+// Publish each record of l1_repeatedprobe, see mastik/stream.h
+void l1_setstream(l1pp_t l1, stream_t stream);
+// Prime the monitored sets with a primer per set, see l3_setprime
+void l1_setprime(l1pp_t l1, primeinfo_t info);
+void l1_prime(l1pp_t l1);
 
 
 
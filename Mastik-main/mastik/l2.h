@@ -61,6 +61,9 @@ void l2_bprobe(l2pp_t l2, uint16_t *results);
 int l2_getmonitoredset(l2pp_t l2, int *lines, int nlines);
 void l2_release(l2pp_t l2);
 int l2_repeatedprobe(l2pp_t l2, int nrecords, uint16_t *results, int slot);
+void l2_setstream(l2pp_t l2, stream_t stream);
+void l2_setprime(l2pp_t l2, primeinfo_t info);
+void l2_prime(l2pp_t l2);
 int l2_getl2info(l2pp_t l2, l2info_t l2info);
 int l2_syncpp(l2pp_t l2, int nrecords, uint16_t *results, lx_sync_cb setup, lx_sync_cb exec, void *data);
 void l2_randomise(l2pp_t l2);
@@ -24,6 +24,12 @@
 
 #include <mastik/low.h>
 #include <mastik/mm.h>
+#include <mastik/pmu.h>
+#include <mastik/stream.h>
+#include <mastik/prime.h>
+#include <mastik/pack.h>
+#include <mastik/taint.h>
+#include <mastik/tlb.h>
 
 typedef void (*l3progressNotification_t)(int count, int est, void *data);
 struct l3info {
@@ -46,6 +52,9 @@ typedef struct l3info *l3info_t;
 #define L3FLAG_NOPROBE		0x04
 #define L3FLAG_QUADRATICMAP	0x08	// Defaults to this if huge pages is specified
 #define L3FLAG_LINEARMAP	0x10	// Defaults to this if small pages is specified
+#define L3FLAG_SLICEHASH	0x20	// Learn the slice hash when probing and reuse it for this CPU model
+#define L3FLAG_SIMULATE		0x40	// Use a simulated cache, see mastik/sim.h
+#define L3FLAG_NUMALOCAL	0x80	// Pin to the caller's LLC and bind the buffers to its nodes, see mm_setsocket
 
 #define L3_SETS_PER_SLICE 1024
 #define L3_GROUPSIZE_FOR_HUGEPAGES 1024
@@ -67,6 +76,29 @@ int l3_getSlices(l3pp_t l3);
 // Returns the LLC associativity
 int l3_getAssociativity(l3pp_t l3);
 
+// Returns the memory manager the sets are allocated from
+mm_t l3_getmm(l3pp_t l3);
+
+// Eviction sets, read directly from the map of the cache.  The lines are
+// part of the buffer used for mapping, not of the monitored sets, so
+// enumerating them does not take monitor slots or reserve lines.  Callers
+// may access the lines but must not write to them.
+
+// Copies up to nlines lines of the eviction set for set into lines.
+// Returns the size of the eviction set, or 0 for an invalid set.
+int l3_getevictionset(l3pp_t l3, int set, void **lines, int nlines);
+
+// Calls cb for each set in turn until it returns non-zero.  lines is only
+// valid during the call.  Returns the set at which cb returned non-zero,
+// or the number of sets if it never did.
+typedef int (*l3evictionset_cb_t)(int set, void **lines, int nlines, void *data);
+int l3_foreachevictionset(l3pp_t l3, l3evictionset_cb_t cb, void *data);
+
+// Fills a flat array of l3_getSets() * ways entries, with the lines of
+// set s at lines[s * ways].  Shorter sets are padded with NULL and longer
+// ones truncated.  Returns the number of sets.
+int l3_exportevictionsets(l3pp_t l3, void **lines, int ways);
+
 int l3_monitor(l3pp_t l3, int line);
 void l3_unmonitorall(l3pp_t l3);
 int l3_unmonitor(l3pp_t l3, int line);
@@ -79,8 +111,72 @@ void l3_bprobe(l3pp_t l3, uint16_t *results);
 void l3_probecount(l3pp_t l3, uint16_t *results);
 void l3_bprobecount(l3pp_t l3, uint16_t *results);
 
+// Probe each set between two reads of a hardware event counter, giving
+// its exact count for the set in counts next to the usual timing result
+// in results: the probe time for l3_pmuprobe, the slow-line count for
+// l3_pmuprobecount.  Sets are probed one at a time.  On a simulated
+// cache counts holds the simulated misses.
+// Returns 1 if counts is valid.  Otherwise counts is zeroed and results
+// are taken as by l3_probe or l3_probecount.
+int l3_pmuprobe(l3pp_t l3, pmu_t pmu, pmuevent_e event, uint16_t *results, uint16_t *counts);
+int l3_pmuprobecount(l3pp_t l3, pmu_t pmu, pmuevent_e event, uint16_t *results, uint16_t *counts);
+
+// Publish each record of l3_repeatedprobe and l3_repeatedprobecount to a
+// live stream, see mastik/stream.h.  NULL stops publishing.
+void l3_setstream(l3pp_t l3, stream_t stream);
+
+// Prime every monitored set with a primer of its lines built with info,
+// e.g. a pattern from pl_primepattern for the policy of the cache (see
+// mastik/policy.h).  NULL restores the default, one walk over each set.
+void l3_setprime(l3pp_t l3, primeinfo_t info);
+void l3_prime(l3pp_t l3);
+
+// Flag the probes of sets that were interrupted, see mastik/taint.h.
+// Applies to the probes and counts of l3_probe, l3_probecount and the
+// repeated variants, on the hardware and without interleaving.  NULL
+// turns detection off.  l3_gettaintstats fills stats with the totals
+// since detection was set and returns 0 if it is off.  l3_taintrecord
+// ends a record after the probe that measures it, flags every set if the
+// thread was switched out since the previous record, and returns the
+// number of flagged results, 0 if detection is off.
+void l3_settaint(l3pp_t l3, taintinfo_t info);
+int l3_gettaintstats(l3pp_t l3, taintstats_t stats);
+int l3_taintrecord(l3pp_t l3, uint16_t *results);
+
+// Order the lines of the monitored sets to need fewer page walks, and
+// warm the TLB up before each set is probed, see mastik/tlb.h.  Call
+// after monitoring the sets.  NULL stops the warm-up and the counting;
+// the layout stays.  l3_gettlbstats returns 0 if it is off.
+void l3_settlb(l3pp_t l3, tlbinfo_t info);
+int l3_gettlbstats(l3pp_t l3, tlbstats_t stats);
+
 int l3_repeatedprobe(l3pp_t l3, int nrecords, uint16_t *results, int slot);
 int l3_repeatedprobecount(l3pp_t l3, int nrecords, uint16_t *results, int slot);
+// As l3_repeatedprobecount, storing each record packed into bits per set,
+// see mastik/pack.h.  results must hold nrecords * pk_recordsize(nmonitored,
+// bits) bytes.  PK_BITMAP marks the sets with more than threshold misses;
+// the count layouts ignore it.  Missed slots are stored as unknown.
+// Returns 0 if bits is not a PK_ value or its counts cannot reach the
+// associativity.
+int l3_repeatedprobecountpacked(l3pp_t l3, int nrecords, void *results, int bits, uint16_t threshold, int slot);
+
+// Scope monitoring (Prime+Scope): l3_scopeprime leaves the first line of
+// each set's list as the set's LLC eviction candidate while it stays in
+// the private caches, so a sample only times that line, at the cost of
+// about one L1 hit per set, and does not disturb the LLC.  A set whose
+// candidate misses is primed again right away.  results gets the
+// candidate's access time, so values above L3_THRESHOLD mark evictions.
+// l3_repeatedscope primes all sets first and lays out its records as
+// l3_repeatedprobe does.
+//
+// The prime relies on the LLC inserting new lines as older than lines
+// that hit, as the QLRU policies of recent Intel parts do; under true LRU
+// the candidate is the line touched first, not the head.  Monitored sets
+// that share the head's L1 set push it out of the private caches, and the
+// next sample then reaches the LLC, which refreshes the head.
+void l3_scopeprime(l3pp_t l3);
+void l3_scope(l3pp_t l3, uint16_t *results);
+int l3_repeatedscope(l3pp_t l3, int nrecords, uint16_t *results, int slot);
 
 // Prime+Abort
 void l3_pa_prime(l3pp_t l3);
@@ -25,10 +25,15 @@
 #include <mastik/low.h>
 #include <mastik/mm.h>
 #include <mastik/info.h>
+#include <mastik/stream.h>
+#include <mastik/prime.h>
 
 struct vlist;
 typedef struct vlist *vlist_t;
 
+struct lxtaint;
+struct lxtlb;
+
 struct lxpp {
   void **monitoredhead;
   int nmonitored;
@@ -48,6 +53,11 @@ struct lxpp {
   
   mm_t mm;
   uint8_t internalmm;
+  stream_t stream;
+  primer_t *primers;
+  struct primeinfo primeinfo;
+  struct lxtaint *taint;
+  struct lxtlb *tlb;
 };
 
 typedef struct lxpp *lxpp_t;
@@ -22,6 +22,8 @@
 
 #include <mastik/low.h>
 #include <mastik/info.h>
+#include <mastik/sim.h>
+#include <mastik/numa.h>
 
 #ifdef MAP_HUGETLB
 #define HUGEPAGES MAP_HUGETLB
@@ -55,17 +57,66 @@ typedef struct mm* mm_t;
 
 mm_t mm_prepare(lxinfo_t l1info, lxinfo_t l2info, lxinfo_t l3info);
 
+// An mm can be shared by several l1pp, l2pp and l3pp handles, which then
+// share its mapping of the cache.  Each handle takes a reference and gets
+// disjoint lines; requesting and returning lines is thread-safe.
+// mm_release drops a reference and frees the mm with the last one.
+mm_t mm_retain(mm_t mm);
+
 void* mm_requestline(mm_t mm, cachelevel_e cachelevel, int line);
 
 void mm_requestlines(mm_t mm, cachelevel_e cachelevel, int line, void** lines, int count);
 
 void mm_returnline(mm_t mm, void* line);
 
+// Reserves a line of the mm's buffers that was not requested, e.g. one
+// read with l3_getevictionset, so that requests skip it.  Returns 0 if
+// the line is already taken or is not the mm's.  mm_returnline frees it.
+int mm_claimline(mm_t mm, void* line);
+
 void mm_returnlines(mm_t mm, void** lines, int count);
 
 void mm_release(mm_t mm);
 
 int mm_initialisel3(mm_t mm);
 
+// Maps the L2 colours of small pages, the set bits above the page offset,
+// by timing.  Done on the first request for L2 lines if not called
+// earlier.  Returns 0 if the L2 cannot be mapped, e.g. when simulating.
+int mm_initialisel2(mm_t mm);
+
+// The LLC set of the line at p as slice * sets per slice + the set index
+// of its physical address, which names the same set on every run.  -1 if
+// the mm cannot tell the slice or the physical address, which needs the
+// slice hash, the simulator or L3FLAG_USEPTE, and on the hardware the
+// rights to read /proc/self/pagemap.
+int mm_llcset(mm_t mm, void *p);
+
+// Memory held for lines and for mapping the caches, in bytes.  If
+// highwater is not NULL it receives the most held at any time.
+size_t mm_footprint(mm_t mm, size_t *highwater);
+
+// Caps the memory held.  Once the cap is reached, requests get fewer
+// lines than asked for and lx_monitor refuses sets it cannot fill.  0,
+// the default, leaves growth unbounded.
+void mm_setlimit(mm_t mm, size_t limit);
+
+// Answer timing queries from a simulated cache instead of the hardware.
+// Must be called before the cache is mapped.  The mm takes its geometry
+// from the simulator and reallocates its buffers; the caller keeps
+// ownership of sim.  mm_prepare with LXFLAG_SIMULATE creates its own.
+int mm_setsim(mm_t mm, sim_t sim);
+sim_t mm_getsim(mm_t mm);
+
+// Place the mm on the LLC of socket on a multi-socket host, socket -1
+// being the one the caller runs on, as LXFLAG_NUMALOCAL does.  The calling
+// thread is pinned to the CPUs of the LLC, which must also run every
+// probe, and the buffers are bound to the LLC's memory nodes, see
+// mastik/numa.h.  Must be called before the cache is mapped.  Returns 0
+// if the socket is unknown or the thread cannot be pinned.
+int mm_setsocket(mm_t mm, int socket);
+// Returns 0 if the mm is not placed
+int mm_getplacement(mm_t mm, struct numaplacement *placement);
+
 
 #endif // __MM_H__
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NUMA_H__
+#define __NUMA_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Placement of the prober and its buffers on one LLC of a multi-socket
+ * host.
+ *
+ * Eviction sets are only valid for the LLC they were found on, and memory
+ * on a remote node answers misses more slowly, which moves the thresholds.
+ * A placement names the LLC shared by a CPU, the CPUs that share it and
+ * the memory nodes those CPUs belong to.  numa_pin keeps the calling
+ * thread on the LLC, numa_bind places pages on its nodes and
+ * numa_offnode checks, from /proc/self/numa_maps, where pages really
+ * went.
+ *
+ * The LLC domains come from mastik/topology.h, and the memory policy
+ * calls are raw system calls, so there is no dependency on libnuma.  Without NUMA support nodes is 0 and binding does nothing.
+ */
+
+#define NUMA_MAXCPUS 1024
+#define NUMA_MAXNODES 64
+
+struct numaplacement {
+  int cpu;		// The CPU the placement was made for
+  int socket;		// Its physical package
+  int llc;		// Id of its LLC, -1 if the kernel does not say
+  int ncpus;		// CPUs sharing the LLC
+  uint64_t cpus[NUMA_MAXCPUS / 64];
+  uint64_t nodes;	// Memory nodes of those CPUs
+};
+typedef struct numaplacement *numaplacement_t;
+
+// Fills placement for the LLC of cpu, -1 for the CPU the caller runs on.
+// Returns 0 if the CPU is unknown.
+int numa_llcplacement(int cpu, numaplacement_t placement);
+
+// As numa_llcplacement for the first CPU of socket
+int numa_socketplacement(int socket, numaplacement_t placement);
+
+// Restricts the calling thread to the CPUs of the LLC and makes its
+// later allocations prefer the LLC's first node.  Returns 0 on failure.
+int numa_pin(numaplacement_t placement);
+
+// Binds the pages of buf to nodes, moving pages already touched.  Call
+// before the first touch.  Returns 0 on failure, 1 if nodes is 0.
+int numa_bind(void *buf, size_t size, uint64_t nodes);
+
+// The pages of the mapping that holds buf that are not on nodes, from
+// /proc/self/numa_maps.  Returns -1 if that cannot be told.
+long numa_offnode(void *buf, uint64_t nodes);
+
+#endif // __NUMA_H__
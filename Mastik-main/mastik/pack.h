@@ -0,0 +1,91 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PACK_H__
+#define __PACK_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Packed records of probecount results.
+ *
+ * A miss count of a set is at most the associativity, so long captures
+ * can store it in a few bits instead of a uint16_t.  A record holds one
+ * row of results, bits per set, with set i at bit i * bits of a little
+ * endian array of 64-bit words.  Records are padded to whole words, so
+ * record r of a capture starts at byte r * pk_recordsize(width, bits).
+ *
+ * Results of TAINT_FLAGGED and above, which includes the -1 of a missed
+ * slot in l3_repeatedprobecount, are not counts.  The count layouts store
+ * them as the all-ones code, PK_NIBBLE as 15 and PK_COUNT5 as 31, and real
+ * counts saturate one below: pk_maxcount gives the largest count a layout
+ * keeps.  PK_BITMAP keeps one bit per set, set if the result is above the
+ * threshold given to pk_pack, after a leading bit that marks a record
+ * with any result that is not a count; every set of such a record reads
+ * as unknown.  Unknown results unpack as PK_UNKNOWN.
+ */
+
+#define PK_BITMAP 1
+#define PK_NIBBLE 4
+#define PK_COUNT5 5
+
+#define PK_UNKNOWN 0xffff
+
+// Returns 1 if bits is one of the PK_ values
+int pk_valid(int bits);
+
+// Largest count a layout keeps, 1 for PK_BITMAP
+int pk_maxcount(int bits);
+
+// Bytes per record of width results
+size_t pk_recordsize(int width, int bits);
+
+// Packs a row of width results into record.  threshold is only used by
+// PK_BITMAP.
+void pk_pack(const uint16_t *row, int width, int bits, uint16_t threshold, void *record);
+
+// Unpacks nrecords consecutive records into rows of width results
+void pk_unpack(const void *records, int nrecords, int width, int bits, uint16_t *rows);
+
+// Result i of a record
+static inline uint16_t pk_get(const void *record, int i, int bits) {
+  const uint64_t *w = (const uint64_t *)record;
+  if (bits == PK_BITMAP && (w[0] & 1))
+    return PK_UNKNOWN;
+  size_t bit = (size_t)i * bits + (bits == PK_BITMAP);
+  uint64_t v = w[bit / 64] >> (bit % 64);
+  if (bit % 64 + bits > 64)
+    v |= w[bit / 64 + 1] << (64 - bit % 64);
+  v &= (1U << bits) - 1;
+  if (bits != PK_BITMAP && v == (1U << bits) - 1)
+    return PK_UNKNOWN;
+  return v;
+}
+
+// Number of sets above the threshold in a PK_BITMAP record, -1 if the
+// record is unknown
+int pk_popcount(const void *record, int width);
+
+// Adds to counts[i] the number of PK_BITMAP records in which set i was
+// above the threshold.  Unknown records are skipped; returns the number
+// of records counted.
+int pk_columncounts(const void *records, int nrecords, int width, uint32_t *counts);
+
+#endif // __PACK_H__
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PMU_H__
+#define __PMU_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Hardware event counters, for exact miss counts alongside the timing
+ * measurements.
+ *
+ * The counters are opened with perf_event_open for the calling thread,
+ * user mode only.  When the kernel allows user-space counter reads
+ * (/sys/bus/event_source/devices/cpu/rdpmc) they are read with rdpmc,
+ * which costs tens of cycles.  Otherwise each read is a read() system
+ * call, which still gives exact counts but is much slower.
+ *
+ * Context switches happen in the kernel, so that event is counted in
+ * kernel mode and needs perf_event_paranoid 1 or less.
+ *
+ * Any event can be unavailable, e.g. in a VM, without a PMU, or with a
+ * restrictive perf_event_paranoid.  pmu_open returns NULL if none opened;
+ * the functions taking a pmu_t accept NULL and report the events as
+ * unavailable.
+ */
+
+typedef struct pmu *pmu_t;
+
+enum pmuevent {
+  PMU_CYCLES,
+  PMU_LLC_MISSES,	// LLC load misses
+  PMU_L1D_MISSES,	// L1D load misses
+  PMU_L2_MISSES,	// L2_RQSTS.MISS, on the Intel models listed in pmu.c
+  PMU_DTLB_MISSES,	// Data TLB load misses that walk the page tables
+  PMU_CONTEXT_SWITCHES,	// Software event, needs kernel counting, always read()
+  PMU_NEVENTS
+};
+typedef enum pmuevent pmuevent_e;
+
+pmu_t pmu_open(void);
+void pmu_close(pmu_t pmu);
+
+// Returns true if the event is counted
+int pmu_available(pmu_t pmu, pmuevent_e event);
+
+// Returns true if the counters are read with rdpmc
+int pmu_userread(pmu_t pmu);
+
+// Current value of an event, 0 if unavailable
+uint64_t pmu_read(pmu_t pmu, pmuevent_e event);
+
+const char *pmu_eventname(pmuevent_e event);
+
+#endif // __PMU_H__
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POLICY_H__
+#define __POLICY_H__ 1
+
+#include <stdint.h>
+
+#include <mastik/sim.h>
+#include <mastik/prime.h>
+
+/*
+ * Inference of the LLC replacement policy, and of prime patterns for it.
+ *
+ * The policy of a set is learnt from experiments on lines congruent in
+ * that set, such as an eviction set from l3_getevictionset topped up with
+ * lines from mm_requestlines.  An experiment flushes the lines, makes a
+ * sequence of accesses to them and times one more access to tell whether
+ * that line survived.  The same sequences are replayed on software models
+ * of the candidate policies and the model that predicts the most outcomes
+ * wins.  Outcomes that change between repetitions of an experiment point
+ * to a random policy.
+ *
+ * Most Intel LLCs choose the insertion age of a QLRU policy by set
+ * dueling: a few leader sets have fixed insertion ages and a counter of
+ * their misses selects the insertion of all other sets.  pl_findleaders
+ * drives the counter both ways, by thrashing the sets and then by reusing
+ * lines right after inserting them, and reports the sets that do not
+ * follow.  The counter only moves through the leaders among the sets
+ * given, so give it many sets, e.g. all the sets of a slice.
+ *
+ * pl_primepattern finds the cheapest repeats, touches and direction of a
+ * primer (see mastik/prime.h) that leave a set holding only the primed
+ * lines whatever the set held before, by replaying the primer on the
+ * model of the policy from random states.
+ *
+ * Accesses that hit in L1 or L2 do not update the LLC policy.  On the
+ * hardware each access of an experiment is followed by a walk over the
+ * scrub lines, which should share the L1 and L2 sets of the lines but
+ * not their LLC set.  On a simulator every access reaches the model.
+ */
+
+enum policy {
+  POLICY_UNKNOWN,
+  POLICY_LRU,
+  POLICY_FIFO,
+  POLICY_TREEPLRU,	// Tree of direction bits, power of two ways only
+  POLICY_BITPLRU,	// One MRU bit per way
+  POLICY_QLRU_M1,	// Two-bit ages, hits to age 0, insertion at age 1
+  POLICY_QLRU_M2,	// Insertion at age 2, as in SRRIP
+  POLICY_QLRU_M3,	// Insertion at age 3
+  POLICY_RANDOM
+};
+typedef enum policy policy_e;
+
+#define POLICY_NTYPES (POLICY_RANDOM + 1)
+
+// Zero fields take the defaults below
+struct policyinfo {
+  int associativity;
+  int sequences;	// Random access sequences per inference
+  int repeats;		// Measurements of each sequence
+  int threshold;	// Slowest hit, in cycles
+  void **scrub;
+  int nscrub;
+  sim_t sim;		// If set, experiments run on the simulator
+  uint32_t seed;
+};
+typedef struct policyinfo *policyinfo_t;
+
+#define POLICY_DEFAULT_SEQUENCES 200
+#define POLICY_DEFAULT_REPEATS 5
+#define POLICY_DEFAULT_SEED 1
+
+struct policyresult {
+  policy_e policy;
+  int agreement;	// Outcomes predicted by the policy, per thousand
+  int stability;	// Repeated measurements that agreed, per thousand
+  int scores[POLICY_NTYPES];	// Agreement of every candidate
+};
+typedef struct policyresult *policyresult_t;
+
+// Roles of the sets in set dueling
+#define PL_FOLLOWER 0
+#define PL_LEADER_THRASHING 1	// Keeps an insertion that thrashes on cyclic access
+#define PL_LEADER_RESISTANT 2	// Keeps an insertion that resists thrashing
+
+const char *pl_name(policy_e policy);
+// Returns POLICY_UNKNOWN for an unknown name
+policy_e pl_parse(const char *name);
+
+// Infers the policy of the set the lines map to.  nlines must exceed the
+// associativity; a few more lines give the sequences more variety.
+// Returns the policy, also in result if not NULL.
+policy_e pl_infer(void **lines, int nlines, policyinfo_t info, policyresult_t result);
+
+// Finds the leader sets among nsets sets, given as a flat array of nsets
+// * nlines congruent lines with set s at lines[s * nlines], as exported by
+// l3_exportevictionsets.  nlines must be at least twice the associativity
+// for the reuse pattern.  Fills roles with a PL_ value for each set.
+// Returns the number of leaders, or -1 if most sets kept their insertion,
+// i.e. no dueling was seen, and then all sets are followers.
+int pl_findleaders(void **lines, int nsets, int nlines, policyinfo_t info, int *roles);
+
+// Fills the repeats, touches and direction of prime with the cheapest
+// pattern that primes a set of associativity ways under policy in at
+// least target per thousand of the trials.  The chains of prime are kept,
+// as they decide the order of the lines.  If no pattern reaches target,
+// prime gets the most reliable one.  Returns the reliability of the
+// pattern, per thousand.
+int pl_primepattern(policy_e policy, int associativity, int target, primeinfo_t prime);
+
+#endif // __POLICY_H__
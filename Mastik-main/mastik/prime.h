@@ -0,0 +1,76 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PRIME_H__
+#define __PRIME_H__ 1
+
+#include <mastik/sim.h>
+
+/*
+ * Prime kernels that keep several misses in flight.
+ *
+ * Walking one linked list through the lines of a large set issues one
+ * load at a time and is bound by memory latency.  A primer splits the
+ * lines into chains contiguous runs and walks them in lockstep.  Within a
+ * chain every load depends on the previous one, so each chain accesses
+ * its lines in order, but the chains are independent and their misses
+ * overlap.  With chains set to PRIME_UNORDERED the lines are loaded
+ * without any ordering, with software prefetch, for when the order does
+ * not matter.
+ *
+ * The lines are only read.  A primer keeps its own copy of the addresses,
+ * so it can be built from eviction sets (see l3_getevictionset) or from
+ * any other memory.
+ */
+
+typedef struct primer *primer_t;
+
+enum primedir {
+  PRIMEDIR_FORWARD,
+  PRIMEDIR_ZIGZAG	// Alternate passes run backwards
+};
+typedef enum primedir primedir_e;
+
+#define PRIME_MAXCHAINS 16
+
+// Zero fields take the defaults below
+struct primeinfo {
+  int chains;		// Independent chains, up to PRIME_MAXCHAINS.  -1 for unordered
+  int repeats;		// Passes over the lines
+  int touches;		// Consecutive accesses to each line in a pass
+  primedir_e direction;
+  sim_t sim;		// If set, accesses go to the simulator instead
+};
+typedef struct primeinfo *primeinfo_t;
+
+#define PRIME_DEFAULT_CHAINS 8
+#define PRIME_DEFAULT_REPEATS 1
+#define PRIME_DEFAULT_TOUCHES 1
+#define PRIME_UNORDERED (-1)
+
+primer_t pr_prepare(void **lines, int nlines, primeinfo_t info);
+void pr_release(primer_t pr);
+
+void pr_prime(primer_t pr);
+
+// Number of lines and the settings in use
+int pr_getlines(primer_t pr);
+void pr_getinfo(primer_t pr, primeinfo_t info);
+
+#endif // __PRIME_H__
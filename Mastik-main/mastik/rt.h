@@ -0,0 +1,109 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RT_H__
+#define __RT_H__ 1
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <mastik/mm.h>
+
+/*
+ * Capture mode: the conditions for stable probe timing on a shared host.
+ *
+ * A page fault on the first touch of a result array, a page of an
+ * eviction set moved by compaction or the prober preempted by another
+ * task all show up as noise, or as eviction sets that silently stopped
+ * working.  rt_enter takes the steps asked for in turn, and each one
+ * that fails for lack of privileges or support is skipped:
+ *
+ *  RT_PIN moves the calling thread to one CPU of its LLC domain (the LLC
+ *  the mm is placed on, see mm_setsocket), preferring a CPU set aside
+ *  with isolcpus or nohz_full, as tp_place does for the prober.
+ *
+ *  RT_LOCKMEMORY locks the pages of the process with mlockall, which
+ *  faults them in.  Later mappings are locked too only when the locked
+ *  memory limit cannot stop the mm from growing.  Otherwise, and if
+ *  mlockall fails, the buffers of the mm are locked one by one, and
+ *  buffers that cannot be locked are prefaulted.  rt_lock does the same
+ *  for result arrays allocated later.  Locked pages may still be moved
+ *  by compaction unless vm.compact_unevictable_allowed is 0.
+ *
+ *  RT_FIFO raises the thread to SCHED_FIFO.  A FIFO thread that never
+ *  blocks can keep other work off its CPU, so a watchdog thread returns
+ *  it to its old policy once watchdog milliseconds pass without a call
+ *  to rt_kick.
+ *
+ * rt_getstate and rt_print tell what was achieved.  rt_exit restores the
+ * scheduling of the thread and unlocks the memory.  Call both functions
+ * from the thread that called rt_enter.
+ */
+
+#define RT_PIN 0x01
+#define RT_LOCKMEMORY 0x02
+#define RT_FIFO 0x04
+#define RT_ALL (RT_PIN | RT_LOCKMEMORY | RT_FIFO)
+
+// Zero fields take the defaults
+struct rtinfo {
+  int flags;
+  int priority;		// SCHED_FIFO priority
+  int watchdog;		// Milliseconds
+  mm_t mm;		// May be NULL
+};
+typedef struct rtinfo *rtinfo_t;
+
+#define RT_DEFAULT_PRIORITY 1
+#define RT_DEFAULT_WATCHDOG 10000
+
+struct rtstate {
+  int cpu;		// CPU the thread is pinned to, -1 if not pinned
+  int isolated;		// TP_ISOLATED and TP_NOHZFULL of the CPU
+  int lockall;		// 1 for current mappings, 2 for later ones too
+  size_t locked;	// Bytes locked one buffer at a time
+  size_t prefaulted;	// Bytes that could only be prefaulted
+  int movable;		// Locked pages may still be moved by compaction
+  int priority;		// SCHED_FIFO priority held, 0 if none
+  int expired;		// The watchdog dropped SCHED_FIFO
+};
+typedef struct rtstate *rtstate_t;
+
+typedef struct rt *rt_t;
+
+// Never fails for lack of privileges: see rt_getstate for what was done
+rt_t rt_enter(rtinfo_t info);
+
+// Locks buf, or prefaults it if it cannot be locked.  Prefaulting writes
+// each page back with its own contents, so buf must not be written by
+// another thread meanwhile.  Returns 1 if buf is locked.
+int rt_lock(rt_t rt, void *buf, size_t size);
+
+// Restarts the watchdog
+void rt_kick(rt_t rt);
+
+void rt_getstate(rt_t rt, rtstate_t state);
+
+// Writes a line describing the state
+void rt_print(rt_t rt, FILE *f);
+
+void rt_exit(rt_t rt);
+
+#endif // __RT_H__
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A software model of the LLC that stands in for timing measurements.
+ *
+ * The model has slices * setsperslice sets of associativity ways each.
+ * Addresses are translated to simulated physical addresses by assigning
+ * page frames in first-touch order from a seeded permutation, so a run
+ * does not depend on ASLR or on the frames the kernel hands out.  The
+ * slice of a line is computed from the physical address with XOR masks
+ * for power-of-two slice counts and otherwise with a fixed table on the
+ * parities of a few masks of the bits above the 128KB boundary.
+ *
+ * The QLRU policies keep a two-bit age per line: hits reset the age to 0,
+ * the victim is the leftmost line of age 3 and all ages in the set are
+ * raised until there is one.  SIMPOLICY_QLRU inserts at age 2, as SRRIP
+ * does.  SIMPOLICY_DUELING chooses the insertion age by set dueling: sets
+ * at multiples of SIM_DUEL_SPACING always insert at age 2, sets half way
+ * between always insert at age 3 (at age 2 once in SIM_BIMODAL misses),
+ * and a SIM_PSELBITS saturating counter of their misses selects the
+ * insertion of all other sets.
+ *
+ * The probing core's private cache is a 64-set, 8-way LRU cache inside
+ * the model: every access fills it, and lines leaving the LLC leave it.
+ * Only sim_scope is served from it.
+ *
+ * Accesses return hittime or misstime cycles plus up to jitter cycles.
+ * noise evicts a random line for that many out of every million
+ * accesses, standing in for other activity on the machine.
+ *
+ * An mm with a simulator attached answers every timing query of the
+ * mapping code and of the lx probe functions from the model, so the
+ * mapping and experiment pipelines run unchanged and reproducibly on any
+ * machine.  The buffers are still real memory because the probe lists
+ * are linked through them.
+ */
+
+typedef struct sim *sim_t;
+
+enum simpolicy {
+  SIMPOLICY_LRU,
+  SIMPOLICY_PLRU,	// One MRU bit per way
+  SIMPOLICY_RANDOM,
+  SIMPOLICY_QLRU,	// Insertion at age 2
+  SIMPOLICY_DUELING	// Insertion at age 2 or 3, chosen by set dueling
+};
+typedef enum simpolicy simpolicy_e;
+
+#define SIM_MAXMASKS 8
+
+// Zero fields take the defaults below
+struct siminfo {
+  int associativity;
+  int setsperslice;
+  int slices;
+  simpolicy_e policy;
+  uint64_t slicemasks[SIM_MAXMASKS];	// Or the key of a non-power-of-two table
+  size_t pagesize;	// Defaults to the page size of the mm
+  int hittime;
+  int misstime;
+  int jitter;
+  int noise;		// Random evictions per million accesses
+  uint32_t seed;
+};
+typedef struct siminfo *siminfo_t;
+
+#define SIM_DEFAULT_ASSOCIATIVITY 12
+#define SIM_DEFAULT_SETSPERSLICE 2048
+#define SIM_DEFAULT_SLICES 8
+#define SIM_DEFAULT_HITTIME 40
+#define SIM_DEFAULT_MISSTIME 250
+#define SIM_DEFAULT_SEED 1
+
+#define SIM_DUEL_SPACING 64
+#define SIM_BIMODAL 32
+#define SIM_PSELBITS 10
+
+struct simstats {
+  uint64_t accesses;
+  uint64_t misses;
+  uint64_t flushes;
+  uint64_t timedwalks;	// Eviction tests made by the mapping code
+  uint64_t probes;	// Probes of a monitored set
+};
+typedef struct simstats *simstats_t;
+
+sim_t sim_new(siminfo_t info);
+void sim_release(sim_t sim);
+
+// Fills info with the geometry and parameters in use
+void sim_getinfo(sim_t sim, siminfo_t info);
+
+// Sets the page size of the physical address translation.  Has no effect
+// once an address has been translated.
+void sim_setpagesize(sim_t sim, size_t pagesize);
+
+uintptr_t sim_physaddr(sim_t sim, void *p);
+int sim_slice(sim_t sim, uintptr_t phys);
+
+// Returns the simulated access time of p
+uint32_t sim_access(sim_t sim, void *p);
+// An access of the probing core.  When p is in its private cache it costs
+// hittime and leaves the LLC's replacement state alone.  Otherwise it goes
+// to the LLC as sim_access does, updating the replacement state on a hit.
+uint32_t sim_scope(sim_t sim, void *p);
+void sim_flush(sim_t sim, void *p);
+
+// Follows the circular list at p count times
+void sim_walk(sim_t sim, void *p, int count);
+
+// Median access time of candidate over rounds rounds, each walking the
+// circular list at list walks times.  This is the eviction test of the
+// mapping code.
+int sim_timedwalk(sim_t sim, void *list, void *candidate, int walks, int rounds);
+
+// Total time and number of misses of one traversal of a circular list
+int sim_probetime(sim_t sim, void *p);
+int sim_probecount(sim_t sim, void *p);
+
+void sim_getstats(sim_t sim, simstats_t stats);
+void sim_resetstats(sim_t sim);
+
+#endif // __SIM_H__
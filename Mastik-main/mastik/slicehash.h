@@ -0,0 +1,80 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SLICEHASH_H__
+#define __SLICEHASH_H__ 1
+
+#include <stdint.h>
+
+#include <mastik/mm.h>
+#include <mastik/l3.h>
+
+/*
+ * Recovers the LLC slice hash from a timing-based mapping of the cache.
+ *
+ * Each eviction set found by the timing-based mapper (probemap) holds lines
+ * that share both a slice and a cache index.  Given the physical addresses
+ * of these lines (read from /proc/self/pagemap, which requires
+ * CAP_SYS_ADMIN), the differences between addresses in the same set span
+ * the kernel of the slice hash.  For power-of-two slice counts the hash is
+ * linear and its XOR masks are the orthogonal complement of that span.
+ *
+ * Non-power-of-two slice counts use a non-linear hash, a table on a
+ * linear key.  For these the solver finds XOR masks whose parities, within
+ * each class of sets, determine the slice, and a table from the class and
+ * key to a slice.  Keys that the mapping did not cover are unknown.  This
+ * takes a mapping of many more pages than the cache holds; with fewer,
+ * sh_solve finds no hash.
+ *
+ * Solved hashes are stored per CPU model, by default in ~/.mastik.  Set
+ * MASTIK_SLICEHASH_DIR to use a different directory.  l3_prepare with
+ * L3FLAG_SLICEHASH loads the stored hash and maps the cache through the
+ * page tables, falling back to probing and then solving when none exists
+ * or the map it gives fails a timing check.
+ */
+
+typedef struct slicehash *slicehash_t;
+
+// Solve for the slice hash of an mm that has been mapped by probing.
+// Returns NULL if physical addresses are not available or the mapping
+// does not match any hash.
+slicehash_t sh_solve(mm_t mm);
+
+// Returns the slice of a physical address, or -1 if unknown.
+int sh_slice(slicehash_t sh, uintptr_t phys);
+
+// Number of XOR masks of the hash, the key of the table for a non-linear
+// hash.
+int sh_getmasks(slicehash_t sh, uint64_t *masks, int nmasks);
+
+// Returns true if sh can map the cache of mm
+int sh_usable(slicehash_t sh, mm_t mm);
+
+int sh_save(slicehash_t sh, const char *path);
+slicehash_t sh_load(const char *path);
+
+// Per-CPU-model storage.  The file name encodes the CPUID signature
+// and the LLC geometry in l3info.
+char *sh_defaultpath(l3info_t l3info, char *path, int len);
+slicehash_t sh_loadcpu(l3info_t l3info);
+int sh_savecpu(slicehash_t sh, l3info_t l3info);
+
+void sh_release(slicehash_t sh);
+
+#endif // __SLICEHASH_H__
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STREAM_H__
+#define __STREAM_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Live streaming of probe results to local viewers.
+ *
+ * The publisher writes rows of results into a ring of frames in shared
+ * memory.  Each frame is guarded by a sequence lock, so writing never
+ * waits for readers: a reader that falls more than a ring behind loses
+ * the overwritten frames and is told how many it missed.
+ *
+ * The ring is announced on a Unix socket.  A viewer connecting to the
+ * socket receives the ring's file descriptor and maps it read-only, so
+ * viewers can attach and detach at any time without the publisher
+ * noticing.  The socket is served by a background thread.
+ *
+ * With decimation d, only every d-th row written is published.  Frames
+ * carry the row's index among all rows written, so viewers can tell
+ * decimation from loss.
+ */
+
+typedef struct stream *stream_t;
+
+struct ms_frame {
+  uint64_t seq;		// Published frame number
+  uint64_t index;	// Row number among all rows written
+  uint64_t tsc;		// Time of publication
+  uint32_t tag;		// Set by the writer, e.g. a record or group number
+  uint32_t len;		// Number of valid results in the row
+};
+
+// Publishing.  width is the maximum row length, nslots the ring size.
+// Returns NULL if the ring or the socket cannot be created.
+stream_t ms_publish(const char *socketpath, int width, int nslots, int decimate);
+void ms_write(stream_t s, const uint16_t *row, int len, uint32_t tag);
+int ms_getwidth(stream_t s);
+void ms_close(stream_t s);
+
+// Viewing.  Reading starts at the newest frame at the time of attaching.
+stream_t ms_attach(const char *socketpath);
+
+// Copies up to maxframes frames published since the last read.  rows
+// receives maxframes * ms_getwidth() results.  Returns the number of
+// frames copied, 0 if none are new, or -1 if the publisher has closed
+// the stream and everything has been read.
+int ms_read(stream_t s, struct ms_frame *frames, uint16_t *rows, int maxframes);
+
+// Frames overwritten before this viewer read them
+uint64_t ms_dropped(stream_t s);
+void ms_detach(stream_t s);
+
+#endif // __STREAM_H__
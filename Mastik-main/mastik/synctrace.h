@@ -22,6 +22,7 @@
 
 #include <mastik/l1.h>
 #include <mastik/l2.h>
+#include <mastik/l3.h>
 
 #include <stdint.h>
 
@@ -55,6 +56,7 @@ struct st_clusters {
 
 typedef struct st_clusters *st_clusters_t;
 
+// cachelevel is 1 or 2, see syncPrimeProbeL3 for the LLC
 st_clusters_t syncPrimeProbe(int nsamples, 
 			      int blocksize, 
 			      int splitinput,
@@ -65,6 +67,43 @@ st_clusters_t syncPrimeProbe(int nsamples,
 			      uint8_t clusterMask,
 						int cachelevel);
 
+// Sparse clusters over a few LLC sets.  Column c holds LLC set sets[c],
+// and the values of cluster k are at avg[k * nsets + c] and
+// var[k * nsets + c].  The clusters of all bytes share sets.
+struct st_sparseclusters {
+  int nsets;
+  int *sets;
+  int count[256];
+  int64_t *avg;
+  int64_t *var;
+};
+
+typedef struct st_sparseclusters *st_sparseclusters_t;
+
+// Synchronized Prime+Probe of the LLC sets in sets, or of all the sets of
+// l3 if sets is NULL, with one column per set rather than ST_TRACEWIDTH.
+// Probes count misses.  If keep is positive and fewer than the sets, a
+// first pass of ranksamples records ranks the sets by the variance of
+// their counts and only the keep most variable are traced.  The
+// monitored sets of l3 are replaced by the sets traced.  Returns an array
+// of blocksize clusters, to be freed with st_freesparseclusters, or NULL
+// if none of the sets could be monitored.
+st_sparseclusters_t syncPrimeProbeL3(int nsamples,
+				      int blocksize,
+				      int splitinput,
+				      uint8_t *fixMask,
+				      uint8_t *fixData,
+				      st_crypto_f crypto,
+				      void *cryptoData,
+				      uint8_t clusterMask,
+				      l3pp_t l3,
+				      const int *sets,
+				      int nsets,
+				      int keep,
+				      int ranksamples);
+
+void st_freesparseclusters(st_sparseclusters_t clusters);
+
 /*
 st_clusters_t syncEvictTime(int nsamples, 
 			      int blocksize, 
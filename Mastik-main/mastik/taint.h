@@ -0,0 +1,76 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TAINT_H__
+#define __TAINT_H__ 1
+
+#include <stdint.h>
+
+#include <mastik/pmu.h>
+
+/*
+ * Rejection of probes hit by an interrupt, a context switch or an SMI.
+ *
+ * With taint detection on, each probe of a set is timed with the TSC.  A
+ * probe slower than gap cycles cannot be explained by cache misses alone,
+ * so it is taken to have been interrupted and its result is replaced by
+ * TAINT_FLAGGED.  The probe is not repeated in place: a second probe would
+ * measure the set after the first one refilled it and report a clean,
+ * empty set.  To get a reading, the caller redoes the whole prime, access
+ * and probe.
+ *
+ * TAINT_CTXSWITCH also counts the context switches of the thread, from a
+ * perf software event through pmu when it can be opened and from
+ * getrusage otherwise.  Reading the count is a system call, so it is not
+ * read inside the probes.  The caller ends each record with
+ * lx_taintrecord after the probe that measures it and before the next
+ * prime.  A record that saw a switch since the previous call has all its
+ * sets flagged, because another task ran between the prime and the probe.
+ * The repeated probes of Mastik call it after every record.  There the
+ * read falls after the probe that primes the next record, as each probe
+ * doubles as the next prime.
+ *
+ * TAINT_FLAGGED sorts above every real result, so min reductions skip it.
+ */
+
+#define TAINT_FLAGGED 0xfffe
+
+#define TAINT_CTXSWITCH 0x01
+
+// Zero fields take the defaults
+struct taintinfo {
+  uint32_t gap;		// Cycles a set's probe may take
+  int flags;
+  pmu_t pmu;		// For PMU_CONTEXT_SWITCHES, may be NULL
+};
+typedef struct taintinfo *taintinfo_t;
+
+// Default gap per line of the set, well above a DRAM access
+#define TAINT_DEFAULT_LINEGAP 1000
+
+struct taintstats {
+  uint64_t records;	// Rows probed
+  uint64_t sets;	// Set probes
+  uint64_t flagged;	// Results replaced by TAINT_FLAGGED
+  uint64_t switched;	// Records ended by lx_taintrecord that saw a context switch
+  uint64_t maxgap;	// Slowest set probe seen, in cycles
+};
+typedef struct taintstats *taintstats_t;
+
+#endif // __TAINT_H__
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __TLB_H__
+#define __TLB_H__ 1
+
+#include <stdint.h>
+
+#include <mastik/pmu.h>
+
+/*
+ * TLB-aware layout of the monitored sets.
+ *
+ * On small pages the lines of a set share a page offset, so each sits on
+ * a page of its own and a probe can take a TLB miss per line.  The page
+ * walks add tens of cycles to a line that hit, which blurs the hit/miss
+ * boundary at L3_THRESHOLD.
+ *
+ * TLB_PAGEORDER links the lines of each set in address order, so that the
+ * page table entries of consecutive lines share cache lines and the page
+ * walks that remain are cheap.
+ *
+ * TLB_WARMUP loads one line of every page of a set before the set is
+ * timed, so the probe itself finds the translations in the TLB.  The
+ * warm-up line is never in the 128 byte pair of a monitored line, which
+ * the adjacent-line prefetcher would refill, and is as far from the
+ * monitored lines as the page allows.  If no line qualifies there is no
+ * warm-up.  Huge pages need none.
+ *
+ * With a pmu that has PMU_DTLB_MISSES the probes count their page walks.
+ * Sets probed one at a time are counted set by set when the counters are
+ * read with rdpmc, and a set is TLB affected if it walked the page tables.
+ * A read() system call between the warm-up and the probe would itself
+ * disturb the TLB, so without rdpmc the misses are counted around the
+ * whole probe, warm-ups included, and no set is marked affected.
+ */
+
+#define TLB_PAGEORDER 0x01
+#define TLB_WARMUP 0x04
+
+struct tlbinfo {
+  int flags;
+  pmu_t pmu;		// For PMU_DTLB_MISSES, may be NULL
+};
+typedef struct tlbinfo *tlbinfo_t;
+
+struct tlbstats {
+  uint64_t probes;	// Set probes counted
+  uint64_t affected;	// Probes that missed the TLB, when counted set by set
+  uint64_t misses;	// TLB misses of all probes
+  int warmoffset;	// Line within the page used for the warm-up, -1 if none
+};
+typedef struct tlbstats *tlbstats_t;
+
+#endif // __TLB_H__
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CPU and cache topology, and placement of the threads of an experiment.
+ *
+ * tp_discover takes a snapshot of the online CPUs from
+ * /sys/devices/system/cpu: the package and core of each CPU, its SMT
+ * siblings, its memory node and the last level cache it shares, which
+ * defines the LLC domains.  Hybrid processors list their performance and
+ * efficiency cores under /sys/devices/cpu_core and cpu_atom.  Whether the
+ * LLC is inclusive is not in sysfs and comes from cpuid leaf 4, as read by
+ * loadL3cpuidInfo, which also fills in the LLC geometry when sysfs lacks
+ * it.  CPUs set aside with isolcpus or nohz_full, as listed in
+ * /sys/devices/system/cpu/isolated and nohz_full, are marked.
+ *
+ * tp_place picks the CPUs of an experiment within one LLC domain: the
+ * prober gets a core of its own, an isolated one if the domain has one,
+ * the victim shares the LLC from another core (or the prober's core with
+ * TP_VICTIM_SIBLING, for attacks on the private caches), contention
+ * threads such as performance degradation attacks take the remaining
+ * cores of the LLC, and the writer, which
+ * handles results, is kept off the LLC where possible.  The prober's SMT
+ * sibling is left idle unless the victim goes there.
+ */
+
+#define TP_MAXCPUS 1024
+#define TP_MAXCONTENTION 64
+
+enum tpcoretype {
+  TP_CORE_UNKNOWN,	// Not a hybrid processor, or not reported
+  TP_CORE_PERFORMANCE,
+  TP_CORE_EFFICIENCY
+};
+typedef enum tpcoretype tpcoretype_e;
+
+// Why a CPU is kept free of other work
+#define TP_ISOLATED 0x01	// isolcpus, no load balancing
+#define TP_NOHZFULL 0x02	// No scheduler tick while one task runs
+
+struct tpcpu {
+  int cpu;
+  int socket;
+  int core;		// Core id within the socket
+  int sibling;		// Another hardware thread of the core, -1 if none
+  int node;		// Memory node, -1 if unknown
+  int llc;		// Index of the LLC domain
+  tpcoretype_e type;
+  int isolated;		// TP_ISOLATED and TP_NOHZFULL
+};
+typedef struct tpcpu *tpcpu_t;
+
+struct tpllc {
+  int id;		// Id of the cache from sysfs, -1 if not given
+  int socket;
+  int ncpus;
+  uint64_t cpus[TP_MAXCPUS / 64];
+  uint64_t nodes;	// Memory nodes of the CPUs, up to 64
+  size_t size;		// Bytes, 0 if unknown
+  int associativity;
+  int sets;
+  int inclusive;	// 1 or 0, -1 if unknown
+};
+typedef struct tpllc *tpllc_t;
+
+typedef struct topology *topology_t;
+
+// Returns NULL if no CPU can be read
+topology_t tp_discover(void);
+void tp_release(topology_t tp);
+
+// One more than the highest online CPU number
+int tp_ncpus(topology_t tp);
+// Returns 0 if cpu is not online
+int tp_getcpu(topology_t tp, int cpu, tpcpu_t info);
+
+int tp_nllcs(topology_t tp);
+int tp_getllc(topology_t tp, int llc, tpllc_t info);
+// The LLC domain of cpu, -1 for the one the caller runs on.  Returns -1
+// if cpu is not online.
+int tp_llcof(topology_t tp, int cpu);
+
+#define TP_VICTIM_SIBLING 0x01
+
+struct tpplacement {
+  int llc;
+  int prober;
+  int victim;		// -1 if no CPU suits
+  int writer;		// -1 if no CPU suits
+  int ncontention;	// May be fewer than asked for
+  int contention[TP_MAXCONTENTION];
+};
+typedef struct tpplacement *tpplacement_t;
+
+// Places the threads of an experiment in LLC domain llc, -1 for the one
+// the caller runs on.  Performance cores are preferred on hybrid
+// processors.  Returns 0 if the domain is unknown.
+int tp_place(topology_t tp, int llc, int flags, int ncontention, tpplacement_t placement);
+
+#endif // __TOPOLOGY_H__
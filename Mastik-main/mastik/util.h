@@ -22,12 +22,24 @@
 
 const char *mastik_version();
 
+/*
+ * Maps the page containing offset in file and returns a pointer to offset.
+ * Files are mapped once, in full, and shared between all the offsets
+ * requested within them.  Every successful call must be matched by a call
+ * to unmap_offset.  The file is unmapped when its last offset is released.
+ * Threads may map and unmap concurrently.
+ */
 void *map_offset(const char *file, uint64_t offset);
+
+#define MAPOFFSET_PREFAULT	0x01	// Touch every page of the file when first mapped
+#define MAPOFFSET_MLOCK		0x02	// Lock the file in memory.  Silently ignored if not permitted
+
+void *map_offset_flags(const char *file, uint64_t offset, int flags);
 void unmap_offset(void *address);
 
 void delayloop(uint32_t cycles);
 
-void setaffinity(int cpu);
+int setaffinity(int cpu);
 
 int ncpus(void);
 
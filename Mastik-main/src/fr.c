@@ -25,6 +25,7 @@
 
 #include <mastik/low.h>
 #include <mastik/fr.h>
+#include <mastik/stream.h>
 
 #include "vlist.h"
 #include "timestats.h"
@@ -32,6 +33,7 @@
 struct fr { 
   vlist_t vl;
   vlist_t evict;
+  stream_t stream;
 };
 
 
@@ -40,6 +42,7 @@ fr_t fr_prepare() {
   fr_t rv = malloc(sizeof(struct fr));
   rv->vl = vl_new();
   rv->evict = vl_new();
+  rv->stream = NULL;
   return rv;
 }
 
@@ -192,6 +195,7 @@ int fr_trace(fr_t fr, int max_records, uint16_t *results, int slot, int threshol
   int count = 1;
   int idle_count = 0;
   int missed = 0;
+  ms_write(fr->stream, results, len, 0);
 
   while (idle_count < max_idle && count < max_records) {
     idle_count++;
@@ -205,12 +209,17 @@ int fr_trace(fr_t fr, int max_records, uint16_t *results, int slot, int threshol
       if (is_active(results, len, threshold))
 	idle_count = 0;
     }
+    ms_write(fr->stream, results, len, count - 1);
     prev_time += slot;
     missed = slotwait(prev_time);
   }
   return count;
 }
 
+void fr_setstream(fr_t fr, stream_t stream) {
+  fr->stream = stream;
+}
+
 int fr_repeatedprobe(fr_t fr, int max_records, uint16_t *results, int slot) {
   return fr_trace(fr, max_records, results, slot, 0, max_records);
 }
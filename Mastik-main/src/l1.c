@@ -52,6 +52,11 @@ struct l1pp {
   
   mm_t mm; 
   uint8_t internalmm;
+  stream_t stream;
+  primer_t *primers;
+  struct primeinfo primeinfo;
+  struct lxtaint *taint;
+  struct lxtlb *tlb;
 };
 
 int loadL1cpuidInfo(l1info_t l1info) {
@@ -83,7 +88,7 @@ l1pp_t l1_prepare(mm_t mm) {
   
   fillL1Info(&l1->l1info);
   
-  l1->mm = mm;
+  l1->mm = mm ? mm_retain(mm) : NULL;
   if (l1->mm == NULL) {
     l1->mm = mm_prepare(NULL, NULL, NULL);
     l1->internalmm = 1;
@@ -139,6 +144,18 @@ void l1_bprobe(l1pp_t l1, uint16_t *results) {
   lx_bprobe((lxpp_t) l1, results);
 }
 
+void l1_setstream(l1pp_t l1, stream_t stream) {
+  lx_setstream((lxpp_t) l1, stream);
+}
+
+void l1_setprime(l1pp_t l1, primeinfo_t info) {
+  lx_setprime((lxpp_t) l1, info);
+}
+
+void l1_prime(l1pp_t l1) {
+  lx_prime((lxpp_t) l1);
+}
+
 int l1_repeatedprobe(l1pp_t l1, int nrecords, uint16_t *results, int slot) {
   return lx_repeatedprobe((lxpp_t) l1, nrecords, results, slot);
 }
@@ -64,6 +64,11 @@ struct l2pp {
   
   mm_t mm;
   uint8_t internalmm;
+  stream_t stream;
+  primer_t *primers;
+  struct primeinfo primeinfo;
+  struct lxtaint *taint;
+  struct lxtlb *tlb;
 };
 
 int loadL2cpuidInfo(l2info_t l2info) {
@@ -98,7 +103,7 @@ l2pp_t l2_prepare(l2info_t l2info, mm_t mm) {
   fillL2Info(&l2->l2info);
   l2->level = L2;
   
-  l2->mm = mm;
+  l2->mm = mm ? mm_retain(mm) : NULL;
   if (l2->mm == NULL) {
     l2->mm = mm_prepare(NULL, NULL, NULL);
     l2->internalmm = 1;
@@ -158,6 +163,18 @@ void l2_release(l2pp_t l2) {
   lx_release((lxpp_t)l2);
 }
 
+void l2_setstream(l2pp_t l2, stream_t stream) {
+  lx_setstream((lxpp_t) l2, stream);
+}
+
+void l2_setprime(l2pp_t l2, primeinfo_t info) {
+  lx_setprime((lxpp_t) l2, info);
+}
+
+void l2_prime(l2pp_t l2) {
+  lx_prime((lxpp_t) l2);
+}
+
 int l2_repeatedprobe(l2pp_t l2, int nrecords, uint16_t *results, int slot) {
   return lx_repeatedprobe((lxpp_t) l2, nrecords, results, slot);
 }
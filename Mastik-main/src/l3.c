@@ -79,6 +79,11 @@ struct l3pp {
   
   mm_t mm; 
   uint8_t internalmm;
+  stream_t stream;
+  primer_t *primers;
+  struct primeinfo primeinfo;
+  struct lxtaint *taint;
+  struct lxtlb *tlb;
   
   // To reduce probe time we group sets in cases that we know that a group of consecutive cache lines will
   // always map to equivalent sets. In the absence of user input (yet to be implemented) the decision is:
@@ -161,14 +166,27 @@ l3pp_t l3_prepare(l3info_t l3info, mm_t mm) {
     return NULL;
   }
   
-  l3->mm = mm;
+  l3->mm = mm ? mm_retain(mm) : NULL;
   if (l3->mm == NULL) {
     l3->mm = mm_prepare(NULL, NULL, (lxinfo_t)l3info);
+    if (l3->mm == NULL) {
+      free(l3);
+      return NULL;
+    }
     l3->internalmm = 1;
   }
+  if (l3->mm->sim) {
+    l3->l3info.associativity = l3->mm->l3info.associativity;
+    l3->l3info.setsperslice = l3->mm->l3info.sets;
+    l3->l3info.slices = l3->mm->l3info.slices;
+    l3->l3info.bufsize = l3->mm->l3info.bufsize;
+  }
   
-  if (!mm_initialisel3(l3->mm)) 
+  if (!mm_initialisel3(l3->mm)) {
+    mm_release(l3->mm);
+    free(l3);
     return NULL;
+  }
   
   l3->ngroups = l3->mm->l3ngroups;
   l3->groupsize = l3->mm->l3groupsize;
@@ -238,6 +256,93 @@ int l3_getAssociativity(l3pp_t l3) {
   return l3->l3info.associativity;
 }
 
+mm_t l3_getmm(l3pp_t l3) {
+  return l3->mm;
+}
+
+int l3_getevictionset(l3pp_t l3, int set, void **lines, int nlines) {
+  if (set < 0 || set >= l3->ngroups * l3->groupsize)
+    return 0;
+  vlist_t es = l3->mm->l3groups[set / l3->groupsize];
+  uintptr_t offset = (set % l3->groupsize) * L3_CACHELINE;
+  int len = vl_len(es);
+  if (lines == NULL)
+    return len;
+  if (nlines > len)
+    nlines = len;
+  for (int i = 0; i < nlines; i++)
+    lines[i] = (char *)vl_get(es, i) + offset;
+  return len;
+}
+
+int l3_foreachevictionset(l3pp_t l3, l3evictionset_cb_t cb, void *data) {
+  int nsets = l3->ngroups * l3->groupsize;
+  int maxlen = 0;
+  for (int g = 0; g < l3->ngroups; g++)
+    if (vl_len(l3->mm->l3groups[g]) > maxlen)
+      maxlen = vl_len(l3->mm->l3groups[g]);
+  void **lines = malloc((maxlen ? maxlen : 1) * sizeof(void *));
+  int set;
+  for (set = 0; set < nsets; set++) {
+    int len = l3_getevictionset(l3, set, lines, maxlen);
+    if (cb(set, lines, len, data))
+      break;
+  }
+  free(lines);
+  return set;
+}
+
+int l3_exportevictionsets(l3pp_t l3, void **lines, int ways) {
+  int nsets = l3->ngroups * l3->groupsize;
+  for (int set = 0; set < nsets; set++) {
+    void **slot = lines + (size_t)set * ways;
+    int len = l3_getevictionset(l3, set, slot, ways);
+    for (int i = len; i < ways; i++)
+      slot[i] = NULL;
+  }
+  return nsets;
+}
+
+int l3_pmuprobe(l3pp_t l3, pmu_t pmu, pmuevent_e event, uint16_t *results, uint16_t *counts) {
+  return lx_pmuprobe((lxpp_t) l3, pmu, event, 0, results, counts);
+}
+
+int l3_pmuprobecount(l3pp_t l3, pmu_t pmu, pmuevent_e event, uint16_t *results, uint16_t *counts) {
+  return lx_pmuprobe((lxpp_t) l3, pmu, event, 1, results, counts);
+}
+
+void l3_setstream(l3pp_t l3, stream_t stream) {
+  lx_setstream((lxpp_t) l3, stream);
+}
+
+void l3_setprime(l3pp_t l3, primeinfo_t info) {
+  lx_setprime((lxpp_t) l3, info);
+}
+
+void l3_settaint(l3pp_t l3, taintinfo_t info) {
+  lx_settaint((lxpp_t) l3, info);
+}
+
+int l3_gettaintstats(l3pp_t l3, taintstats_t stats) {
+  return lx_gettaintstats((lxpp_t) l3, stats);
+}
+
+int l3_taintrecord(l3pp_t l3, uint16_t *results) {
+  return lx_taintrecord((lxpp_t) l3, results);
+}
+
+void l3_settlb(l3pp_t l3, tlbinfo_t info) {
+  lx_settlb((lxpp_t) l3, info);
+}
+
+int l3_gettlbstats(l3pp_t l3, tlbstats_t stats) {
+  return lx_gettlbstats((lxpp_t) l3, stats);
+}
+
+void l3_prime(l3pp_t l3) {
+  lx_prime((lxpp_t) l3);
+}
+
 int l3_repeatedprobe(l3pp_t l3, int nrecords, uint16_t *results, int slot) {
   return lx_repeatedprobe((lxpp_t) l3, nrecords, results, slot);
 }
@@ -246,6 +351,22 @@ int l3_repeatedprobecount(l3pp_t l3, int nrecords, uint16_t *results, int slot)
   return lx_repeatedprobecount((lxpp_t) l3, nrecords, results, slot);
 }
 
+int l3_repeatedprobecountpacked(l3pp_t l3, int nrecords, void *results, int bits, uint16_t threshold, int slot) {
+  return lx_repeatedprobecountpacked((lxpp_t) l3, nrecords, results, bits, threshold, slot);
+}
+
+void l3_scopeprime(l3pp_t l3) {
+  lx_scopeprime((lxpp_t) l3);
+}
+
+void l3_scope(l3pp_t l3, uint16_t *results) {
+  lx_scope((lxpp_t) l3, results);
+}
+
+int l3_repeatedscope(l3pp_t l3, int nrecords, uint16_t *results, int slot) {
+  return lx_repeatedscope((lxpp_t) l3, nrecords, results, slot);
+}
+
 void l3_pa_prime(l3pp_t l3) {
   for (int i = 0; i < l3->nmonitored; i++) {
     int t = probetime(l3->monitoredhead[i]);
@@ -17,7 +17,7 @@
  * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-
+#define _GNU_SOURCE
 #include "config.h"
 #include <stdio.h>
 #include <assert.h>
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <strings.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #ifdef __APPLE__
 #include <mach/vm_statistics.h>
 #endif
@@ -37,6 +38,11 @@
 #include <mastik/low.h>
 #include <mastik/impl.h>
 #include <mastik/mm.h>
+#include <mastik/sim.h>
+#include <mastik/pmu.h>
+#include <mastik/pack.h>
+#include <mastik/taint.h>
+#include <mastik/tlb.h>
 
 #include "vlist.h"
 #include "mm-impl.h"
@@ -82,7 +88,427 @@ int bprobecount(void *pp) {
   return probecount(NEXTPTR(pp));
 }
 
+// Probes of an lx on a simulated cache.  The backward list of a set starts
+// one pointer into the same lines.
+static void simprobe(lxpp_t lx, uint16_t *results, int backward) {
+  for (int i = 0; i < lx->nmonitored; i++) {
+    void *head = lx->monitoredhead[i];
+    int t = sim_probetime(lx->mm->sim, backward && head ? NEXTPTR(head) : head);
+    results[i] = t > UINT16_MAX ? UINT16_MAX : t;
+  }
+}
+
+static void simprobecount(lxpp_t lx, uint16_t *results, int backward) {
+  for (int i = 0; i < lx->nmonitored; i++) {
+    void *head = lx->monitoredhead[i];
+    results[i] = sim_probecount(lx->mm->sim, backward && head ? NEXTPTR(head) : head);
+  }
+}
+
+// The lines of the list at head, or just their number if lines is NULL
+static int listlines(void *head, void **lines) {
+  int n = 0;
+  void *p = head;
+  do {
+    if (lines)
+      lines[n] = p;
+    n++;
+    p = LNEXT(p);
+  } while (p != head);
+  return n;
+}
+
+// Links lines into a set's forward list and, one pointer in, its
+// backward list
+static void linkset(void **lines, int n) {
+  for (int way = 0; way < n; way++) {
+    void *mem = lines[way];
+    void *nmem = lines[(way + 1) % n];
+    void *pmem = lines[(way - 1 + n) % n];
+    LNEXT(mem) = nmem;
+    LNEXT(mem + sizeof(void *)) = (pmem + sizeof(void *));
+  }
+}
+
+#define LX_PAGELINES (PAGE_SIZE / LX_CACHELINE)
+#define PAGEOF(p) ((uintptr_t)(p) & ~(uintptr_t)(PAGE_SIZE - 1))
+#define LINEINPAGE(p) (((uintptr_t)(p) / LX_CACHELINE) % LX_PAGELINES)
+
+// TLB layout state, see mastik/tlb.h.  The pages of each set are kept by
+// set number, so that warming a set up does not touch its lines.
+struct lxtlb {
+  struct tlbinfo info;
+  struct tlbstats stats;
+  int offsetcount[LX_PAGELINES];	// Monitored sets at each line of the page
+  uintptr_t **pages;
+  int *npages;
+};
+
+static int compareaddr(const void *a, const void *b) {
+  uintptr_t pa = (uintptr_t)*(void **)a;
+  uintptr_t pb = (uintptr_t)*(void **)b;
+  return pa < pb ? -1 : pa > pb;
+}
+
+// A new head invalidates the set's primer, which is rebuilt on first use
+static void relink(lxpp_t lx, int i, void **lines, int n) {
+  linkset(lines, n);
+  lx->monitoredhead[i] = lines[0];
+  if (lx->primers && lx->primers[i]) {
+    pr_release(lx->primers[i]);
+    lx->primers[i] = NULL;
+  }
+}
+
+static void tlbadd(lxpp_t lx, int i) {
+  struct lxtlb *t = lx->tlb;
+  void *head = lx->monitoredhead[i];
+  int set = lx->monitoredset[i];
+  int n = listlines(head, NULL);
+  void **lines = malloc(n * sizeof(void *));
+  listlines(head, lines);
+  if (t->info.flags & TLB_PAGEORDER) {
+    qsort(lines, n, sizeof(void *), compareaddr);
+    relink(lx, i, lines, n);
+  }
+  free(t->pages[set]);
+  t->pages[set] = malloc(n * sizeof(uintptr_t));
+  t->npages[set] = n;
+  for (int j = 0; j < n; j++)
+    t->pages[set][j] = PAGEOF(lines[j]);
+  t->offsetcount[LINEINPAGE(lines[0])]++;
+  free(lines);
+}
+
+static void tlbremove(lxpp_t lx, int i) {
+  struct lxtlb *t = lx->tlb;
+  int set = lx->monitoredset[i];
+  t->offsetcount[LINEINPAGE(lx->monitoredhead[i])]--;
+  free(t->pages[set]);
+  t->pages[set] = NULL;
+  t->npages[set] = 0;
+}
+
+static void tlbclear(lxpp_t lx) {
+  for (int i = 0; i < lx->nmonitored; i++)
+    tlbremove(lx, i);
+}
+
+// The line of the page to warm up with: outside the 128 byte pair of every
+// monitored line, so the adjacent-line prefetcher does not refill one, and
+// as far from them as the page allows, to keep out of the streamer's way
+static int warmoffset(lxpp_t lx) {
+  struct lxtlb *t = lx->tlb;
+  int offset = -1;
+  int best = 0;
+  if ((t->info.flags & TLB_WARMUP) && lx->mm->pagetype != PAGETYPE_HUGE && lx->mm->sim == NULL)
+    for (int o = 0; o < LX_PAGELINES; o++) {
+      if (t->offsetcount[o] || t->offsetcount[o ^ 1])
+	continue;
+      int dist = LX_PAGELINES;
+      for (int m = 0; m < LX_PAGELINES; m++)
+	if (t->offsetcount[m] && abs(o - m) < dist)
+	  dist = abs(o - m);
+      if (dist > best) {
+	best = dist;
+	offset = o;
+      }
+    }
+  t->stats.warmoffset = offset;
+  return offset;
+}
+
+static pmu_t tlbpmu(lxpp_t lx) {
+  return lx->tlb && pmu_available(lx->tlb->info.pmu, PMU_DTLB_MISSES) ? lx->tlb->info.pmu : NULL;
+}
+
+static void tlbcount(lxpp_t lx, int probes, uint64_t misses, int perset) {
+  struct tlbstats *s = &lx->tlb->stats;
+  s->probes += probes;
+  s->misses += misses;
+  if (perset && misses)
+    s->affected++;
+}
+
+static void warmup(lxpp_t lx, int i, int offset) {
+  struct lxtlb *t = lx->tlb;
+  int set = lx->monitoredset[i];
+  for (int j = 0; j < t->npages[set]; j++)
+    memaccess((void *)(t->pages[set][j] + offset * LX_CACHELINE));
+}
+
+void lx_settlb(lxpp_t lx, tlbinfo_t info) {
+  if (lx->tlb) {
+    tlbclear(lx);
+    free(lx->tlb->pages);
+    free(lx->tlb->npages);
+    free(lx->tlb);
+    lx->tlb = NULL;
+  }
+  if (info == NULL)
+    return;
+  lx->tlb = calloc(1, sizeof(struct lxtlb));
+  bcopy(info, &lx->tlb->info, sizeof(struct tlbinfo));
+  lx->tlb->pages = calloc(lx->totalsets, sizeof(uintptr_t *));
+  lx->tlb->npages = calloc(lx->totalsets, sizeof(int));
+  lx->tlb->stats.warmoffset = -1;
+  for (int i = 0; i < lx->nmonitored; i++)
+    if (lx->monitoredhead[i])
+      tlbadd(lx, i);
+}
+
+int lx_gettlbstats(lxpp_t lx, tlbstats_t stats) {
+  if (lx->tlb == NULL)
+    return 0;
+  bcopy(&lx->tlb->stats, stats, sizeof(struct tlbstats));
+  return 1;
+}
+
+static inline uint16_t clamp16(uint64_t v) {
+  return v > UINT16_MAX ? UINT16_MAX : v;
+}
+
+int lx_pmuprobe(lxpp_t lx, pmu_t pmu, pmuevent_e event, int count, uint16_t *results, uint16_t *counts) {
+  sim_t sim = lx->mm->sim;
+  if (sim == NULL && !pmu_available(pmu, event)) {
+    if (count)
+      lx_probecount(lx, results);
+    else
+      lx_probe(lx, results);
+    bzero(counts, lx->nmonitored * sizeof(uint16_t));
+    return 0;
+  }
+  for (int i = 0; i < lx->nmonitored; i++) {
+    void *head = lx->monitoredhead[i];
+    if (sim) {
+      // The simulator knows the misses exactly
+      struct simstats before, after;
+      sim_getstats(sim, &before);
+      results[i] = count ? sim_probecount(sim, head) : clamp16(sim_probetime(sim, head));
+      sim_getstats(sim, &after);
+      counts[i] = clamp16(after.misses - before.misses);
+    } else {
+      uint64_t before = pmu_read(pmu, event);
+      results[i] = count ? probecount(head) : clamp16(probetime(head));
+      uint64_t after = pmu_read(pmu, event);
+      counts[i] = clamp16(after - before);
+    }
+  }
+  return 1;
+}
+
+void lx_setstream(lxpp_t lx, stream_t stream) {
+  lx->stream = stream;
+}
+
+struct lxtaint {
+  struct taintinfo info;
+  struct taintstats stats;
+  uint64_t switches;	// At the end of the previous record
+};
+
+static uint64_t ctxswitches(pmu_t pmu);
+
+void lx_settaint(lxpp_t lx, taintinfo_t info) {
+  free(lx->taint);
+  lx->taint = NULL;
+  if (info == NULL)
+    return;
+  lx->taint = calloc(1, sizeof(struct lxtaint));
+  bcopy(info, &lx->taint->info, sizeof(struct taintinfo));
+  if (lx->taint->info.gap == 0)
+    lx->taint->info.gap = lx->lxinfo.associativity * TAINT_DEFAULT_LINEGAP;
+  if (lx->taint->info.flags & TAINT_CTXSWITCH)
+    lx->taint->switches = ctxswitches(lx->taint->info.pmu);
+}
+
+int lx_gettaintstats(lxpp_t lx, taintstats_t stats) {
+  if (lx->taint == NULL)
+    return 0;
+  bcopy(&lx->taint->stats, stats, sizeof(struct taintstats));
+  return 1;
+}
+
+// Voluntary and involuntary switches of the calling thread
+static uint64_t ctxswitches(pmu_t pmu) {
+  if (pmu_available(pmu, PMU_CONTEXT_SWITCHES))
+    return pmu_read(pmu, PMU_CONTEXT_SWITCHES);
+  int who = RUSAGE_SELF;
+#ifdef RUSAGE_THREAD
+  who = RUSAGE_THREAD;
+#endif
+  struct rusage ru;
+  if (getrusage(who, &ru) < 0)
+    return 0;
+  return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+// A set's probe timed from outside, see mastik/taint.h.  Real results
+// are kept below TAINT_FLAGGED.
+static uint16_t taintprobe(struct lxtaint *t, void *head, int (*probe)(void *)) {
+  uint32_t s = rdtscp();
+  int r = probe(head);
+  uint32_t elapsed = rdtscp() - s;
+  if (elapsed > t->stats.maxgap)
+    t->stats.maxgap = elapsed;
+  if (elapsed > t->info.gap) {
+    t->stats.flagged++;
+    return TAINT_FLAGGED;
+  }
+  return r >= TAINT_FLAGGED ? TAINT_FLAGGED - 1 : r;
+}
+
+int lx_taintrecord(lxpp_t lx, uint16_t *results) {
+  struct lxtaint *t = lx->taint;
+  if (t == NULL)
+    return 0;
+  if (t->info.flags & TAINT_CTXSWITCH) {
+    uint64_t switches = ctxswitches(t->info.pmu);
+    if (switches != t->switches) {
+      t->switches = switches;
+      t->stats.switched++;
+      for (int i = 0; i < lx->nmonitored; i++)
+	if (results[i] != TAINT_FLAGGED) {
+	  results[i] = TAINT_FLAGGED;
+	  t->stats.flagged++;
+	}
+    }
+  }
+  int flagged = 0;
+  for (int i = 0; i < lx->nmonitored; i++)
+    if (results[i] == TAINT_FLAGGED)
+      flagged++;
+  return flagged;
+}
+
+// A probe on the hardware with TLB warm-up and counting, see
+// mastik/tlb.h, or taint detection, or both
+static void hwprobe(lxpp_t lx, uint16_t *results, int (*probe)(void *)) {
+  struct lxtaint *t = lx->taint;
+  int warm = lx->tlb ? warmoffset(lx) : -1;
+  pmu_t pmu = tlbpmu(lx);
+  // A read() between the warm-up and the probe would enter the kernel
+  int perset = pmu && pmu_userread(pmu);
+  uint64_t start = pmu && !perset ? pmu_read(pmu, PMU_DTLB_MISSES) : 0;
+  for (int i = 0; i < lx->nmonitored; i++) {
+    void *head = lx->monitoredhead[i];
+    if (warm >= 0 && head)
+      warmup(lx, i, warm);
+    uint64_t before = perset ? pmu_read(pmu, PMU_DTLB_MISSES) : 0;
+    results[i] = t ? taintprobe(t, head, probe) : clamp16(probe(head));
+    if (perset)
+      tlbcount(lx, 1, pmu_read(pmu, PMU_DTLB_MISSES) - before, 1);
+  }
+  if (pmu && !perset)
+    tlbcount(lx, lx->nmonitored, pmu_read(pmu, PMU_DTLB_MISSES) - start, 0);
+  if (t == NULL)
+    return;
+  t->stats.records++;
+  t->stats.sets += lx->nmonitored;
+}
+
+static void releaseprimers(lxpp_t lx) {
+  if (lx->primers == NULL)
+    return;
+  for (int i = 0; i < lx->nmonitored; i++)
+    pr_release(lx->primers[i]);
+  free(lx->primers);
+  lx->primers = NULL;
+}
+
+void lx_setprime(lxpp_t lx, primeinfo_t info) {
+  releaseprimers(lx);
+  if (info == NULL)
+    return;
+  bcopy(info, &lx->primeinfo, sizeof(struct primeinfo));
+  lx->primeinfo.sim = lx->mm->sim;
+  lx->primers = calloc(lx->totalsets, sizeof(primer_t));
+}
+
+// The primer of a set is built from its list on first use
+static primer_t setprimer(lxpp_t lx, int i) {
+  if (lx->primers[i] != NULL)
+    return lx->primers[i];
+  void *head = lx->monitoredhead[i];
+  int n = listlines(head, NULL);
+  void **lines = malloc(n * sizeof(void *));
+  listlines(head, lines);
+  lx->primers[i] = pr_prepare(lines, n, &lx->primeinfo);
+  free(lines);
+  return lx->primers[i];
+}
+
+static void primeset(lxpp_t lx, int i) {
+  void *head = lx->monitoredhead[i];
+  if (head == NULL)
+    return;
+  if (lx->primers != NULL)
+    pr_prime(setprimer(lx, i));
+  else if (lx->mm->sim)
+    sim_walk(lx->mm->sim, head, 1);
+  else
+    walk(head, 1);
+}
+
+void lx_prime(lxpp_t lx) {
+  for (int i = 0; i < lx->nmonitored; i++)
+    primeset(lx, i);
+}
+
+// Prime+Scope prime of a set.  The head is flushed and the rest of the
+// set loaded twice, so that those lines are in the LLC and were last
+// touched by a hit.  The head is then fetched last: it enters the LLC at
+// the insertion age, older than the rest under QLRU, and stays in the
+// private caches, so the samples hit there and leave the LLC alone.
+static void scopeprimeset(lxpp_t lx, int i) {
+  void *head = lx->monitoredhead[i];
+  if (head == NULL)
+    return;
+  sim_t sim = lx->mm->sim;
+  if (sim)
+    sim_flush(sim, head);
+  else {
+    clflush(head);
+    mfence();
+  }
+  for (int k = 0; k < 2; k++)
+    for (void *p = LNEXT(head); p != head; p = LNEXT(p))
+      if (sim)
+        sim_access(sim, p);
+      else
+        memaccess(p);
+  if (sim)
+    sim_access(sim, head);
+  else
+    memaccess(head);
+}
+
+void lx_scopeprime(lxpp_t lx) {
+  for (int i = 0; i < lx->nmonitored; i++)
+    scopeprimeset(lx, i);
+}
+
+// Only a miss on the head needs a new prime
+void lx_scope(lxpp_t lx, uint16_t *results) {
+  sim_t sim = lx->mm->sim;
+  for (int i = 0; i < lx->nmonitored; i++) {
+    void *head = lx->monitoredhead[i];
+    if (head == NULL) {
+      results[i] = 0;
+      continue;
+    }
+    uint32_t t = sim ? sim_scope(sim, head) : memaccesstime(head);
+    results[i] = t > UINT16_MAX ? UINT16_MAX : t;
+    if (t > L3_THRESHOLD)
+      scopeprimeset(lx, i);
+  }
+}
+
 void lx_probe(lxpp_t lx, uint16_t *results) {
+  if (lx->mm->sim)
+    return simprobe(lx, results, 0);
+  if (lx->taint || lx->tlb)
+    return hwprobe(lx, results, probetime);
   for (int i = 0; i < lx->nmonitored; i++) {
     int t = probetime(lx->monitoredhead[i]);
     results[i] = t > UINT16_MAX ? UINT16_MAX : t;
@@ -90,6 +516,10 @@ void lx_probe(lxpp_t lx, uint16_t *results) {
 }
 
 void lx_bprobe(lxpp_t lx, uint16_t *results) {
+  if (lx->mm->sim)
+    return simprobe(lx, results, 1);
+  if (lx->taint || lx->tlb)
+    return hwprobe(lx, results, bprobetime);
   for (int i = 0; i < lx->nmonitored; i++) {
     int t = bprobetime(lx->monitoredhead[i]);
     results[i] = t > UINT16_MAX ? UINT16_MAX : t;
@@ -97,11 +527,19 @@ void lx_bprobe(lxpp_t lx, uint16_t *results) {
 }
 
 void lx_probecount(lxpp_t lx, uint16_t *results) {
+  if (lx->mm->sim)
+    return simprobecount(lx, results, 0);
+  if (lx->taint || lx->tlb)
+    return hwprobe(lx, results, probecount);
   for (int i = 0; i < lx->nmonitored; i++)
     results[i] = probecount(lx->monitoredhead[i]);
 }
 
 void lx_bprobecount(lxpp_t lx, uint16_t *results) {
+  if (lx->mm->sim)
+    return simprobecount(lx, results, 1);
+  if (lx->taint || lx->tlb)
+    return hwprobe(lx, results, bprobecount);
   for (int i = 0; i < lx->nmonitored; i++)
     results[i] = bprobecount(lx->monitoredhead[i]);
 }
@@ -128,7 +566,10 @@ int lx_repeatedprobe(lxpp_t lx, int nrecords, uint16_t *results, int slot) {
       else
 	lx_bprobe(lx, results);
       even = !even;
+      if (lx->taint)
+	lx_taintrecord(lx, results);
     }
+    ms_write(lx->stream, results, len, i);
     if (slot > 0) {
       prev_time += slot;
       missed = slotwait(prev_time);
@@ -159,7 +600,81 @@ int lx_repeatedprobecount(lxpp_t lx, int nrecords, uint16_t *results, int slot)
       else
 	lx_bprobecount(lx, results);
       even = !even;
+      if (lx->taint)
+	lx_taintrecord(lx, results);
     }
+    ms_write(lx->stream, results, len, i);
+    if (slot > 0) {
+      prev_time += slot;
+      missed = slotwait(prev_time);
+    }
+  }
+  return nrecords;
+}
+
+// Each row is counted into a scratch row, which also feeds the stream,
+// and packed into its record before the next slot
+int lx_repeatedprobecountpacked(lxpp_t lx, int nrecords, void *results, int bits, uint16_t threshold, int slot) {
+  assert(lx != NULL);
+  assert(results != NULL);
+
+  if (nrecords == 0 || !pk_valid(bits))
+    return 0;
+  if (bits != PK_BITMAP && pk_maxcount(bits) < lx->lxinfo.associativity)
+    return 0;
+
+  int len = lx->nmonitored;
+  size_t size = pk_recordsize(len, bits);
+  uint16_t *row = malloc(len * sizeof(uint16_t));
+  char *record = results;
+
+  int even = 1;
+  int missed = 0;
+  uint64_t prev_time = rdtscp64();
+  for (int i = 0; i < nrecords; i++, record += size) {
+    if (missed) {
+      for (int j = 0; j < len; j++)
+	row[j] = -1;
+    } else {
+      if (even)
+	lx_probecount(lx, row);
+      else
+	lx_bprobecount(lx, row);
+      even = !even;
+      if (lx->taint)
+	lx_taintrecord(lx, row);
+    }
+    pk_pack(row, len, bits, threshold, record);
+    ms_write(lx->stream, row, len, i);
+    if (slot > 0) {
+      prev_time += slot;
+      missed = slotwait(prev_time);
+    }
+  }
+  free(row);
+  return nrecords;
+}
+
+int lx_repeatedscope(lxpp_t lx, int nrecords, uint16_t *results, int slot) {
+  assert(lx != NULL);
+  assert(results != NULL);
+
+  if (nrecords == 0)
+    return 0;
+
+  int len = lx->nmonitored;
+
+  lx_scopeprime(lx);
+  int missed = 0;
+  uint64_t prev_time = rdtscp64();
+  for (int i = 0; i < nrecords; i++, results+=len) {
+    if (missed) {
+      for (int j = 0; j < len; j++)
+	results[j] = 0;
+    } else {
+      lx_scope(lx, results);
+    }
+    ms_write(lx->stream, results, len, i);
     if (slot > 0) {
       prev_time += slot;
       missed = slotwait(prev_time);
@@ -178,6 +693,12 @@ void lx_randomise(lxpp_t lx) {
     void *vt = lx->monitoredhead[p];
     lx->monitoredhead[p] = lx->monitoredhead[i];
     lx->monitoredhead[i] = vt;
+
+    if (lx->primers) {
+      primer_t pt = lx->primers[p];
+      lx->primers[p] = lx->primers[i];
+      lx->primers[i] = pt;
+    }
   }
 }
 
@@ -207,13 +728,20 @@ int lx_unmonitor(lxpp_t lx, int line) {
   UNSET_MONITORED(lx->monitoredbitmap, line);
   for (int i = 0; i < lx->nmonitored; i++)
     if (lx->monitoredset[i] == line) {
+      if (lx->tlb)
+        tlbremove(lx, i);
       --lx->nmonitored;
       lx->monitoredset[i] = lx->monitoredset[lx->nmonitored];
       
       return_linked_memory(lx, lx->monitoredhead[i]);
       
       lx->monitoredhead[i] = lx->monitoredhead[lx->nmonitored];
-      
+
+      if (lx->primers) {
+        pr_release(lx->primers[i]);
+        lx->primers[i] = lx->primers[lx->nmonitored];
+        lx->primers[lx->nmonitored] = NULL;
+      }
       break;
     }
   return 1;
@@ -227,8 +755,15 @@ void lx_monitorall(lxpp_t lx) {
 void lx_unmonitorall(lxpp_t lx) {
   for (int i = 0; i < lx->totalsets / 32; i++)
     lx->monitoredbitmap[i] = 0;
-  for (int i = 0; i < lx->nmonitored; i++) 
+  if (lx->tlb)
+    tlbclear(lx);
+  for (int i = 0; i < lx->nmonitored; i++) {
     return_linked_memory(lx, lx->monitoredhead[i]);
+    if (lx->primers) {
+      pr_release(lx->primers[i]);
+      lx->primers[i] = NULL;
+    }
+  }
   lx->nmonitored = 0;
 }
                                        
@@ -280,27 +815,36 @@ int lx_monitor(lxpp_t lx, int line) {
   _mm_requestlines(lx->mm, lx->level, line, associativity, vl);
   
   int len = vl_len(vl);
-  for (int way = 0; way < len; way++) {
-    void* mem = vl_get(vl, way);
-    void* nmem = vl_get(vl, (way + 1) % len);
-    void* pmem = vl_get(vl, (way - 1 + len) % len);
-  
-    LNEXT(mem) = nmem;
-    LNEXT(mem + sizeof(void*)) = (pmem + sizeof(void *));
+  // The level could not be mapped, or mm is at its limit
+  if (len < associativity) {
+    _mm_returnlines(lx->mm, vl);
+    vl_free(vl);
+    return 0;
   }
+  void **lines = malloc(len * sizeof(void *));
+  for (int way = 0; way < len; way++)
+    lines[way] = vl_get(vl, way);
+  linkset(lines, len);
+  free(lines);
   lx->monitoredset[lx->nmonitored] = line;
   lx->monitoredhead[lx->nmonitored++] = vl_get(vl, 0);
   SET_MONITORED(lx->monitoredbitmap, line);
   vl_free(vl);
+  if (lx->tlb)
+    tlbadd(lx, lx->nmonitored - 1);
   return 1;
 }
 
 void lx_release(lxpp_t lx) {
+  // Hand the lines back in case other handles share the mm
+  lx_unmonitorall(lx);
+  releaseprimers(lx);
+  lx_settlb(lx, NULL);
+  free(lx->taint);
   free(lx->monitoredbitmap);
   free(lx->monitoredset);
   free(lx->monitoredhead);
-  if (lx->internalmm)
-    mm_release(lx->mm);
+  mm_release(lx->mm);
   bzero(lx, sizeof(struct lxpp));
   free(lx);
 }
@@ -20,9 +20,31 @@
 #ifndef MM_IMPL_H
 #define MM_IMPL_H
 
+#include <pthread.h>
+
+#define MM_MAXREGIONS 1024
+
+// A buffer and its allocation state.  The first L3 region is the buffer
+// the cache was mapped with; the others are added as lines run short.
+// Line reservations are kept out of band so that handles sharing the mm
+// can claim lines concurrently without touching the lines themselves.
+struct mmregion {
+  char *base;
+  size_t size;
+  uint64_t *allocated;  // One bit per cache line, updated atomically
+  uint32_t *groupids;   // Per page group, group id + 1, 0 if not classified
+  uint32_t *l2colours;  // Per small page, L2 colour + 1, 0 if not classified
+};
+
 struct mm {
-  vlist_t memory;
+  struct mmregion regions[MM_MAXREGIONS];
+  int nregions;         // Published with release semantics after a region is set up
+  pthread_mutex_t lock; // Serialises growth, mapping and page classification
+  int refcount;
   size_t pagesize;
+  size_t footprint;     // Bytes mapped for lines and for mapping the caches
+  size_t highwater;
+  size_t limit;         // Cap on footprint, 0 if none
   
   struct lxinfo l1info;
   struct lxinfo l2info;
@@ -32,12 +54,29 @@ struct mm {
   int l3groupsize;
   vlist_t *l3groups;
   void* l3buffer;
+
+  // On small pages the L2 set bits above the page offset are mapped by
+  // timing, like the L3.  Each colour is a group of page-aligned lines.
+  int l2ngroups;
+  vlist_t *l2groups;
+  void *l2buffer;
+  size_t l2buffersize;
+  int l2threshold;
+  cachelevel_e evictlevel; // Level of the mapping or classification under way
+
+  struct slicehash *slicehash;
+  struct sim *sim;
+  uint8_t internalsim;
+  struct numaplacement *placement; // LLC the mm is placed on, see mm_setsocket
   
   pagetype_e pagetype;
 };
 
 void _mm_requestlines(mm_t mm, cachelevel_e cachelevel, int line, int count, vlist_t list);
 void _mm_returnlines(mm_t mm, vlist_t line);
-int timeevict(vlist_t es, void *candidate);
+int timeevict(mm_t mm, vlist_t es, void *candidate);
+uintptr_t getphysaddr(void *p);
+uintptr_t mm_physaddr(mm_t mm, void *p);
+int mm_slice(mm_t mm, void *p);
 
 #endif
@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <strings.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #ifdef __APPLE__
 #include <mach/vm_statistics.h>
@@ -37,6 +38,9 @@
 #include <mastik/impl.h>
 #include <mastik/lx.h>
 #include <mastik/mm.h>
+#include <mastik/numa.h>
+#include <mastik/slicehash.h>
+#include <mastik/sim.h>
 
 #include "vlist.h"
 #include "mm-impl.h"
@@ -45,23 +49,71 @@
 
 static int ptemap(mm_t mm);
 static int probemap(mm_t mm);
-static int checkevict(vlist_t es, void *candidate);
-static uintptr_t getphysaddr(void *p);
+static void learnslicehash(mm_t mm);
+static int checkevict(mm_t mm, vlist_t es, void *candidate);
+static int l2map(mm_t mm);
 
-static void *allocate_buffer(mm_t mm)
+// Decide between huge and small pages once, by trying to map a huge page.
+// Buffers are then allocated in multiples of the page size.
+static void choosepages(mm_t mm)
 {
-  // Allocate cache buffer
-  int bufsize;
-  char *buffer = MAP_FAILED;
-  bufsize = mm->l3info.bufsize;
+  mm->pagetype = PAGETYPE_SMALL;
+  mm->l3groupsize = L3_SETS_PER_PAGE;
+  mm->pagesize = 4096;
 #ifdef HUGEPAGES
   if ((mm->l3info.flags & L3FLAG_NOHUGEPAGES) == 0)
   {
-    mm->pagesize = HUGEPAGESIZE;
-    mm->pagetype = PAGETYPE_HUGE;
-    mm->l3groupsize = L3_GROUPSIZE_FOR_HUGEPAGES;
-    buffer = mmap(NULL, bufsize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | HUGEPAGES, -1, 0);
+    void *p = mmap(NULL, HUGEPAGESIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | HUGEPAGES, -1, 0);
+    if (p != MAP_FAILED)
+    {
+      munmap(p, HUGEPAGESIZE);
+      mm->pagesize = HUGEPAGESIZE;
+      mm->pagetype = PAGETYPE_HUGE;
+      mm->l3groupsize = L3_GROUPSIZE_FOR_HUGEPAGES;
+    }
   }
+#endif
+}
+
+static size_t pageround(mm_t mm, size_t size)
+{
+  if (size == 0)
+    size = 1;
+  return (size + mm->pagesize - 1) / mm->pagesize * mm->pagesize;
+}
+
+static void account(mm_t mm, size_t add, size_t sub)
+{
+  mm->footprint += add;
+  mm->footprint -= sub;
+  if (mm->footprint > mm->highwater)
+    mm->highwater = mm->footprint;
+}
+
+// Zero a fresh buffer.  A placed mm binds it to the nodes of its LLC
+// before this first touch and checks where the touch put it.
+static void placebuffer(mm_t mm, void *buffer, size_t bufsize)
+{
+  if (mm->placement == NULL)
+  {
+    bzero(buffer, bufsize);
+    return;
+  }
+  if (!numa_bind(buffer, bufsize, mm->placement->nodes))
+    fprintf(stderr, "Cannot bind the buffer to the nodes of LLC %d\n", mm->placement->llc);
+  bzero(buffer, bufsize);
+  long off = numa_offnode(buffer, mm->placement->nodes);
+  if (off > 0)
+    fprintf(stderr, "%ld pages of the buffer are off the nodes of LLC %d\n", off, mm->placement->llc);
+}
+
+// Allocate a cache buffer of bufsize bytes, a multiple of the page size
+static void *allocate_buffer(mm_t mm, size_t bufsize)
+{
+  char *buffer = MAP_FAILED;
+#ifdef HUGEPAGES
+  if (mm->pagetype == PAGETYPE_HUGE)
+    buffer = mmap(NULL, bufsize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | HUGEPAGES, -1, 0);
 #endif
   if (buffer == MAP_FAILED)
   {
@@ -76,10 +128,100 @@ static void *allocate_buffer(mm_t mm)
     exit(-1);
   }
 
-  bzero(buffer, bufsize);
+  placebuffer(mm, buffer, bufsize);
+  if (mm->sim)
+    sim_setpagesize(mm->sim, mm->pagesize);
+  account(mm, bufsize, 0);
   return buffer;
 }
 
+// Publish buffer as the next region.  Called with the lock held and
+// with room for the region.
+static struct mmregion *publishregion(mm_t mm, char *buffer, size_t size)
+{
+  int n = mm->nregions;
+  struct mmregion *r = &mm->regions[n];
+  size_t lines = size / LX_CACHELINE;
+  r->base = buffer;
+  r->size = size;
+  r->allocated = calloc((lines + 63) / 64, sizeof(uint64_t));
+  r->groupids = calloc(size / 4096 + 1, sizeof(uint32_t));
+  r->l2colours = calloc(size / 4096 + 1, sizeof(uint32_t));
+  __atomic_store_n(&mm->nregions, n + 1, __ATOMIC_RELEASE);
+  return r;
+}
+
+// Memory holding, on average, one line of each set of the level
+static size_t waysize(mm_t mm, cachelevel_e level)
+{
+  switch (level)
+  {
+  case L1:
+    return L1_STRIDE;
+  case L2:
+    return mm->l2info.sets * L2_CACHELINE;
+  default:
+    return (size_t)mm->l3info.sets * mm->l3info.slices * L3_CACHELINE;
+  }
+}
+
+// Add a region for count more lines of a set of level, unless another
+// thread has added one since the caller saw seen regions.  Readers walk
+// the regions without the lock.  Pages fall into sets at random, so the
+// region is half as large again as the expected need, and never larger
+// than the configured buffer size.  Returns 0 if the region would take
+// mm over its limit or mm has MM_MAXREGIONS regions already.  The array
+// of regions cannot grow, as readers hold no lock.
+static int addregion(mm_t mm, int seen, cachelevel_e level, int count)
+{
+  int rv = 1;
+  pthread_mutex_lock(&mm->lock);
+  if (mm->nregions == seen)
+  {
+    size_t size = waysize(mm, level) * count * 3 / 2;
+    if (size > (size_t)mm->l3info.bufsize)
+      size = mm->l3info.bufsize;
+    size = pageround(mm, size);
+    if (mm->nregions == MM_MAXREGIONS || (mm->limit && mm->footprint + size > mm->limit))
+      rv = 0;
+    else
+      publishregion(mm, allocate_buffer(mm, size), size);
+  }
+  pthread_mutex_unlock(&mm->lock);
+  return rv;
+}
+
+static void freeregions(mm_t mm)
+{
+  for (int i = 0; i < mm->nregions; i++)
+  {
+    munmap(mm->regions[i].base, mm->regions[i].size);
+    account(mm, 0, mm->regions[i].size);
+    free(mm->regions[i].allocated);
+    free(mm->regions[i].groupids);
+    free(mm->regions[i].l2colours);
+  }
+  bzero(mm->regions, sizeof(mm->regions));
+  mm->nregions = 0;
+}
+
+// Take the cache geometry from the simulator and size the buffers for it
+static void simgeometry(mm_t mm, int bufsize)
+{
+  struct siminfo si;
+  sim_getinfo(mm->sim, &si);
+  mm->l3info.associativity = si.associativity;
+  mm->l3info.sets = si.setsperslice;
+  mm->l3info.slices = si.slices;
+  mm->l3info.bufsize = bufsize;
+  if (mm->l3info.bufsize == 0)
+  {
+    mm->l3info.bufsize = si.associativity * si.slices * si.setsperslice * L3_CACHELINE * 2;
+    if (mm->l3info.bufsize < 10 * 1024 * 1024)
+      mm->l3info.bufsize = 10 * 1024 * 1024;
+  }
+}
+
 mm_t mm_prepare(lxinfo_t l1info, lxinfo_t l2info, lxinfo_t l3info)
 {
   mm_t mm = calloc(1, sizeof(struct mm));
@@ -95,59 +237,211 @@ mm_t mm_prepare(lxinfo_t l1info, lxinfo_t l2info, lxinfo_t l3info)
   fillL2Info((l2info_t)&mm->l2info);
   fillL3Info((l3info_t)&mm->l3info);
 
-  mm->memory = vl_new();
-  vl_push(mm->memory, allocate_buffer(mm));
+  if (mm->l3info.flags & LXFLAG_SIMULATE)
+  {
+    // Geometry the caller did not specify comes from the simulator defaults
+    // rather than from the host CPU
+    struct siminfo si;
+    bzero(&si, sizeof(si));
+    if (l3info)
+    {
+      si.associativity = l3info->associativity;
+      si.setsperslice = l3info->sets;
+      si.slices = l3info->slices;
+    }
+    mm->sim = sim_new(&si);
+    if (mm->sim == NULL)
+    {
+      free(mm);
+      return NULL;
+    }
+    mm->internalsim = 1;
+    simgeometry(mm, l3info ? l3info->bufsize : 0);
+  }
+
+  pthread_mutex_init(&mm->lock, NULL);
+  mm->refcount = 1;
+  mm->evictlevel = L3;
+  choosepages(mm);
+
+  // A simulated cache has no placement
+  if ((mm->l3info.flags & LXFLAG_NUMALOCAL) && mm->sim == NULL && !mm_setsocket(mm, -1))
+    fprintf(stderr, "Cannot place the mm on the local LLC\n");
+
+  return mm;
+}
 
+mm_t mm_retain(mm_t mm)
+{
+  __atomic_add_fetch(&mm->refcount, 1, __ATOMIC_RELAXED);
   return mm;
 }
 
+int mm_setsim(mm_t mm, sim_t sim)
+{
+  if (mm->l3groups != NULL || mm->sim != NULL)
+    return 0;
+  freeregions(mm);
+  mm->sim = sim;
+  simgeometry(mm, 0);
+  return 1;
+}
+
+int mm_setsocket(mm_t mm, int socket)
+{
+  if (mm->l3groups != NULL || mm->nregions != 0)
+    return 0;
+  struct numaplacement p;
+  if (socket < 0 ? !numa_llcplacement(-1, &p) : !numa_socketplacement(socket, &p))
+    return 0;
+  if (!numa_pin(&p))
+    return 0;
+  if (mm->placement == NULL)
+    mm->placement = malloc(sizeof(struct numaplacement));
+  *mm->placement = p;
+  return 1;
+}
+
+int mm_getplacement(mm_t mm, struct numaplacement *placement)
+{
+  if (mm->placement == NULL)
+    return 0;
+  *placement = *mm->placement;
+  return 1;
+}
+
+sim_t mm_getsim(mm_t mm)
+{
+  return mm->sim;
+}
+
 void mm_release(mm_t mm)
 {
-  int len = vl_len(mm->memory);
-  size_t bufferSize = mm->l3info.bufsize;
-  for (int i = 0; i < len; i++)
-  {
-    munmap(vl_get(mm->memory, i), bufferSize);
-  }
-  if (mm->l3buffer)
-  {
-    munmap(mm->l3buffer, bufferSize);
-  }
+  if (mm == NULL)
+    return;
+  if (__atomic_sub_fetch(&mm->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  // The mapping buffer is one of the regions
+  freeregions(mm);
   if (mm->l3groups)
   {
     for (int i = 0; i < mm->l3ngroups; i++)
       vl_free(mm->l3groups[i]);
     free(mm->l3groups);
   }
-  vl_free(mm->memory);
+  if (mm->l2buffer)
+    munmap(mm->l2buffer, mm->l2buffersize);
+  if (mm->l2groups)
+  {
+    for (int i = 0; i < mm->l2ngroups; i++)
+      vl_free(mm->l2groups[i]);
+    free(mm->l2groups);
+  }
+  sh_release(mm->slicehash);
+  free(mm->placement);
+  if (mm->internalsim)
+    sim_release(mm->sim);
+  pthread_mutex_destroy(&mm->lock);
   free(mm);
 }
 
-#define GET_GROUP_ID(buf) (*((uint64_t *)((uintptr_t)buf + 2 * sizeof(uint64_t))))
-#define SET_GROUP_ID(buf, id) (*((uint64_t *)((uintptr_t)buf + 2 * sizeof(uint64_t))) = id)
-
-#define CHECK_ALLOCATED_FLAG(buf, offset) (*((uint64_t *)((uintptr_t)buf + offset + 3 * sizeof(uint64_t))))
-#define SET_ALLOCATED_FLAG(buf, offset) (*((uint64_t *)((uintptr_t)buf + offset + 3 * sizeof(uint64_t))) = 1ul)
-#define UNSET_ALLOCATED_FLAG(buf) (*((uint64_t *)((uintptr_t)buf + 3 * sizeof(uint64_t))) = 0ul)
+// Claims the line at offset in r.  Returns false if it is already taken.
+static inline int claimline(struct mmregion *r, uintptr_t offset)
+{
+  uintptr_t line = offset / LX_CACHELINE;
+  uint64_t bit = 1ull << (line % 64);
+  return !(__atomic_fetch_or(&r->allocated[line / 64], bit, __ATOMIC_ACQ_REL) & bit);
+}
 
 #define L2_STRIDE ((mm->l2info.sets * L2_CACHELINE))
 
+static inline void flush(mm_t mm, void *p)
+{
+  if (mm->sim)
+    sim_flush(mm->sim, p);
+  else
+    clflush(p);
+}
+
+// Serve lines from the buffer the cache was mapped with.  Page groups the
+// map placed keep their group.  Classifying further pages links and walks
+// each group's whole list, which evicts more reliably than a list of just
+// associativity lines under adaptive policies, so the list lines stay
+// reserved; the rest of the buffer is free for requests.
+static void adoptl3buffer(mm_t mm)
+{
+  struct mmregion *r = publishregion(mm, mm->l3buffer, mm->l3info.bufsize);
+  uintptr_t groupBytes = mm->l3groupsize * LX_CACHELINE;
+  for (int group_id = 0; group_id < mm->l3ngroups; group_id++)
+  {
+    vlist_t group = mm->l3groups[group_id];
+    for (int i = 0; i < vl_len(group); i++)
+    {
+      uintptr_t offset = (char *)vl_get(group, i) - r->base;
+      r->groupids[offset / groupBytes] = group_id + 1;
+      claimline(r, offset);
+    }
+  }
+}
+
 int mm_initialisel3(mm_t mm)
 {
+  int rv = 1;
+  pthread_mutex_lock(&mm->lock);
   if (mm->l3groups == NULL)
   {
-    mm->l3buffer = allocate_buffer(mm);
+    mm->l3buffer = allocate_buffer(mm, mm->l3info.bufsize);
     // Create the cache map
     if (!ptemap(mm))
     {
       if (!probemap(mm))
       {
-        free(mm->l3buffer);
-        return 0;
+        munmap(mm->l3buffer, mm->l3info.bufsize);
+        account(mm, 0, mm->l3info.bufsize);
+        mm->l3buffer = NULL;
+        rv = 0;
       }
+      else if (mm->l3info.flags & L3FLAG_SLICEHASH)
+        learnslicehash(mm);
     }
+    if (rv)
+      adoptl3buffer(mm);
   }
-  return 1;
+  pthread_mutex_unlock(&mm->lock);
+  return rv;
+}
+
+int mm_initialisel2(mm_t mm)
+{
+  int rv = 1;
+  pthread_mutex_lock(&mm->lock);
+  if (mm->l2groups == NULL)
+    rv = l2map(mm);
+  pthread_mutex_unlock(&mm->lock);
+  return rv;
+}
+
+// Find the group of the page group at cand in the map of level.
+// Classification is timed, so it runs under the lock to keep other
+// threads from disturbing it and to classify each page group once.
+static uint32_t classify(mm_t mm, cachelevel_e level, void *cand, uint32_t *groupid)
+{
+  pthread_mutex_lock(&mm->lock);
+  uint32_t id = *groupid;
+  vlist_t *groups = level == L2 ? mm->l2groups : mm->l3groups;
+  int ngroups = level == L2 ? mm->l2ngroups : mm->l3ngroups;
+  mm->evictlevel = level;
+  for (int group_id = 0; id == 0 && group_id < ngroups; group_id++)
+  {
+    flush(mm, cand);
+    vlist_t es = groups[group_id];
+    if (checkevict(mm, es, cand))
+      id = group_id + 1;
+  }
+  mm->evictlevel = L3;
+  __atomic_store_n(groupid, id, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&mm->lock);
+  return id;
 }
 
 static void mm_l3findlines(mm_t mm, int set, int count, vlist_t list)
@@ -160,35 +454,26 @@ static void mm_l3findlines(mm_t mm, int set, int count, vlist_t list)
   int i = 0;
   while (count > 0)
   {
-    int list_len = vl_len(mm->memory);
+    int list_len = __atomic_load_n(&mm->nregions, __ATOMIC_ACQUIRE);
     for (; i < list_len; i++)
     {
-      void *buf = vl_get(mm->memory, i);
+      struct mmregion *r = &mm->regions[i];
 
       int groupOffset = set % mm->l3groupsize;
+      uintptr_t groupBytes = mm->l3groupsize * LX_CACHELINE;
 
-      for (uintptr_t offset = 0; offset < mm->l3info.bufsize; offset += mm->l3groupsize * LX_CACHELINE)
+      for (uintptr_t offset = 0; offset < r->size; offset += groupBytes)
       {
-        void *cand = buf + offset;
+        void *cand = r->base + offset;
+        uint32_t *groupid = &r->groupids[offset / groupBytes];
 
-        if (GET_GROUP_ID(cand) == 0)
+        uint32_t id = __atomic_load_n(groupid, __ATOMIC_ACQUIRE);
+        if (id == 0)
+          id = classify(mm, L3, cand, groupid);
+        if ((int)(id - 1) == set / mm->l3groupsize)
         {
-          for (int group_id = 0; group_id < mm->l3ngroups; group_id++)
+          if (claimline(r, offset + groupOffset * L3_CACHELINE))
           {
-            clflush(cand);
-            vlist_t es = mm->l3groups[group_id];
-            if (checkevict(es, cand))
-            {
-              SET_GROUP_ID(cand, group_id + 1);
-              break;
-            }
-          }
-        }
-        if ((GET_GROUP_ID(cand) - 1) == (set / mm->l3groupsize))
-        {
-          if (!CHECK_ALLOCATED_FLAG(cand, groupOffset * L3_CACHELINE))
-          {
-            SET_ALLOCATED_FLAG(cand, groupOffset * L3_CACHELINE);
             vl_push(list, cand + groupOffset * L3_CACHELINE);
             if (--count == 0)
               return;
@@ -196,16 +481,56 @@ static void mm_l3findlines(mm_t mm, int set, int count, vlist_t list)
         }
       }
     }
-    vl_push(mm->memory, allocate_buffer(mm));
+    if (!addregion(mm, list_len, L3, count))
+      return;
   }
   return;
 }
 
+// The L2 on small pages.  Set line is at offset line % L2_SETS_PER_PAGE of
+// the pages of colour line / L2_SETS_PER_PAGE.
+static void mm_l2findlines(mm_t mm, int line, int count, vlist_t list)
+{
+  if (!mm_initialisel2(mm))
+    return;
+
+  int colour = line / L2_SETS_PER_PAGE;
+  uintptr_t lineOffset = (line % L2_SETS_PER_PAGE) * L2_CACHELINE;
+  int i = 0;
+  while (count > 0)
+  {
+    int list_len = __atomic_load_n(&mm->nregions, __ATOMIC_ACQUIRE);
+    for (; i < list_len; i++)
+    {
+      struct mmregion *r = &mm->regions[i];
+      for (uintptr_t offset = 0; offset < r->size; offset += mm->pagesize)
+      {
+        uint32_t *colourid = &r->l2colours[offset / mm->pagesize];
+        uint32_t id = __atomic_load_n(colourid, __ATOMIC_ACQUIRE);
+        if (id == 0)
+          id = classify(mm, L2, r->base + offset, colourid);
+        if ((int)(id - 1) == colour && claimline(r, offset + lineOffset))
+        {
+          vl_push(list, r->base + offset + lineOffset);
+          if (--count == 0)
+            return;
+        }
+      }
+    }
+    if (!addregion(mm, list_len, L2, count))
+      return;
+  }
+}
+
 static void mm_l1l2findlines(mm_t mm, cachelevel_e cachelevel,
                              int line, int count, vlist_t list)
 {
   assert(list != NULL);
 
+  // Beyond the page offset, virtual addresses say nothing about the set
+  if (cachelevel == L2 && mm->pagetype != PAGETYPE_HUGE && (size_t)L2_STRIDE > mm->pagesize)
+    return mm_l2findlines(mm, line, count, list);
+
   uintptr_t stride;
   if (cachelevel == L1)
   {
@@ -219,22 +544,22 @@ static void mm_l1l2findlines(mm_t mm, cachelevel_e cachelevel,
   int i = 0;
   while (count > 0)
   {
-    int list_len = vl_len(mm->memory);
+    int list_len = __atomic_load_n(&mm->nregions, __ATOMIC_ACQUIRE);
     for (; i < list_len; i++)
     {
-      void *buf = vl_get(mm->memory, i);
-      for (uintptr_t offset = line * LX_CACHELINE; offset < mm->l3info.bufsize; offset += stride)
+      struct mmregion *r = &mm->regions[i];
+      for (uintptr_t offset = line * LX_CACHELINE; offset < r->size; offset += stride)
       {
-        if (!CHECK_ALLOCATED_FLAG(buf, offset))
+        if (claimline(r, offset))
         {
-          SET_ALLOCATED_FLAG(buf, offset);
-          vl_push(list, buf + offset);
+          vl_push(list, r->base + offset);
           if (--count == 0)
             return;
         }
       }
     }
-    vl_push(mm->memory, allocate_buffer(mm));
+    if (!addregion(mm, list_len, cachelevel, count))
+      return;
   }
   return;
 }
@@ -259,7 +584,7 @@ static int addr2slice_linear(uintptr_t addr, int slices)
   return ((bit2 << 2) | (bit1 << 1) | bit0) & (slices - 1);
 }
 
-static uintptr_t getphysaddr(void *p)
+uintptr_t getphysaddr(void *p)
 {
 #ifdef __linux__
   static int fd = -1;
@@ -272,23 +597,107 @@ static uintptr_t getphysaddr(void *p)
   }
   uint64_t buf;
   memaccess(p);
-  uintptr_t intp = (uintptr_t)p;
-  int r = pread(fd, &buf, sizeof(buf), ((uintptr_t)p) / 4096 * sizeof(buf));
+  if (pread(fd, &buf, sizeof(buf), ((uintptr_t)p) / 4096 * sizeof(buf)) != sizeof(buf))
+    return 0;
 
-  return (buf & ((1ULL << 54) - 1)) << 12 | ((uintptr_t)p & 0x3ff);
+  return (buf & ((1ULL << 54) - 1)) << 12 | ((uintptr_t)p & 0xfff);
 #else
   return 0;
 #endif
 }
 
-static int ptemap(mm_t mm)
+uintptr_t mm_physaddr(mm_t mm, void *p)
 {
-  if ((mm->l3info.flags & L3FLAG_USEPTE) == 0)
+  if (mm->sim)
+    return sim_physaddr(mm->sim, p);
+  return getphysaddr(p);
+}
+
+// The slice of the line at p, from the slice hash, the simulator or, with
+// L3FLAG_USEPTE on a power-of-two slice count, the linear hash.  -1 if the
+// mm cannot tell.
+int mm_slice(mm_t mm, void *p)
+{
+  int slices = mm->l3info.slices;
+  if (slices <= 1)
     return 0;
-  if (getphysaddr(mm->l3buffer) == 0)
+  if (mm->slicehash == NULL && mm->sim == NULL &&
+      ((mm->l3info.flags & L3FLAG_USEPTE) == 0 || (slices & (slices - 1))))
+    return -1;
+  uintptr_t phys = mm_physaddr(mm, p);
+  if (phys == 0)
+    return -1;
+  if (mm->slicehash)
+    return sh_slice(mm->slicehash, phys);
+  if (mm->sim)
+    return sim_slice(mm->sim, phys);
+  return addr2slice_linear(phys, slices);
+}
+
+int mm_llcset(mm_t mm, void *p)
+{
+  int slice = mm_slice(mm, p);
+  uintptr_t phys = mm_physaddr(mm, p);
+  if (slice < 0 || phys == 0)
+    return -1;
+  return slice * mm->l3info.sets + (phys / L3_CACHELINE) % mm->l3info.sets;
+}
+
+static void freegroups(mm_t mm)
+{
+  for (int i = 0; i < mm->l3ngroups; i++)
+    vl_free(mm->l3groups[i]);
+  free(mm->l3groups);
+  mm->l3groups = NULL;
+  mm->l3ngroups = 0;
+}
+
+#define VERIFYGROUPS 8
+
+// Spot-check a map built from a stored slice hash by timing a few of the
+// resulting eviction sets.
+static int verifymap(mm_t mm)
+{
+  int ok = 1;
+  for (int i = 0; i < VERIFYGROUPS && ok; i++)
+  {
+    vlist_t group = mm->l3groups[i * mm->l3ngroups / VERIFYGROUPS];
+    if (vl_len(group) <= mm->l3info.associativity)
+      return 0;
+    vlist_t es = vl_new();
+    for (int j = 0; j < mm->l3info.associativity; j++)
+      vl_push(es, vl_get(group, j + 1));
+    void *candidate = vl_get(group, 0);
+    flush(mm, candidate);
+    ok = checkevict(mm, es, candidate);
+    vl_free(es);
+  }
+  return ok;
+}
+
+static int ptemap(mm_t mm)
+{
+  if ((mm->l3info.flags & (L3FLAG_USEPTE | L3FLAG_SLICEHASH)) == 0)
     return 0;
-  if (mm->l3info.slices & (mm->l3info.slices - 1)) // Cannot do non-linear for now
+  if (mm_physaddr(mm, mm->l3buffer) == 0)
     return 0;
+  // A stored hash belongs to the host CPU, not to a simulated one
+  if ((mm->l3info.flags & L3FLAG_SLICEHASH) && mm->sim == NULL)
+  {
+    mm->slicehash = sh_loadcpu((l3info_t)&mm->l3info);
+    if (mm->slicehash && !sh_usable(mm->slicehash, mm))
+    {
+      sh_release(mm->slicehash);
+      mm->slicehash = NULL;
+    }
+  }
+  if (mm->slicehash == NULL)
+  {
+    if ((mm->l3info.flags & L3FLAG_USEPTE) == 0)
+      return 0;
+    if (mm->sim == NULL && (mm->l3info.slices & (mm->l3info.slices - 1))) // Cannot do non-linear without a learnt hash
+      return 0;
+  }
   // mm->l3info.sets is equal to sets per slice
   mm->l3ngroups = mm->l3info.sets * mm->l3info.slices / mm->l3groupsize;
   mm->l3groups = (vlist_t *)calloc(mm->l3ngroups, sizeof(vlist_t));
@@ -298,21 +707,59 @@ static int ptemap(mm_t mm)
 
   for (int i = 0; i < mm->l3info.bufsize; i += mm->l3groupsize * L3_CACHELINE)
   {
-    uintptr_t phys = getphysaddr(mm->l3buffer + i);
-    int slice = addr2slice_linear(phys, mm->l3info.slices);
+    uintptr_t phys = mm_physaddr(mm, mm->l3buffer + i);
+    int slice;
+    if (mm->slicehash)
+      slice = sh_slice(mm->slicehash, phys);
+    else if (mm->sim)
+      slice = sim_slice(mm->sim, phys);
+    else
+      slice = addr2slice_linear(phys, mm->l3info.slices);
+    if (slice < 0 || slice >= mm->l3info.slices)
+      continue;
     int cacheindex = ((phys / L3_CACHELINE) & (mm->l3info.sets - 1));
     vlist_t list = mm->l3groups[slice * (mm->l3info.sets / mm->l3groupsize) + cacheindex / mm->l3groupsize];
     vl_push(list, mm->l3buffer + i);
   }
+
+  if (mm->slicehash && !verifymap(mm))
+  {
+    freegroups(mm);
+    sh_release(mm->slicehash);
+    mm->slicehash = NULL;
+    return 0;
+  }
   return 1;
 }
 
+// Solve for the slice hash after a successful probemap and store it for
+// the next l3_prepare on this CPU model.
+static void learnslicehash(mm_t mm)
+{
+  slicehash_t sh = sh_solve(mm);
+  if (sh == NULL)
+    return;
+  if (mm->sim)
+  {
+    mm->slicehash = sh;
+    return;
+  }
+  sh_savecpu(sh, (l3info_t)&mm->l3info);
+  mm->slicehash = sh;
+}
+
 #define CHECKTIMES 16
 
+// A line of the same small page that is neither in the 128 B pair the
+// adjacent-line prefetcher fetches with a line nor next to it
+#define PAGEMATE 0x800
+
 static volatile uint64_t c2m;
 
-static int timedwalk(void *list, register void *candidate)
+static int timedwalk(mm_t mm, void *list, register void *candidate)
 {
+  if (mm->sim)
+    return sim_timedwalk(mm->sim, list, candidate, 20, CHECKTIMES);
 #ifdef DEBUG
   static int debug = 100;
   static int debugl = 1000;
@@ -336,6 +783,11 @@ static int timedwalk(void *list, register void *candidate)
   {
     walk(list, 20);
     void *p = LNEXT(c2);
+    // L2 eviction sets span more pages than the TLB holds.  Translating
+    // the candidate's page through another line keeps the TLB miss out
+    // of the L2/L3 difference.
+    if (mm->evictlevel == L2)
+      memaccess((void *)((uintptr_t)p ^ PAGEMATE));
     uint32_t time = memaccesstime(p);
     ts_add(ts, time);
   }
@@ -359,29 +811,48 @@ static int timedwalk(void *list, register void *candidate)
   return rv;
 }
 
-int timeevict(vlist_t es, void *candidate)
+int timeevict(mm_t mm, vlist_t es, void *candidate)
 {
   if (vl_len(es) == 0)
     return 0;
   for (int i = 0; i < vl_len(es); i++)
     LNEXT(vl_get(es, i)) = vl_get(es, (i + 1) % vl_len(es));
-  int timecur = timedwalk(vl_get(es, 0), candidate);
+  int timecur = timedwalk(mm, vl_get(es, 0), candidate);
 
   return timecur;
 }
 
-static int checkevict(vlist_t es, void *candidate)
+#define L2_CONFIRMATIONS 2
+
+static inline int evictthreshold(mm_t mm)
+{
+  return mm->evictlevel == L2 ? mm->l2threshold : L3_THRESHOLD;
+}
+
+// The margin between L2 and L3 hits is narrow, and a single slow walk
+// makes contraction drop lines it needs.  An L2 eviction only counts if
+// further walks of the linked list see it too.
+static int confirmevict(mm_t mm, void *list, void *candidate, int timecur)
+{
+  if (mm->evictlevel != L2)
+    return timecur > evictthreshold(mm);
+  for (int i = 0; i < L2_CONFIRMATIONS && timecur > evictthreshold(mm); i++)
+    timecur = timedwalk(mm, list, candidate);
+  return timecur > evictthreshold(mm);
+}
+
+static int checkevict(mm_t mm, vlist_t es, void *candidate)
 {
-  int timecur = timeevict(es, candidate);
+  int timecur = timeevict(mm, es, candidate);
 
-  return timecur > L3_THRESHOLD;
+  return confirmevict(mm, vl_len(es) ? vl_get(es, 0) : NULL, candidate, timecur);
 }
 
 // Read lines from es\partition[removed_partition_index] to check if
 // partition[removed_partition_index] is part of the eviction set. es is
 // partitioned into nPartitions sublists with remainders added to last
 // sublist.
-static int checkevict_remove_partition(vlist_t es, int removed_partition_index,
+static int checkevict_remove_partition(mm_t mm, vlist_t es, int removed_partition_index,
                                        int subl_len, int nPartitions, void *candidate)
 {
   if (vl_len(es) == 0)
@@ -410,21 +881,22 @@ static int checkevict_remove_partition(vlist_t es, int removed_partition_index,
     next_index = (next_index + 1) % vl_len(es);
   }
   LNEXT(vl_get(es, current_index)) = vl_get(es, (end_removal_ind + 1) % vl_len(es));
-  int timecur = timedwalk(vl_get(es, (end_removal_ind + 1) % vl_len(es)), candidate);
+  void *list = vl_get(es, (end_removal_ind + 1) % vl_len(es));
+  int timecur = timedwalk(mm, list, candidate);
 
-  return timecur > L3_THRESHOLD;
+  return confirmevict(mm, list, candidate, timecur);
 }
 
-static void contract(vlist_t es, vlist_t candidates, void *current);
+static void contract(mm_t mm, vlist_t es, vlist_t candidates, void *current);
 
-static void *expand(vlist_t es, vlist_t candidates)
+static void *expand(mm_t mm, vlist_t es, vlist_t candidates)
 {
   while (vl_len(candidates) > 0)
   {
     void *current = vl_poprand(candidates);
-    int time = timeevict(es, current);
+    int time = timeevict(mm, es, current);
 
-    if (time > L3_THRESHOLD)
+    if (time > evictthreshold(mm))
       return current;
 
     vl_push(es, current);
@@ -432,14 +904,14 @@ static void *expand(vlist_t es, vlist_t candidates)
   return NULL;
 }
 
-static void contract(vlist_t es, vlist_t candidates, void *current)
+static void contract(mm_t mm, vlist_t es, vlist_t candidates, void *current)
 {
   for (int i = 0; i < vl_len(es);)
   {
     void *cand = vl_get(es, i);
     vl_del(es, i);
-    clflush(current);
-    if (checkevict(es, current))
+    flush(mm, current);
+    if (checkevict(mm, es, current))
       vl_push(candidates, cand);
     else
     {
@@ -451,7 +923,7 @@ static void contract(vlist_t es, vlist_t candidates, void *current)
 
 // Finds minimal eviction set by repeatedly partitioning es into (minEvictionSetSize + 1) sublists of
 // equal length (remainder added to last sublist) and removing sublists not part of the eviction set
-static void contract_partition(vlist_t es, vlist_t candidates, int minEvictionSetSize, void *current)
+static void contract_partition(mm_t mm, vlist_t es, vlist_t candidates, int minEvictionSetSize, void *current)
 {
   int nPartitions = minEvictionSetSize + 1;
 
@@ -464,8 +936,8 @@ static void contract_partition(vlist_t es, vlist_t candidates, int minEvictionSe
     // Find which sublists are not part of the eviction set
     for (int i = nPartitions - 1; i >= 0; i--)
     {
-      clflush(current);
-      if (checkevict_remove_partition(es, i, sublist_len, nPartitions, current))
+      flush(mm, current);
+      if (checkevict_remove_partition(mm, es, i, sublist_len, nPartitions, current))
       {
         n_sublist_positives--;
         // Calculate partition length (last partition can have more elements)
@@ -487,19 +959,19 @@ static void contract_partition(vlist_t es, vlist_t candidates, int minEvictionSe
   return;
 }
 
-static void collect(vlist_t es, vlist_t candidates, vlist_t set)
+static void collect(mm_t mm, vlist_t es, vlist_t candidates, vlist_t set)
 {
   for (int i = vl_len(candidates); i--;)
   {
     void *p = vl_del(candidates, i);
-    if (checkevict(es, p))
+    if (checkevict(mm, es, p))
       vl_push(set, p);
     else
       vl_push(candidates, p);
   }
 }
 
-static vlist_t map(mm_t mm, vlist_t lines)
+static vlist_t map(mm_t mm, lxinfo_t info, vlist_t lines)
 {
 #ifdef DEBUG
   printf("%d lines\n", vl_len(lines));
@@ -521,13 +993,13 @@ static vlist_t map(mm_t mm, vlist_t lines)
     int d_l2 = vl_len(lines);
 #endif // DEBUG
     vlist_t leftovers = vl_new();
-    contract_partition(lines, leftovers, mm->l3info.associativity, c);
+    contract_partition(mm, lines, leftovers, info->associativity, c);
     es = lines;
     lines = leftovers;
 #ifdef DEBUG
     int d_l3 = vl_len(es);
 #endif // DEBUG
-    if (vl_len(es) > mm->l3info.associativity || vl_len(es) < mm->l3info.associativity - 3)
+    if (vl_len(es) > info->associativity || vl_len(es) < info->associativity - 3)
     {
       vl_push(lines, c);
       while (vl_len(es))
@@ -541,15 +1013,15 @@ static vlist_t map(mm_t mm, vlist_t lines)
     fail = 0;
     vlist_t set = vl_new();
     vl_push(set, c);
-    collect(es, lines, set);
+    collect(mm, es, lines, set);
     while (vl_len(es))
       vl_push(set, vl_del(es, 0));
 #ifdef DEBUG
     printf("set %3d: lines: %4d contracted: %2d collected: %d\n", vl_len(groups), d_l1, d_l3, vl_len(set));
 #endif // DEBUG
     vl_push(groups, set);
-    if (mm->l3info.progressNotification)
-      (*mm->l3info.progressNotification)(nlines - vl_len(lines), nlines, mm->l3info.progressNotificationData);
+    if (info->progressNotification)
+      (*info->progressNotification)(nlines - vl_len(lines), nlines, info->progressNotificationData);
   }
 
   vl_free(es);
@@ -573,7 +1045,7 @@ static vlist_t quadraticmap(mm_t mm, vlist_t lines)
 #endif // DEBUG
     if (fail > 5)
       break;
-    void *c = expand(es, lines);
+    void *c = expand(mm, es, lines);
 #ifdef DEBUG
     int d_l2 = vl_len(es);
 #endif // DEBUG
@@ -587,9 +1059,9 @@ static vlist_t quadraticmap(mm_t mm, vlist_t lines)
       fail++;
       continue;
     }
-    contract(es, lines, c);
-    contract(es, lines, c);
-    contract(es, lines, c);
+    contract(mm, es, lines, c);
+    contract(mm, es, lines, c);
+    contract(mm, es, lines, c);
 #ifdef DEBUG
     int d_l3 = vl_len(es);
 #endif // DEBUG
@@ -606,7 +1078,7 @@ static vlist_t quadraticmap(mm_t mm, vlist_t lines)
     fail = 0;
     vlist_t set = vl_new();
     vl_push(set, c);
-    collect(es, lines, set);
+    collect(mm, es, lines, set);
     while (vl_len(es))
       vl_push(set, vl_del(es, 0));
 #ifdef DEBUG
@@ -636,12 +1108,12 @@ static int probemap(mm_t mm)
   }
   else if ((mm->l3info.flags & LXFLAG_LINEARMAP) != 0)
   {
-    groups = map(mm, pages);
+    groups = map(mm, &mm->l3info, pages);
   }
   // If quadratic or linear map aren't specified, default to fastest behavior based on small/huge pages
   else if ((mm->l3info.flags & LXFLAG_NOHUGEPAGES) != 0)
   {
-    groups = map(mm, pages);
+    groups = map(mm, &mm->l3info, pages);
   }
   else
   {
@@ -658,6 +1130,100 @@ static int probemap(mm_t mm)
   return 1;
 }
 
+#define L2_CALIBRATIONS 9
+#define L2_MAPATTEMPTS 3
+
+// Midway between the times of L2 and L3 hits, measured the way mapping
+// measures them.  For L2 hits the walk evicts the target from the L1 with
+// a few lines at its page offset and touches every page of buf through
+// another offset.  For L3 hits it walks every page of buf at the target's
+// offset, which covers each colour many times over.
+static int l2calibrate(mm_t mm, char *buf, size_t size)
+{
+  void *target = buf;
+  vlist_t hit = vl_new();
+  vlist_t miss = vl_new();
+  for (int i = 1; i <= mm->l1info.associativity * 2; i++)
+    vl_push(hit, buf + i * mm->pagesize);
+  for (size_t offset = 0; offset < size; offset += mm->pagesize)
+  {
+    vl_push(hit, buf + offset + PAGEMATE);
+    if (offset != 0)
+      vl_push(miss, buf + offset);
+  }
+
+  ts_t l2 = ts_alloc();
+  ts_t l3 = ts_alloc();
+  for (int i = 0; i < L2_CALIBRATIONS; i++)
+  {
+    ts_add(l2, timeevict(mm, hit, target));
+    ts_add(l3, timeevict(mm, miss, target));
+  }
+  int threshold = (ts_median(l2) + ts_median(l3)) / 2;
+#ifdef DEBUG
+  printf("L2 hit %d L3 hit %d threshold %d\n", ts_median(l2), ts_median(l3), threshold);
+#endif // DEBUG
+  ts_free(l2);
+  ts_free(l3);
+  vl_free(hit);
+  vl_free(miss);
+  return threshold;
+}
+
+// Groups the pages of a buffer twice the size of the L2 by colour, using
+// the L3 mapping algorithm on page-aligned lines.  Called with the lock
+// held.
+static int l2map(mm_t mm)
+{
+  // The simulator only models the LLC
+  if (mm->sim)
+    return 0;
+  int ncolours = L2_STRIDE / mm->pagesize;
+  size_t size = 2 * mm->l2info.associativity * L2_STRIDE;
+  char *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (buf == MAP_FAILED)
+    return 0;
+  placebuffer(mm, buf, size);
+  account(mm, size, 0);
+
+  mm->evictlevel = L2;
+  mm->l2threshold = l2calibrate(mm, buf, size);
+  vlist_t groups = NULL;
+  for (int attempt = 0; attempt < L2_MAPATTEMPTS; attempt++)
+  {
+    vlist_t pages = vl_new();
+    for (size_t offset = 0; offset < size; offset += mm->pagesize)
+      vl_push(pages, buf + offset);
+    groups = map(mm, &mm->l2info, pages);
+    vl_free(pages);
+    if (vl_len(groups) == ncolours)
+      break;
+#ifdef DEBUG
+    printf("L2 map found %d of %d colours\n", vl_len(groups), ncolours);
+#endif // DEBUG
+    while (vl_len(groups))
+      vl_free(vl_pop(groups));
+    vl_free(groups);
+    groups = NULL;
+  }
+  mm->evictlevel = L3;
+  if (groups == NULL)
+  {
+    munmap(buf, size);
+    account(mm, 0, size);
+    return 0;
+  }
+
+  mm->l2ngroups = vl_len(groups);
+  mm->l2groups = (vlist_t *)calloc(mm->l2ngroups, sizeof(vlist_t));
+  for (int i = 0; i < mm->l2ngroups; i++)
+    mm->l2groups[i] = vl_get(groups, i);
+  vl_free(groups);
+  mm->l2buffer = buf;
+  mm->l2buffersize = size;
+  return 1;
+}
+
 void _mm_requestlines(mm_t mm, cachelevel_e cachelevel, int line, int count, vlist_t list)
 {
   switch (cachelevel)
@@ -665,11 +1231,7 @@ void _mm_requestlines(mm_t mm, cachelevel_e cachelevel, int line, int count, vli
   case L1:
     return mm_l1l2findlines(mm, cachelevel, line, count, list);
   case L2:
-    if (mm->pagetype == PAGETYPE_HUGE)
-      return mm_l1l2findlines(mm, cachelevel, line, count, list);
-    else
-      perror("Operation not supported yet!\n");
-    exit(-2);
+    return mm_l1l2findlines(mm, cachelevel, line, count, list);
   case L3:
     return mm_l3findlines(mm, line, count, list);
   }
@@ -679,7 +1241,7 @@ void *mm_requestline(mm_t mm, cachelevel_e cachelevel, int line)
 {
   vlist_t vl = vl_new();
   _mm_requestlines(mm, cachelevel, line, 1, vl);
-  void *mem = vl_get(vl, 0);
+  void *mem = vl_len(vl) ? vl_get(vl, 0) : NULL;
   vl_free(vl);
   return mem;
 }
@@ -688,9 +1250,10 @@ void mm_requestlines(mm_t mm, cachelevel_e cachelevel, int line, void **lines, i
 {
   vlist_t vl = vl_new();
   _mm_requestlines(mm, cachelevel, line, count, vl);
+  // Lines the mm could not provide are NULL
   for (int i = 0; i < count; i++)
   {
-    lines[i] = vl_get(vl, i);
+    lines[i] = i < vl_len(vl) ? vl_get(vl, i) : NULL;
   }
   vl_free(vl);
   return;
@@ -698,7 +1261,31 @@ void mm_requestlines(mm_t mm, cachelevel_e cachelevel, int line, void **lines, i
 
 void mm_returnline(mm_t mm, void *line)
 {
-  UNSET_ALLOCATED_FLAG(line);
+  int n = __atomic_load_n(&mm->nregions, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < n; i++)
+  {
+    struct mmregion *r = &mm->regions[i];
+    uintptr_t offset = (char *)line - r->base;
+    if (offset < r->size)
+    {
+      uintptr_t l = offset / LX_CACHELINE;
+      __atomic_fetch_and(&r->allocated[l / 64], ~(1ull << (l % 64)), __ATOMIC_ACQ_REL);
+      return;
+    }
+  }
+}
+
+int mm_claimline(mm_t mm, void *line)
+{
+  int n = __atomic_load_n(&mm->nregions, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < n; i++)
+  {
+    struct mmregion *r = &mm->regions[i];
+    uintptr_t offset = (char *)line - r->base;
+    if (offset < r->size)
+      return claimline(r, offset);
+  }
+  return 0;
 }
 
 void _mm_returnlines(mm_t mm, vlist_t lines)
@@ -714,4 +1301,21 @@ void mm_returnlines(mm_t mm, void **lines, int count)
   {
     mm_returnline(mm, lines[i]);
   }
-}
\ No newline at end of file
+}
+
+size_t mm_footprint(mm_t mm, size_t *highwater)
+{
+  pthread_mutex_lock(&mm->lock);
+  size_t footprint = mm->footprint;
+  if (highwater)
+    *highwater = mm->highwater;
+  pthread_mutex_unlock(&mm->lock);
+  return footprint;
+}
+
+void mm_setlimit(mm_t mm, size_t limit)
+{
+  pthread_mutex_lock(&mm->lock);
+  mm->limit = limit;
+  pthread_mutex_unlock(&mm->lock);
+}
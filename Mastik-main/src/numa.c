@@ -0,0 +1,144 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <mastik/numa.h>
+#include <mastik/topology.h>
+
+// From linux/mempolicy.h
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_BIND 2
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+
+static int fillplacement(topology_t tp, int cpu, numaplacement_t placement) {
+  struct tpcpu c;
+  struct tpllc llc;
+  if (!tp_getcpu(tp, cpu, &c) || !tp_getllc(tp, c.llc, &llc))
+    return 0;
+  placement->cpu = cpu;
+  placement->socket = c.socket;
+  placement->llc = llc.id;
+  placement->ncpus = llc.ncpus;
+  memcpy(placement->cpus, llc.cpus, sizeof(placement->cpus));
+  placement->nodes = llc.nodes;
+  return 1;
+}
+
+int numa_llcplacement(int cpu, numaplacement_t p) {
+  bzero(p, sizeof(struct numaplacement));
+#ifdef __linux__
+  if (cpu < 0)
+    cpu = sched_getcpu();
+#endif
+  topology_t tp = tp_discover();
+  if (tp == NULL)
+    return 0;
+  int rv = fillplacement(tp, cpu, p);
+  tp_release(tp);
+  return rv;
+}
+
+int numa_socketplacement(int socket, numaplacement_t p) {
+  bzero(p, sizeof(struct numaplacement));
+  topology_t tp = tp_discover();
+  if (tp == NULL)
+    return 0;
+  int rv = 0;
+  struct tpcpu c;
+  for (int cpu = 0; cpu < tp_ncpus(tp) && !rv; cpu++)
+    if (tp_getcpu(tp, cpu, &c) && c.socket == socket)
+      rv = fillplacement(tp, cpu, p);
+  tp_release(tp);
+  return rv;
+}
+
+int numa_pin(numaplacement_t placement) {
+#ifdef HAVE_SCHED_SETAFFINITY
+  cpu_set_t cs;
+  CPU_ZERO(&cs);
+  for (int c = 0; c < NUMA_MAXCPUS && c < CPU_SETSIZE; c++)
+    if (placement->cpus[c / 64] & (1ULL << (c % 64)))
+      CPU_SET(c, &cs);
+  if (sched_setaffinity(0, sizeof(cs), &cs) < 0)
+    return 0;
+#ifdef SYS_set_mempolicy
+  if (placement->nodes) {
+    uint64_t first = placement->nodes & -placement->nodes;
+    syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, &first, NUMA_MAXNODES + 1);
+  }
+#endif
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+int numa_bind(void *buf, size_t size, uint64_t nodes) {
+  if (nodes == 0)
+    return 1;
+#ifdef SYS_mbind
+  return syscall(SYS_mbind, buf, size, NUMA_MPOL_BIND, &nodes, NUMA_MAXNODES + 1, NUMA_MPOL_MF_MOVE) == 0;
+#else
+  return 0;
+#endif
+}
+
+// The mapping of buf is the one with the highest start at or below it
+long numa_offnode(void *buf, uint64_t nodes) {
+  if (nodes == 0)
+    return -1;
+  FILE *f = fopen("/proc/self/numa_maps", "r");
+  if (f == NULL)
+    return -1;
+  uintptr_t target = (uintptr_t)buf;
+  uintptr_t beststart = 0;
+  long rv = -1;
+  char *line = NULL;
+  size_t len = 0;
+  while (getline(&line, &len, f) > 0) {
+    uintptr_t start;
+    if (sscanf(line, "%lx", &start) != 1 || start > target || start < beststart)
+      continue;
+    beststart = start;
+    rv = 0;
+    for (char *p = strstr(line, " N"); p != NULL; p = strstr(p + 1, " N")) {
+      int node;
+      long pages;
+      if (sscanf(p, " N%d=%ld", &node, &pages) == 2 && (node >= NUMA_MAXNODES || !(nodes & (1ULL << node))))
+	rv += pages;
+    }
+  }
+  free(line);
+  fclose(f);
+  return rv;
+}
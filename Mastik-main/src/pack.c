@@ -0,0 +1,129 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+
+#include <mastik/low.h>
+#include <mastik/pack.h>
+#include <mastik/taint.h>
+
+// PK_BITMAP records start with the unknown bit
+#define BITMAPSKIP(bits) ((bits) == PK_BITMAP)
+
+int pk_valid(int bits) {
+  return bits == PK_BITMAP || bits == PK_NIBBLE || bits == PK_COUNT5;
+}
+
+int pk_maxcount(int bits) {
+  return bits == PK_BITMAP ? 1 : (1 << bits) - 2;
+}
+
+size_t pk_recordsize(int width, int bits) {
+  return ((size_t)width * bits + BITMAPSKIP(bits) + 63) / 64 * sizeof(uint64_t);
+}
+
+void pk_pack(const uint16_t *row, int width, int bits, uint16_t threshold, void *record) {
+  uint64_t *w = (uint64_t *)record;
+  memset(w, 0, pk_recordsize(width, bits));
+  uint64_t unknown = (1U << bits) - 1;
+  for (int i = 0; i < width; i++) {
+    uint64_t v = row[i];
+    if (v >= TAINT_FLAGGED) {
+      if (bits == PK_BITMAP) {
+	memset(w, 0, pk_recordsize(width, bits));
+	w[0] = 1;
+	return;
+      }
+      v = unknown;
+    } else if (bits == PK_BITMAP)
+      v = v > threshold;
+    else if (v > unknown - 1)
+      v = unknown - 1;
+    size_t bit = (size_t)i * bits + BITMAPSKIP(bits);
+    w[bit / 64] |= v << (bit % 64);
+    if (bit % 64 + bits > 64)
+      w[bit / 64 + 1] |= v >> (64 - bit % 64);
+  }
+}
+
+void pk_unpack(const void *records, int nrecords, int width, int bits, uint16_t *rows) {
+  size_t size = pk_recordsize(width, bits);
+  const char *r = records;
+  for (int n = 0; n < nrecords; n++, r += size, rows += width)
+    for (int i = 0; i < width; i++)
+      rows[i] = pk_get(r, i, bits);
+}
+
+static inline __attribute__((always_inline)) int countwords(const uint64_t *w, int nwords) {
+  int rv = 0;
+  for (int i = 0; i < nwords; i++)
+    rv += __builtin_popcountll(w[i]);
+  return rv;
+}
+
+// The library is not built with -mpopcnt, where __builtin_popcountll is a
+// libgcc call, so this copy is compiled for POPCNT and chosen by CPUID
+__attribute__((target("popcnt")))
+static int countwords_popcnt(const uint64_t *w, int nwords) {
+  return countwords(w, nwords);
+}
+
+static int haspopcnt(void) {
+  static int has = -1;
+  if (has < 0) {
+    union cpuid c;
+    memset(&c, 0, sizeof(c));
+    c.regs.eax = 1;
+    cpuid(&c);
+    has = (c.regs.ecx >> 23) & 1;
+  }
+  return has;
+}
+
+int pk_popcount(const void *record, int width) {
+  const uint64_t *w = record;
+  if (w[0] & 1)
+    return -1;
+  int nwords = (width + 1 + 63) / 64;
+  if (haspopcnt())
+    return countwords_popcnt(w, nwords);
+  return countwords(w, nwords);
+}
+
+// Misses are sparse in most captures, so only the set bits are visited
+int pk_columncounts(const void *records, int nrecords, int width, uint32_t *counts) {
+  int nwords = (width + 1 + 63) / 64;
+  const uint64_t *w = records;
+  int counted = 0;
+  for (int n = 0; n < nrecords; n++, w += nwords) {
+    if (w[0] & 1)
+      continue;
+    counted++;
+    for (int i = 0; i < nwords; i++) {
+      uint64_t v = w[i];
+      while (v) {
+	counts[i * 64 + __builtin_ctzll(v) - 1]++;
+	v &= v - 1;
+      }
+    }
+  }
+  return counted;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <mastik/low.h>
+#include <mastik/pmu.h>
+
+// L2_RQSTS.MISS: event 0x24, umask 0x3f
+#define INTEL_L2_MISS 0x3f24
+
+struct pmu {
+  int fd[PMU_NEVENTS];
+  void *page[PMU_NEVENTS];
+  int userread;
+};
+
+static const char *eventnames[PMU_NEVENTS] = {
+  "cycles", "llc_misses", "l1d_misses", "l2_misses", "dtlb_misses",
+  "context_switches"
+};
+
+const char *pmu_eventname(pmuevent_e event) {
+  if (event < 0 || event >= PMU_NEVENTS)
+    return "unknown";
+  return eventnames[event];
+}
+
+#ifdef __linux__
+
+// Models on which INTEL_L2_MISS is L2_RQSTS.MISS: Haswell to Rocket Lake
+// and the server parts of that span, Sapphire and Emerald Rapids.  The
+// hybrid parts are left out, as their Atom cores encode it differently.
+static const uint8_t l2missmodels[] = {
+  0x3c, 0x3f, 0x45, 0x46,		// Haswell
+  0x3d, 0x47, 0x4f, 0x56,		// Broadwell
+  0x4e, 0x5e, 0x55,			// Skylake
+  0x8e, 0x9e, 0xa5, 0xa6,		// Kaby, Coffee and Comet Lake
+  0x6a, 0x6c, 0x7d, 0x7e, 0xa7,		// Ice and Rocket Lake
+  0x8c, 0x8d,				// Tiger Lake
+  0x8f, 0xcf				// Sapphire and Emerald Rapids
+};
+
+static int hasintell2miss() {
+  union cpuid c;
+  bzero(&c, sizeof(c));
+  cpuid(&c);
+  // "GenuineIntel" in ebx, edx, ecx
+  if (c.regs.ebx != 0x756e6547 || c.regs.edx != 0x49656e69 || c.regs.ecx != 0x6c65746e)
+    return 0;
+  bzero(&c, sizeof(c));
+  c.regs.eax = 1;
+  cpuid(&c);
+  uint32_t family = (c.regs.eax >> 8) & 0xf;
+  uint32_t model = ((c.regs.eax >> 4) & 0xf) | ((c.regs.eax >> 12) & 0xf0);
+  if (family != 6)
+    return 0;
+  for (int i = 0; i < (int)sizeof(l2missmodels); i++)
+    if (l2missmodels[i] == model)
+      return 1;
+  return 0;
+}
+
+static int openevent(uint32_t type, uint64_t config, int kernel) {
+  struct perf_event_attr attr;
+  bzero(&attr, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = !kernel;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+pmu_t pmu_open(void) {
+  pmu_t pmu = (pmu_t)calloc(1, sizeof(struct pmu));
+  uint64_t llc = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  uint64_t l1d = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  uint64_t dtlb = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  pmu->fd[PMU_CYCLES] = openevent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0);
+  pmu->fd[PMU_LLC_MISSES] = openevent(PERF_TYPE_HW_CACHE, llc, 0);
+  pmu->fd[PMU_L1D_MISSES] = openevent(PERF_TYPE_HW_CACHE, l1d, 0);
+  pmu->fd[PMU_L2_MISSES] = hasintell2miss() ? openevent(PERF_TYPE_RAW, INTEL_L2_MISS, 0) : -1;
+  pmu->fd[PMU_DTLB_MISSES] = openevent(PERF_TYPE_HW_CACHE, dtlb, 0);
+  pmu->fd[PMU_CONTEXT_SWITCHES] = openevent(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 1);
+
+  int opened = 0;
+  pmu->userread = 1;
+  for (int e = 0; e < PMU_NEVENTS; e++) {
+    if (pmu->fd[e] < 0)
+      continue;
+    opened++;
+    // Software events have no PMC to read from user space
+    if (e == PMU_CONTEXT_SWITCHES)
+      continue;
+    void *page = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, pmu->fd[e], 0);
+    if (page == MAP_FAILED) {
+      pmu->userread = 0;
+      continue;
+    }
+    pmu->page[e] = page;
+    if (!((struct perf_event_mmap_page *)page)->cap_user_rdpmc)
+      pmu->userread = 0;
+  }
+  if (opened == 0) {
+    free(pmu);
+    return NULL;
+  }
+  return pmu;
+}
+
+void pmu_close(pmu_t pmu) {
+  if (pmu == NULL)
+    return;
+  for (int e = 0; e < PMU_NEVENTS; e++) {
+    if (pmu->page[e])
+      munmap(pmu->page[e], PAGE_SIZE);
+    if (pmu->fd[e] >= 0)
+      close(pmu->fd[e]);
+  }
+  free(pmu);
+}
+
+static inline uint64_t rdpmc(uint32_t counter) {
+  uint32_t low, high;
+  asm volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+  return (((uint64_t)high) << 32) | low;
+}
+
+// The user-space read protocol of perf_event_mmap_page.  Returns 0 if the
+// counter is not on a PMC right now.
+static int mmapread(struct perf_event_mmap_page *pc, uint64_t *value) {
+  uint32_t seq;
+  int ok;
+  do {
+    seq = pc->lock;
+    asm volatile("" ::: "memory");
+    uint32_t index = pc->index;
+    ok = pc->cap_user_rdpmc && index != 0;
+    if (ok) {
+      int64_t pmc = rdpmc(index - 1);
+      pmc <<= 64 - pc->pmc_width;
+      pmc >>= 64 - pc->pmc_width;
+      *value = pc->offset + pmc;
+    }
+    asm volatile("" ::: "memory");
+  } while (pc->lock != seq);
+  return ok;
+}
+
+uint64_t pmu_read(pmu_t pmu, pmuevent_e event) {
+  if (!pmu_available(pmu, event))
+    return 0;
+  uint64_t value;
+  if (pmu->page[event] && mmapread(pmu->page[event], &value))
+    return value;
+  if (read(pmu->fd[event], &value, sizeof(value)) != sizeof(value))
+    return 0;
+  return value;
+}
+
+#else // __linux__
+
+pmu_t pmu_open(void) {
+  return NULL;
+}
+
+void pmu_close(pmu_t pmu) {
+}
+
+uint64_t pmu_read(pmu_t pmu, pmuevent_e event) {
+  return 0;
+}
+
+#endif // __linux__
+
+int pmu_available(pmu_t pmu, pmuevent_e event) {
+  if (pmu == NULL || event < 0 || event >= PMU_NEVENTS)
+    return 0;
+  return pmu->fd[event] >= 0;
+}
+
+int pmu_userread(pmu_t pmu) {
+  return pmu != NULL && pmu->userread;
+}
@@ -0,0 +1,590 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <mastik/low.h>
+#include <mastik/sim.h>
+#include <mastik/prime.h>
+#include <mastik/policy.h>
+
+#define MAXWAYS 64
+#define QLRU_MAXAGE 3
+
+// Below this many repeated measurements agreeing, per thousand, a policy
+// that no deterministic model explains is taken to be random
+#define STABLE 950
+
+// Passes of the thrash test, the last one timed
+#define THRASH_PASSES 3
+// Passes over every set to move the dueling counter
+#define PUSH_PASSES 8
+// Reuse push: groups of REUSE_GROUP new lines accessed REUSE_TIMES times
+#define REUSE_GROUP 2
+#define REUSE_TIMES 3
+
+// Rounds of hits and misses after the fill of a sequence
+#define SEQ_ROUNDS 2
+
+#define PRIME_TRIALS 1000
+#define PRIME_MAXTOUCHES 3
+#define PRIME_MAXREPEATS 4
+
+static const char *names[POLICY_NTYPES] = {
+  "unknown", "lru", "fifo", "tree-plru", "bit-plru", "qlru-m1", "qlru-m2", "qlru-m3", "random"
+};
+
+static uint64_t rnd(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dUL;
+}
+
+static uint64_t seedstate(uint32_t seed) {
+  uint64_t s = seed * 0x9e3779b97f4a7c15UL;
+  return s ? s : 1;
+}
+
+const char *pl_name(policy_e policy) {
+  if (policy < 0 || policy >= POLICY_NTYPES)
+    return names[POLICY_UNKNOWN];
+  return names[policy];
+}
+
+policy_e pl_parse(const char *name) {
+  for (int i = 0; i < POLICY_NTYPES; i++)
+    if (strcmp(name, names[i]) == 0)
+      return i;
+  return POLICY_UNKNOWN;
+}
+
+
+/*
+ * Models of one cache set.  Lines are small integers, 0 marks an invalid
+ * way and invalid ways fill from the left.
+ */
+struct model {
+  policy_e policy;
+  int assoc;
+  int levels;		// Of the PLRU tree
+  int line[MAXWAYS];
+  uint64_t state[MAXWAYS];	// LRU and FIFO stamps or QLRU ages
+  uint64_t bits;		// PLRU tree or MRU bits
+  uint64_t clock;
+  uint64_t rng;
+};
+
+// Returns 0 if the model does not apply to the associativity
+static int model_init(struct model *m, policy_e policy, int assoc, uint32_t seed) {
+  bzero(m, sizeof(struct model));
+  m->policy = policy;
+  m->assoc = assoc;
+  m->rng = seedstate(seed);
+  if (assoc < 1 || assoc > MAXWAYS)
+    return 0;
+  if (policy == POLICY_TREEPLRU) {
+    if (assoc & (assoc - 1))
+      return 0;
+    while ((1 << m->levels) < assoc)
+      m->levels++;
+  }
+  return policy != POLICY_UNKNOWN;
+}
+
+static void model_reset(struct model *m) {
+  bzero(m->line, sizeof(m->line));
+  bzero(m->state, sizeof(m->state));
+  m->bits = 0;
+  m->clock = 0;
+}
+
+static int model_insertage(struct model *m) {
+  switch (m->policy) {
+  case POLICY_QLRU_M1: return 1;
+  case POLICY_QLRU_M2: return 2;
+  default: return 3;
+  }
+}
+
+static void model_touch(struct model *m, int way, int miss) {
+  switch (m->policy) {
+  case POLICY_LRU:
+    m->state[way] = ++m->clock;
+    break;
+  case POLICY_FIFO:
+    if (miss)
+      m->state[way] = ++m->clock;
+    break;
+  case POLICY_TREEPLRU: {
+    // Each node on the path points away from the way
+    int node = 1;
+    for (int l = m->levels - 1; l >= 0; l--) {
+      int d = (way >> l) & 1;
+      if (d)
+	m->bits &= ~(1UL << node);
+      else
+	m->bits |= 1UL << node;
+      node = node * 2 + d;
+    }
+    break;
+  }
+  case POLICY_BITPLRU: {
+    uint64_t all = m->assoc == 64 ? ~0UL : (1UL << m->assoc) - 1;
+    m->bits |= 1UL << way;
+    if (m->bits == all)
+      m->bits = 1UL << way;
+    break;
+  }
+  case POLICY_QLRU_M1:
+  case POLICY_QLRU_M2:
+  case POLICY_QLRU_M3:
+    m->state[way] = miss ? model_insertage(m) : 0;
+    break;
+  default:
+    break;
+  }
+}
+
+static int model_victim(struct model *m) {
+  for (int i = 0; i < m->assoc; i++)
+    if (m->line[i] == 0)
+      return i;
+  switch (m->policy) {
+  case POLICY_LRU:
+  case POLICY_FIFO: {
+    int rv = 0;
+    for (int i = 1; i < m->assoc; i++)
+      if (m->state[i] < m->state[rv])
+	rv = i;
+    return rv;
+  }
+  case POLICY_TREEPLRU: {
+    int node = 1, way = 0;
+    for (int l = 0; l < m->levels; l++) {
+      int d = (m->bits >> node) & 1;
+      way = way * 2 + d;
+      node = node * 2 + d;
+    }
+    return way;
+  }
+  case POLICY_BITPLRU:
+    for (int i = 0; i < m->assoc; i++)
+      if (!(m->bits & (1UL << i)))
+	return i;
+    return 0;
+  case POLICY_QLRU_M1:
+  case POLICY_QLRU_M2:
+  case POLICY_QLRU_M3: {
+    int oldest = 0;
+    for (int i = 1; i < m->assoc; i++)
+      if (m->state[i] > m->state[oldest])
+	oldest = i;
+    uint64_t raise = QLRU_MAXAGE - m->state[oldest];
+    for (int i = 0; i < m->assoc; i++)
+      m->state[i] += raise;
+    return oldest;
+  }
+  default:
+    return rnd(&m->rng) % m->assoc;
+  }
+}
+
+// Returns 1 on a hit
+static int model_access(struct model *m, int line) {
+  for (int i = 0; i < m->assoc; i++) {
+    if (m->line[i] == line + 1) {
+      model_touch(m, i, 0);
+      return 1;
+    }
+  }
+  int way = model_victim(m);
+  m->line[way] = line + 1;
+  model_touch(m, way, 1);
+  return 0;
+}
+
+static int model_present(struct model *m, int line) {
+  for (int i = 0; i < m->assoc; i++)
+    if (m->line[i] == line + 1)
+      return 1;
+  return 0;
+}
+
+
+/*
+ * Experiments on the lines, on the hardware or on the simulator
+ */
+struct target {
+  void **lines;
+  int nlines;
+  struct policyinfo info;
+};
+
+static void fillinfo(struct policyinfo *dst, policyinfo_t info) {
+  bzero(dst, sizeof(struct policyinfo));
+  if (info != NULL)
+    bcopy(info, dst, sizeof(struct policyinfo));
+  if (dst->sequences <= 0)
+    dst->sequences = POLICY_DEFAULT_SEQUENCES;
+  if (dst->repeats <= 0)
+    dst->repeats = POLICY_DEFAULT_REPEATS;
+  if (dst->threshold <= 0)
+    dst->threshold = L3_THRESHOLD;
+  if (dst->seed == 0)
+    dst->seed = POLICY_DEFAULT_SEED;
+}
+
+// Flushes the first n lines
+static void flushlines(struct target *t, int n) {
+  for (int i = 0; i < n; i++) {
+    if (t->info.sim)
+      sim_flush(t->info.sim, t->lines[i]);
+    else
+      clflush(t->lines[i]);
+  }
+  if (!t->info.sim)
+    mfence();
+}
+
+// Returns 1 if the access was a hit
+static int lineaccess(struct target *t, int line) {
+  void *p = t->lines[line];
+  uint32_t time;
+  if (t->info.sim) {
+    time = sim_access(t->info.sim, p);
+  } else {
+    time = memaccesstime(p);
+    for (int i = 0; i < t->info.nscrub; i++)
+      memaccess(t->info.scrub[i]);
+  }
+  return time < (uint32_t)t->info.threshold;
+}
+
+
+/*
+ * Policy inference
+ */
+struct sequence {
+  int pool[MAXWAYS * 2];
+  int npool;
+  int *accesses;
+  int naccesses;
+  int probe;
+};
+
+// Fills the set with associativity lines of the pool, then makes rounds
+// of hits on lines already seen followed by accesses anywhere in the
+// pool, which are mostly misses.  Which lines survive the misses depends
+// on how the policy ranks lines by insertion and by hits.
+static void makesequence(struct sequence *s, int nlines, int assoc, uint64_t *rng) {
+  int all[nlines];
+  for (int i = 0; i < nlines; i++)
+    all[i] = i;
+  s->npool = assoc + assoc / 2 + 1;
+  if (s->npool > nlines)
+    s->npool = nlines;
+  for (int i = 0; i < s->npool; i++) {
+    int j = i + rnd(rng) % (nlines - i);
+    int tmp = all[i];
+    all[i] = all[j];
+    all[j] = tmp;
+    s->pool[i] = all[i];
+  }
+  s->naccesses = 0;
+  for (int i = 0; i < assoc; i++)
+    s->accesses[s->naccesses++] = s->pool[i];
+  int seen = assoc;
+  for (int round = 0; round < SEQ_ROUNDS; round++) {
+    int hits = rnd(rng) % assoc;
+    int misses = 1 + rnd(rng) % (assoc / 2 + 1);
+    for (int i = 0; i < hits; i++)
+      s->accesses[s->naccesses++] = s->pool[rnd(rng) % seen];
+    for (int i = 0; i < misses; i++) {
+      int p = rnd(rng) % s->npool;
+      s->accesses[s->naccesses++] = s->pool[p];
+      if (p >= seen)
+	seen = p + 1;
+    }
+  }
+  s->probe = s->pool[rnd(rng) % s->npool];
+}
+
+static int measure(struct target *t, struct sequence *s) {
+  flushlines(t, t->nlines);
+  for (int i = 0; i < s->naccesses; i++)
+    lineaccess(t, s->accesses[i]);
+  return lineaccess(t, s->probe);
+}
+
+static int predict(struct model *m, struct sequence *s) {
+  model_reset(m);
+  for (int i = 0; i < s->naccesses; i++)
+    model_access(m, s->accesses[i]);
+  return model_present(m, s->probe);
+}
+
+policy_e pl_infer(void **lines, int nlines, policyinfo_t info, policyresult_t result) {
+  struct policyresult res;
+  bzero(&res, sizeof(res));
+  struct target t;
+  t.lines = lines;
+  t.nlines = nlines;
+  fillinfo(&t.info, info);
+  int assoc = t.info.associativity;
+  if (assoc <= 0 || assoc > MAXWAYS || nlines <= assoc) {
+    if (result)
+      *result = res;
+    return POLICY_UNKNOWN;
+  }
+
+  struct model models[POLICY_NTYPES];
+  int valid[POLICY_NTYPES];
+  for (int p = 0; p < POLICY_NTYPES; p++)
+    valid[p] = model_init(&models[p], p, assoc, t.info.seed);
+
+  uint64_t rng = seedstate(t.info.seed);
+  struct sequence s;
+  s.accesses = malloc((assoc + SEQ_ROUNDS * (assoc * 2 + 2)) * sizeof(int));
+  int stable = 0;
+  for (int q = 0; q < t.info.sequences; q++) {
+    makesequence(&s, nlines, assoc, &rng);
+    int hits = 0;
+    for (int r = 0; r < t.info.repeats; r++)
+      hits += measure(&t, &s);
+    int outcome = hits * 2 > t.info.repeats;
+    stable += outcome ? hits : t.info.repeats - hits;
+    for (int p = 0; p < POLICY_NTYPES; p++)
+      if (valid[p] && predict(&models[p], &s) == outcome)
+	res.scores[p]++;
+  }
+  free(s.accesses);
+
+  for (int p = 0; p < POLICY_NTYPES; p++)
+    res.scores[p] = res.scores[p] * 1000 / t.info.sequences;
+  res.stability = stable * 1000 / (t.info.sequences * t.info.repeats);
+
+  // Ties go to the simpler policy, earlier in the list
+  res.policy = POLICY_UNKNOWN;
+  for (int p = POLICY_LRU; p < POLICY_RANDOM; p++)
+    if (valid[p] && (res.policy == POLICY_UNKNOWN || res.scores[p] > res.scores[res.policy]))
+      res.policy = p;
+  if (res.scores[res.policy] < STABLE && res.stability < STABLE)
+    res.policy = POLICY_RANDOM;
+  res.agreement = res.scores[res.policy];
+  if (result)
+    *result = res;
+  return res.policy;
+}
+
+
+/*
+ * Set dueling
+ */
+
+// Hits in the last of THRASH_PASSES cyclic passes over associativity + 1
+// lines.  Insertion near the LRU end keeps most of the lines.
+static int thrashhits(struct target *t, int assoc) {
+  flushlines(t, t->nlines);
+  int hits = 0;
+  for (int pass = 0; pass < THRASH_PASSES; pass++)
+    for (int i = 0; i <= assoc; i++)
+      if (lineaccess(t, i) && pass == THRASH_PASSES - 1)
+	hits++;
+  return hits;
+}
+
+static int resistant(struct target *t, int assoc) {
+  return thrashhits(t, assoc) * 4 > assoc + 1;
+}
+
+// Cyclic access misses on every access with insertion near the MRU end,
+// so leaders with that insertion move the counter away from it
+static void pushthrash(struct target *sets, int nsets, int assoc) {
+  for (int pass = 0; pass < PUSH_PASSES; pass++)
+    for (int s = 0; s < nsets; s++)
+      for (int i = 0; i <= assoc; i++)
+	lineaccess(&sets[s], i);
+}
+
+// Lines reused soon after a miss are lost with insertion near the LRU
+// end.  Only the sets in mask are pushed.
+static void pushreuse(struct target *sets, int nsets, int nlines, int *mask) {
+  for (int pass = 0; pass < PUSH_PASSES; pass++) {
+    for (int s = 0; s < nsets; s++) {
+      if (!mask[s])
+	continue;
+      for (int g = 0; g < nlines; g += REUSE_GROUP)
+	for (int r = 0; r < REUSE_TIMES; r++)
+	  for (int i = 0; i < REUSE_GROUP; i++)
+	    lineaccess(&sets[s], (g + i) % nlines);
+    }
+  }
+}
+
+int pl_findleaders(void **lines, int nsets, int nlines, policyinfo_t info, int *roles) {
+  struct policyinfo pi;
+  fillinfo(&pi, info);
+  int assoc = pi.associativity;
+  if (nsets <= 0 || assoc <= 0 || assoc > MAXWAYS || nlines < assoc * 2)
+    return -1;
+
+  struct target *sets = malloc(nsets * sizeof(struct target));
+  for (int s = 0; s < nsets; s++) {
+    sets[s].lines = lines + (size_t)s * nlines;
+    sets[s].nlines = nlines;
+    sets[s].info = pi;
+  }
+
+  // Thrashing leaves the followers resisting thrashing, so the sets that
+  // still thrash lead.  The reuse push then goes through the other
+  // leaders only, and the followers stop resisting.  Testing them does
+  // not undo the push, since only leaders move the counter and the
+  // resisting leaders miss little in the test.
+  int *thrashed = malloc(nsets * sizeof(int));
+  pushthrash(sets, nsets, assoc);
+  for (int s = 0; s < nsets; s++)
+    thrashed[s] = resistant(&sets[s], assoc);
+  pushreuse(sets, nsets, nlines, thrashed);
+  int changed = 0;
+  for (int s = 0; s < nsets; s++) {
+    if (!thrashed[s]) {
+      roles[s] = PL_LEADER_THRASHING;
+    } else if (!resistant(&sets[s], assoc)) {
+      roles[s] = PL_FOLLOWER;
+      changed++;
+    } else {
+      roles[s] = PL_LEADER_RESISTANT;
+    }
+  }
+  free(thrashed);
+  free(sets);
+
+  // Followers are the bulk of the sets.  A few changes are noise.
+  if (changed * 2 <= nsets) {
+    for (int s = 0; s < nsets; s++)
+      roles[s] = PL_FOLLOWER;
+    return -1;
+  }
+  return nsets - changed;
+}
+
+
+/*
+ * Prime patterns
+ */
+
+// Line order of one pass of a primer over nlines lines, as pr_prepare
+// lays them out
+static int primeorder(int *order, int nlines, int chains) {
+  if (chains == 0)
+    chains = PRIME_DEFAULT_CHAINS;
+  if (chains > PRIME_MAXCHAINS)
+    chains = PRIME_MAXCHAINS;
+  // Unordered primers take the lines as given
+  if (chains < 0)
+    chains = 1;
+  if (chains > nlines)
+    chains = nlines;
+  int steps = (nlines + chains - 1) / chains;
+  int n = 0;
+  for (int s = 0; s < steps; s++) {
+    for (int c = 0; c < chains; c++) {
+      int start = c * nlines / chains;
+      int len = (c + 1) * nlines / chains - start;
+      order[n++] = start + (s < len ? s : len - 1);
+    }
+  }
+  return n;
+}
+
+// Per thousand of random starting states after which the primed lines,
+// 0 to assoc - 1, fill the set
+static int primetrials(struct model *m, int *order, int norder, int repeats, int touches,
+    		       primedir_e direction) {
+  int assoc = m->assoc;
+  int foreign = assoc * 2;
+  uint64_t rng = seedstate(assoc);
+  int filled = 0;
+  for (int trial = 0; trial < PRIME_TRIALS; trial++) {
+    model_reset(m);
+    int prev = assoc;
+    for (int i = 0; i < assoc * 4; i++) {
+      int line;
+      switch (rnd(&rng) % 4) {
+      case 0: line = rnd(&rng) % assoc; break;
+      case 1: line = prev; break;
+      default: line = assoc + rnd(&rng) % foreign; break;
+      }
+      model_access(m, line);
+      prev = line;
+    }
+    for (int r = 0; r < repeats; r++) {
+      int backward = direction == PRIMEDIR_ZIGZAG && (r & 1);
+      for (int i = 0; i < norder; i++)
+	for (int k = 0; k < touches; k++)
+	  model_access(m, order[backward ? norder - 1 - i : i]);
+    }
+    int ok = 1;
+    for (int i = 0; i < assoc && ok; i++)
+      ok = model_present(m, i);
+    filled += ok;
+  }
+  return filled * 1000 / PRIME_TRIALS;
+}
+
+int pl_primepattern(policy_e policy, int associativity, int target, primeinfo_t prime) {
+  struct model m;
+  if (!model_init(&m, policy, associativity, POLICY_DEFAULT_SEED))
+    return 0;
+  int *order = malloc((associativity + PRIME_MAXCHAINS) * sizeof(int));
+  int norder = primeorder(order, associativity, prime->chains);
+
+  // Cheapest first: accesses per line are repeats * touches
+  int best = -1;
+  struct primeinfo bestinfo = *prime;
+  for (int cost = 1; cost <= PRIME_MAXTOUCHES * PRIME_MAXREPEATS; cost++) {
+    for (int touches = 1; touches <= PRIME_MAXTOUCHES; touches++) {
+      int repeats = cost / touches;
+      if (cost % touches || repeats > PRIME_MAXREPEATS)
+	continue;
+      for (int dir = PRIMEDIR_FORWARD; dir <= PRIMEDIR_ZIGZAG; dir++) {
+	if (dir == PRIMEDIR_ZIGZAG && repeats == 1)
+	  continue;
+	int rel = primetrials(&m, order, norder, repeats, touches, dir);
+	if (rel > best) {
+	  best = rel;
+	  bestinfo.repeats = repeats;
+	  bestinfo.touches = touches;
+	  bestinfo.direction = dir;
+	}
+	if (rel >= target)
+	  goto done;
+      }
+    }
+  }
+done:
+  free(order);
+  *prime = bestinfo;
+  return best;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <mastik/low.h>
+#include <mastik/sim.h>
+#include <mastik/prime.h>
+
+// How far ahead unordered passes prefetch
+#define PREFETCH_DISTANCE 16
+
+struct primer {
+  struct primeinfo info;
+  int nlines;
+  int steps;
+  int width;	// Entries per step in order
+  void **order;	// steps rows of width lines, row s holds step s of each chain
+};
+
+// Load from p and return zero.  The result still depends on the load, so
+// adding it to the next address in a chain orders the chain's loads.
+static inline uintptr_t chainload(void *p) {
+  uintptr_t v;
+  asm volatile("movq (%1), %0\n"
+               "andq $0, %0\n"
+               : "=r" (v) : "r" (p));
+  return v;
+}
+
+primer_t pr_prepare(void **lines, int nlines, primeinfo_t info) {
+  primer_t pr = (primer_t)calloc(1, sizeof(struct primer));
+  if (info != NULL)
+    bcopy(info, &pr->info, sizeof(struct primeinfo));
+  if (pr->info.chains == 0)
+    pr->info.chains = PRIME_DEFAULT_CHAINS;
+  if (pr->info.chains > PRIME_MAXCHAINS)
+    pr->info.chains = PRIME_MAXCHAINS;
+  if (pr->info.chains < 0)
+    pr->info.chains = PRIME_UNORDERED;
+  if (pr->info.chains > nlines && nlines > 0)
+    pr->info.chains = nlines;
+  if (pr->info.repeats <= 0)
+    pr->info.repeats = PRIME_DEFAULT_REPEATS;
+  if (pr->info.touches <= 0)
+    pr->info.touches = PRIME_DEFAULT_TOUCHES;
+
+  pr->nlines = nlines;
+  if (nlines <= 0)
+    return pr;
+
+  if (pr->info.chains == PRIME_UNORDERED) {
+    pr->width = 1;
+    pr->steps = nlines;
+    pr->order = malloc(nlines * sizeof(void *));
+    bcopy(lines, pr->order, nlines * sizeof(void *));
+    return pr;
+  }
+
+  // Chain c takes a contiguous run of the lines.  Shorter runs repeat
+  // their last line so that every step has one entry per chain.
+  int k = pr->info.chains;
+  pr->width = k;
+  pr->steps = (nlines + k - 1) / k;
+  pr->order = malloc(pr->steps * k * sizeof(void *));
+  for (int c = 0; c < k; c++) {
+    int start = c * nlines / k;
+    int len = (c + 1) * nlines / k - start;
+    for (int s = 0; s < pr->steps; s++)
+      pr->order[s * k + c] = lines[start + (s < len ? s : len - 1)];
+  }
+  return pr;
+}
+
+void pr_release(primer_t pr) {
+  if (pr == NULL)
+    return;
+  free(pr->order);
+  free(pr);
+}
+
+static void chainpass(primer_t pr, int backward) {
+  int k = pr->width;
+  int touches = pr->info.touches;
+  uintptr_t dep[PRIME_MAXCHAINS];
+  bzero(dep, sizeof(dep));
+  for (int i = 0; i < pr->steps; i++) {
+    void **row = pr->order + (backward ? pr->steps - 1 - i : i) * k;
+    for (int c = 0; c < k; c++)
+      for (int t = 0; t < touches; t++)
+        dep[c] = chainload((char *)row[c] + dep[c]);
+  }
+}
+
+static void unorderedpass(primer_t pr, int backward) {
+  int n = pr->steps;
+  int touches = pr->info.touches;
+  for (int i = 0; i < n; i++) {
+    int s = backward ? n - 1 - i : i;
+    int ahead = backward ? s - PREFETCH_DISTANCE : s + PREFETCH_DISTANCE;
+    if (ahead >= 0 && ahead < n)
+      __builtin_prefetch(pr->order[ahead]);
+    for (int t = 0; t < touches; t++)
+      memaccess(pr->order[s]);
+  }
+}
+
+// The simulator sees the accesses in program order
+static void simpass(primer_t pr, int backward) {
+  int k = pr->width;
+  for (int i = 0; i < pr->steps; i++) {
+    void **row = pr->order + (backward ? pr->steps - 1 - i : i) * k;
+    for (int c = 0; c < k; c++)
+      for (int t = 0; t < pr->info.touches; t++)
+        sim_access(pr->info.sim, row[c]);
+  }
+}
+
+void pr_prime(primer_t pr) {
+  if (pr->nlines <= 0)
+    return;
+  for (int r = 0; r < pr->info.repeats; r++) {
+    int backward = pr->info.direction == PRIMEDIR_ZIGZAG && (r & 1);
+    if (pr->info.sim)
+      simpass(pr, backward);
+    else if (pr->info.chains == PRIME_UNORDERED)
+      unorderedpass(pr, backward);
+    else
+      chainpass(pr, backward);
+  }
+}
+
+int pr_getlines(primer_t pr) {
+  return pr->nlines;
+}
+
+void pr_getinfo(primer_t pr, primeinfo_t info) {
+  bcopy(&pr->info, info, sizeof(struct primeinfo));
+}
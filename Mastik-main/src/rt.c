@@ -0,0 +1,310 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+
+#include <mastik/mm.h>
+#include <mastik/numa.h>
+#include <mastik/rt.h>
+#include <mastik/topology.h>
+
+#include "vlist.h"
+#include "mm-impl.h"
+
+struct lockedrange {
+  void *base;
+  size_t size;
+};
+
+struct rt {
+  struct rtstate state;
+  struct lockedrange *ranges;	// Locked one at a time, for rt_exit
+  int nranges;
+  int maxranges;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+  cpu_set_t affinity;		// Before pinning
+#endif
+
+  pthread_t thread;
+  int policy;			// Before SCHED_FIFO
+  struct sched_param param;
+  int haswatchdog;
+  pthread_t watchdog;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int stop;
+  int timeout;
+  uint64_t deadline;		// CLOCK_MONOTONIC, in milliseconds
+};
+
+static uint64_t nowms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void pin(rt_t rt, mm_t mm) {
+#ifdef HAVE_SCHED_SETAFFINITY
+  topology_t tp = tp_discover();
+  if (tp == NULL)
+    return;
+  int llc = -1;
+  struct numaplacement p;
+  if (mm != NULL && mm_getplacement(mm, &p))
+    llc = tp_llcof(tp, p.cpu);
+  struct tpplacement pl;
+  if (tp_place(tp, llc, 0, 0, &pl) && sched_getaffinity(0, sizeof(cpu_set_t), &rt->affinity) == 0) {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(pl.prober, &cs);
+    struct tpcpu cpu;
+    if (sched_setaffinity(0, sizeof(cs), &cs) == 0 && tp_getcpu(tp, pl.prober, &cpu)) {
+      rt->state.cpu = pl.prober;
+      rt->state.isolated = cpu.isolated;
+    }
+  }
+  tp_release(tp);
+#endif
+}
+
+static void addrange(rt_t rt, void *base, size_t size) {
+  if (rt->nranges == rt->maxranges) {
+    rt->maxranges = rt->maxranges ? rt->maxranges * 2 : 16;
+    rt->ranges = realloc(rt->ranges, rt->maxranges * sizeof(struct lockedrange));
+  }
+  rt->ranges[rt->nranges].base = base;
+  rt->ranges[rt->nranges].size = size;
+  rt->nranges++;
+}
+
+// Writes every page of buf back with its own contents
+static void prefault(void *buf, size_t size) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t end = (uintptr_t)buf + size;
+  for (uintptr_t a = (uintptr_t)buf; a < end; a = (a & ~(page - 1)) + page)
+    *(volatile char *)a = *(volatile char *)a;
+}
+
+// The buffers of the mm, for when mlockall fails
+static void lockmm(rt_t rt, mm_t mm) {
+  int nregions = __atomic_load_n(&mm->nregions, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < nregions; i++)
+    rt_lock(rt, mm->regions[i].base, mm->regions[i].size);
+  if (mm->l2buffer != NULL)
+    rt_lock(rt, mm->l2buffer, mm->l2buffersize);
+}
+
+static int readint(const char *path, int *value) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  int rv = fscanf(f, "%d", value) == 1;
+  fclose(f);
+  return rv;
+}
+
+// Locking later mappings would make the mm fail to grow at the limit
+static void lockmemory(rt_t rt, mm_t mm) {
+  struct rlimit rl;
+  int future = geteuid() == 0 || (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur == RLIM_INFINITY);
+  if (mlockall(MCL_CURRENT | (future ? MCL_FUTURE : 0)) == 0)
+    rt->state.lockall = future ? 2 : 1;
+  else if (mm != NULL)
+    lockmm(rt, mm);
+  int allowed = 1;
+  readint("/proc/sys/vm/compact_unevictable_allowed", &allowed);
+  rt->state.movable = allowed != 0;
+}
+
+// Gives the thread its old policy back if rt_kick is not called in time
+static void *watchdog(void *arg) {
+  rt_t rt = arg;
+  pthread_mutex_lock(&rt->lock);
+  while (!rt->stop) {
+    uint64_t deadline = __atomic_load_n(&rt->deadline, __ATOMIC_RELAXED);
+    if (nowms() >= deadline) {
+      pthread_setschedparam(rt->thread, rt->policy, &rt->param);
+      __atomic_store_n(&rt->state.priority, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&rt->state.expired, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000;
+    ts.tv_nsec = (deadline % 1000) * 1000000;
+    pthread_cond_timedwait(&rt->cond, &rt->lock, &ts);
+  }
+  pthread_mutex_unlock(&rt->lock);
+  return NULL;
+}
+
+// The watchdog runs above the thread it watches and may use the CPUs the
+// thread had before pinning
+static void startwatchdog(rt_t rt) {
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_cond_init(&rt->cond, &ca);
+  pthread_condattr_destroy(&ca);
+  pthread_mutex_init(&rt->lock, NULL);
+  rt_kick(rt);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  struct sched_param sp;
+  sp.sched_priority = rt->state.priority + 1;
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+  pthread_attr_setschedparam(&attr, &sp);
+#ifdef HAVE_SCHED_SETAFFINITY
+  if (rt->state.cpu >= 0)
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &rt->affinity);
+#endif
+  rt->haswatchdog = pthread_create(&rt->watchdog, &attr, watchdog, rt) == 0;
+  pthread_attr_destroy(&attr);
+  if (!rt->haswatchdog)
+    rt->haswatchdog = pthread_create(&rt->watchdog, NULL, watchdog, rt) == 0;
+}
+
+// One priority level is kept for the watchdog.  Without a watchdog the
+// thread does not stay FIFO.
+static void fifo(rt_t rt, int priority) {
+  rt->thread = pthread_self();
+  if (pthread_getschedparam(rt->thread, &rt->policy, &rt->param) != 0)
+    return;
+  int max = sched_get_priority_max(SCHED_FIFO) - 1;
+  if (priority > max)
+    priority = max;
+  struct sched_param sp;
+  sp.sched_priority = priority;
+  if (pthread_setschedparam(rt->thread, SCHED_FIFO, &sp) != 0)
+    return;
+  rt->state.priority = priority;
+  startwatchdog(rt);
+  if (!rt->haswatchdog) {
+    pthread_setschedparam(rt->thread, rt->policy, &rt->param);
+    rt->state.priority = 0;
+  }
+}
+
+rt_t rt_enter(rtinfo_t info) {
+  rt_t rt = calloc(1, sizeof(struct rt));
+  rt->state.cpu = -1;
+  rt->timeout = info->watchdog > 0 ? info->watchdog : RT_DEFAULT_WATCHDOG;
+  // Pages are faulted in on the CPU, and so the node, the thread stays on
+  if (info->flags & RT_PIN)
+    pin(rt, info->mm);
+  if (info->flags & RT_LOCKMEMORY)
+    lockmemory(rt, info->mm);
+  if (info->flags & RT_FIFO)
+    fifo(rt, info->priority > 0 ? info->priority : RT_DEFAULT_PRIORITY);
+  return rt;
+}
+
+int rt_lock(rt_t rt, void *buf, size_t size) {
+  if (buf == NULL || size == 0 || rt->state.lockall == 2)
+    return 1;
+  if (mlock(buf, size) == 0) {
+    addrange(rt, buf, size);
+    rt->state.locked += size;
+    return 1;
+  }
+  prefault(buf, size);
+  rt->state.prefaulted += size;
+  return 0;
+}
+
+void rt_kick(rt_t rt) {
+  __atomic_store_n(&rt->deadline, nowms() + rt->timeout, __ATOMIC_RELAXED);
+}
+
+void rt_getstate(rt_t rt, rtstate_t state) {
+  *state = rt->state;
+  state->priority = __atomic_load_n(&rt->state.priority, __ATOMIC_RELAXED);
+  state->expired = __atomic_load_n(&rt->state.expired, __ATOMIC_RELAXED);
+}
+
+void rt_print(rt_t rt, FILE *f) {
+  struct rtstate s;
+  rt_getstate(rt, &s);
+  fprintf(f, "Capture mode:");
+  if (s.cpu < 0)
+    fprintf(f, " not pinned");
+  else
+    fprintf(f, " CPU %d%s%s%s", s.cpu, s.isolated ? "" : " (not isolated)",
+	(s.isolated & TP_ISOLATED) ? " isolcpus" : "", (s.isolated & TP_NOHZFULL) ? " nohz_full" : "");
+  if (s.lockall)
+    fprintf(f, ", memory locked%s", s.lockall == 2 ? " with later mappings" : "");
+  if (s.locked)
+    fprintf(f, ", %zu KB locked", s.locked >> 10);
+  if (s.prefaulted)
+    fprintf(f, ", %zu KB only prefaulted", s.prefaulted >> 10);
+  if (!s.lockall && !s.locked && !s.prefaulted)
+    fprintf(f, ", memory not locked");
+  else if (s.movable && (s.lockall || s.locked))
+    fprintf(f, " (movable by compaction)");
+  if (s.priority)
+    fprintf(f, ", SCHED_FIFO %d, watchdog %d ms", s.priority, rt->timeout);
+  else if (s.expired)
+    fprintf(f, ", SCHED_FIFO dropped by the watchdog");
+  else
+    fprintf(f, ", default scheduling");
+  fprintf(f, "\n");
+}
+
+void rt_exit(rt_t rt) {
+  if (rt == NULL)
+    return;
+  if (rt->haswatchdog) {
+    pthread_mutex_lock(&rt->lock);
+    rt->stop = 1;
+    pthread_cond_signal(&rt->cond);
+    pthread_mutex_unlock(&rt->lock);
+    pthread_join(rt->watchdog, NULL);
+    pthread_mutex_destroy(&rt->lock);
+    pthread_cond_destroy(&rt->cond);
+    if (!rt->state.expired)
+      pthread_setschedparam(rt->thread, rt->policy, &rt->param);
+  }
+  if (rt->state.lockall)
+    munlockall();
+  for (int i = 0; i < rt->nranges; i++)
+    munlock(rt->ranges[i].base, rt->ranges[i].size);
+#ifdef HAVE_SCHED_SETAFFINITY
+  if (rt->state.cpu >= 0)
+    sched_setaffinity(0, sizeof(cpu_set_t), &rt->affinity);
+#endif
+  free(rt->ranges);
+  free(rt);
+}
@@ -0,0 +1,528 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <mastik/low.h>
+#include <mastik/impl.h>
+#include <mastik/sim.h>
+
+#include "timestats.h"
+
+#define PHYSBITS 40
+#define TLBSIZE 4096
+#define INVALID 0
+
+// The private cache of the probing core, LRU, see sim_scope
+#define PRIV_SETS 64
+#define PRIV_WAYS 8
+
+// Slices of non-power-of-two caches are a fixed table of a key made of
+// NONLINEAR_KEYBITS parities of the bits above NONLINEAR_SHIFT
+#define NONLINEAR_SHIFT 17
+#define NONLINEAR_KEYBITS 7
+
+static const uint64_t intelmasks[] = {
+  0x1b5f575440UL,
+  0x2eb5faa880UL,
+  0x3cccc93100UL
+};
+#define NINTELMASKS ((int)(sizeof(intelmasks) / sizeof(intelmasks[0])))
+
+struct sim {
+  struct siminfo info;
+  int nmasks;
+  int nonlinear;
+
+  int pagebits;
+  int framebits;
+  uint64_t nextframe;
+
+  // Open addressing map from virtual page number + 1 to frame number
+  size_t ptsize;
+  size_t ptused;
+  uint64_t *ptvpn;
+  uint64_t *ptframe;
+  uint64_t tlbvpn[TLBSIZE];
+  uint64_t tlbframe[TLBSIZE];
+
+  // Cache state, associativity entries per set
+  int nsets;
+  uint64_t waymask;
+  uint64_t *tags;
+  uint64_t *stamps;
+  uint64_t *mru;
+  uint64_t clock;
+  int psel;
+
+  // Private cache state, inclusive in the model above
+  uint64_t privtags[PRIV_SETS * PRIV_WAYS];
+  uint64_t privstamps[PRIV_SETS * PRIV_WAYS];
+
+  uint64_t rng;
+  struct simstats stats;
+};
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53UL;
+  x ^= x >> 33;
+  return x;
+}
+
+static uint64_t rnd(sim_t sim) {
+  sim->rng ^= sim->rng >> 12;
+  sim->rng ^= sim->rng << 25;
+  sim->rng ^= sim->rng >> 27;
+  return sim->rng * 0x2545f4914f6cdd1dUL;
+}
+
+static int ilog2(uint64_t v) {
+  int rv = 0;
+  while ((1UL << rv) < v)
+    rv++;
+  return rv;
+}
+
+// Rank over GF(2) of the first n masks
+static int rank(uint64_t *masks, int n) {
+  uint64_t basis[64];
+  int r = 0;
+  for (int i = 0; i < n; i++) {
+    uint64_t v = masks[i];
+    for (int j = 0; j < r; j++)
+      if ((v ^ basis[j]) < v)
+	v ^= basis[j];
+    if (v)
+      basis[r++] = v;
+  }
+  return r;
+}
+
+static void defaultmasks(sim_t sim) {
+  uint64_t rng = mix64(sim->info.seed) | 1;
+  for (int i = 0; i < sim->nmasks; i++) {
+    if (sim->info.slicemasks[i] != 0)
+      continue;
+    int tries = 0;
+    do {
+      if (tries++ == 0 && i < NINTELMASKS && !sim->nonlinear)
+	sim->info.slicemasks[i] = intelmasks[i];
+      else {
+	rng = mix64(rng);
+	sim->info.slicemasks[i] = rng & (((1UL << 38) - 1) & ~((1UL << NONLINEAR_SHIFT) - 1));
+      }
+    } while (rank(sim->info.slicemasks, i + 1) != i + 1);
+  }
+}
+
+sim_t sim_new(siminfo_t info) {
+  sim_t sim = calloc(1, sizeof(struct sim));
+  if (info != NULL)
+    sim->info = *info;
+  if (sim->info.associativity == 0)
+    sim->info.associativity = SIM_DEFAULT_ASSOCIATIVITY;
+  if (sim->info.setsperslice == 0)
+    sim->info.setsperslice = SIM_DEFAULT_SETSPERSLICE;
+  if (sim->info.slices == 0)
+    sim->info.slices = SIM_DEFAULT_SLICES;
+  if (sim->info.hittime == 0)
+    sim->info.hittime = SIM_DEFAULT_HITTIME;
+  if (sim->info.misstime == 0)
+    sim->info.misstime = SIM_DEFAULT_MISSTIME;
+  if (sim->info.seed == 0)
+    sim->info.seed = SIM_DEFAULT_SEED;
+
+  if (sim->info.associativity > 64 || 
+      (sim->info.setsperslice & (sim->info.setsperslice - 1)) != 0) {
+    fprintf(stderr, "sim: unsupported cache geometry\n");
+    free(sim);
+    return NULL;
+  }
+  if ((sim->info.slices & (sim->info.slices - 1)) == 0) {
+    sim->nmasks = ilog2(sim->info.slices);
+    if (sim->nmasks > SIM_MAXMASKS) {
+      fprintf(stderr, "sim: too many slices\n");
+      free(sim);
+      return NULL;
+    }
+  } else {
+    sim->nmasks = NONLINEAR_KEYBITS;
+    sim->nonlinear = 1;
+  }
+  defaultmasks(sim);
+
+  sim->nsets = sim->info.slices * sim->info.setsperslice;
+  sim->waymask = sim->info.associativity == 64 ? ~0UL : (1UL << sim->info.associativity) - 1;
+  sim->tags = calloc(sim->nsets * sim->info.associativity, sizeof(uint64_t));
+  sim->stamps = calloc(sim->nsets * sim->info.associativity, sizeof(uint64_t));
+  sim->mru = calloc(sim->nsets, sizeof(uint64_t));
+  sim->psel = 1 << (SIM_PSELBITS - 1);
+  sim->rng = mix64(sim->info.seed ^ 0x5851f42d4c957f2dUL) | 1;
+
+  sim->ptsize = 1024;
+  sim->ptvpn = calloc(sim->ptsize, sizeof(uint64_t));
+  sim->ptframe = calloc(sim->ptsize, sizeof(uint64_t));
+  sim_setpagesize(sim, sim->info.pagesize ? sim->info.pagesize : PAGE_SIZE);
+  return sim;
+}
+
+void sim_release(sim_t sim) {
+  if (sim == NULL)
+    return;
+  free(sim->tags);
+  free(sim->stamps);
+  free(sim->mru);
+  free(sim->ptvpn);
+  free(sim->ptframe);
+  free(sim);
+}
+
+void sim_getinfo(sim_t sim, siminfo_t info) {
+  *info = sim->info;
+  info->pagesize = 1UL << sim->pagebits;
+}
+
+void sim_setpagesize(sim_t sim, size_t pagesize) {
+  if (sim->ptused != 0)
+    return;
+  sim->pagebits = ilog2(pagesize);
+  sim->framebits = PHYSBITS - sim->pagebits;
+}
+
+
+/*
+ * Physical address translation.  Frames are handed out in the order pages
+ * are first touched.  The frame number is a fixed permutation of that
+ * order over framebits bits, so frames never repeat and look random.
+ */
+static uint64_t permute(sim_t sim, uint64_t x) {
+  uint64_t mask = (1UL << sim->framebits) - 1;
+  uint64_t key = mix64(sim->info.seed);
+  for (int i = 0; i < 3; i++) {
+    x = (x * 0x9e3779b97f4a7c15UL + (key >> (i * 16))) & mask;
+    x ^= x >> (sim->framebits / 2 + 1);
+  }
+  return x;
+}
+
+static void ptgrow(sim_t sim) {
+  size_t oldsize = sim->ptsize;
+  uint64_t *oldvpn = sim->ptvpn;
+  uint64_t *oldframe = sim->ptframe;
+  sim->ptsize *= 2;
+  sim->ptvpn = calloc(sim->ptsize, sizeof(uint64_t));
+  sim->ptframe = calloc(sim->ptsize, sizeof(uint64_t));
+  for (size_t i = 0; i < oldsize; i++) {
+    if (oldvpn[i] == 0)
+      continue;
+    size_t h = mix64(oldvpn[i]) & (sim->ptsize - 1);
+    while (sim->ptvpn[h] != 0)
+      h = (h + 1) & (sim->ptsize - 1);
+    sim->ptvpn[h] = oldvpn[i];
+    sim->ptframe[h] = oldframe[i];
+  }
+  free(oldvpn);
+  free(oldframe);
+}
+
+static uint64_t frame(sim_t sim, uint64_t vpn) {
+  uint64_t key = vpn + 1;
+  int t = vpn % TLBSIZE;
+  if (sim->tlbvpn[t] == key)
+    return sim->tlbframe[t];
+  size_t h = mix64(key) & (sim->ptsize - 1);
+  while (sim->ptvpn[h] != 0 && sim->ptvpn[h] != key)
+    h = (h + 1) & (sim->ptsize - 1);
+  if (sim->ptvpn[h] == 0) {
+    uint64_t f;
+    do {
+      f = permute(sim, sim->nextframe++);
+    } while (f == 0);
+    sim->ptvpn[h] = key;
+    sim->ptframe[h] = f;
+    sim->ptused++;
+  }
+  uint64_t f = sim->ptframe[h];
+  if (sim->ptused * 2 > sim->ptsize)
+    ptgrow(sim);
+  sim->tlbvpn[t] = key;
+  sim->tlbframe[t] = f;
+  return f;
+}
+
+uintptr_t sim_physaddr(sim_t sim, void *p) {
+  uintptr_t v = (uintptr_t)p;
+  return (frame(sim, v >> sim->pagebits) << sim->pagebits) | (v & ((1UL << sim->pagebits) - 1));
+}
+
+int sim_slice(sim_t sim, uintptr_t phys) {
+  int rv = 0;
+  for (int i = 0; i < sim->nmasks; i++)
+    rv |= __builtin_parityll(phys & sim->info.slicemasks[i]) << i;
+  if (sim->nonlinear)
+    return mix64(rv ^ sim->info.seed) % sim->info.slices;
+  return rv;
+}
+
+
+/*
+ * Cache model
+ */
+#define QLRU_MAXAGE 3
+
+// Insertion age of a miss in set.  Misses in the leader sets of the
+// dueling policy move the selector towards the other insertion.
+static int insertage(sim_t sim, int set) {
+  if (sim->info.policy == SIMPOLICY_QLRU)
+    return 2;
+  int bimodal = rnd(sim) % SIM_BIMODAL == 0 ? 2 : QLRU_MAXAGE;
+  int max = (1 << SIM_PSELBITS) - 1;
+  switch (set % SIM_DUEL_SPACING) {
+  case 0:
+    if (sim->psel < max)
+      sim->psel++;
+    return 2;
+  case SIM_DUEL_SPACING / 2:
+    if (sim->psel > 0)
+      sim->psel--;
+    return bimodal;
+  default:
+    return sim->psel > max / 2 ? bimodal : 2;
+  }
+}
+
+static void touch(sim_t sim, int set, int way, int miss) {
+  switch (sim->info.policy) {
+  case SIMPOLICY_LRU:
+    sim->stamps[set * sim->info.associativity + way] = ++sim->clock;
+    break;
+  case SIMPOLICY_PLRU:
+    sim->mru[set] |= 1UL << way;
+    if (sim->mru[set] == sim->waymask)
+      sim->mru[set] = 1UL << way;
+    break;
+  case SIMPOLICY_QLRU:
+  case SIMPOLICY_DUELING:
+    sim->stamps[set * sim->info.associativity + way] = miss ? insertage(sim, set) : 0;
+    break;
+  case SIMPOLICY_RANDOM:
+    break;
+  }
+}
+
+static int victim(sim_t sim, int set) {
+  int assoc = sim->info.associativity;
+  uint64_t *tags = sim->tags + set * assoc;
+  for (int i = 0; i < assoc; i++)
+    if (tags[i] == INVALID)
+      return i;
+  switch (sim->info.policy) {
+  case SIMPOLICY_LRU: {
+    uint64_t *stamps = sim->stamps + set * assoc;
+    int rv = 0;
+    for (int i = 1; i < assoc; i++)
+      if (stamps[i] < stamps[rv])
+	rv = i;
+    return rv;
+  }
+  case SIMPOLICY_PLRU:
+    return __builtin_ctzll(~sim->mru[set] & sim->waymask);
+  case SIMPOLICY_QLRU:
+  case SIMPOLICY_DUELING: {
+    uint64_t *ages = sim->stamps + set * assoc;
+    int oldest = 0;
+    for (int i = 1; i < assoc; i++)
+      if (ages[i] > ages[oldest])
+	oldest = i;
+    int raise = QLRU_MAXAGE - ages[oldest];
+    for (int i = 0; i < assoc; i++)
+      ages[i] += raise;
+    return oldest;
+  }
+  case SIMPOLICY_RANDOM:
+  default:
+    return rnd(sim) % assoc;
+  }
+}
+
+static int lookup(sim_t sim, uintptr_t phys, int *set) {
+  uint64_t tag = (phys >> 6) + 1;
+  *set = sim_slice(sim, phys) * sim->info.setsperslice + ((phys >> 6) & (sim->info.setsperslice - 1));
+  uint64_t *tags = sim->tags + *set * sim->info.associativity;
+  for (int i = 0; i < sim->info.associativity; i++)
+    if (tags[i] == tag)
+      return i;
+  return -1;
+}
+
+static int privlookup(sim_t sim, uint64_t tag) {
+  uint64_t *tags = sim->privtags + (tag & (PRIV_SETS - 1)) * PRIV_WAYS;
+  for (int i = 0; i < PRIV_WAYS; i++)
+    if (tags[i] == tag)
+      return i;
+  return -1;
+}
+
+static void privfill(sim_t sim, uint64_t tag) {
+  int base = (tag & (PRIV_SETS - 1)) * PRIV_WAYS;
+  int way = privlookup(sim, tag);
+  if (way < 0) {
+    way = 0;
+    for (int i = 1; i < PRIV_WAYS; i++)
+      if (sim->privstamps[base + i] < sim->privstamps[base + way])
+	way = i;
+    sim->privtags[base + way] = tag;
+  }
+  sim->privstamps[base + way] = ++sim->clock;
+}
+
+// A line leaving the LLC leaves the private cache too
+static void privdrop(sim_t sim, uint64_t tag) {
+  int way = privlookup(sim, tag);
+  if (tag != INVALID && way >= 0)
+    sim->privtags[(tag & (PRIV_SETS - 1)) * PRIV_WAYS + way] = INVALID;
+}
+
+static void noise(sim_t sim) {
+  if (sim->info.noise == 0 || rnd(sim) % 1000000 >= (uint64_t)sim->info.noise)
+    return;
+  int set = rnd(sim) % sim->nsets;
+  int way = rnd(sim) % sim->info.associativity;
+  privdrop(sim, sim->tags[set * sim->info.associativity + way]);
+  sim->tags[set * sim->info.associativity + way] = INVALID;
+  sim->mru[set] &= ~(1UL << way);
+}
+
+uint32_t sim_access(sim_t sim, void *p) {
+  sim->stats.accesses++;
+  noise(sim);
+  uintptr_t phys = sim_physaddr(sim, p);
+  int set;
+  int way = lookup(sim, phys, &set);
+  uint32_t rv = sim->info.hittime;
+  int miss = way < 0;
+  if (miss) {
+    sim->stats.misses++;
+    way = victim(sim, set);
+    privdrop(sim, sim->tags[set * sim->info.associativity + way]);
+    sim->tags[set * sim->info.associativity + way] = (phys >> 6) + 1;
+    rv = sim->info.misstime;
+  }
+  touch(sim, set, way, miss);
+  privfill(sim, (phys >> 6) + 1);
+  if (sim->info.jitter)
+    rv += rnd(sim) % (sim->info.jitter + 1);
+  return rv;
+}
+
+uint32_t sim_scope(sim_t sim, void *p) {
+  uint64_t tag = (sim_physaddr(sim, p) >> 6) + 1;
+  if (privlookup(sim, tag) < 0)
+    return sim_access(sim, p);
+  sim->stats.accesses++;
+  noise(sim);
+  privfill(sim, tag);
+  uint32_t rv = sim->info.hittime;
+  if (sim->info.jitter)
+    rv += rnd(sim) % (sim->info.jitter + 1);
+  return rv;
+}
+
+void sim_flush(sim_t sim, void *p) {
+  sim->stats.flushes++;
+  int set;
+  uintptr_t phys = sim_physaddr(sim, p);
+  privdrop(sim, (phys >> 6) + 1);
+  int way = lookup(sim, phys, &set);
+  if (way < 0)
+    return;
+  sim->tags[set * sim->info.associativity + way] = INVALID;
+  sim->mru[set] &= ~(1UL << way);
+}
+
+void sim_walk(sim_t sim, void *p, int count) {
+  if (p == NULL)
+    return;
+  void *start = p;
+  while (count--) {
+    do {
+      sim_access(sim, p);
+      p = LNEXT(p);
+    } while (p != start);
+  }
+}
+
+int sim_timedwalk(sim_t sim, void *list, void *candidate, int walks, int rounds) {
+  if (list == NULL)
+    return 0;
+  if (LNEXT(list) == NULL)
+    return 0;
+  sim->stats.timedwalks++;
+  ts_t ts = ts_alloc();
+  sim_access(sim, candidate);
+  for (int i = 0; i < rounds; i++) {
+    sim_walk(sim, list, walks);
+    ts_add(ts, sim_access(sim, candidate));
+  }
+  int rv = ts_median(ts);
+  ts_free(ts);
+  return rv;
+}
+
+int sim_probetime(sim_t sim, void *pp) {
+  if (pp == NULL)
+    return 0;
+  sim->stats.probes++;
+  int rv = 0;
+  void *p = pp;
+  do {
+    rv += sim_access(sim, p);
+    p = LNEXT(p);
+  } while (p != pp);
+  return rv;
+}
+
+int sim_probecount(sim_t sim, void *pp) {
+  if (pp == NULL)
+    return 0;
+  sim->stats.probes++;
+  int rv = 0;
+  void *p = pp;
+  do {
+    if (sim_access(sim, p) > L3_THRESHOLD)
+      rv++;
+    p = LNEXT(p);
+  } while (p != pp);
+  return rv;
+}
+
+void sim_getstats(sim_t sim, simstats_t stats) {
+  *stats = sim->stats;
+}
+
+void sim_resetstats(sim_t sim) {
+  bzero(&sim->stats, sizeof(struct simstats));
+}
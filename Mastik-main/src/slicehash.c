@@ -0,0 +1,511 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <mastik/low.h>
+#include <mastik/l3.h>
+#include <mastik/mm.h>
+#include <mastik/impl.h>
+#include <mastik/slicehash.h>
+
+#include "vlist.h"
+#include "mm-impl.h"
+
+// Also the most key bits of a table
+#define SH_MAXMASKS 16
+#define SH_UNKNOWN 0xff
+// In-group differences in a row that may fail to extend the kernel of a
+// table before the solver stops looking
+#define SH_MAXREJECTS 256
+// Lines a table needs on average for each class and key it knows.  With
+// fewer, the kernel is fitted to the frames of the mapping and the table
+// does not carry over to other frames.
+#define SH_MINSAMPLES 4
+
+#define PFN(phys) ((phys) >> 12)
+
+struct slicehash {
+  int slices;
+  int setsperslice;
+  int groupsize;
+
+  int nmasks;
+  uint64_t masks[SH_MAXMASKS];
+
+  // For non-linear hashes, the label of each class of sets and key,
+  // indexed by class << nmasks | key
+  int nclasses;
+  uint8_t *table;
+};
+
+static int parity(uint64_t v) {
+  return __builtin_parityll(v);
+}
+
+static int ilog2(int v) {
+  int rv = 0;
+  while ((1 << rv) < v)
+    rv++;
+  return rv;
+}
+
+static slicehash_t sh_new(int slices, int setsperslice, int groupsize) {
+  slicehash_t sh = calloc(1, sizeof(struct slicehash));
+  sh->slices = slices;
+  sh->setsperslice = setsperslice;
+  sh->groupsize = groupsize;
+  sh->nclasses = setsperslice / groupsize;
+  return sh;
+}
+
+void sh_release(slicehash_t sh) {
+  if (sh == NULL)
+    return;
+  free(sh->table);
+  free(sh);
+}
+
+static int newtable(slicehash_t sh) {
+  size_t size = (size_t)sh->nclasses << sh->nmasks;
+  sh->table = malloc(size);
+  if (sh->table == NULL)
+    return 0;
+  memset(sh->table, SH_UNKNOWN, size);
+  return 1;
+}
+
+static int linear(slicehash_t sh, uintptr_t phys) {
+  int rv = 0;
+  for (int i = 0; i < sh->nmasks; i++)
+    rv |= parity(phys & sh->masks[i]) << i;
+  return rv;
+}
+
+static int tableindex(slicehash_t sh, uintptr_t phys) {
+  int class = ((phys / L3_CACHELINE) & (sh->setsperslice - 1)) / sh->groupsize;
+  return class << sh->nmasks | linear(sh, phys);
+}
+
+int sh_slice(slicehash_t sh, uintptr_t phys) {
+  if (sh->table == NULL)
+    return linear(sh, phys);
+  int label = sh->table[tableindex(sh, phys)];
+  return label == SH_UNKNOWN ? -1 : label;
+}
+
+int sh_getmasks(slicehash_t sh, uint64_t *masks, int nmasks) {
+  if (masks != NULL)
+    for (int i = 0; i < nmasks && i < sh->nmasks; i++)
+      masks[i] = sh->masks[i];
+  return sh->nmasks;
+}
+
+// The cache index of a line, divided into the groups mm uses
+static int groupclass(mm_t mm, uintptr_t phys) {
+  return ((phys / L3_CACHELINE) & (mm->l3info.sets - 1)) / mm->l3groupsize;
+}
+
+int sh_usable(slicehash_t sh, mm_t mm) {
+  if (sh->slices != mm->l3info.slices || sh->setsperslice != mm->l3info.sets)
+    return 0;
+  // Table labels are only distinct within a class of sets
+  return sh->table == NULL || sh->groupsize <= mm->l3groupsize;
+}
+
+// Inserts v into basis[], kept with each vector at the index of its top
+// bit.  Returns the index, or -1 if v is in the span.
+static int insert(uint64_t *basis, uint64_t v) {
+  for (int bit = 63; bit >= 0 && v; bit--) {
+    if (((v >> bit) & 1) == 0)
+      continue;
+    if (basis[bit] == 0) {
+      basis[bit] = v;
+      return bit;
+    }
+    v ^= basis[bit];
+  }
+  return -1;
+}
+
+/*
+ * The null space of the span of basis[] within the varying bits, as XOR
+ * masks shifted back into place.  Every varying bit that is not a pivot
+ * yields one mask.  Reduces basis[] so that each pivot appears only in
+ * its own vector.  Returns -1 if there are more than SH_MAXMASKS masks.
+ */
+static int nullspace(uint64_t *basis, uint64_t varying, int shift, uint64_t *masks) {
+  for (int bit = 0; bit < 64; bit++) {
+    if (basis[bit] == 0)
+      continue;
+    for (int other = bit + 1; other < 64; other++)
+      if (basis[other] && ((basis[other] >> bit) & 1))
+	basis[other] ^= basis[bit];
+  }
+
+  int nmasks = 0;
+  for (int bit = 0; bit < 64; bit++) {
+    if (((varying >> bit) & 1) == 0 || basis[bit] != 0)
+      continue;
+    if (nmasks == SH_MAXMASKS)
+      return -1;
+    uint64_t mask = 1ULL << bit;
+    for (int pivot = 0; pivot < 64; pivot++)
+      if (basis[pivot] && ((basis[pivot] >> bit) & 1))
+	mask |= 1ULL << pivot;
+    masks[nmasks++] = mask << shift;
+  }
+  return nmasks;
+}
+
+
+/*
+ * Linear hash.  Addresses are shifted right past the cache index bits,
+ * which are constant within each group and only relabel slices within a
+ * class of sets.  basis[] holds the span of the in-group differences in
+ * reduced row echelon form; every bit that varies in the buffer and is
+ * not a pivot of the basis yields one vector of the null space.
+ */
+static uint64_t varyingbits(mm_t mm, uint64_t **phys, int *lens, int shift) {
+  uint64_t varying = 0;
+  uint64_t ref = phys[0][0] >> shift;
+  for (int g = 0; g < mm->l3ngroups; g++)
+    for (int i = 0; i < lens[g]; i++)
+      varying |= (phys[g][i] >> shift) ^ ref;
+  return varying;
+}
+
+static int solvelinear(mm_t mm, slicehash_t sh, uint64_t **phys, int *lens) {
+  int shift = ilog2(mm->l3info.sets) + 6;
+  uint64_t basis[64];
+  bzero(basis, sizeof(basis));
+  for (int g = 0; g < mm->l3ngroups; g++)
+    for (int i = 0; i < lens[g]; i++)
+      insert(basis, (phys[g][i] ^ phys[g][0]) >> shift);
+
+  int nmasks = nullspace(basis, varyingbits(mm, phys, lens, shift), shift, sh->masks);
+  if (nmasks < 0)
+    return 0;
+  sh->nmasks = nmasks;
+  if ((1 << nmasks) != sh->slices)
+    return 0;
+
+  // Each class of sets must have one group per slice
+  int nclasses = mm->l3info.sets / mm->l3groupsize;
+  int *owner = malloc(nclasses * sh->slices * sizeof(int));
+  for (int i = 0; i < nclasses * sh->slices; i++)
+    owner[i] = -1;
+  int ok = 1;
+  for (int g = 0; g < mm->l3ngroups && ok; g++) {
+    int slice = sh_slice(sh, phys[g][0]);
+    int key = groupclass(mm, phys[g][0]) * sh->slices + slice;
+    if (owner[key] != -1)
+      ok = 0;
+    owner[key] = g;
+    for (int i = 1; i < lens[g] && ok; i++)
+      if (sh_slice(sh, phys[g][i]) != slice)
+	ok = 0;
+  }
+  free(owner);
+  return ok;
+}
+
+struct sample {
+  uint64_t addr;	// Address bits above the cache index
+  uint64_t rep;		// addr reduced by the kernel
+  int class;
+  int group;
+};
+
+static int cmpsample(const void *a, const void *b) {
+  const struct sample *sa = a, *sb = b;
+  if (sa->class != sb->class)
+    return sa->class < sb->class ? -1 : 1;
+  return sa->rep < sb->rep ? -1 : sa->rep > sb->rep;
+}
+
+/*
+ * Lines a difference must newly equate with others of their group before
+ * it joins the kernel.  Any difference is consistent with a sparse
+ * mapping, but one outside the kernel only equates k lines within their
+ * groups with a chance of about slices^-k, which this keeps well below
+ * once in the differences the solver tries.
+ */
+static int evidence(int slices) {
+  int k = 1;
+  for (long chance = slices; chance < SH_MAXREJECTS * 16; chance *= slices)
+    k++;
+  return k;
+}
+
+static uint64_t reduce(uint64_t *basis, uint64_t v) {
+  for (int bit = 63; bit >= 0 && v; bit--)
+    if (((v >> bit) & 1) && basis[bit])
+      v ^= basis[bit];
+  return v;
+}
+
+// The number of samples that kernel[] makes equal to another sample of
+// their class, or -1 if two of these are in different groups
+static int equated(struct sample *samples, int n, uint64_t *kernel) {
+  for (int i = 0; i < n; i++)
+    samples[i].rep = reduce(kernel, samples[i].addr);
+  qsort(samples, n, sizeof(struct sample), cmpsample);
+  int rv = 0;
+  for (int i = 1; i < n; i++) {
+    if (samples[i].class != samples[i - 1].class || samples[i].rep != samples[i - 1].rep)
+      continue;
+    if (samples[i].group != samples[i - 1].group)
+      return -1;
+    rv++;
+  }
+  return rv;
+}
+
+/*
+ * Table on a linear key, the form of the hash of Intel parts with
+ * non-power-of-two slice counts.  Within a class of sets the slice is
+ * taken to be a function of the parities of a few masks of the bits above
+ * the cache index.  The kernel of these masks is grown from in-group
+ * differences, keeping those that equate enough more lines of a class,
+ * see evidence(), and no two lines of different groups, until
+ * SH_MAXREJECTS differences in a row add nothing.  The masks are the null space of the kernel, and the table
+ * gives the label of each class and key seen.  Slices are labelled by
+ * their order of discovery within each class.  The labels are arbitrary,
+ * but ptemap only needs them to be distinct within a class.  The solve
+ * fails when the mapping has too few lines for the table, see
+ * SH_MINSAMPLES.
+ */
+static int solvetable(mm_t mm, slicehash_t sh, uint64_t **phys, int *lens) {
+  int shift = ilog2(mm->l3info.sets) + 6;
+  int total = 0;
+  for (int g = 0; g < mm->l3ngroups; g++)
+    total += lens[g];
+  struct sample *samples = malloc(total * sizeof(struct sample));
+  int n = 0;
+  for (int g = 0; g < mm->l3ngroups; g++) {
+    for (int i = 0; i < lens[g]; i++) {
+      samples[n].addr = phys[g][i] >> shift;
+      samples[n].class = groupclass(mm, phys[g][i]);
+      samples[n++].group = g;
+    }
+  }
+
+  uint64_t kernel[64];
+  bzero(kernel, sizeof(kernel));
+  // A frame in two groups means the mapping is inconsistent
+  int equal = equated(samples, n, kernel);
+  int ok = equal >= 0;
+  int rejects = 0;
+  int needed = evidence(sh->slices);
+  for (int i = 1, left = 1; ok && left && rejects < SH_MAXREJECTS; i++) {
+    left = 0;
+    for (int g = 0; g < mm->l3ngroups && rejects < SH_MAXREJECTS; g++) {
+      if (i >= lens[g])
+	continue;
+      left = 1;
+      int bit = insert(kernel, (phys[g][i] ^ phys[g][0]) >> shift);
+      if (bit < 0)
+	continue;
+      int now = equated(samples, n, kernel);
+      if (now >= equal + needed) {
+	equal = now;
+	rejects = 0;
+      } else {
+	kernel[bit] = 0;
+	rejects++;
+      }
+    }
+  }
+  free(samples);
+
+  int nmasks = ok ? nullspace(kernel, varyingbits(mm, phys, lens, shift), shift, sh->masks) : -1;
+  if (nmasks < 0)
+    return 0;
+  sh->nmasks = nmasks;
+  if (!newtable(sh))
+    return 0;
+
+  int *used = calloc(sh->nclasses, sizeof(int));
+  int known = 0;
+  for (int g = 0; g < mm->l3ngroups && ok; g++) {
+    int label = used[groupclass(mm, phys[g][0])]++;
+    if (label >= sh->slices || label >= SH_UNKNOWN)
+      ok = 0;
+    for (int i = 0; i < lens[g] && ok; i++) {
+      uint8_t *entry = &sh->table[tableindex(sh, phys[g][i])];
+      if (*entry == SH_UNKNOWN)
+	known++;
+      else if (*entry != label)
+	ok = 0;
+      *entry = label;
+    }
+  }
+  free(used);
+  return ok && total >= SH_MINSAMPLES * known;
+}
+
+slicehash_t sh_solve(mm_t mm) {
+  if (mm->l3groups == NULL || mm->l3ngroups == 0)
+    return NULL;
+  if (PFN(mm_physaddr(mm, mm->l3buffer)) == 0)
+    return NULL;
+
+  uint64_t **phys = malloc(mm->l3ngroups * sizeof(uint64_t *));
+  int *lens = malloc(mm->l3ngroups * sizeof(int));
+  for (int g = 0; g < mm->l3ngroups; g++) {
+    lens[g] = vl_len(mm->l3groups[g]);
+    phys[g] = malloc((lens[g] + 1) * sizeof(uint64_t));
+    for (int i = 0; i < lens[g]; i++)
+      phys[g][i] = mm_physaddr(mm, vl_get(mm->l3groups[g], i));
+  }
+
+  slicehash_t sh = sh_new(mm->l3info.slices, mm->l3info.sets, mm->l3groupsize);
+  int ok;
+  if ((sh->slices & (sh->slices - 1)) == 0)
+    ok = solvelinear(mm, sh, phys, lens);
+  else
+    ok = solvetable(mm, sh, phys, lens);
+
+  for (int g = 0; g < mm->l3ngroups; g++)
+    free(phys[g]);
+  free(phys);
+  free(lens);
+  if (!ok) {
+    sh_release(sh);
+    return NULL;
+  }
+  return sh;
+}
+
+int sh_save(slicehash_t sh, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+    return -1;
+  fprintf(f, "# Mastik LLC slice hash\n");
+  fprintf(f, "geometry %d %d %d\n", sh->slices, sh->setsperslice, sh->groupsize);
+  for (int i = 0; i < sh->nmasks; i++)
+    fprintf(f, "mask 0x%lx\n", (unsigned long)sh->masks[i]);
+  if (sh->table != NULL)
+    for (int class = 0; class < sh->nclasses; class++)
+      for (int key = 0; key < 1 << sh->nmasks; key++)
+	if (sh->table[class << sh->nmasks | key] != SH_UNKNOWN)
+	  fprintf(f, "key %d 0x%x %d\n", class, key, sh->table[class << sh->nmasks | key]);
+  return fclose(f);
+}
+
+// Tables of older versions list page frames, which load as nothing
+slicehash_t sh_load(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return NULL;
+  slicehash_t sh = NULL;
+  int ok = 1;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    int slices, setsperslice, groupsize, class, key, label;
+    unsigned long v;
+    if (sscanf(line, "geometry %d %d %d", &slices, &setsperslice, &groupsize) == 3) {
+      if (sh == NULL && groupsize > 0 && setsperslice >= groupsize)
+	sh = sh_new(slices, setsperslice, groupsize);
+    } else if (sh && sscanf(line, "mask %lx", &v) == 1) {
+      // The masks key the table, so they all come before it
+      if (sh->nmasks < SH_MAXMASKS && sh->table == NULL)
+	sh->masks[sh->nmasks++] = v;
+      else
+	ok = 0;
+    } else if (sh && sscanf(line, "key %d %x %d", &class, &key, &label) == 3) {
+      if (sh->table == NULL && !newtable(sh))
+	ok = 0;
+      else if (class < 0 || class >= sh->nclasses || key < 0 || key >= 1 << sh->nmasks ||
+	  label < 0 || label >= sh->slices)
+	ok = 0;
+      else
+	sh->table[class << sh->nmasks | key] = label;
+    }
+  }
+  fclose(f);
+  if (sh != NULL && (!ok || (sh->table == NULL && (1 << sh->nmasks) != sh->slices))) {
+    sh_release(sh);
+    return NULL;
+  }
+  return sh;
+}
+
+
+static uint32_t cpusignature() {
+  union cpuid c;
+  bzero(&c, sizeof(c));
+  c.regs.eax = 1;
+  cpuid(&c);
+  return c.regs.eax;
+}
+
+static const char *shdir(char *buf, int len) {
+  const char *dir = getenv("MASTIK_SLICEHASH_DIR");
+  if (dir != NULL)
+    return dir;
+  const char *home = getenv("HOME");
+  if (home == NULL)
+    return NULL;
+  snprintf(buf, len, "%s/.mastik", home);
+  return buf;
+}
+
+char *sh_defaultpath(l3info_t l3info, char *path, int len) {
+  char buf[256];
+  const char *dir = shdir(buf, sizeof(buf));
+  if (dir == NULL)
+    return NULL;
+  snprintf(path, len, "%s/slicehash-%08x-%dx%d", dir, cpusignature(),
+      		l3info->slices, l3info->setsperslice);
+  return path;
+}
+
+slicehash_t sh_loadcpu(l3info_t l3info) {
+  char path[512];
+  if (sh_defaultpath(l3info, path, sizeof(path)) == NULL)
+    return NULL;
+  slicehash_t sh = sh_load(path);
+  if (sh != NULL && (sh->slices != l3info->slices || sh->setsperslice != l3info->setsperslice)) {
+    sh_release(sh);
+    return NULL;
+  }
+  return sh;
+}
+
+int sh_savecpu(slicehash_t sh, l3info_t l3info) {
+  char buf[256];
+  char path[512];
+  const char *dir = shdir(buf, sizeof(buf));
+  if (dir == NULL)
+    return -1;
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    return -1;
+  if (sh_defaultpath(l3info, path, sizeof(path)) == NULL)
+    return -1;
+  return sh_save(sh, path);
+}
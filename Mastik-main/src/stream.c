@@ -0,0 +1,337 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <mastik/low.h>
+#include <mastik/stream.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MS_MAGIC 0x4d53524e	// "MSRN"
+#define MS_VERSION 1
+#define MS_HEADERSIZE 128
+
+// Shared ring header.  head is the number of frames published.
+struct ms_ring {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t nslots;
+  uint32_t decimate;
+  uint32_t slotsize;
+  uint32_t closed;
+  uint32_t pad;
+  uint64_t head __attribute__((aligned(64)));
+};
+
+// Each slot is a sequence lock followed by the frame.  The lock is
+// 2 * seq + 1 while frame seq is written and 2 * seq + 2 once it is done.
+struct ms_slot {
+  uint64_t lock;
+  struct ms_frame frame;
+  uint16_t row[];
+};
+
+struct stream {
+  struct ms_ring *ring;
+  size_t size;
+  int fd;
+
+  // Publisher
+  int publisher;
+  int listenfd;
+  pthread_t thread;
+  char *path;
+  uint64_t written;
+
+  // Viewer
+  uint64_t next;
+  uint64_t dropped;
+};
+
+static inline struct ms_slot *slot(struct ms_ring *ring, uint64_t seq) {
+  return (struct ms_slot *)((char *)ring + MS_HEADERSIZE + (seq % ring->nslots) * ring->slotsize);
+}
+
+static int ringfd(size_t size) {
+  int fd;
+#ifdef __linux__
+  fd = memfd_create("mastik-stream", MFD_CLOEXEC);
+#else
+  char path[] = "/tmp/mastik-stream-XXXXXX";
+  fd = mkstemp(path);
+  if (fd >= 0)
+    unlink(path);
+#endif
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, size) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int unixaddr(struct sockaddr_un *addr, const char *path) {
+  bzero(addr, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+    return 0;
+  strcpy(addr->sun_path, path);
+  return 1;
+}
+
+// Hands the ring to every viewer that connects
+static void *announce(void *arg) {
+  stream_t s = arg;
+  for (;;) {
+    int c = accept(s->listenfd, NULL, NULL);
+    if (c < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+	continue;
+      return NULL;
+    }
+    char byte = 0;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    bzero(control, sizeof(control));
+    struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control,
+      .msg_controllen = sizeof(control)
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &s->fd, sizeof(int));
+    sendmsg(c, &msg, MSG_NOSIGNAL);
+    close(c);
+  }
+}
+
+stream_t ms_publish(const char *socketpath, int width, int nslots, int decimate) {
+  if (width <= 0 || nslots <= 0)
+    return NULL;
+  if (decimate < 1)
+    decimate = 1;
+  struct sockaddr_un addr;
+  if (!unixaddr(&addr, socketpath))
+    return NULL;
+
+  size_t slotsize = (sizeof(struct ms_slot) + width * sizeof(uint16_t) + 63) & ~(size_t)63;
+  size_t size = MS_HEADERSIZE + nslots * slotsize;
+  stream_t s = calloc(1, sizeof(struct stream));
+  s->publisher = 1;
+  s->size = size;
+  s->listenfd = -1;
+  s->fd = ringfd(size);
+  if (s->fd < 0)
+    goto fail;
+  s->ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+  if (s->ring == MAP_FAILED) {
+    s->ring = NULL;
+    goto fail;
+  }
+  s->ring->width = width;
+  s->ring->nslots = nslots;
+  s->ring->decimate = decimate;
+  s->ring->slotsize = slotsize;
+  s->ring->version = MS_VERSION;
+  __atomic_store_n(&s->ring->magic, MS_MAGIC, __ATOMIC_RELEASE);
+
+  s->listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s->listenfd < 0)
+    goto fail;
+  unlink(socketpath);
+  if (bind(s->listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s->listenfd, 8) < 0)
+    goto fail;
+  s->path = strdup(socketpath);
+  if (pthread_create(&s->thread, NULL, announce, s) != 0) {
+    unlink(s->path);
+    goto fail;
+  }
+  return s;
+
+fail:
+  if (s->listenfd >= 0)
+    close(s->listenfd);
+  if (s->ring)
+    munmap(s->ring, size);
+  if (s->fd >= 0)
+    close(s->fd);
+  free(s->path);
+  free(s);
+  return NULL;
+}
+
+// Never blocks: the frame is written in place and readers that race with
+// the write detect it through the sequence lock.
+void ms_write(stream_t s, const uint16_t *row, int len, uint32_t tag) {
+  if (s == NULL)
+    return;
+  struct ms_ring *ring = s->ring;
+  uint64_t index = s->written++;
+  if (index % ring->decimate)
+    return;
+  if (len > (int)ring->width)
+    len = ring->width;
+
+  uint64_t seq = ring->head;
+  struct ms_slot *sl = slot(ring, seq);
+  __atomic_store_n(&sl->lock, 2 * seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  sl->frame.seq = seq;
+  sl->frame.index = index;
+  sl->frame.tsc = rdtscp64();
+  sl->frame.tag = tag;
+  sl->frame.len = len;
+  memcpy(sl->row, row, len * sizeof(uint16_t));
+  __atomic_store_n(&sl->lock, 2 * seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&ring->head, seq + 1, __ATOMIC_RELEASE);
+}
+
+int ms_getwidth(stream_t s) {
+  return s->ring->width;
+}
+
+void ms_close(stream_t s) {
+  if (s == NULL)
+    return;
+  if (s->publisher) {
+    __atomic_store_n(&s->ring->closed, 1, __ATOMIC_RELEASE);
+    // Wakes the accept in the announcing thread
+    shutdown(s->listenfd, SHUT_RDWR);
+    pthread_join(s->thread, NULL);
+    close(s->listenfd);
+    unlink(s->path);
+    free(s->path);
+  }
+  munmap(s->ring, s->size);
+  close(s->fd);
+  free(s);
+}
+
+stream_t ms_attach(const char *socketpath) {
+  struct sockaddr_un addr;
+  if (!unixaddr(&addr, socketpath))
+    return NULL;
+  int c = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (c < 0)
+    return NULL;
+  if (connect(c, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(c);
+    return NULL;
+  }
+
+  char byte;
+  struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control)
+  };
+  ssize_t n = recvmsg(c, &msg, 0);
+  close(c);
+  struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    return NULL;
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+  struct stat st;
+  struct ms_ring *ring = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= MS_HEADERSIZE)
+    ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (ring == MAP_FAILED || ring->magic != MS_MAGIC || ring->version != MS_VERSION ||
+      MS_HEADERSIZE + (size_t)ring->nslots * ring->slotsize > (size_t)st.st_size) {
+    if (ring != MAP_FAILED)
+      munmap(ring, st.st_size);
+    close(fd);
+    return NULL;
+  }
+
+  stream_t s = calloc(1, sizeof(struct stream));
+  s->ring = ring;
+  s->size = st.st_size;
+  s->fd = fd;
+  s->listenfd = -1;
+  s->next = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  return s;
+}
+
+int ms_read(stream_t s, struct ms_frame *frames, uint16_t *rows, int maxframes) {
+  struct ms_ring *ring = s->ring;
+  int closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (head - s->next > ring->nslots) {
+    s->dropped += head - ring->nslots - s->next;
+    s->next = head - ring->nslots;
+  }
+
+  int n = 0;
+  for (; s->next < head && n < maxframes; s->next++) {
+    struct ms_slot *sl = slot(ring, s->next);
+    uint64_t lock = __atomic_load_n(&sl->lock, __ATOMIC_ACQUIRE);
+    if (lock != 2 * s->next + 2) {
+      s->dropped++;
+      continue;
+    }
+    frames[n] = sl->frame;
+    uint32_t len = frames[n].len <= ring->width ? frames[n].len : ring->width;
+    memcpy(rows + (size_t)n * ring->width, sl->row, len * sizeof(uint16_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&sl->lock, __ATOMIC_RELAXED) != lock) {
+      s->dropped++;
+      continue;
+    }
+    frames[n].len = len;
+    n++;
+  }
+  if (n == 0 && closed && s->next >= head)
+    return -1;
+  return n;
+}
+
+uint64_t ms_dropped(stream_t s) {
+  return s->dropped;
+}
+
+void ms_detach(stream_t s) {
+  ms_close(s);
+}
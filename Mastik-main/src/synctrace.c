@@ -30,6 +30,7 @@
 
 #include <mastik/lx.h>
 #include <mastik/l2.h>
+#include <mastik/l3.h>
 
 #define ST_TRACEWIDTH L2_SETS
 
@@ -58,6 +59,11 @@ struct synctrace
   int map[L2_SETS];
   uint8_t clusterMask;
   st_clusters_t clusters;
+
+  // Sparse LLC data
+  st_sparseclusters_t sparse;
+  int64_t *ranksum;
+  int64_t *ranksq;
 };
 
 void dummy_setup_cb(int nrecords, void *data)
@@ -65,8 +71,7 @@ void dummy_setup_cb(int nrecords, void *data)
   return;
 }
 
-// Synchronized Prime+Probe
-int st_lxpp(lxpp_t lx, int nrecords, st_setup_cb setup, st_exec_cb exec, st_process_cb process, void *data)
+static int synclxpp(lxpp_t lx, int nrecords, st_setup_cb setup, st_exec_cb exec, st_process_cb process, void *data, int count)
 {
   assert(lx != NULL);
   assert(exec != NULL);
@@ -84,9 +89,15 @@ int st_lxpp(lxpp_t lx, int nrecords, st_setup_cb setup, st_exec_cb exec, st_proc
   for (int i = 0; i < nrecords; i++)
   {
     setup(i, data);
-    lx_probe(lx, res);
+    if (count)
+      lx_probecount(lx, res);
+    else
+      lx_probe(lx, res);
     exec(i, data);
-    lx_bprobe(lx, res);
+    if (count)
+      lx_bprobecount(lx, res);
+    else
+      lx_bprobe(lx, res);
     process(i, data, len, res);
   }
 
@@ -94,6 +105,12 @@ int st_lxpp(lxpp_t lx, int nrecords, st_setup_cb setup, st_exec_cb exec, st_proc
   return nrecords;
 }
 
+// Synchronized Prime+Probe
+int st_lxpp(lxpp_t lx, int nrecords, st_setup_cb setup, st_exec_cb exec, st_process_cb process, void *data)
+{
+  return synclxpp(lx, nrecords, setup, exec, process, data, 0);
+}
+
 /*
 // Synchronized Evict+Time
 int st_l1et(l1pp_t l1, int nrecords, st_setup_cb setup, st_exec_cb exec, st_process_cb process, void *data);
@@ -152,6 +169,36 @@ static void spp_process(int recnum, void *vst, int nres, uint16_t results[])
   }
 }
 
+// Columns follow the monitored set, so no map is needed.  Counts need no
+// limit.
+static void sparse_process(int recnum, void *vst, int nres, uint16_t results[])
+{
+  synctrace_t st = (synctrace_t)vst;
+  for (int byte = 0; byte < st->blockSize; byte++)
+  {
+    st_sparseclusters_t cl = st->sparse + byte;
+    int inputbyte = st->split[byte] & st->clusterMask;
+    cl->count[inputbyte]++;
+    int64_t *avg = cl->avg + inputbyte * cl->nsets;
+    int64_t *var = cl->var + inputbyte * cl->nsets;
+    for (int i = 0; i < nres; i++)
+    {
+      avg[i] += results[i];
+      var[i] += (int64_t)results[i] * results[i];
+    }
+  }
+}
+
+static void rank_process(int recnum, void *vst, int nres, uint16_t results[])
+{
+  synctrace_t st = (synctrace_t)vst;
+  for (int i = 0; i < nres; i++)
+  {
+    st->ranksum[i] += results[i];
+    st->ranksq[i] += (int64_t)results[i] * results[i];
+  }
+}
+
 static void spp_exec(int recnum, void *vst)
 {
   synctrace_t st = (synctrace_t)vst;
@@ -196,6 +243,151 @@ static void normalise(int blockSize, st_clusters_t clusters,
   }
 }
 
+static void sparse_normalise(int blockSize, st_sparseclusters_t clusters)
+{
+  int nsets = clusters->nsets;
+  for (int byte = 0; byte < blockSize; byte++)
+  {
+    st_sparseclusters_t cl = clusters + byte;
+    int total_count = 0;
+    int64_t total_avg[nsets];
+    memset(total_avg, 0, sizeof(total_avg));
+    for (int cluster = 0; cluster < 256; cluster++)
+    {
+      int count = cl->count[cluster];
+      if (count == 0)
+        continue;
+      total_count += count;
+      int64_t *avg = cl->avg + cluster * nsets;
+      for (int set = 0; set < nsets; set++)
+      {
+        total_avg[set] += avg[set];
+        avg[set] = (avg[set] * SCALE + count / 2) / count;
+      }
+    }
+    if (total_count == 0)
+      continue;
+    for (int set = 0; set < nsets; set++)
+      total_avg[set] = (total_avg[set] * SCALE + total_count / 2) / total_count;
+
+    for (int cluster = 0; cluster < 256; cluster++)
+      if (cl->count[cluster])
+        for (int set = 0; set < nsets; set++)
+          cl->avg[cluster * nsets + set] -= total_avg[set];
+  }
+}
+
+// Keeps the keep sets whose counts varied most over the ranking pass
+static void rank(l3pp_t l3, synctrace_t st, int nsets, int nsamples, int keep)
+{
+  int *sets = malloc(nsets * sizeof(int));
+  l3_getmonitoredset(l3, sets, nsets);
+  int64_t *score = malloc(nsets * sizeof(int64_t));
+  // nsamples^2 times the variance
+  for (int i = 0; i < nsets; i++)
+    score[i] = st->ranksq[i] * nsamples - st->ranksum[i] * st->ranksum[i];
+  for (int k = 0; k < keep; k++)
+  {
+    int best = k;
+    for (int i = k + 1; i < nsets; i++)
+      if (score[i] > score[best])
+        best = i;
+    int64_t ts = score[k];
+    score[k] = score[best];
+    score[best] = ts;
+    int t = sets[k];
+    sets[k] = sets[best];
+    sets[best] = t;
+  }
+  for (int i = keep; i < nsets; i++)
+    l3_unmonitor(l3, sets[i]);
+  free(score);
+  free(sets);
+}
+
+st_sparseclusters_t syncPrimeProbeL3(int nsamples,
+                                     int blockSize,
+                                     int splitinput,
+                                     uint8_t *fixMask,
+                                     uint8_t *fixData,
+                                     st_crypto_f crypto,
+                                     void *cryptoData,
+                                     uint8_t clusterMask,
+                                     l3pp_t l3,
+                                     const int *sets,
+                                     int nsets,
+                                     int keep,
+                                     int ranksamples)
+{
+  assert(l3 != NULL);
+  l3_unmonitorall(l3);
+  if (sets == NULL)
+  {
+    nsets = l3_getSets(l3);
+    for (int i = 0; i < nsets; i++)
+      l3_monitor(l3, i);
+  }
+  else
+    for (int i = 0; i < nsets; i++)
+      l3_monitor(l3, sets[i]);
+  int nmonitored = l3_getmonitoredset(l3, NULL, 0);
+  if (nmonitored == 0)
+    return NULL;
+
+  synctrace_t st = (synctrace_t)malloc(sizeof(struct synctrace));
+  memset(st, 0, sizeof(struct synctrace));
+  st->blockSize = blockSize;
+  if (fixMask && fixData)
+  {
+    memcpy(st->fixMask, fixMask, blockSize);
+    memcpy(st->fixData, fixData, blockSize);
+  }
+  st->crypto = crypto;
+  st->cryptoData = cryptoData;
+  st->clusterMask = clusterMask;
+  st->split = splitinput ? st->input : st->output;
+
+  if (keep > 0 && keep < nmonitored && ranksamples > 0)
+  {
+    st->ranksum = calloc(nmonitored, sizeof(int64_t));
+    st->ranksq = calloc(nmonitored, sizeof(int64_t));
+    synclxpp((lxpp_t)l3, ranksamples, spp_setup, spp_exec, rank_process, st, 1);
+    rank(l3, st, nmonitored, ranksamples, keep);
+    free(st->ranksum);
+    free(st->ranksq);
+    nmonitored = keep;
+  }
+
+  st_sparseclusters_t clusters = calloc(blockSize, sizeof(struct st_sparseclusters));
+  int *columns = malloc(nmonitored * sizeof(int));
+  l3_getmonitoredset(l3, columns, nmonitored);
+  int64_t *avg = calloc((size_t)blockSize * 256 * nmonitored, sizeof(int64_t));
+  int64_t *var = calloc((size_t)blockSize * 256 * nmonitored, sizeof(int64_t));
+  for (int byte = 0; byte < blockSize; byte++)
+  {
+    clusters[byte].nsets = nmonitored;
+    clusters[byte].sets = columns;
+    clusters[byte].avg = avg + (size_t)byte * 256 * nmonitored;
+    clusters[byte].var = var + (size_t)byte * 256 * nmonitored;
+  }
+  st->sparse = clusters;
+  synclxpp((lxpp_t)l3, nsamples, spp_setup, spp_exec, sparse_process, st, 1);
+
+  free(st);
+  sparse_normalise(blockSize, clusters);
+  return clusters;
+}
+
+void st_freesparseclusters(st_sparseclusters_t clusters)
+{
+  if (clusters == NULL)
+    return;
+  free(clusters->sets);
+  free(clusters->avg);
+  free(clusters->var);
+  free(clusters);
+}
+
 st_clusters_t syncPrimeProbe(int nsamples,
                              int blockSize,
                              int splitinput,
@@ -225,6 +417,12 @@ st_clusters_t syncPrimeProbe(int nsamples,
     lx = (lxpp_t)l1_prepare(NULL);
   else if (cachelevel == 2)
     lx = (lxpp_t)l2_prepare(NULL, NULL);
+  else
+  {
+    free(clusters);
+    free(st);
+    return NULL;
+  }
 
   lx_monitorall(lx);
 
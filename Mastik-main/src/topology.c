@@ -0,0 +1,368 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <unistd.h>
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+
+#include <mastik/l3.h>
+#include <mastik/topology.h>
+
+#define SYSCPU "/sys/devices/system/cpu"
+
+#define ISSET(mask, c) ((mask)[(c) / 64] & (1ULL << ((c) % 64)))
+#define SET(mask, c) ((mask)[(c) / 64] |= 1ULL << ((c) % 64))
+
+struct topology {
+  int ncpus;
+  struct tpcpu *cpus;	// Indexed by CPU number, cpu is -1 if offline
+  int nllcs;
+  struct tpllc *llcs;
+};
+
+static int readint(const char *path, int *value) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  int rv = fscanf(f, "%d", value) == 1;
+  fclose(f);
+  return rv;
+}
+
+// Parses a kernel CPU list such as 0-3,8-11 into cpus.  Returns the
+// number of CPUs listed.
+static int readcpulist(const char *path, uint64_t *cpus) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  char buf[4096];
+  char *p = fgets(buf, sizeof(buf), f);
+  fclose(f);
+  if (p == NULL)
+    return 0;
+  int n = 0;
+  while (*p && *p != '\n') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p)
+      break;
+    long last = first;
+    p = end;
+    if (*p == '-')
+      last = strtol(p + 1, &p, 10);
+    for (long c = first; c <= last && c < TP_MAXCPUS; c++, n++)
+      SET(cpus, c);
+    if (*p == ',')
+      p++;
+  }
+  return n;
+}
+
+static int cpuint(int cpu, const char *file, int *value) {
+  char path[128];
+  snprintf(path, sizeof(path), SYSCPU "/cpu%d/%s", cpu, file);
+  return readint(path, value);
+}
+
+static int cpulist(int cpu, const char *file, uint64_t *cpus) {
+  char path[128];
+  snprintf(path, sizeof(path), SYSCPU "/cpu%d/%s", cpu, file);
+  return readcpulist(path, cpus);
+}
+
+// The cache index of the last level cache of cpu, -1 if none is listed
+static int llcindex(int cpu) {
+  int best = -1;
+  int bestlevel = 0;
+  for (int i = 0;; i++) {
+    char file[64];
+    int level;
+    snprintf(file, sizeof(file), "cache/index%d/level", i);
+    if (!cpuint(cpu, file, &level))
+      break;
+    if (level > bestlevel) {
+      bestlevel = level;
+      best = i;
+    }
+  }
+  return bestlevel >= 3 ? best : -1;
+}
+
+// The node of a CPU is given by a nodeN link in its directory
+static int cpunode(int cpu) {
+  char path[128];
+  snprintf(path, sizeof(path), SYSCPU "/cpu%d", cpu);
+  DIR *d = opendir(path);
+  if (d == NULL)
+    return -1;
+  int node = -1;
+  struct dirent *e;
+  while (node < 0 && (e = readdir(d)) != NULL)
+    if (strncmp(e->d_name, "node", 4) == 0)
+      sscanf(e->d_name + 4, "%d", &node);
+  closedir(d);
+  return node;
+}
+
+// Fills the LLC domain of cpu, the whole package if there is no cache
+// information
+static void readllc(int cpu, tpllc_t llc) {
+  bzero(llc, sizeof(struct tpllc));
+  llc->id = -1;
+  int index = llcindex(cpu);
+  if (index >= 0) {
+    char file[64];
+    snprintf(file, sizeof(file), "cache/index%d/id", index);
+    cpuint(cpu, file, &llc->id);
+    snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", index);
+    llc->ncpus = cpulist(cpu, file, llc->cpus);
+    snprintf(file, sizeof(file), "cache/index%d/ways_of_associativity", index);
+    cpuint(cpu, file, &llc->associativity);
+    snprintf(file, sizeof(file), "cache/index%d/number_of_sets", index);
+    cpuint(cpu, file, &llc->sets);
+    int kb;
+    snprintf(file, sizeof(file), "cache/index%d/size", index);
+    if (cpuint(cpu, file, &kb))
+      llc->size = (size_t)kb * 1024;
+  }
+  if (llc->ncpus == 0)
+    llc->ncpus = cpulist(cpu, "topology/core_siblings_list", llc->cpus);
+  if (llc->ncpus == 0) {
+    SET(llc->cpus, cpu);
+    llc->ncpus = 1;
+  }
+  llc->inclusive = -1;
+}
+
+// cpuid describes the cache of the CPU the caller runs on, which is taken
+// to stand for all domains
+static void cpuidllc(topology_t tp) {
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  if (!loadL3cpuidInfo(&l3info))
+    return;
+  for (int i = 0; i < tp->nllcs; i++) {
+    tpllc_t llc = &tp->llcs[i];
+    llc->inclusive = l3info.cpuidInfo.cacheInfo.inclusive;
+    if (llc->associativity == 0)
+      llc->associativity = l3info.cpuidInfo.cacheInfo.associativity + 1;
+    if (llc->sets == 0)
+      llc->sets = l3info.cpuidInfo.cacheInfo.sets + 1;
+    if (llc->size == 0)
+      llc->size = (size_t)llc->associativity * llc->sets * (l3info.cpuidInfo.cacheInfo.lineSize + 1);
+  }
+}
+
+topology_t tp_discover(void) {
+  uint64_t online[TP_MAXCPUS / 64];
+  bzero(online, sizeof(online));
+  if (readcpulist(SYSCPU "/online", online) == 0)
+    return NULL;
+  uint64_t pcores[TP_MAXCPUS / 64], ecores[TP_MAXCPUS / 64];
+  bzero(pcores, sizeof(pcores));
+  bzero(ecores, sizeof(ecores));
+  int hybrid = readcpulist("/sys/devices/cpu_core/cpus", pcores) +
+    readcpulist("/sys/devices/cpu_atom/cpus", ecores);
+  uint64_t isolated[TP_MAXCPUS / 64], nohzfull[TP_MAXCPUS / 64];
+  bzero(isolated, sizeof(isolated));
+  bzero(nohzfull, sizeof(nohzfull));
+  readcpulist(SYSCPU "/isolated", isolated);
+  readcpulist(SYSCPU "/nohz_full", nohzfull);
+
+  topology_t tp = calloc(1, sizeof(struct topology));
+  for (int c = 0; c < TP_MAXCPUS; c++)
+    if (ISSET(online, c))
+      tp->ncpus = c + 1;
+  tp->cpus = calloc(tp->ncpus, sizeof(struct tpcpu));
+  tp->llcs = calloc(tp->ncpus, sizeof(struct tpllc));
+
+  for (int c = 0; c < tp->ncpus; c++) {
+    tpcpu_t cpu = &tp->cpus[c];
+    cpu->cpu = -1;
+    if (!ISSET(online, c))
+      continue;
+    cpu->cpu = c;
+    if (!cpuint(c, "topology/physical_package_id", &cpu->socket))
+      cpu->socket = 0;
+    if (!cpuint(c, "topology/core_id", &cpu->core))
+      cpu->core = c;
+    cpu->sibling = -1;
+    uint64_t siblings[TP_MAXCPUS / 64];
+    bzero(siblings, sizeof(siblings));
+    cpulist(c, "topology/thread_siblings_list", siblings);
+    for (int s = 0; s < tp->ncpus && cpu->sibling < 0; s++)
+      if (s != c && ISSET(siblings, s) && ISSET(online, s))
+	cpu->sibling = s;
+    cpu->node = cpunode(c);
+    cpu->type = !hybrid ? TP_CORE_UNKNOWN : ISSET(ecores, c) ? TP_CORE_EFFICIENCY : TP_CORE_PERFORMANCE;
+    cpu->isolated = (ISSET(isolated, c) ? TP_ISOLATED : 0) | (ISSET(nohzfull, c) ? TP_NOHZFULL : 0);
+
+    // CPUs sharing a cache list the same CPUs
+    struct tpllc llc;
+    readllc(c, &llc);
+    for (int i = 0; i < TP_MAXCPUS / 64; i++)
+      llc.cpus[i] &= online[i];
+    cpu->llc = -1;
+    for (int l = 0; l < tp->nllcs && cpu->llc < 0; l++)
+      if (memcmp(tp->llcs[l].cpus, llc.cpus, sizeof(llc.cpus)) == 0)
+	cpu->llc = l;
+    if (cpu->llc < 0) {
+      llc.socket = cpu->socket;
+      llc.ncpus = 0;
+      for (int s = 0; s < TP_MAXCPUS; s++)
+	if (ISSET(llc.cpus, s))
+	  llc.ncpus++;
+      cpu->llc = tp->nllcs;
+      tp->llcs[tp->nllcs++] = llc;
+    }
+    if (cpu->node >= 0 && cpu->node < 64)
+      tp->llcs[cpu->llc].nodes |= 1ULL << cpu->node;
+  }
+  cpuidllc(tp);
+  return tp;
+}
+
+void tp_release(topology_t tp) {
+  if (tp == NULL)
+    return;
+  free(tp->cpus);
+  free(tp->llcs);
+  free(tp);
+}
+
+int tp_ncpus(topology_t tp) {
+  return tp->ncpus;
+}
+
+int tp_getcpu(topology_t tp, int cpu, tpcpu_t info) {
+  if (cpu < 0 || cpu >= tp->ncpus || tp->cpus[cpu].cpu < 0)
+    return 0;
+  *info = tp->cpus[cpu];
+  return 1;
+}
+
+int tp_nllcs(topology_t tp) {
+  return tp->nllcs;
+}
+
+int tp_getllc(topology_t tp, int llc, tpllc_t info) {
+  if (llc < 0 || llc >= tp->nllcs)
+    return 0;
+  *info = tp->llcs[llc];
+  return 1;
+}
+
+int tp_llcof(topology_t tp, int cpu) {
+#ifdef __linux__
+  if (cpu < 0)
+    cpu = sched_getcpu();
+#endif
+  if (cpu < 0 || cpu >= tp->ncpus || tp->cpus[cpu].cpu < 0)
+    return -1;
+  return tp->cpus[cpu].llc;
+}
+
+// A core of an LLC domain: its first hardware thread and another one
+struct core {
+  int first;
+  int second;
+  int used;
+};
+
+int tp_place(topology_t tp, int llc, int flags, int ncontention, tpplacement_t placement) {
+  bzero(placement, sizeof(struct tpplacement));
+  placement->prober = placement->victim = placement->writer = -1;
+  if (llc < 0)
+    llc = tp_llcof(tp, -1);
+  if (llc < 0 || llc >= tp->nllcs)
+    return 0;
+  placement->llc = llc;
+  if (ncontention > TP_MAXCONTENTION)
+    ncontention = TP_MAXCONTENTION;
+
+  // Performance cores first, then the efficiency cores
+  struct core *cores = calloc(tp->ncpus, sizeof(struct core));
+  int ncores = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int c = 0; c < tp->ncpus; c++) {
+      tpcpu_t cpu = &tp->cpus[c];
+      if (cpu->cpu < 0 || cpu->llc != llc || (cpu->type == TP_CORE_EFFICIENCY) != pass)
+	continue;
+      if (cpu->sibling >= 0 && cpu->sibling < c)
+	continue;
+      cores[ncores].first = c;
+      cores[ncores].second = cpu->sibling;
+      ncores++;
+    }
+  }
+
+  if (ncores == 0) {
+    free(cores);
+    return 0;
+  }
+  // The most isolated core, in the order above, takes the prober
+  int best = 0;
+  for (int i = 1; i < ncores; i++)
+    if (tp->cpus[cores[i].first].isolated > tp->cpus[cores[best].first].isolated)
+      best = i;
+  struct core t = cores[0];
+  cores[0] = cores[best];
+  cores[best] = t;
+  placement->prober = cores[0].first;
+  cores[0].used = 1;
+  if (flags & TP_VICTIM_SIBLING) {
+    placement->victim = cores[0].second;
+  } else {
+    for (int i = 1; i < ncores && placement->victim < 0; i++) {
+      placement->victim = cores[i].first;
+      cores[i].used = 1;
+    }
+  }
+
+  // Whole cores first, then the second threads of cores other than the
+  // prober's
+  for (int i = 1; i < ncores && placement->ncontention < ncontention; i++) {
+    if (!cores[i].used) {
+      placement->contention[placement->ncontention++] = cores[i].first;
+      cores[i].used = 1;
+    }
+  }
+  for (int i = 1; i < ncores && placement->ncontention < ncontention; i++)
+    if (cores[i].second >= 0)
+      placement->contention[placement->ncontention++] = cores[i].second;
+
+  // The writer goes to another domain if there is one
+  for (int c = 0; c < tp->ncpus && placement->writer < 0; c++)
+    if (tp->cpus[c].cpu >= 0 && tp->cpus[c].llc != llc)
+      placement->writer = c;
+  for (int i = 1; i < ncores && placement->writer < 0; i++)
+    if (!cores[i].used)
+      placement->writer = cores[i].first;
+  free(cores);
+  return 1;
+}
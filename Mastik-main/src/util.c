@@ -21,40 +21,139 @@
 #define _GNU_SOURCE
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #ifdef HAVE_SCHED_H
 #include <sched.h>
 #endif
 
 #include <mastik/low.h>
+#include <mastik/util.h>
 
 const char *mastik_version() {
   return PACKAGE_VERSION;
 }
 
-void *map_offset(const char *file, uint64_t offset) {
+/*
+ * Files mapped by map_offset are kept in a registry so that each file is
+ * mapped once, as a whole, no matter how many offsets within it are
+ * requested.  Each entry counts the outstanding map_offset calls and the
+ * mapping is removed when the last of them is passed to unmap_offset.
+ * The registry is guarded by mappedlock.
+ */
+struct mappedfile {
+  struct mappedfile *next;
+  dev_t dev;
+  ino_t ino;
+  char *base;
+  size_t size;
+  int refcount;
+  int flags;
+};
+
+static struct mappedfile *mappedfiles = NULL;
+static pthread_mutex_t mappedlock = PTHREAD_MUTEX_INITIALIZER;
+
+static void prefault(struct mappedfile *mf) {
+  long pagesize = sysconf(_SC_PAGE_SIZE);
+  for (size_t off = 0; off < mf->size; off += pagesize)
+    memaccess(mf->base + off);
+}
+
+static void unmapfile(struct mappedfile *mf) {
+  for (struct mappedfile **pmf = &mappedfiles; *pmf != NULL; pmf = &(*pmf)->next) {
+    if (*pmf == mf) {
+      *pmf = mf->next;
+      break;
+    }
+  }
+  if (mf->flags & MAPOFFSET_MLOCK)
+    munlock(mf->base, mf->size);
+  munmap(mf->base, mf->size);
+  free(mf);
+}
+
+static struct mappedfile *mapfile(const char *file) {
+  struct stat st;
+  if (stat(file, &st) < 0)
+    return NULL;
+  for (struct mappedfile *mf = mappedfiles; mf != NULL; mf = mf->next)
+    if (mf->dev == st.st_dev && mf->ino == st.st_ino)
+      return mf;
+
   int fd = open(file, O_RDONLY);
   if (fd < 0)
     return NULL;
-  
-  char *mapaddress = MAP_FAILED;
-#ifdef HAVE_MMAP64
-  mapaddress = mmap(0, sysconf(_SC_PAGE_SIZE), PROT_READ, MAP_PRIVATE, fd, offset & ~(sysconf(_SC_PAGE_SIZE) -1));
-#else
-  mapaddress = mmap(0, sysconf(_SC_PAGE_SIZE), PROT_READ, MAP_PRIVATE, fd, ((off_t)offset) & ~(sysconf(_SC_PAGE_SIZE) -1));
-#endif
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  char *mapaddress = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
   close(fd);
   if (mapaddress == MAP_FAILED)
     return NULL;
-  return (void *)(mapaddress+(offset & (sysconf(_SC_PAGE_SIZE) -1)));
+
+  struct mappedfile *mf = calloc(1, sizeof(struct mappedfile));
+  if (mf == NULL) {
+    munmap(mapaddress, st.st_size);
+    return NULL;
+  }
+  mf->dev = st.st_dev;
+  mf->ino = st.st_ino;
+  mf->base = mapaddress;
+  mf->size = st.st_size;
+  mf->next = mappedfiles;
+  mappedfiles = mf;
+  return mf;
+}
+
+void *map_offset_flags(const char *file, uint64_t offset, int flags) {
+  pthread_mutex_lock(&mappedlock);
+  struct mappedfile *mf = mapfile(file);
+  if (mf == NULL) {
+    pthread_mutex_unlock(&mappedlock);
+    return NULL;
+  }
+  if (offset >= mf->size) {
+    if (mf->refcount == 0)
+      unmapfile(mf);
+    pthread_mutex_unlock(&mappedlock);
+    return NULL;
+  }
+
+  // Apply any options the earlier requests for this file did not ask for.
+  int newflags = flags & ~mf->flags;
+  if (newflags & MAPOFFSET_PREFAULT)
+    prefault(mf);
+  if ((newflags & MAPOFFSET_MLOCK) && mlock(mf->base, mf->size) < 0)
+    newflags &= ~MAPOFFSET_MLOCK;
+  mf->flags |= newflags;
+
+  mf->refcount++;
+  pthread_mutex_unlock(&mappedlock);
+  return (void *)(mf->base + offset);
+}
+
+void *map_offset(const char *file, uint64_t offset) {
+  return map_offset_flags(file, offset, 0);
 }
 
 
 void unmap_offset(void *address) {
-  munmap((char *)(((uintptr_t)address) & ~(sysconf(_SC_PAGE_SIZE) -1)),
-      			sysconf(_SC_PAGE_SIZE));
+  char *p = (char *)address;
+  pthread_mutex_lock(&mappedlock);
+  for (struct mappedfile *mf = mappedfiles; mf != NULL; mf = mf->next) {
+    if (p >= mf->base && p < mf->base + mf->size) {
+      if (--mf->refcount == 0)
+        unmapfile(mf);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mappedlock);
 }
 
 
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <mastik/numa.h>
+#include <mastik/mm.h>
+
+// Places a buffer on the nodes of the caller's LLC and checks the pages
+// through /proc/self/numa_maps.  Hosts without the sysfs topology skip.
+
+#define BUFSIZE (4 << 20)
+
+int main(int c, char **v) {
+  struct numaplacement p;
+  if (!numa_llcplacement(-1, &p)) {
+    printf("# No topology, skipped\n");
+    return 0;
+  }
+  printf("# CPU %d socket %d LLC %d: %d CPUs, nodes 0x%llx\n", p.cpu, p.socket, p.llc, p.ncpus,
+      (unsigned long long)p.nodes);
+  int bad = 0;
+  if (p.ncpus < 1 || !(p.cpus[p.cpu / 64] & (1ULL << (p.cpu % 64))))
+    bad++;
+  if (!numa_pin(&p))
+    bad++;
+
+  char *buf = mmap(NULL, BUFSIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (!numa_bind(buf, BUFSIZE, p.nodes))
+    bad++;
+  memset(buf, 1, BUFSIZE);
+  if (p.nodes) {
+    long off = numa_offnode(buf, p.nodes);
+    long others = numa_offnode(buf, ~p.nodes);
+    printf("# %ld pages off the nodes, %ld off the other nodes\n", off, others);
+    if (off != 0 || others < BUFSIZE / 4096)
+      bad++;
+  }
+  munmap(buf, BUFSIZE);
+
+  // A placed mm keeps its placement
+  mm_t mm = mm_prepare(NULL, NULL, NULL);
+  struct numaplacement q;
+  if (!mm_setsocket(mm, p.socket) || !mm_getplacement(mm, &q) || q.socket != p.socket)
+    bad++;
+  mm_release(mm);
+
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
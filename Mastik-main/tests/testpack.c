@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <mastik/l3.h>
+#include <mastik/mm.h>
+#include <mastik/sim.h>
+#include <mastik/pack.h>
+#include <mastik/stream.h>
+#include <mastik/taint.h>
+
+// Round trips of packed records, including unknown results, the bitmap
+// popcounts, and a packed capture of a simulated cache against the rows
+// it streamed.
+
+#define RECORDS 50
+#define NSETS 70
+
+#define THRESHOLD 2
+
+// The expected unpacked row
+static void expect(const uint16_t *row, int width, int bits, uint16_t *exp) {
+  int unknown = 0;
+  for (int i = 0; i < width; i++) {
+    if (row[i] >= TAINT_FLAGGED)
+      unknown = 1;
+    if (row[i] >= TAINT_FLAGGED)
+      exp[i] = PK_UNKNOWN;
+    else if (bits == PK_BITMAP)
+      exp[i] = row[i] > THRESHOLD;
+    else
+      exp[i] = row[i] > pk_maxcount(bits) ? pk_maxcount(bits) : row[i];
+  }
+  if (bits == PK_BITMAP && unknown)
+    for (int i = 0; i < width; i++)
+      exp[i] = PK_UNKNOWN;
+}
+
+static l3pp_t simcache(sim_t *sim, mm_t *mm, int assoc) {
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  l3info.flags = L3FLAG_NOHUGEPAGES;
+  l3info.associativity = assoc;
+  l3info.setsperslice = 1024;
+  l3info.slices = 1;
+  struct siminfo si;
+  bzero(&si, sizeof(si));
+  si.associativity = assoc;
+  si.setsperslice = 1024;
+  si.slices = 1;
+  si.noise = 20000;
+  *sim = sim_new(&si);
+  *mm = mm_prepare(NULL, NULL, (lxinfo_t)&l3info);
+  mm_setsim(*mm, *sim);
+  l3pp_t l3 = l3_prepare(&l3info, *mm);
+  if (l3 == NULL)
+    exit(1);
+  for (int i = 0; i < NSETS; i++)
+    l3_monitor(l3, i * 13);
+  return l3;
+}
+
+int main(int c, char **v) {
+  int bad = 0;
+  int allbits[] = { PK_BITMAP, PK_NIBBLE, PK_COUNT5 };
+  uint16_t *rows = malloc(RECORDS * 200 * sizeof(uint16_t));
+  uint16_t *out = malloc(RECORDS * 200 * sizeof(uint16_t));
+  uint16_t *exp = malloc(RECORDS * 200 * sizeof(uint16_t));
+  char *packed = malloc(RECORDS * pk_recordsize(200, PK_COUNT5));
+  for (int b = 0; b < 3; b++) {
+    int bits = allbits[b];
+    for (int width = 1; width <= 200; width += 13) {
+      size_t size = pk_recordsize(width, bits);
+      if (size % 8 || size * 8 < (size_t)width * bits)
+	bad++;
+      // Every seventh row is a missed slot, and some results are flagged
+      for (int r = 0; r < RECORDS; r++)
+	for (int j = 0; j < width; j++) {
+	  uint16_t *v = rows + r * width + j;
+	  *v = random() % 3 ? 0 : random() % 40;
+	  if (r % 7 == 3)
+	    *v = -1;
+	  else if (random() % 500 == 0)
+	    *v = TAINT_FLAGGED;
+	}
+      for (int r = 0; r < RECORDS; r++) {
+	pk_pack(rows + r * width, width, bits, THRESHOLD, packed + r * size);
+	expect(rows + r * width, width, bits, exp + r * width);
+      }
+      pk_unpack(packed, RECORDS, width, bits, out);
+      for (int i = 0; i < RECORDS * width; i++)
+	if (out[i] != exp[i])
+	  bad++;
+
+      if (bits != PK_BITMAP)
+	continue;
+      uint32_t counts[200];
+      bzero(counts, sizeof(counts));
+      int known = 0;
+      for (int r = 0; r < RECORDS; r++)
+	known += exp[r * width] != PK_UNKNOWN;
+      if (pk_columncounts(packed, RECORDS, width, counts) != known)
+	bad++;
+      for (int j = 0; j < width; j++) {
+	uint32_t n = 0;
+	for (int r = 0; r < RECORDS; r++)
+	  n += exp[r * width + j] == 1;
+	if (counts[j] != n)
+	  bad++;
+      }
+      for (int r = 0; r < RECORDS; r++) {
+	int n = 0;
+	for (int j = 0; j < width; j++)
+	  n += exp[r * width + j] == 1;
+	if (exp[r * width] == PK_UNKNOWN)
+	  n = -1;
+	if (pk_popcount(packed + r * size, width) != n)
+	  bad++;
+      }
+    }
+  }
+
+  // The stream publishes each row of a capture before it is packed
+  sim_t sim;
+  mm_t mm;
+  l3pp_t l3 = simcache(&sim, &mm, 12);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/testpack-%d.sock", getpid());
+  stream_t pub = ms_publish(path, NSETS, RECORDS, 1);
+  stream_t view = pub ? ms_attach(path) : NULL;
+  if (view == NULL)
+    exit(1);
+  l3_setstream(l3, pub);
+  struct ms_frame frames[RECORDS];
+  for (int b = 0; b < 3; b++) {
+    int bits = allbits[b];
+    if (l3_repeatedprobecountpacked(l3, RECORDS, packed, bits, THRESHOLD, 0) != RECORDS)
+      bad++;
+    if (ms_read(view, frames, rows, RECORDS) != RECORDS)
+      bad++;
+    pk_unpack(packed, RECORDS, NSETS, bits, out);
+    for (int r = 0; r < RECORDS; r++)
+      expect(rows + r * NSETS, NSETS, bits, exp + r * NSETS);
+    int misses = 0;
+    for (int i = 0; i < RECORDS * NSETS; i++) {
+      misses += rows[i] != 0;
+      if (out[i] != exp[i])
+	bad++;
+    }
+    printf("# %d bits: %d of %d results with misses\n", bits, misses, RECORDS * NSETS);
+  }
+  if (l3_repeatedprobecountpacked(l3, RECORDS, packed, 3, THRESHOLD, 0) != 0)
+    bad++;
+  l3_setstream(l3, NULL);
+  ms_detach(view);
+  ms_close(pub);
+  l3_release(l3);
+  mm_release(mm);
+  sim_release(sim);
+
+  // Nibbles cannot hold the counts of a 16-way cache
+  l3 = simcache(&sim, &mm, 16);
+  if (l3_repeatedprobecountpacked(l3, RECORDS, packed, PK_NIBBLE, THRESHOLD, 0) != 0)
+    bad++;
+  if (l3_repeatedprobecountpacked(l3, RECORDS, packed, PK_COUNT5, THRESHOLD, 0) != RECORDS)
+    bad++;
+  l3_release(l3);
+  mm_release(mm);
+  sim_release(sim);
+
+  free(rows);
+  free(out);
+  free(exp);
+  free(packed);
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
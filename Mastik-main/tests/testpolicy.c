@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <sys/mman.h>
+
+#include <mastik/l3.h>
+#include <mastik/mm.h>
+#include <mastik/sim.h>
+#include <mastik/policy.h>
+
+// Infers the policy of simulated caches, finds the leader sets of a
+// dueling one, and checks that l3_prime with the learnt prime pattern
+// fills the monitored sets.
+
+#define ASSOC 12
+#define SETS 256
+#define WAYS (ASSOC * 2)
+#define BUFSIZE (64 << 20)
+
+// WAYS lines of each set of a single-slice cache
+static void **congruent(sim_t sim, char *buf) {
+  void **lines = calloc(SETS * WAYS, sizeof(void *));
+  int count[SETS];
+  bzero(count, sizeof(count));
+  for (size_t off = 0; off < BUFSIZE; off += 64) {
+    int set = (sim_physaddr(sim, buf + off) >> 6) % SETS;
+    if (count[set] < WAYS)
+      lines[set * WAYS + count[set]++] = buf + off;
+  }
+  for (int s = 0; s < SETS; s++)
+    if (count[s] < WAYS)
+      exit(1);
+  return lines;
+}
+
+int main(int c, char **v) {
+  char *buf = mmap(NULL, BUFSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    exit(1);
+
+  simpolicy_e simpolicies[] = { SIMPOLICY_LRU, SIMPOLICY_PLRU, SIMPOLICY_QLRU, SIMPOLICY_RANDOM, SIMPOLICY_DUELING };
+  policy_e expect[] = { POLICY_LRU, POLICY_BITPLRU, POLICY_QLRU_M2, POLICY_RANDOM, POLICY_QLRU_M2 };
+  int bad = 0;
+  for (int i = 0; i < 5; i++) {
+    struct siminfo si;
+    bzero(&si, sizeof(si));
+    si.associativity = ASSOC;
+    si.setsperslice = SETS;
+    si.slices = 1;
+    si.policy = simpolicies[i];
+    sim_t sim = sim_new(&si);
+    void **lines = congruent(sim, buf);
+    struct policyinfo pi;
+    bzero(&pi, sizeof(pi));
+    pi.associativity = ASSOC;
+    pi.sim = sim;
+
+    // Set 0 leads with insertion at age 2 under dueling
+    struct policyresult res;
+    pl_infer(lines, WAYS, &pi, &res);
+    printf("# %s: agreement %d stability %d\n", pl_name(res.policy), res.agreement, res.stability);
+    if (res.policy != expect[i])
+      bad++;
+
+    // Leaders are every SIM_DUEL_SPACING sets, alternating in kind
+    int roles[SETS];
+    int nleaders = pl_findleaders(lines, SETS, WAYS, &pi, roles);
+    if (simpolicies[i] != SIMPOLICY_DUELING) {
+      if (nleaders != -1)
+	bad++;
+    } else {
+      printf("# %d leaders\n", nleaders);
+      if (nleaders != 2 * SETS / SIM_DUEL_SPACING)
+	bad++;
+      for (int s = 0; s < SETS; s++) {
+	int role = PL_FOLLOWER;
+	if (s % SIM_DUEL_SPACING == 0)
+	  role = PL_LEADER_THRASHING;
+	else if (s % SIM_DUEL_SPACING == SIM_DUEL_SPACING / 2)
+	  role = PL_LEADER_RESISTANT;
+	if (roles[s] != role)
+	  bad++;
+      }
+    }
+    free(lines);
+    sim_release(sim);
+  }
+
+  // One pass suffices for LRU, QLRU needs more
+  struct primeinfo lru, qlru;
+  bzero(&lru, sizeof(lru));
+  bzero(&qlru, sizeof(qlru));
+  if (pl_primepattern(POLICY_LRU, ASSOC, 990, &lru) < 990 || lru.repeats * lru.touches != 1)
+    bad++;
+  if (pl_primepattern(POLICY_QLRU_M2, ASSOC, 990, &qlru) < 990 || qlru.repeats * qlru.touches < 2)
+    bad++;
+  printf("# qlru-m2 prime: repeats %d touches %d\n", qlru.repeats, qlru.touches);
+
+  // After priming with the pattern, a probe of a QLRU set finds all its
+  // lines whatever other lines were used last.  A single walk does not.
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  l3info.flags = L3FLAG_NOHUGEPAGES;
+  l3info.associativity = ASSOC;
+  l3info.setsperslice = 1024;
+  l3info.slices = 1;
+  struct siminfo si;
+  bzero(&si, sizeof(si));
+  si.associativity = ASSOC;
+  si.setsperslice = 1024;
+  si.slices = 1;
+  si.policy = SIMPOLICY_QLRU;
+  sim_t sim = sim_new(&si);
+  mm_t mm = mm_prepare(NULL, NULL, (lxinfo_t)&l3info);
+  mm_setsim(mm, sim);
+  l3pp_t l3 = l3_prepare(&l3info, mm);
+  if (l3 == NULL)
+    exit(1);
+  l3_setprime(l3, &qlru);
+  uint16_t res[8];
+  for (int i = 0; i < 8; i++)
+    l3_monitor(l3, i * 97);
+  int monitored[8];
+  l3_getmonitoredset(l3, monitored, 8);
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 8; i++) {
+      void *others[ASSOC];
+      mm_requestlines(mm, L3, monitored[i], others, ASSOC);
+      for (int j = 0; j < ASSOC * 4; j++) {
+	int k = random() % ASSOC;
+	sim_access(sim, others[k]);
+	if (random() & 1)
+	  sim_access(sim, others[k]);
+      }
+      mm_returnlines(mm, others, ASSOC);
+    }
+    l3_prime(l3);
+    l3_probecount(l3, res);
+    for (int i = 0; i < 8; i++)
+      if (res[i] != 0)
+	bad++;
+  }
+  l3_setprime(l3, NULL);
+  l3_release(l3);
+  mm_release(mm);
+  sim_release(sim);
+
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
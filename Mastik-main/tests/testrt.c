@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include <mastik/rt.h>
+
+// Enters capture mode with whatever privileges the test has, checks that
+// the state reported matches the thread's scheduling, that the watchdog
+// drops SCHED_FIFO from a thread that spins past it and that rt_exit
+// puts everything back.
+
+#define BUFSIZE (1 << 20)
+#define WATCHDOG 100
+
+static double seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int c, char **v) {
+  int bad = 0;
+  cpu_set_t before, after;
+  sched_getaffinity(0, sizeof(before), &before);
+  int policy = sched_getscheduler(0);
+
+  struct rtinfo info;
+  memset(&info, 0, sizeof(info));
+  info.flags = RT_ALL;
+  info.watchdog = WATCHDOG;
+  rt_t rt = rt_enter(&info);
+  char *buf = malloc(BUFSIZE);
+  int locked = rt_lock(rt, buf, BUFSIZE);
+  rt_print(rt, stdout);
+
+  struct rtstate s;
+  rt_getstate(rt, &s);
+  if (locked && s.lockall != 2 && s.locked < BUFSIZE)
+    bad++;
+  if (!locked && s.prefaulted < BUFSIZE)
+    bad++;
+  if (s.cpu >= 0) {
+    sched_getaffinity(0, sizeof(after), &after);
+    if (CPU_COUNT(&after) != 1 || !CPU_ISSET(s.cpu, &after))
+      bad++;
+  }
+  if ((sched_getscheduler(0) == SCHED_FIFO) != (s.priority > 0))
+    bad++;
+
+  if (s.priority > 0) {
+    // Kicks keep the thread FIFO, spinning past the watchdog does not
+    for (double end = seconds() + 3.0 * WATCHDOG / 1000; seconds() < end;)
+      rt_kick(rt);
+    if (sched_getscheduler(0) != SCHED_FIFO)
+      bad++;
+    for (double end = seconds() + 3.0 * WATCHDOG / 1000; seconds() < end;)
+      ;
+    rt_getstate(rt, &s);
+    if (!s.expired || s.priority != 0 || sched_getscheduler(0) != policy)
+      bad++;
+    rt_print(rt, stdout);
+  }
+
+  rt_exit(rt);
+  sched_getaffinity(0, sizeof(after), &after);
+  if (!CPU_EQUAL(&before, &after) || sched_getscheduler(0) != policy)
+    bad++;
+  free(buf);
+
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include <mastik/l3.h>
+#include <mastik/mm.h>
+#include <mastik/sim.h>
+
+// Scope monitoring of a simulated QLRU cache: a quiet cache gives no
+// misses, a foreign line in a monitored set shows as one miss in that set
+// only, and a sample costs one access per set, served by the private
+// cache.  With the walk prime the head leaves the private cache, so the
+// first sample refreshes it in the LLC and the foreign line goes unseen.
+
+#define NSETS 8
+#define RECORDS 100
+
+int main(int c, char **v) {
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  l3info.flags = L3FLAG_NOHUGEPAGES;
+  l3info.associativity = 12;
+  l3info.setsperslice = 1024;
+  l3info.slices = 1;
+  struct siminfo si;
+  bzero(&si, sizeof(si));
+  si.associativity = 12;
+  si.setsperslice = 1024;
+  si.slices = 1;
+  si.policy = SIMPOLICY_QLRU;
+  sim_t sim = sim_new(&si);
+  mm_t mm = mm_prepare(NULL, NULL, (lxinfo_t)&l3info);
+  mm_setsim(mm, sim);
+  l3pp_t l3 = l3_prepare(&l3info, mm);
+  if (l3 == NULL)
+    exit(1);
+  for (int i = 0; i < NSETS; i++)
+    l3_monitor(l3, i * 101);
+  int monitored[NSETS];
+  l3_getmonitoredset(l3, monitored, NSETS);
+  // Requests can classify pages, which walks the mm's eviction sets, so
+  // the foreign lines are taken before anything is primed
+  void *foreign[NSETS];
+  for (int i = 0; i < NSETS; i++)
+    mm_requestlines(mm, L3, monitored[i], &foreign[i], 1);
+
+  int bad = 0;
+  uint16_t *res = calloc(RECORDS * NSETS, sizeof(uint16_t));
+  struct simstats before, after;
+  sim_getstats(sim, &before);
+  l3_repeatedscope(l3, RECORDS, res, 0);
+  sim_getstats(sim, &after);
+  for (int i = 0; i < RECORDS * NSETS; i++)
+    if (res[i] > L3_THRESHOLD)
+      bad++;
+  // One prime, the rest of the set twice and the head, and then one
+  // access per set and sample
+  uint64_t accesses = after.accesses - before.accesses;
+  printf("# %lu accesses for %d samples\n", (unsigned long)accesses, RECORDS);
+  if (accesses != NSETS * (2 * 11 + 1 + RECORDS))
+    bad++;
+
+  for (int round = 0; round < 20; round++) {
+    int target = round % NSETS;
+    sim_access(sim, foreign[target]);
+    uint16_t sample[NSETS];
+    l3_scope(l3, sample);
+    for (int i = 0; i < NSETS; i++)
+      if ((sample[i] > L3_THRESHOLD) != (i == target))
+	bad++;
+    // The missed set was primed again
+    l3_scope(l3, sample);
+    for (int i = 0; i < NSETS; i++)
+      if (sample[i] > L3_THRESHOLD)
+	bad++;
+  }
+
+  // The walk prime leaves the head to be refreshed by the first sample
+  uint16_t sample[NSETS];
+  l3_prime(l3);
+  l3_scope(l3, sample);
+  sim_access(sim, foreign[0]);
+  l3_scope(l3, sample);
+  if (sample[0] > L3_THRESHOLD)
+    bad++;
+
+  mm_returnlines(mm, foreign, NSETS);
+  free(res);
+  l3_release(l3);
+  mm_release(mm);
+  sim_release(sim);
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
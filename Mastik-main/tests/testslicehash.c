@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <mastik/l3.h>
+#include <mastik/sim.h>
+#include <mastik/slicehash.h>
+
+// Solves the table-on-a-linear-key hash of a simulated six-slice LLC and
+// checks it, and a saved and reloaded copy, on frames outside the mapped
+// buffer: every address it knows must be labelled consistently with its
+// slice within each cache index, and most addresses must be known.  The
+// cache is mapped through the simulated page tables, which is exact and
+// fast enough for a large buffer.  A buffer of the default size is too
+// small to solve the table from.
+
+#define SLICES 6
+#define SETSPERSLICE 1024
+#define SAMPLES 100000
+
+static l3pp_t prepare(int bufsize) {
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  l3info.flags = L3FLAG_SIMULATE | L3FLAG_NOHUGEPAGES | L3FLAG_USEPTE;
+  l3info.associativity = 8;
+  l3info.setsperslice = SETSPERSLICE;
+  l3info.slices = SLICES;
+  l3info.bufsize = bufsize;
+  return l3_prepare(&l3info, NULL);
+}
+
+int main(int c, char **v) {
+  int bad = 0;
+  l3pp_t l3 = prepare(0);
+  if (l3 == NULL)
+    exit(1);
+  slicehash_t sh = sh_solve(l3_getmm(l3));
+  if (sh != NULL) {
+    printf("# Solved from a small buffer\n");
+    bad++;
+    sh_release(sh);
+  }
+  l3_release(l3);
+
+  l3 = prepare(128 << 20);
+  if (l3 == NULL)
+    exit(1);
+  mm_t mm = l3_getmm(l3);
+  sim_t sim = mm_getsim(mm);
+  sh = sh_solve(mm);
+  if (sh == NULL) {
+    printf("# No hash solved\n");
+    exit(1);
+  }
+  printf("# %d key bits\n", sh_getmasks(sh, NULL, 0));
+
+  char path[] = "/tmp/testslicehash.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    exit(1);
+  close(fd);
+  if (sh_save(sh, path) != 0)
+    bad++;
+  slicehash_t loaded = sh_load(path);
+  unlink(path);
+  if (loaded == NULL)
+    exit(1);
+
+  int *slice = malloc(SETSPERSLICE * SLICES * sizeof(int));
+  int *label = malloc(SETSPERSLICE * SLICES * sizeof(int));
+  for (int i = 0; i < SETSPERSLICE * SLICES; i++)
+    slice[i] = label[i] = -1;
+  int known = 0;
+  srandom(1);
+  for (int i = 0; i < SAMPLES; i++) {
+    uintptr_t phys = (((uintptr_t)random() << 31) ^ random()) & ((1UL << 40) - 64);
+    int l = sh_slice(sh, phys);
+    if (sh_slice(loaded, phys) != l)
+      bad++;
+    if (l < 0)
+      continue;
+    known++;
+    int index = (phys / L3_CACHELINE) % SETSPERSLICE;
+    int s = sim_slice(sim, phys);
+    if (slice[index * SLICES + l] < 0 && label[index * SLICES + s] < 0) {
+      slice[index * SLICES + l] = s;
+      label[index * SLICES + s] = l;
+    } else if (slice[index * SLICES + l] != s || label[index * SLICES + s] != l) {
+      bad++;
+    }
+  }
+  printf("# %d of %d addresses known\n", known, SAMPLES);
+  if (known < SAMPLES / 2)
+    bad++;
+
+  printf("# %d bad\n", bad);
+  free(slice);
+  free(label);
+  sh_release(loaded);
+  sh_release(sh);
+  l3_release(l3);
+  exit(bad != 0);
+}
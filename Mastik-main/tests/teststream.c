@@ -0,0 +1,116 @@
+/*
+ * Copyright 2026 The University of Adelaide
+ *
+ * This file is part of Mastik.
+ *
+ * Mastik is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mastik is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mastik.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <mastik/l3.h>
+#include <mastik/stream.h>
+
+// Publishes on a stream and reads it back: frames arrive in order, a
+// viewer that falls behind is told how many it lost, decimation keeps
+// every n-th row, and l3_repeatedprobe publishes each record.
+
+#define WIDTH 8
+#define SLOTS 16
+
+int main(int c, char **v) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/teststream-%d.sock", getpid());
+  int bad = 0;
+
+  stream_t pub = ms_publish(path, WIDTH, SLOTS, 1);
+  stream_t view = pub ? ms_attach(path) : NULL;
+  if (view == NULL) {
+    printf("Cannot publish or attach on %s\n", path);
+    exit(1);
+  }
+
+  struct ms_frame frames[SLOTS];
+  uint16_t rows[SLOTS * WIDTH];
+  uint16_t row[WIDTH];
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < WIDTH; j++)
+      row[j] = i * 100 + j;
+    ms_write(pub, row, WIDTH, i);
+  }
+  int n = ms_read(view, frames, rows, SLOTS);
+  if (n != 5)
+    bad++;
+  for (int i = 0; i < n; i++)
+    if (frames[i].seq != i || frames[i].tag != i || frames[i].len != WIDTH || rows[i * WIDTH + 3] != i * 100 + 3)
+      bad++;
+  if (ms_read(view, frames, rows, SLOTS) != 0)
+    bad++;
+
+  // Overrun the viewer: only the last SLOTS frames survive
+  for (int i = 0; i < 3 * SLOTS; i++)
+    ms_write(pub, row, 2, 1000 + i);
+  n = ms_read(view, frames, rows, SLOTS);
+  if (n != SLOTS || ms_dropped(view) != 2 * SLOTS || frames[0].tag != 1000 + 2 * SLOTS || frames[0].len != 2)
+    bad++;
+  printf("# Overrun: read %d, dropped %lu\n", n, (unsigned long)ms_dropped(view));
+  ms_detach(view);
+  ms_close(pub);
+
+  // Decimation
+  pub = ms_publish(path, WIDTH, SLOTS, 3);
+  view = ms_attach(path);
+  for (int i = 0; i < 9; i++)
+    ms_write(pub, row, WIDTH, i);
+  n = ms_read(view, frames, rows, SLOTS);
+  if (n != 3 || frames[1].index != 3 || frames[2].tag != 6)
+    bad++;
+  ms_close(pub);
+  if (ms_read(view, frames, rows, SLOTS) != -1)
+    bad++;
+  ms_detach(view);
+
+  // Records of l3_repeatedprobe on a simulated cache
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  l3info.flags = L3FLAG_SIMULATE | L3FLAG_NOHUGEPAGES;
+  l3info.associativity = 4;
+  l3info.setsperslice = 128;
+  l3info.slices = 2;
+  l3pp_t l3 = l3_prepare(&l3info, NULL);
+  if (l3 == NULL)
+    exit(1);
+  for (int i = 0; i < WIDTH; i++)
+    l3_monitor(l3, i * 17);
+  pub = ms_publish(path, WIDTH, SLOTS, 1);
+  view = ms_attach(path);
+  l3_setstream(l3, pub);
+  uint16_t res[10 * WIDTH];
+  l3_repeatedprobecount(l3, 10, res, 0);
+  l3_setstream(l3, NULL);
+  n = ms_read(view, frames, rows, SLOTS);
+  if (n != 10 || memcmp(rows, res, sizeof(res)) != 0)
+    bad++;
+  ms_detach(view);
+  ms_close(pub);
+  l3_release(l3);
+
+  printf("# %d bad\n", bad);
+  exit(bad != 0);
+}
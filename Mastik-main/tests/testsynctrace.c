@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include <mastik/l3.h>
+#include <mastik/mm.h>
+#include <mastik/sim.h>
+#include <mastik/synctrace.h>
+
+// Sparse synchronized Prime+Probe on a simulated LLC.  The victim touches
+// one of VICTIMS sets, chosen by the top nibble of the first input byte.
+// Ranking CANDIDATES sets must keep exactly the victim sets, and the
+// cluster of each nibble must stand out in its set.
+
+#define CANDIDATES 64
+#define VICTIMS 16
+
+struct victim {
+  sim_t sim;
+  void *lines[VICTIMS];
+};
+
+static void crypto(uint8_t input[], uint8_t output[], void *data) {
+  struct victim *v = data;
+  sim_access(v->sim, v->lines[input[0] >> 4]);
+  memcpy(output, input, ST_BLOCKBYTES);
+}
+
+int main(int c, char **v) {
+  int bad = 0;
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  l3info.flags = L3FLAG_NOHUGEPAGES;
+  l3info.associativity = 12;
+  l3info.setsperslice = 1024;
+  l3info.slices = 1;
+  struct siminfo si;
+  bzero(&si, sizeof(si));
+  si.associativity = 12;
+  si.setsperslice = 1024;
+  si.slices = 1;
+  si.policy = SIMPOLICY_LRU;
+  sim_t sim = sim_new(&si);
+  mm_t mm = mm_prepare(NULL, NULL, (lxinfo_t)&l3info);
+  mm_setsim(mm, sim);
+  l3pp_t l3 = l3_prepare(&l3info, mm);
+  if (l3 == NULL)
+    exit(1);
+
+  int candidates[CANDIDATES];
+  for (int i = 0; i < CANDIDATES; i++)
+    candidates[i] = i * 13 + 5;
+  struct victim victim;
+  victim.sim = sim;
+  for (int i = 0; i < VICTIMS; i++)
+    mm_requestlines(mm, L3, candidates[i * 4 + 1], &victim.lines[i], 1);
+
+  st_sparseclusters_t clusters = syncPrimeProbeL3(2000, 1, 1, NULL, NULL, crypto, &victim, 0xf0,
+      l3, candidates, CANDIDATES, VICTIMS, 500);
+  if (clusters == NULL)
+    exit(1);
+  if (clusters->nsets != VICTIMS || l3_getmonitoredset(l3, NULL, 0) != VICTIMS)
+    bad++;
+
+  // Every nibble peaks in the set of its victim line
+  int total = 0;
+  for (int n = 0; n < VICTIMS; n++) {
+    int cluster = n << 4;
+    total += clusters->count[cluster];
+    int64_t *avg = clusters->avg + cluster * clusters->nsets;
+    int best = 0;
+    for (int col = 1; col < clusters->nsets; col++)
+      if (avg[col] > avg[best])
+	best = col;
+    if (clusters->sets[best] != candidates[n * 4 + 1])
+      bad++;
+  }
+  printf("# %d sets kept, %d samples clustered\n", clusters->nsets, total);
+  if (total != 2000)
+    bad++;
+  st_freesparseclusters(clusters);
+
+  // Without ranking every given set is traced
+  clusters = syncPrimeProbeL3(100, 1, 1, NULL, NULL, crypto, &victim, 0xf0,
+      l3, candidates, CANDIDATES, 0, 0);
+  if (clusters == NULL || clusters->nsets != CANDIDATES)
+    bad++;
+  st_freesparseclusters(clusters);
+
+  mm_returnlines(mm, victim.lines, VICTIMS);
+  l3_release(l3);
+  mm_release(mm);
+  sim_release(sim);
+
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
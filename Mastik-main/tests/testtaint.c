@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <mastik/l1.h>
+#include <mastik/impl.h>
+#include <mastik/taint.h>
+
+// Taint detection on the L1: a gap no probe can meet flags every set, a
+// generous gap flags only sets that were really interrupted, a record
+// that slept is flagged whole, and the statistics add up either way.
+
+#define RECORDS 1000
+
+int main(int c, char **v) {
+  l1pp_t l1 = l1_prepare(NULL);
+  if (l1 == NULL)
+    exit(1);
+  l1_monitorall(l1);
+  int nsets = l1_getmonitoredset(l1, NULL, 0);
+  uint16_t *res = calloc((size_t)RECORDS * nsets, sizeof(uint16_t));
+  int bad = 0;
+
+  struct taintinfo ti;
+  bzero(&ti, sizeof(ti));
+  ti.gap = 1;
+  lx_settaint((lxpp_t)l1, &ti);
+  l1_repeatedprobe(l1, 10, res, 0);
+  struct taintstats ts;
+  if (!lx_gettaintstats((lxpp_t)l1, &ts))
+    bad++;
+  for (int i = 0; i < 10 * nsets; i++)
+    if (res[i] != TAINT_FLAGGED)
+      bad++;
+  if (ts.records != 10 || ts.sets != 10 * nsets || ts.flagged != ts.sets)
+    bad++;
+
+  bzero(&ti, sizeof(ti));
+  ti.flags = TAINT_CTXSWITCH;
+  lx_settaint((lxpp_t)l1, &ti);
+  l1_repeatedprobe(l1, RECORDS, res, 0);
+  lx_gettaintstats((lxpp_t)l1, &ts);
+  int flagged = 0;
+  for (int i = 0; i < RECORDS * nsets; i++)
+    if (res[i] == TAINT_FLAGGED)
+      flagged++;
+  printf("# %d of %d flagged, %d records switched, max gap %d\n", flagged, RECORDS * nsets,
+      (int)ts.switched, (int)ts.maxgap);
+  if (ts.records != RECORDS || ts.flagged != flagged || ts.switched * nsets > flagged)
+    bad++;
+  // A handful of interrupts at most on an otherwise idle core
+  if (flagged > RECORDS * nsets / 10)
+    bad++;
+
+  // Sleeping between the prime and the probe switches the thread out
+  l1_probe(l1, res);
+  usleep(1000);
+  l1_probe(l1, res);
+  if (lx_taintrecord((lxpp_t)l1, res) != nsets)
+    bad++;
+
+  lx_settaint((lxpp_t)l1, NULL);
+  if (lx_taintrecord((lxpp_t)l1, res) != 0)
+    bad++;
+  if (lx_gettaintstats((lxpp_t)l1, &ts))
+    bad++;
+  free(res);
+  l1_release(l1);
+
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
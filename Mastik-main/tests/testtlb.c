@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include <mastik/l1.h>
+#include <mastik/l3.h>
+#include <mastik/mm.h>
+#include <mastik/sim.h>
+#include <mastik/impl.h>
+#include <mastik/tlb.h>
+
+// TLB layout on a simulated LLC: page order sorts the lists, even after
+// half of them were reversed, and probes still see a quiet cache as
+// quiet.  Then the warm-up on the L1 of the hardware, on
+// small pages and with part of the sets monitored so that a free page
+// offset is left.
+
+#define NSETS 64
+
+static int lines(lxpp_t lx, int i, void **out) {
+  void *head = lx->monitoredhead[i];
+  int n = 0;
+  void *p = head;
+  do {
+    out[n++] = p;
+    p = *(void **)p;
+  } while (p != head);
+  return n;
+}
+
+// Reverses the lists of a set, as lx_monitor links them
+static void reverse(lxpp_t lx, int i) {
+  void *l[32];
+  int n = lines(lx, i, l);
+  for (int j = 0; j < n; j++) {
+    void *line = l[n - 1 - j];
+    *(void **)line = l[(2 * n - 2 - j) % n];
+    *(void **)((char *)line + sizeof(void *)) = (char *)l[(n - j) % n] + sizeof(void *);
+  }
+  lx->monitoredhead[i] = l[n - 1];
+}
+
+int main(int c, char **v) {
+  int bad = 0;
+  struct l3info l3info;
+  bzero(&l3info, sizeof(l3info));
+  l3info.flags = L3FLAG_NOHUGEPAGES;
+  l3info.associativity = 12;
+  l3info.setsperslice = 1024;
+  l3info.slices = 1;
+  struct siminfo si;
+  bzero(&si, sizeof(si));
+  si.associativity = 12;
+  si.setsperslice = 1024;
+  si.slices = 1;
+  si.policy = SIMPOLICY_LRU;
+  sim_t sim = sim_new(&si);
+  mm_t mm = mm_prepare(NULL, NULL, (lxinfo_t)&l3info);
+  mm_setsim(mm, sim);
+  l3pp_t l3 = l3_prepare(&l3info, mm);
+  if (l3 == NULL)
+    exit(1);
+  lxpp_t lx = (lxpp_t)l3;
+  for (int i = 0; i < NSETS; i++)
+    l3_monitor(l3, i);
+  for (int i = 0; i < NSETS; i += 2)
+    reverse(lx, i);
+
+  struct tlbinfo ti;
+  bzero(&ti, sizeof(ti));
+  ti.flags = TLB_PAGEORDER | TLB_WARMUP;
+  l3_settlb(l3, &ti);
+  for (int i = 0; i < NSETS; i++) {
+    void *l[32];
+    int n = lines(lx, i, l);
+    for (int j = 1; j < n; j++)
+      if ((uintptr_t)l[j] < (uintptr_t)l[j - 1])
+	bad++;
+  }
+  struct tlbstats ts;
+  if (!l3_gettlbstats(l3, &ts) || ts.warmoffset != -1)
+    bad++;
+
+  uint16_t res[NSETS];
+  l3_prime(l3);
+  l3_probecount(l3, res);
+  for (int i = 0; i < NSETS; i++)
+    if (res[i] != 0)
+      bad++;
+  l3_release(l3);
+  mm_release(mm);
+  sim_release(sim);
+
+  // Sets 0 to 7 of the L1 take the first lines of each page, so the
+  // warm-up takes the last.  Huge pages need no warm-up.
+  mm = mm_prepare(NULL, NULL, (lxinfo_t)&l3info);
+  l1pp_t l1 = l1_prepare(mm);
+  if (l1 == NULL)
+    exit(1);
+  l1_unmonitorall(l1);
+  for (int i = 0; i < 8; i++)
+    l1_monitor(l1, i);
+  ti.pmu = pmu_open();
+  lx_settlb((lxpp_t)l1, &ti);
+  for (int i = 0; i < 1000; i++)
+    l1_probe(l1, res);
+  lx_gettlbstats((lxpp_t)l1, &ts);
+  printf("# warm-up line %d, %d of %d probes TLB affected, %d misses\n", ts.warmoffset,
+      (int)ts.affected, (int)ts.probes, (int)ts.misses);
+  if (ts.warmoffset != 63)
+    bad++;
+  if (pmu_available(ti.pmu, PMU_DTLB_MISSES) && (ts.probes != 8000 || ts.affected > ts.probes))
+    bad++;
+  // One set at line 1 leaves line 0 free, but that is its prefetch pair
+  l1_unmonitorall(l1);
+  l1_monitor(l1, 1);
+  l1_probe(l1, res);
+  lx_gettlbstats((lxpp_t)l1, &ts);
+  if (ts.warmoffset != 63)
+    bad++;
+  lx_settlb((lxpp_t)l1, NULL);
+  if (lx_gettlbstats((lxpp_t)l1, &ts))
+    bad++;
+  l1_release(l1);
+  mm_release(mm);
+  pmu_close(ti.pmu);
+
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <mastik/topology.h>
+
+// Prints the LLC domains of the host and checks that they are consistent
+// and that a placement keeps its threads apart.  Hosts without the sysfs
+// topology skip.
+
+#define ISSET(mask, c) ((mask)[(c) / 64] & (1ULL << ((c) % 64)))
+
+int main(int c, char **v) {
+  topology_t tp = tp_discover();
+  if (tp == NULL) {
+    printf("# No topology, skipped\n");
+    return 0;
+  }
+  int bad = 0;
+  int ncpus = 0;
+  for (int l = 0; l < tp_nllcs(tp); l++) {
+    struct tpllc llc;
+    tp_getllc(tp, l, &llc);
+    printf("# LLC %d (id %d) socket %d: %d CPUs, %zu KB, %d ways, %d sets, inclusive %d, nodes 0x%llx\n",
+	l, llc.id, llc.socket, llc.ncpus, llc.size / 1024, llc.associativity, llc.sets, llc.inclusive,
+	(unsigned long long)llc.nodes);
+    ncpus += llc.ncpus;
+  }
+  int online = 0;
+  for (int cpu = 0; cpu < tp_ncpus(tp); cpu++) {
+    struct tpcpu info;
+    if (!tp_getcpu(tp, cpu, &info))
+      continue;
+    online++;
+    struct tpllc llc;
+    if (!tp_getllc(tp, info.llc, &llc) || !ISSET(llc.cpus, cpu))
+      bad++;
+    // Siblings share a core and an LLC
+    struct tpcpu sibling;
+    if (info.sibling >= 0 && (!tp_getcpu(tp, info.sibling, &sibling) || sibling.core != info.core ||
+	  sibling.socket != info.socket || sibling.llc != info.llc))
+      bad++;
+  }
+  // Every online CPU is in exactly one domain
+  if (online != ncpus)
+    bad++;
+
+  struct tpplacement p;
+  if (!tp_place(tp, -1, 0, 4, &p)) {
+    bad++;
+  } else {
+    printf("# prober %d victim %d writer %d, %d contention\n", p.prober, p.victim, p.writer, p.ncontention);
+    int cpus[3 + TP_MAXCONTENTION] = { p.prober, p.victim, p.writer };
+    for (int i = 0; i < p.ncontention; i++)
+      cpus[3 + i] = p.contention[i];
+    for (int i = 0; i < 3 + p.ncontention; i++)
+      for (int j = i + 1; j < 3 + p.ncontention; j++)
+	if (cpus[i] >= 0 && cpus[i] == cpus[j])
+	  bad++;
+    struct tpcpu prober;
+    if (!tp_getcpu(tp, p.prober, &prober) || prober.llc != p.llc)
+      bad++;
+    // An isolated CPU of the domain, if any, takes the prober
+    for (int cpu = 0; cpu < tp_ncpus(tp); cpu++) {
+      struct tpcpu info;
+      if (tp_getcpu(tp, cpu, &info) && info.llc == p.llc && info.isolated && !prober.isolated)
+	bad++;
+    }
+    // The prober's sibling is left idle
+    for (int i = 1; i < 3 + p.ncontention; i++)
+      if (cpus[i] >= 0 && cpus[i] == prober.sibling)
+	bad++;
+  }
+  if (tp_place(tp, tp_nllcs(tp), 0, 0, &p))
+    bad++;
+
+  tp_release(tp);
+  printf("# %d bad\n", bad);
+  return bad != 0;
+}
@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <mastik/low.h>
+#include <mastik/util.h>
+#include <mastik/l1.h>
+#include <mastik/l2.h>
+#include <mastik/l3.h>
+#include <mastik/fr.h>
+#include <mastik/ff.h>
+#include <mastik/prime.h>
+#include <mastik/pmu.h>
+#include <mastik/impl.h>
+
+// Benchmarks of the Mastik mapping and probing primitives.  Every
+// measurement is repeated after a warm-up and reported as the median and
+// 99th percentile in cycles, as JSON that can be compared across commits
+// and hosts.
+
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+#define L3_BENCH_SETS 64
+#define FR_BENCH_LINES 16
+#define SLOT_RECORDS 1000
+#define MAX_MISSED 0.01
+#define PRIME_BENCH_MB 24
+#define PRIME_BENCH_SAMPLES 200
+
+typedef struct {
+    int samples;
+    int warmup;
+    int prepare_repeats;
+    const char *file;
+} bench_config_t;
+
+typedef struct {
+    uint64_t min;
+    uint64_t median;
+    uint64_t p99;
+    uint64_t max;
+    int n;
+} bench_stats_t;
+
+static FILE *out;
+static int nresults = 0;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bench_stats_t summarise(uint64_t *samples, int n) {
+    bench_stats_t st = {0};
+    if (n == 0)
+        return st;
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    st.n = n;
+    st.min = samples[0];
+    st.median = samples[n / 2];
+    st.p99 = samples[(int)((n - 1) * 0.99)];
+    st.max = samples[n - 1];
+    return st;
+}
+
+// params is a JSON object body, e.g. "\"level\":\"L3\""
+static void report(const char *name, const char *params, bench_stats_t st, const char *extra) {
+    fprintf(out, "%s\n    {\"name\":\"%s\",\"params\":{%s},\"unit\":\"cycles\","
+            "\"samples\":%d,\"min\":%lu,\"median\":%lu,\"p99\":%lu,\"max\":%lu%s%s}",
+            nresults++ ? "," : "", name, params, st.n, st.min, st.median, st.p99, st.max,
+            extra ? "," : "", extra ? extra : "");
+    fflush(out);
+}
+
+static void print_host(const bench_config_t *cfg) {
+    char hostname[256] = "unknown";
+    char cpu[256] = "unknown";
+    gethostname(hostname, sizeof(hostname));
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f) {
+        char line[512];
+        while (fgets(line, sizeof(line), f)) {
+            char *colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon) {
+                snprintf(cpu, sizeof(cpu), "%s", colon + 2);
+                cpu[strcspn(cpu, "\n\"\\")] = '\0';
+                break;
+            }
+        }
+        fclose(f);
+    }
+    fprintf(out, "{\n  \"host\":{\"hostname\":\"%s\",\"cpu\":\"%s\",\"ncpus\":%d},\n", hostname, cpu, ncpus());
+    fprintf(out, "  \"mastik\":\"%s\",\"commit\":\"%s\",\"time\":%ld,\n", mastik_version(), BENCH_COMMIT, (long)time(NULL));
+    fprintf(out, "  \"config\":{\"samples\":%d,\"warmup\":%d,\"prepare_repeats\":%d},\n",
+            cfg->samples, cfg->warmup, cfg->prepare_repeats);
+    fprintf(out, "  \"results\":[");
+}
+
+static int hugepages_available(void) {
+#ifdef MAP_HUGETLB
+    void *p = mmap(NULL, 2 * 1024 * 1024, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED)
+        return 0;
+    munmap(p, 2 * 1024 * 1024);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+//------------------ l3_prepare under each flag combination ------------------//
+
+static const struct {
+    uint32_t flags;
+    const char *text;
+} prepare_flags[] = {
+    {0, "default"},
+    {L3FLAG_QUADRATICMAP, "quadratic"},
+    {L3FLAG_LINEARMAP, "linear"},
+    {L3FLAG_NOHUGEPAGES, "smallpages"},
+    {L3FLAG_NOHUGEPAGES | L3FLAG_QUADRATICMAP, "smallpages,quadratic"},
+    {L3FLAG_NOHUGEPAGES | L3FLAG_LINEARMAP, "smallpages,linear"},
+    {L3FLAG_USEPTE, "pte"},
+    {L3FLAG_SLICEHASH, "slicehash"},
+    {0, NULL}
+};
+
+static void bench_prepare(const bench_config_t *cfg) {
+    uint64_t *samples = calloc(cfg->prepare_repeats, sizeof(uint64_t));
+    for (int i = 0; prepare_flags[i].text; i++) {
+        int n = 0;
+        int sets = 0;
+        for (int r = 0; r < cfg->prepare_repeats; r++) {
+            struct l3info l3i;
+            memset(&l3i, 0, sizeof(l3i));
+            l3i.flags = prepare_flags[i].flags;
+            uint64_t start = rdtscp64();
+            l3pp_t l3 = l3_prepare(&l3i, NULL);
+            uint64_t end = rdtscp64();
+            if (!l3)
+                continue;
+            samples[n++] = end - start;
+            sets = l3_getSets(l3);
+            l3_release(l3);
+        }
+        char params[128], extra[64];
+        snprintf(params, sizeof(params), "\"flags\":\"%s\"", prepare_flags[i].text);
+        snprintf(extra, sizeof(extra), "\"sets\":%d", sets);
+        report("l3_prepare", params, summarise(samples, n), extra);
+    }
+    free(samples);
+}
+
+//------------------ Per-level monitor and probe costs ------------------//
+
+static void bench_monitor(const bench_config_t *cfg, lxpp_t lx, const char *level, uint64_t *samples) {
+    int total = lx->totalsets;
+    uint64_t *unmon = calloc(cfg->samples, sizeof(uint64_t));
+    lx_unmonitorall(lx);
+    for (int i = -cfg->warmup; i < cfg->samples; i++) {
+        int set = random() % total;
+        uint64_t start = rdtscp64();
+        lx_monitor(lx, set);
+        uint64_t mid = rdtscp64();
+        lx_unmonitor(lx, set);
+        uint64_t end = rdtscp64();
+        if (i >= 0) {
+            samples[i] = mid - start;
+            unmon[i] = end - mid;
+        }
+    }
+    char params[64];
+    snprintf(params, sizeof(params), "\"level\":\"%s\"", level);
+    report("lx_monitor", params, summarise(samples, cfg->samples), NULL);
+    report("lx_unmonitor", params, summarise(unmon, cfg->samples), NULL);
+    free(unmon);
+}
+
+typedef void (*probe_fn)(lxpp_t lx, uint16_t *results);
+
+static void bench_probe(const bench_config_t *cfg, lxpp_t lx, const char *level, int nsets, uint64_t *samples) {
+    static const struct {
+        probe_fn fn;
+        const char *name;
+    } probes[] = {
+        {lx_probe, "probe"},
+        {lx_bprobe, "bprobe"},
+        {lx_probecount, "probecount"},
+        {lx_bprobecount, "bprobecount"},
+        {NULL, NULL}
+    };
+
+    lx_unmonitorall(lx);
+    int stride = lx->totalsets / nsets;
+    for (int i = 0; i < nsets; i++)
+        lx_monitor(lx, i * stride);
+    int nmonitored = lx_getmonitoredset(lx, NULL, 0);
+    uint16_t *res = calloc(nmonitored, sizeof(uint16_t));
+
+    for (int p = 0; probes[p].name; p++) {
+        for (int i = -cfg->warmup; i < cfg->samples; i++) {
+            uint64_t start = rdtscp64();
+            probes[p].fn(lx, res);
+            uint64_t end = rdtscp64();
+            if (i >= 0)
+                samples[i] = (end - start) / nmonitored;
+        }
+        char params[64];
+        snprintf(params, sizeof(params), "\"level\":\"%s\",\"sets\":%d", level, nmonitored);
+        char name[32];
+        snprintf(name, sizeof(name), "%s_per_set", probes[p].name);
+        report(name, params, summarise(samples, cfg->samples), NULL);
+    }
+    free(res);
+}
+
+// Finds the shortest slot at which lx_repeatedprobe misses fewer than
+// MAX_MISSED of its slots.  A missed slot is recorded as all zeros.
+static void bench_slotrate(const bench_config_t *cfg, lxpp_t lx, const char *level, int nsets, uint64_t *samples) {
+    lx_unmonitorall(lx);
+    int stride = lx->totalsets / nsets;
+    for (int i = 0; i < nsets; i++)
+        lx_monitor(lx, i * stride);
+    int nmonitored = lx_getmonitoredset(lx, NULL, 0);
+    uint16_t *res = calloc(SLOT_RECORDS * nmonitored, sizeof(uint16_t));
+
+    // Unslotted cost of one record
+    int reps = cfg->samples / 10 + 1;
+    for (int i = -1; i < reps; i++) {
+        uint64_t start = rdtscp64();
+        lx_repeatedprobe(lx, SLOT_RECORDS, res, 0);
+        uint64_t end = rdtscp64();
+        if (i >= 0)
+            samples[i] = (end - start) / SLOT_RECORDS;
+    }
+    bench_stats_t st = summarise(samples, reps);
+    char params[64];
+    snprintf(params, sizeof(params), "\"level\":\"%s\",\"sets\":%d,\"slot\":0", level, nmonitored);
+    report("lx_repeatedprobe_record", params, st, NULL);
+
+    int min_slot = 0;
+    for (int slot = st.median * 4; slot >= (int)st.median / 2 && slot > 0; slot = slot * 3 / 4) {
+        lx_repeatedprobe(lx, SLOT_RECORDS, res, slot);
+        int missed = 0;
+        for (int r = 0; r < SLOT_RECORDS; r++) {
+            int zero = 1;
+            for (int j = 0; j < nmonitored && zero; j++)
+                zero = res[r * nmonitored + j] == 0;
+            missed += zero;
+        }
+        if ((double)missed / SLOT_RECORDS < MAX_MISSED)
+            min_slot = slot;
+        else
+            break;
+    }
+    fprintf(out, ",\n    {\"name\":\"lx_repeatedprobe_minslot\",\"params\":{\"level\":\"%s\",\"sets\":%d,\"max_missed\":%.2f},"
+            "\"unit\":\"cycles\",\"value\":%d}", level, nmonitored, MAX_MISSED, min_slot);
+    nresults++;
+    free(res);
+}
+
+static void bench_level(const bench_config_t *cfg, lxpp_t lx, const char *level, int nsets) {
+    if (lx->totalsets == 0 || nsets <= 0) {
+        fprintf(stderr, "bench: no %s sets found, skipping %s\n", level, level);
+        return;
+    }
+    uint64_t *samples = calloc(cfg->samples + 1, sizeof(uint64_t));
+    bench_monitor(cfg, lx, level, samples);
+    bench_probe(cfg, lx, level, nsets, samples);
+    if (strcmp(level, "L3") == 0)
+        bench_slotrate(cfg, lx, level, 16, samples);
+    free(samples);
+}
+
+//------------------ Flush+Reload and Flush+Flush ------------------//
+
+static void bench_fr_ff(const bench_config_t *cfg) {
+    void *lines[FR_BENCH_LINES];
+    for (int i = 0; i < FR_BENCH_LINES; i++) {
+        // Different pages and page offsets so the lines do not share sets
+        lines[i] = map_offset(cfg->file, i * (PAGE_SIZE + 2 * LX_CACHELINE));
+        if (lines[i] == NULL) {
+            fprintf(stderr, "bench: cannot map %s\n", cfg->file);
+            for (int j = 0; j < i; j++)
+                unmap_offset(lines[j]);
+            return;
+        }
+    }
+    uint64_t *samples = calloc(cfg->samples, sizeof(uint64_t));
+    uint16_t res[FR_BENCH_LINES];
+    char params[64];
+    snprintf(params, sizeof(params), "\"addresses\":%d", FR_BENCH_LINES);
+
+    fr_t fr = fr_prepare();
+    for (int i = 0; i < FR_BENCH_LINES; i++)
+        fr_monitor(fr, lines[i]);
+    for (int i = -cfg->warmup; i < cfg->samples; i++) {
+        uint64_t start = rdtscp64();
+        fr_probe(fr, res);
+        uint64_t end = rdtscp64();
+        if (i >= 0)
+            samples[i] = (end - start) / FR_BENCH_LINES;
+    }
+    report("fr_probe_per_address", params, summarise(samples, cfg->samples), NULL);
+    fr_release(fr);
+
+    ff_t ff = ff_prepare();
+    for (int i = 0; i < FR_BENCH_LINES; i++)
+        ff_monitor(ff, lines[i]);
+    ff_setthresholds(ff);
+    for (int i = -cfg->warmup; i < cfg->samples; i++) {
+        uint64_t start = rdtscp64();
+        ff_probe(ff, res);
+        uint64_t end = rdtscp64();
+        if (i >= 0)
+            samples[i] = (end - start) / FR_BENCH_LINES;
+    }
+    report("ff_probe_per_address", params, summarise(samples, cfg->samples), NULL);
+    ff_release(ff);
+
+    for (int i = 0; i < FR_BENCH_LINES; i++)
+        unmap_offset(lines[i]);
+    free(samples);
+}
+
+//------------------ Prime kernels ------------------//
+
+// One line per page of a lazyMapping-sized arena, in random order, primed
+// with increasing numbers of chains.
+static void bench_prime(const bench_config_t *cfg) {
+    size_t size = (size_t)PRIME_BENCH_MB << 20;
+    char *arena = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        perror("bench: mmap");
+        return;
+    }
+    memset(arena, 1, size);
+    int nlines = size / PAGE_SIZE;
+    void **lines = malloc(nlines * sizeof(void *));
+    for (int i = 0; i < nlines; i++)
+        lines[i] = arena + (size_t)i * PAGE_SIZE;
+    for (int i = nlines - 1; i > 0; i--) {
+        int j = random() % (i + 1);
+        void *t = lines[i];
+        lines[i] = lines[j];
+        lines[j] = t;
+    }
+
+    int nsamples = cfg->samples < PRIME_BENCH_SAMPLES ? cfg->samples : PRIME_BENCH_SAMPLES;
+    uint64_t *samples = calloc(nsamples, sizeof(uint64_t));
+    static const int chains[] = {1, 2, 4, 8, 16, PRIME_UNORDERED};
+    for (size_t c = 0; c < sizeof(chains) / sizeof(chains[0]); c++) {
+        struct primeinfo pi = {0};
+        pi.chains = chains[c];
+        primer_t pr = pr_prepare(lines, nlines, &pi);
+        for (int i = -cfg->warmup; i < nsamples; i++) {
+            uint64_t start = rdtscp64();
+            pr_prime(pr);
+            uint64_t end = rdtscp64();
+            if (i >= 0)
+                samples[i] = (end - start) / nlines;
+        }
+        char params[96];
+        if (chains[c] == PRIME_UNORDERED)
+            snprintf(params, sizeof(params), "\"lines\":%d,\"chains\":\"unordered\"", nlines);
+        else
+            snprintf(params, sizeof(params), "\"lines\":%d,\"chains\":%d", nlines, chains[c]);
+        report("pr_prime_per_line", params, summarise(samples, nsamples), NULL);
+        pr_release(pr);
+    }
+    free(samples);
+    free(lines);
+    munmap(arena, size);
+}
+
+//------------------ Hardware counters ------------------//
+
+static void bench_pmu(const bench_config_t *cfg) {
+    pmu_t pmu = pmu_open();
+    if (pmu == NULL) {
+        fprintf(stderr, "bench: no hardware counters, skipping pmu_read\n");
+        return;
+    }
+    uint64_t *samples = calloc(cfg->samples, sizeof(uint64_t));
+    for (int e = 0; e < PMU_NEVENTS; e++) {
+        if (!pmu_available(pmu, e))
+            continue;
+        for (int i = -cfg->warmup; i < cfg->samples; i++) {
+            uint64_t start = rdtscp64();
+            pmu_read(pmu, e);
+            uint64_t end = rdtscp64();
+            if (i >= 0)
+                samples[i] = end - start;
+        }
+        char params[96];
+        snprintf(params, sizeof(params), "\"event\":\"%s\",\"rdpmc\":%s",
+                 pmu_eventname(e), pmu_userread(pmu) ? "true" : "false");
+        report("pmu_read", params, summarise(samples, cfg->samples), NULL);
+    }
+    free(samples);
+    pmu_close(pmu);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-o file] [-n samples] [-w warmup] [-p prepare_repeats] [-c cpu] [-f file]\n", prog);
+    fprintf(stderr, "  -p 0 skips the l3_prepare measurements\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    bench_config_t cfg = {1000, 100, 3, "/proc/self/exe"};
+    const char *outfile = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:n:w:p:c:f:")) != -1) {
+        switch (opt) {
+            case 'o': outfile = optarg; break;
+            case 'n': cfg.samples = atoi(optarg); break;
+            case 'w': cfg.warmup = atoi(optarg); break;
+            case 'p': cfg.prepare_repeats = atoi(optarg); break;
+            case 'c': setaffinity(atoi(optarg)); break;
+            case 'f': cfg.file = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (cfg.samples <= 0 || cfg.warmup < 0 || cfg.prepare_repeats < 0)
+        usage(argv[0]);
+
+    out = stdout;
+    if (outfile && !(out = fopen(outfile, "w"))) {
+        perror(outfile);
+        return 1;
+    }
+    srandom(42);
+    print_host(&cfg);
+
+    if (cfg.prepare_repeats > 0)
+        bench_prepare(&cfg);
+
+    l3pp_t l3 = l3_prepare(NULL, NULL);
+    if (l3) {
+        bench_level(&cfg, (lxpp_t)l3, "L3", L3_BENCH_SETS);
+        l3_release(l3);
+    } else {
+        fprintf(stderr, "bench: l3_prepare failed, skipping L3\n");
+    }
+
+    l1pp_t l1 = l1_prepare(NULL);
+    bench_level(&cfg, (lxpp_t)l1, "L1", L1_SETS);
+    l1_release(l1);
+
+    // L2 sets can only be allocated on huge pages
+    if (hugepages_available()) {
+        l2pp_t l2 = l2_prepare(NULL, NULL);
+        bench_level(&cfg, (lxpp_t)l2, "L2", l2_getmonitoredset(l2, NULL, 0));
+        l2_release(l2);
+    } else {
+        fprintf(stderr, "bench: no huge pages, skipping L2\n");
+    }
+
+    bench_fr_ff(&cfg);
+    bench_prime(&cfg);
+    bench_pmu(&cfg);
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
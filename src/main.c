@@ -14,6 +14,7 @@
 #include <mastik/l3.h>
 #include <mastik/impl.h>
 #include "utils.h"
+#include "phasestats.h"
 
 
 // Experiment modes: 1=NEW, 2=PRIME_BY_GROUP_LINE, 3=OLD, 4=MISSES, 0=function testing
@@ -28,6 +29,16 @@
 
 void old_experiment(l3pp_t l3, group_t *groups, experiment_config_t *experiments, int num_experiments, const char *output_dir) {
     uint16_t* res = (uint16_t*) calloc(l3_getSets(l3), sizeof(uint16_t));
+
+    // Exact LLC miss counts next to the timing counts, where available
+    pmu_t pmu = PMU_COUNTS ? pmu_open() : NULL;
+    int use_pmu = PMU_COUNTS && (pmu_available(pmu, PMU_LLC_MISSES) || SIMULATE_LLC);
+    uint16_t* pmu_res = use_pmu ? (uint16_t*) calloc(l3_getSets(l3), sizeof(uint16_t)) : NULL;
+    capture_buffer(res, l3_getSets(l3) * sizeof(uint16_t));
+    if (pmu_res)
+        capture_buffer(pmu_res, l3_getSets(l3) * sizeof(uint16_t));
+    if (PMU_COUNTS && !use_pmu)
+        fprintf(stderr, "LLC miss counter unavailable, logging timing counts only\n");
     
     // monitor all sets 
     for(int i = 0; i < l3_getSets(l3); i++){
@@ -62,18 +73,25 @@ void old_experiment(l3pp_t l3, group_t *groups, experiment_config_t *experiments
             cleanup_merged_groups(exp_groups, config->num_groups);
             continue;
         }
+        primer_t *primers = config->prime_enabled && config->prime_chains ?
+            group_primers(exp_groups, config->num_groups, config->prime_chains) : NULL;
 
         // Run the experiment
         for(int g = 0; g < config->num_groups; g++){
             for(int iter = 0; iter < 30; iter++){
                 printf("Group %d, Iteration %d\n", g, iter);
+                capture_kick();
+                PHASE_BEGIN(phase_ts);
                 l3_bprobecount(l3, res);
                 __asm__ volatile("lfence" ::: "memory");
+                PHASE_NEXT(PHASE_BPROBE, phase_ts);
 
                 // __asm__ volatile("mfence" ::: "memory");
 
                 // Prime only if enabled
-                if (config->prime_enabled) {
+                if (primers) {
+                    pr_prime(primers[g]);
+                } else if (config->prime_enabled) {
                     addr_node_t *current = exp_groups[g].head;
                     while (current != NULL && current->next != NULL) {
                         maccessMy(current->next->addr);
@@ -84,9 +102,15 @@ void old_experiment(l3pp_t l3, group_t *groups, experiment_config_t *experiments
                     }
                 }
                 __asm__ volatile("lfence" ::: "memory");
+                PHASE_NEXT(PHASE_PRIME, phase_ts);
 
                 // __asm__ volatile("mfence" ::: "memory");
-                l3_probecount(l3, res);
+                if (use_pmu)
+                    l3_pmuprobecount(l3, pmu, PMU_LLC_MISSES, res, pmu_res);
+                else
+                    l3_probecount(l3, res);
+                PHASE_NEXT(PHASE_PROBE, phase_ts);
+                ms_write(live_stream, res, l3_getSets(l3), STREAM_TAG(g, iter));
 
                 // Write to JSONL log
                 fprintf(log, "{\"group\":%d,\"iter\":%d,\"probe_counts\":[", g, iter);
@@ -96,16 +120,25 @@ void old_experiment(l3pp_t l3, group_t *groups, experiment_config_t *experiments
                         fprintf(log, ",");
                     }
                 }
+                if (use_pmu) {
+                    fprintf(log, "],\"llc_misses\":[");
+                    for (int set = 0; set < l3_getSets(l3); set++)
+                        fprintf(log, set ? ",%u" : "%u", pmu_res[set]);
+                }
                 fprintf(log, "]}\n");
                 fflush(log);
+                PHASE_NEXT(PHASE_LOG, phase_ts);
             }
         }
 
         fclose(log);
+        release_group_primers(primers, config->num_groups);
         cleanup_merged_groups(exp_groups, config->num_groups);
         printf("Completed experiment: %s\n", config->name);
     }
     
+    pmu_close(pmu);
+    free(pmu_res);
     free(res);
 }
 
@@ -123,6 +156,7 @@ void only_misses_exp(l3pp_t l3, l3pp_t l3_primer, const char *output_dir) {
     // }
 
     for(int set = 0; set < l3_getSets(l3); set++){
+        PHASE_BEGIN(phase_ts);
         l3_unmonitorall(l3);
         l3_unmonitorall(l3_primer);
         
@@ -130,12 +164,16 @@ void only_misses_exp(l3pp_t l3, l3pp_t l3_primer, const char *output_dir) {
         for(int slice = 0; slice < l3_getSlices(l3_primer);slice++){
         l3_monitor(l3_primer, set*slice);
         }
+        PHASE_NEXT(PHASE_MONITOR, phase_ts);
         
         l3_bprobecount(l3, res);
         __asm__ volatile("lfence" ::: "memory");
+        PHASE_NEXT(PHASE_BPROBE, phase_ts);
         l3_repeatedprobecount(l3_primer, 2,primer_res, 3000);  // primer probe to evict from cache
         __asm__ volatile("lfence" ::: "memory");
+        PHASE_NEXT(PHASE_PRIME, phase_ts);
         l3_probecount(l3, res);
+        PHASE_NEXT(PHASE_PROBE, phase_ts);
         finalRes[set] = res[0];
     }
     // Write to JSONL log
@@ -169,6 +207,8 @@ void only_misses_exp(l3pp_t l3, l3pp_t l3_primer, const char *output_dir) {
 void new_experiment(l3pp_t l3, group_t *groups, experiment_config_t *experiments, int num_experiments, const char *output_dir) {
     uint16_t* res = (uint16_t*) calloc(1, sizeof(uint16_t));
     uint16_t* finalRes = (uint16_t*) calloc(l3_getSets(l3), sizeof(uint16_t));
+    capture_buffer(res, sizeof(uint16_t));
+    capture_buffer(finalRes, l3_getSets(l3) * sizeof(uint16_t));
     
 
     // Run each experiment
@@ -196,36 +236,46 @@ void new_experiment(l3pp_t l3, group_t *groups, experiment_config_t *experiments
             cleanup_merged_groups(exp_groups, config->num_groups);
             continue;
         }
+        primer_t *primers = config->prime_enabled && config->prime_chains ?
+            group_primers(exp_groups, config->num_groups, config->prime_chains) : NULL;
 
         // Run the experiment
         for(int g = 0; g < config->num_groups; g++){
             for(int iter = 0; iter < 100; iter++){
                 // printf("Group %d, Iteration %d\n", g, iter);
+                capture_kick();
                 for(int set = 0; set < l3_getSets(l3); set++){
+                    PHASE_BEGIN(phase_ts);
                     l3_unmonitorall(l3);
                     l3_monitor(l3, set);
+                    PHASE_NEXT(PHASE_MONITOR, phase_ts);
                     l3_bprobecount(l3, res);
 
                     __asm__ volatile("mfence" ::: "memory");
+                    PHASE_NEXT(PHASE_BPROBE, phase_ts);
 
                     // Prime only if enabled
-                    if (config->prime_enabled) {
+                    if (primers) {
+                        pr_prime(primers[g]);
+                    } else if (config->prime_enabled) {
                         addr_node_t *current = exp_groups[g].head;
                         while (current != NULL) {
                             maccessMy(current->addr);
                             maccessMy(current->addr);
                             maccessMy(current->addr);
-                            // maccessMy(current->addr);
-
                             current = current->next;
                         }
                     }
                     __asm__ volatile("mfence" ::: "memory");
+                    PHASE_NEXT(PHASE_PRIME, phase_ts);
                     l3_probecount(l3, res);
+                    PHASE_NEXT(PHASE_PROBE, phase_ts);
                     finalRes[set] = res[0];
                 }
 
                 // Write to JSONL log
+                PHASE_BEGIN(log_ts);
+                ms_write(live_stream, finalRes, l3_getSets(l3), STREAM_TAG(g, iter));
                 fprintf(log, "{\"group\":%d,\"iter\":%d,\"probe_counts\":[", g, iter);
                 for (int set = 0; set < l3_getSets(l3); set++) {
                     fprintf(log, "%u", finalRes[set]);
@@ -235,10 +285,12 @@ void new_experiment(l3pp_t l3, group_t *groups, experiment_config_t *experiments
                 }
                 fprintf(log, "]}\n");
                 fflush(log);
+                PHASE_NEXT(PHASE_LOG, log_ts);
             }
         }
 
         fclose(log);
+        release_group_primers(primers, config->num_groups);
         cleanup_merged_groups(exp_groups, config->num_groups);
         printf("Completed experiment: %s\n", config->name);
     }
@@ -405,7 +457,20 @@ void calculate_avg_monitor_and_bprobe_time(l3pp_t l3) {
 //     free(res);
 // }
 
-void prime_by_group_line(l3pp_t l3, group_t *groups, experiment_config_t *experiments, int num_experiments, const char *output_dir) {
+// Runs the lines of each group that belong to shard, see shard_t.
+// Returns 0 if an experiment could not be run or logged.
+int prime_by_group_line(l3pp_t l3, group_t *groups, experiment_config_t *experiments, int num_experiments, const char *output_dir, const shard_t *shard) {
+    // Refuse before anything runs rather than skip the experiments whose
+    // logs another mapping numbered
+    int resumable = 1;
+    for (int exp = 0; exp < num_experiments; exp++) {
+        char name[256];
+        shard_name(shard, experiments[exp].name, name, sizeof(name));
+        resumable = checkpoint_resumable(output_dir, name) && resumable;
+    }
+    if (!resumable)
+        return 0;
+
     uint16_t* res = (uint16_t*) calloc(1, sizeof(uint16_t));
     
     // OPTIMIZATION: Allocate a single vector instead of a large matrix
@@ -414,8 +479,10 @@ void prime_by_group_line(l3pp_t l3, group_t *groups, experiment_config_t *experi
     if (!min_res) {
         fprintf(stderr, "Failed to allocate min_res\n");
         free(res);
-        return;
+        return 0;
     }
+    capture_buffer(res, sizeof(uint16_t));
+    capture_buffer(min_res, num_sets * sizeof(uint16_t));
 
     // Run each experiment
     for (int exp = 0; exp < num_experiments; exp++) {
@@ -425,30 +492,44 @@ void prime_by_group_line(l3pp_t l3, group_t *groups, experiment_config_t *experi
                config->name, config->num_groups, 
                config->prime_enabled ? "yes" : "no");
 
+        // Open the log, resuming after the last completed group line
+        char name[256];
+        shard_name(shard, config->name, name, sizeof(name));
+        checkpoint_t cp;
+        FILE *log = checkpoint_open(&cp, output_dir, name);
+        if (!log) {
+            fprintf(stderr, "Failed to open log file %s, stopping\n", cp.results_path);
+            free(min_res);
+            free(res);
+            return 0;
+        }
+        if (cp.done) {
+            checkpoint_close(&cp, 1);
+            continue;
+        }
+
         // Create merged groups for this experiment
         group_t *exp_groups = merge_groups_create_new(groups, config->num_groups);
         if (!exp_groups) {
             printf("merge failed for %s\n", config->name);
-            continue;
-        }
-
-        // Create log file
-        char filename[512];
-        snprintf(filename, sizeof(filename), "%s/%s.jsonl", output_dir, config->name);
-        FILE *log = fopen(filename, "w");
-        
-        if (!log) {
-            fprintf(stderr, "Failed to open log file %s\n", filename);
-            cleanup_merged_groups(exp_groups, config->num_groups);
-            continue;
+            checkpoint_close(&cp, 0);
+            free(min_res);
+            free(res);
+            return 0;
         }
 
-        // uint64_t start_cycles, end_cycles;
         for(int g = 0; g < config->num_groups; g++){
             addr_node_t *current = exp_groups[g].head;
             int lineCount = 0;
-            while (current != NULL)
+            int first_line, end_line;
+            shard_range(shard, exp_groups[g].count, &first_line, &end_line);
+            while (current != NULL && lineCount < end_line)
             { 
+                if (lineCount < first_line || checkpoint_completed(&cp, g, lineCount)) {
+                    current = current->next;
+                    lineCount++;
+                    continue;
+                }
                 printf("Group %d, groupLine: %d\n", g, lineCount);        
                 
                 // OPTIMIZATION: Reset min_res vector for this group line
@@ -456,69 +537,83 @@ void prime_by_group_line(l3pp_t l3, group_t *groups, experiment_config_t *experi
                 for (int i = 0; i < num_sets; i++) {
                     min_res[i] = UINT16_MAX;
                 }
-                // start_cycles = rdtscp64();
                 for(int iter = 0; iter < NUM_ITERATIONS; iter++){
+                    capture_kick();
                     for(int set = 0; set < num_sets; set++){
-                        // start_cycles = rdtscp64();
-
+                        PHASE_BEGIN(phase_ts);
                         l3_unmonitorall(l3);
                         l3_monitor(l3, set);
-                        l3_bprobecount(l3, res);
+                        PHASE_NEXT(PHASE_MONITOR, phase_ts);
+                        // An interrupted probe is redone from the prime
+                        for (int tries = 0; ; tries++) {
+                            l3_bprobecount(l3, res);
 
 
-                        __asm__ volatile("mfence" ::: "memory"); 
-                        // start_cycles = rdtscp64();
+                            __asm__ volatile("mfence" ::: "memory"); 
+                            PHASE_NEXT(PHASE_BPROBE, phase_ts);
                            
-                        maccessMy(current->addr);
+                            maccessMy(current->addr);
                         
-                        __asm__ volatile("mfence" ::: "memory");
-                        l3_probecount(l3, res);
+                            __asm__ volatile("mfence" ::: "memory");
+                            PHASE_NEXT(PHASE_PRIME, phase_ts);
+                            l3_probecount(l3, res);
+                            PHASE_NEXT(PHASE_PROBE, phase_ts);
+                            if (!taint_redo(l3, res, tries))
+                                break;
+                        }
 
-                        // end_cycles = rdtscp64();
-                        // double time_cycles = (double)((end_cycles - start_cycles)/CLCOCK_SPEED)*1e6; // in us
-                        // printf("group %d, groupLine %d MONITORING + BPROBE + PRIME + PROBE took: %.3f us\n", g, lineCount, time_cycles);
                         // OPTIMIZATION: Update min value on the fly
                         
                         if (res[0] < min_res[set]) {
                             min_res[set] = res[0];
                         }
+                        PHASE_NEXT(PHASE_REDUCE, phase_ts);
                     }
                 }
 
                 // Write to JSONL log
+                PHASE_BEGIN(log_ts);
+                ms_write(live_stream, min_res, num_sets, STREAM_TAG(g, lineCount));
                 fprintf(log, "{\"group\":%d,\"groupLine\":%d,\"missed_sets\":[", g, lineCount);
 
                 // Filter and Write directly from min_res
-                // Condition matches previous logic: > 0 and != MAX
+                // Condition matches previous logic: > 0 and != MAX, and
+                // sets whose every probe was flagged are left out too
                 int first = 1;
                 for (int s = 0; s < num_sets; s++) {
-                    if (min_res[s] > 0 && min_res[s] != UINT16_MAX) {
+                    if (min_res[s] > 0 && min_res[s] < TAINT_FLAGGED) {
                         if (!first) {
                             fprintf(log, ",");
                         }
-                        fprintf(log, "[%d,%u]", s, min_res[s]);
+                        fprintf(log, "[%d,%u]", set_id(s), min_res[s]);
                         first = 0;
                     }
                 }
 
                 fprintf(log, "]}\n");
-                fflush(log);
+                if (!checkpoint_commit(&cp, g, lineCount)) {
+                    fprintf(stderr, "Cannot save %s, stopping\n", cp.results_path);
+                    checkpoint_close(&cp, 0);
+                    cleanup_merged_groups(exp_groups, config->num_groups);
+                    free(min_res);
+                    free(res);
+                    return 0;
+                }
+                PHASE_NEXT(PHASE_LOG, log_ts);
 
                 current = current->next;
                 lineCount++;
-                // end_cycles = rdtscp64();
-                // double time_cycles = (double)((end_cycles - start_cycles)/CLCOCK_SPEED)*1e3; // in ms
-                // printf("group %d, groupLine %d took: %.3f ms\n", g, lineCount, time_cycles);
             }
         }
 
-        fclose(log);
+        checkpoint_close(&cp, 1);
         cleanup_merged_groups(exp_groups, config->num_groups);
         printf("Completed experiment: %s\n", config->name);
     }
     
     free(min_res);
     free(res);
+    return 1;
 }
 // Add function definition before main()
 int create_output_directory(const char *path) {
@@ -538,6 +633,17 @@ int main(int argc, char **argv) {
             return 1;
         }
     }
+    // Per-phase cycle summary on exit and on SIGUSR1, also written as JSON
+    // to $PHASE_STATS_FILE if set
+    phase_stats_init(getenv("PHASE_STATS_FILE"));
+
+    // SHARD=index/count runs one shard of the prime_by_group_line plan
+    shard_t shard;
+    if (!shard_parse(&shard, getenv("SHARD"))) {
+        fprintf(stderr, "Invalid SHARD, expected index/count\n");
+        return 1;
+    }
+
     // Create output directory path
     char output_dir[256];
     snprintf(output_dir, sizeof(output_dir), "%s/%zuMB", OUTPUT_BASE_DIR, arena_mb);
@@ -551,21 +657,34 @@ int main(int argc, char **argv) {
     printf("Output directory: %s\n", output_dir);
 
     experiment_config_t experiments[] = {
-    // {"1_group_no_prime0", 1, 0},
-    // {"1_group_no_prime1", 1, 0},
-    {"1_group_prime", 1, 1},
-    {"2_group_prime", 2, 1},
-    {"4_group_prime", 4, 1},
-    {"8_group_prime", 8, 1},
-    {"16_group_prime", 16, 1},
-    {"32_group_prime", 32, 1}
-    // {"64_group_prime", 64, 1}
+    // {"1_group_no_prime0", 1, 0, 0},
+    // {"1_group_no_prime1", 1, 0, 0},
+    {"1_group_prime", 1, 1, 0},
+    {"2_group_prime", 2, 1, 0},
+    {"4_group_prime", 4, 1, 0},
+    {"8_group_prime", 8, 1, 0},
+    {"16_group_prime", 16, 1, 0},
+    {"32_group_prime", 32, 1, 0}
+    // {"64_group_prime", 64, 1, 0}
+    // {"8_group_prime_chains", 8, 1, PRIME_CHAINS}
     };
     int num_experiments = sizeof(experiments) / sizeof(experiments[0]);
 
-    l3pp_t l3;
+    l3pp_t l3 = NULL;
     prepareL3(&l3);
 
+    setup_prime_pattern(l3);
+    setup_taint(l3);
+    setup_tlb(l3);
+    setup_capture(l3);
+
+    const char *stream_path = getenv("STREAM_SOCKET");
+    if (stream_path && l3) {
+        live_stream = ms_publish(stream_path, l3_getSets(l3), STREAM_SLOTS, STREAM_DECIMATE);
+        if (!live_stream)
+            fprintf(stderr, "Cannot publish on %s\n", stream_path);
+    }
+
 
     if (TESTING_MODE == 1) {
         printf("Testing functions mode...\n");
@@ -573,7 +692,8 @@ int main(int argc, char **argv) {
         // calculate_avg_monitor_and_bprobe_time(l3);
 
 
-        // void **eviction_sets = get_eviction_sets_via_offsets(l3);
+        // int ways;
+        // void **eviction_sets = get_eviction_sets(l3, &ways);
         // (void)eviction_sets; // Suppress unused variable warning
 
 
@@ -592,22 +712,23 @@ int main(int argc, char **argv) {
         // }
 
 
-        // void **sets_a = get_eviction_sets_via_offsets(l3);
+        // void **sets_a = get_eviction_sets(l3, &ways);
         // l3_release(l3);
         // free(eviction_sets);
 
         sleep(3); // Pause to read output
-        l3pp_t l3_b;
+        l3pp_t l3_b = NULL;
         prepareL3(&l3_b);
-        int numOfSets = l3_getSets(l3_b);
-        void **sets_b = get_eviction_sets_via_offsets(l3_b);
         // create groups from eviction sets
-        group_t* groups_a = eviction_sets_to_groups(sets_b, numOfSets);
+        group_t* groups_a = eviction_sets_to_groups(l3_b);
         new_experiment(l3, groups_a, experiments, num_experiments, "data/mastik_lazyGroups/24MB");
+        release_set_groups(l3_b, groups_a);
 
         
         
-        // int intersection = check_intersection(sets_a, sets_b, numOfSets);
+        // int numOfSets = l3_getSets(l3_b);
+        // void **sets_b = get_eviction_sets(l3_b, &ways);
+        // int intersection = check_intersection(sets_a, sets_b, numOfSets, ways);
         // printf("Intersection result: %d\n", intersection);
 
 
@@ -618,10 +739,15 @@ int main(int argc, char **argv) {
     
     if( EXPERIMENT_MODE == 4) {
         
-        l3pp_t l3_primer;
+        l3pp_t l3_primer = NULL;
         prepareL3(&l3_primer);
         only_misses_exp(l3, l3_primer, "data");
+        report_footprint(l3);
+        report_taint(l3);
+        report_tlb(l3);
+        end_capture();
         l3_release(l3_primer);
+        ms_close(live_stream);
         return 0;
     } 
 
@@ -640,12 +766,16 @@ int main(int argc, char **argv) {
     //------------------ END OF INITIALIZATION ------------------//
 
 
+    int status = 0;
     switch (EXPERIMENT_MODE) {
         case 1:
             new_experiment(l3, groups, experiments, num_experiments, "data/64B_stride_L2_prefetcher/24MB_3accesses");
             break;
         case 2:
-            prime_by_group_line(l3, groups, experiments, num_experiments, "data/regular_pages");
+            setup_set_ids(l3);
+            shard_write_meta(&shard, l3, arena_mb, experiments, num_experiments, "data/regular_pages");
+            if (!prime_by_group_line(l3, groups, experiments, num_experiments, "data/regular_pages", &shard))
+                status = 1;
             break;
         case 3:
             old_experiment(l3, groups, experiments, num_experiments, output_dir);
@@ -680,13 +810,19 @@ int main(int argc, char **argv) {
         fflush(stdout);
     }
 
+    ms_close(live_stream);
+    report_footprint(l3);
+    report_taint(l3);
+    report_tlb(l3);
+    end_capture();
+
     printf("Before l3_release\n");
     fflush(stdout);
     l3_release(l3);
     printf("After l3_release\n");
     fflush(stdout);
     
-    return 0;
+    return status;
 
 
 
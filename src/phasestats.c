@@ -0,0 +1,199 @@
+#include "phasestats.h"
+
+#if PHASE_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static const char *phase_names[PHASE_COUNT] = {
+    "monitor", "bprobe", "prime", "probe", "reduce", "log"
+};
+
+__thread phase_thread_t *phase_self = NULL;
+
+// Threads are only ever added, at the head, so the signal handler can walk
+// the list without taking the lock.
+static phase_thread_t *phase_threads = NULL;
+static pthread_mutex_t phase_lock = PTHREAD_MUTEX_INITIALIZER;
+static int phase_nthreads = 0;
+static char *phase_export_path = NULL;
+
+phase_thread_t *phase_register_thread(void) {
+    // Never freed: the histograms outlive the thread for the final summary
+    phase_thread_t *t = calloc(1, sizeof(phase_thread_t));
+    pthread_mutex_lock(&phase_lock);
+    t->id = phase_nthreads++;
+    t->next = phase_threads;
+    __atomic_store_n(&phase_threads, t, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&phase_lock);
+    phase_self = t;
+    return t;
+}
+
+// Buffered output built from async-signal-safe calls only, so the same
+// code serves the exit handler and SIGUSR1.
+typedef struct {
+    int fd;
+    int len;
+    char buf[4096];
+} out_t;
+
+static void out_flush(out_t *o) {
+    int off = 0;
+    while (off < o->len) {
+        ssize_t n = write(o->fd, o->buf + off, o->len - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    o->len = 0;
+}
+
+static void out_str(out_t *o, const char *s) {
+    while (*s) {
+        if (o->len == sizeof(o->buf))
+            out_flush(o);
+        o->buf[o->len++] = *s++;
+    }
+}
+
+static void out_u64(out_t *o, uint64_t v) {
+    char tmp[21];
+    int i = sizeof(tmp) - 1;
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    out_str(o, tmp + i);
+}
+
+// Right-aligned to width
+static void out_col(out_t *o, uint64_t v, int width) {
+    int digits = 1;
+    for (uint64_t x = v; x >= 10; x /= 10)
+        digits++;
+    while (width-- > digits)
+        out_str(o, " ");
+    out_u64(o, v);
+}
+
+// Lower bound of the bucket holding the given fraction of the samples
+static uint64_t hist_quantile(const phase_hist_t *h, uint64_t num, uint64_t den) {
+    uint64_t target = (h->count * num + den - 1) / den;
+    uint64_t seen = 0;
+    for (int k = 0; k < PHASE_BUCKETS; k++) {
+        seen += h->buckets[k];
+        if (seen >= target && seen > 0)
+            return 1ull << k;
+    }
+    return 0;
+}
+
+void phase_stats_dump(int fd) {
+    out_t o = {.fd = fd, .len = 0};
+    phase_thread_t *t = __atomic_load_n(&phase_threads, __ATOMIC_ACQUIRE);
+    for (; t != NULL; t = t->next) {
+        uint64_t total = 0;
+        for (int p = 0; p < PHASE_COUNT; p++)
+            total += t->hist[p].cycles;
+        if (total == 0)
+            continue;
+        out_str(&o, "Phase cycles, thread ");
+        out_u64(&o, t->id);
+        out_str(&o, ":\n  phase          count          cycles  share%      mean    ~p50    ~p99\n");
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            const phase_hist_t *h = &t->hist[p];
+            if (h->count == 0)
+                continue;
+            out_str(&o, "  ");
+            out_str(&o, phase_names[p]);
+            for (int pad = strlen(phase_names[p]); pad < 8; pad++)
+                out_str(&o, " ");
+            out_col(&o, h->count, 12);
+            out_col(&o, h->cycles, 16);
+            out_col(&o, h->cycles * 100 / total, 8);
+            out_col(&o, h->cycles / h->count, 10);
+            out_col(&o, hist_quantile(h, 1, 2), 8);
+            out_col(&o, hist_quantile(h, 99, 100), 8);
+            out_str(&o, "\n");
+        }
+    }
+    out_flush(&o);
+}
+
+int phase_stats_export(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    out_t o = {.fd = fd, .len = 0};
+    out_str(&o, "{\"threads\":[");
+    phase_thread_t *t = __atomic_load_n(&phase_threads, __ATOMIC_ACQUIRE);
+    for (int first = 1; t != NULL; t = t->next, first = 0) {
+        out_str(&o, first ? "\n" : ",\n");
+        out_str(&o, "{\"thread\":");
+        out_u64(&o, t->id);
+        out_str(&o, ",\"phases\":{");
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            const phase_hist_t *h = &t->hist[p];
+            out_str(&o, p ? ",\"" : "\"");
+            out_str(&o, phase_names[p]);
+            out_str(&o, "\":{\"count\":");
+            out_u64(&o, h->count);
+            out_str(&o, ",\"cycles\":");
+            out_u64(&o, h->cycles);
+            out_str(&o, ",\"log2_hist\":[");
+            int last = PHASE_BUCKETS - 1;
+            while (last > 0 && h->buckets[last] == 0)
+                last--;
+            for (int k = 0; k <= last; k++) {
+                if (k)
+                    out_str(&o, ",");
+                out_u64(&o, h->buckets[k]);
+            }
+            out_str(&o, "]}");
+        }
+        out_str(&o, "}}");
+    }
+    out_str(&o, "\n]}\n");
+    out_flush(&o);
+    close(fd);
+    return 0;
+}
+
+static void phase_stats_report(void) {
+    phase_stats_dump(STDERR_FILENO);
+    if (phase_export_path)
+        phase_stats_export(phase_export_path);
+}
+
+static void phase_stats_signal(int sig) {
+    (void)sig;
+    phase_stats_report();
+}
+
+void phase_stats_init(const char *export_path) {
+    static int initialised = 0;
+    if (export_path) {
+        free(phase_export_path);
+        phase_export_path = strdup(export_path);
+    }
+    if (initialised)
+        return;
+    initialised = 1;
+    atexit(phase_stats_report);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = phase_stats_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef PHASESTATS_H
+#define PHASESTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mastik/low.h>
+
+// Per-phase cycle histograms for the experiment loops.  Each thread keeps
+// its own log2 histogram per phase, so recording is a few increments with
+// no locking or formatting.  A summary is written to stderr on exit and on
+// SIGUSR1, and to the export file, if one is given, as JSON.
+//
+// Build with -DPHASE_STATS=0 to compile the probes out.
+
+#ifndef PHASE_STATS
+#define PHASE_STATS 1
+#endif
+
+#define PHASE_BUCKETS 64
+
+typedef enum {
+    PHASE_MONITOR,
+    PHASE_BPROBE,
+    PHASE_PRIME,
+    PHASE_PROBE,
+    PHASE_REDUCE,
+    PHASE_LOG,
+    PHASE_COUNT
+} phase_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t buckets[PHASE_BUCKETS]; // buckets[k] counts samples in [2^k, 2^(k+1))
+} phase_hist_t;
+
+typedef struct phase_thread {
+    int id;
+    phase_hist_t hist[PHASE_COUNT];
+    struct phase_thread *next;
+} phase_thread_t;
+
+#if PHASE_STATS
+
+extern __thread phase_thread_t *phase_self;
+phase_thread_t *phase_register_thread(void);
+
+static inline void phase_record(phase_t phase, uint64_t *start) {
+    uint64_t now = rdtscp64();
+    uint64_t cycles = now - *start;
+    phase_thread_t *t = phase_self;
+    if (__builtin_expect(t == NULL, 0))
+        t = phase_register_thread();
+    phase_hist_t *h = &t->hist[phase];
+    h->count++;
+    h->cycles += cycles;
+    h->buckets[63 - __builtin_clzll(cycles | 1)]++;
+    *start = now;
+}
+
+// PHASE_BEGIN(t) starts timing.  PHASE_NEXT(phase, t) charges the cycles
+// since the last mark to phase and starts timing the next one.
+#define PHASE_BEGIN(t) uint64_t t = rdtscp64()
+#define PHASE_NEXT(phase, t) phase_record((phase), &(t))
+
+void phase_stats_init(const char *export_path);
+void phase_stats_dump(int fd);
+int phase_stats_export(const char *path);
+
+#else
+
+#define PHASE_BEGIN(t) ((void)0)
+#define PHASE_NEXT(phase, t) ((void)0)
+#define phase_stats_init(export_path) ((void)(export_path))
+#define phase_stats_dump(fd) ((void)(fd))
+#define phase_stats_export(path) ((void)(path), 0)
+
+#endif
+
+#endif
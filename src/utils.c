@@ -1,68 +1,189 @@
 #include "utils.h"
+#include <mastik/policy.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
-#include <mastik/impl.h>
+#include <unistd.h>
+
+
+sim_t llc_sim = NULL;
+stream_t live_stream = NULL;
+
+// All L3 instances share one mm, so only the first pays for mapping the
+// cache and each later instance just reserves its own lines in it.
+static mm_t shared_mm = NULL;
+
+static mm_t new_shared_mm(l3info_t l3i) {
+    mm_t mm = mm_prepare(NULL, NULL, (lxinfo_t)l3i);
+    if (mm && llc_sim)
+        mm_setsim(mm, llc_sim);
+    const char *limit = getenv("MM_LIMIT_MB");
+    if (mm && limit)
+        mm_setlimit(mm, (size_t)strtoul(limit, NULL, 10) << 20);
+    const char *socket = getenv("LLC_SOCKET");
+    if (mm && socket && !llc_sim) {
+        int s = strcmp(socket, "local") == 0 ? -1 : atoi(socket);
+        struct numaplacement p;
+        if (mm_setsocket(mm, s) && mm_getplacement(mm, &p))
+            printf("Placed on socket %d, LLC %d: %d CPUs, nodes 0x%llx\n",
+                   p.socket, p.llc, p.ncpus, (unsigned long long)p.nodes);
+        else
+            fprintf(stderr, "Cannot place the mm on socket %s\n", socket);
+    }
+    return mm;
+}
 
+void report_footprint(l3pp_t l3) {
+    if (!l3)
+        return;
+    size_t highwater;
+    size_t footprint = mm_footprint(l3_getmm(l3), &highwater);
+    printf("mm footprint: %.1f MB, high-water %.1f MB\n",
+           footprint / 1048576.0, highwater / 1048576.0);
+}
 
+// Counts context switches for the taint detection, see setup_taint
+static pmu_t taint_pmu = NULL;
+static int taint_retries = 0;
+static uint64_t taint_redone = 0;
 
-// Offsets derived from Mastik struct l3pp
-#define OFFSET_MONITOREDHEAD 0
-#define OFFSET_NMONITORED    8
-#define OFFSET_MONITOREDSET  16
+void setup_taint(l3pp_t l3) {
+    const char *retries = getenv("PROBE_TAINT");
+    if (!retries || !l3)
+        return;
+    if (llc_sim) {
+        fprintf(stderr, "PROBE_TAINT has no effect on a simulated LLC\n");
+        return;
+    }
+    struct taintinfo ti = {0};
+    taint_retries = atoi(retries);
+    ti.flags = TAINT_CTXSWITCH;
+    const char *gap = getenv("PROBE_TAINT_GAP");
+    if (gap)
+        ti.gap = (uint32_t)strtoul(gap, NULL, 10);
+    taint_pmu = pmu_open();
+    ti.pmu = taint_pmu;
+    l3_settaint(l3, &ti);
+    printf("Taint detection: %d retries, gap %s, switches from %s\n", taint_retries,
+           gap ? gap : "default",
+           pmu_available(taint_pmu, PMU_CONTEXT_SWITCHES) ? "perf" : "getrusage");
+}
 
+int taint_redo(l3pp_t l3, uint16_t *res, int tries) {
+    if (l3_taintrecord(l3, res) == 0 || tries >= taint_retries)
+        return 0;
+    taint_redone++;
+    return 1;
+}
 
+// Counts DTLB misses of the probes, see setup_tlb
+static pmu_t tlb_pmu = NULL;
 
-void **get_eviction_sets_via_offsets(l3pp_t l3) {
-    if (!l3) return NULL;
-    int total_sets = l3_getSets(l3);
-    // 1. Ensure all sets are being monitored
-    for (int i = 0; i < total_sets; i++)
-    {
-        l3_monitor(l3, i);
+void setup_tlb(l3pp_t l3) {
+    const char *spec = getenv("PROBE_TLB");
+    if (!spec || !l3)
+        return;
+    struct tlbinfo ti = {0};
+    if (strstr(spec, "order"))
+        ti.flags |= TLB_PAGEORDER;
+    if (strstr(spec, "warm"))
+        ti.flags |= TLB_WARMUP;
+    if (ti.flags == 0) {
+        fprintf(stderr, "Nothing to do for PROBE_TLB=%s\n", spec);
+        return;
     }
-    
+    if (!llc_sim) {
+        tlb_pmu = pmu_open();
+        ti.pmu = tlb_pmu;
+    }
+    l3_settlb(l3, &ti);
+    printf("TLB layout: %s, misses %s\n", spec,
+           pmu_available(tlb_pmu, PMU_DTLB_MISSES) ? "counted" : "not counted");
+}
 
-    // 2. Use pointer arithmetic to access the private fields
-    char *base_addr = (char *)l3;
-    
-    // Extract: void **monitoredhead
-    void ***monitoredhead_ptr = (void ***)(base_addr + OFFSET_MONITOREDHEAD);
-    void **internal_heads = *monitoredhead_ptr;
-
-    // Extract: int nmonitored
-    int *nmonitored_ptr = (int *)(base_addr + OFFSET_NMONITORED);
-    int active_count = *nmonitored_ptr;
-    printf("Active monitored sets: %d\n", active_count);
-
-    // Extract: int *monitoredset (The array of actual Set IDs)
-    // While strict sequential monitoring makes this optional, using it makes the code crash-proof.
-    int **monitoredset_ptr = (int **)(base_addr + OFFSET_MONITOREDSET);
-    int *internal_set_ids = *monitoredset_ptr;
-
-    // 3. Allocate the dense array to return
-    // l3_getSets returns the total number of sets (e.g. 2048, 8192)
-    void **dense_array = (void **)calloc(total_sets, sizeof(void *));
-    if (!dense_array) return NULL;
-
-    // 4. Map the internal sparse arrays to our dense array
-    for (int i = 0; i < active_count; i++) {
-        // Get the real Set ID (e.g., 0, 1, 2...)
-        int set_idx = internal_set_ids[i];
-
-        // if(i % 256 == 0) {
-        //     printf("i IS: %d set_idx IS: %d\n", i, set_idx);
-        // }
-        
-        // Safety check
-        if (set_idx >= 0 && set_idx < total_sets) {
-            dense_array[set_idx] = internal_heads[i];
-        }
+// Capture mode, see setup_capture
+static rt_t capture = NULL;
+
+void setup_capture(l3pp_t l3) {
+    const char *spec = getenv("CAPTURE_MODE");
+    if (!spec || !l3)
+        return;
+    struct rtinfo info = {0};
+    if (strcmp(spec, "all") == 0)
+        info.flags = RT_ALL;
+    if (strstr(spec, "pin"))
+        info.flags |= RT_PIN;
+    if (strstr(spec, "lock"))
+        info.flags |= RT_LOCKMEMORY;
+    if (strstr(spec, "fifo"))
+        info.flags |= RT_FIFO;
+    if (info.flags == 0) {
+        fprintf(stderr, "Nothing to do for CAPTURE_MODE=%s\n", spec);
+        return;
     }
-    l3_unmonitorall(l3);
-    return dense_array;
+    const char *watchdog = getenv("CAPTURE_WATCHDOG_MS");
+    if (watchdog)
+        info.watchdog = atoi(watchdog);
+    info.mm = l3_getmm(l3);
+    capture = rt_enter(&info);
+    rt_print(capture, stdout);
+}
+
+void capture_buffer(void *buf, size_t size) {
+    if (capture)
+        rt_lock(capture, buf, size);
+}
+
+void capture_kick(void) {
+    if (capture)
+        rt_kick(capture);
+}
+
+void end_capture(void) {
+    if (!capture)
+        return;
+    rt_print(capture, stdout);
+    rt_exit(capture);
+    capture = NULL;
+}
+
+void report_taint(l3pp_t l3) {
+    struct taintstats ts;
+    if (!l3 || !l3_gettaintstats(l3, &ts))
+        return;
+    printf("Taint: %llu of %llu set probes flagged, %llu records redone, "
+           "%llu of %llu records switched, slowest %llu cycles\n",
+           (unsigned long long)ts.flagged, (unsigned long long)ts.sets,
+           (unsigned long long)taint_redone, (unsigned long long)ts.switched,
+           (unsigned long long)ts.records, (unsigned long long)ts.maxgap);
+}
+
+void report_tlb(l3pp_t l3) {
+    struct tlbstats ts;
+    if (!l3 || !l3_gettlbstats(l3, &ts))
+        return;
+    // Only probes counted set by set are marked as affected, see tlb.h
+    printf("TLB: %llu misses in %llu set probes, %llu probes seen missing, warm-up line %d\n",
+           (unsigned long long)ts.misses, (unsigned long long)ts.probes,
+           (unsigned long long)ts.affected, ts.warmoffset);
+}
+
+
+// Returns the eviction sets of l3 as a flat array of l3_getSets() * ways
+// lines, with set s starting at index s * ways.  Short sets are padded
+// with NULL.  The lines come from Mastik's map of the cache, so this does
+// not monitor anything.
+void **get_eviction_sets(l3pp_t l3, int *ways) {
+    if (!l3) return NULL;
+    int total_sets = l3_getSets(l3);
+    *ways = l3_getAssociativity(l3);
+
+    void **flat = (void **)calloc((size_t)total_sets * *ways, sizeof(void *));
+    if (!flat) return NULL;
+    l3_exportevictionsets(l3, flat, *ways);
+    return flat;
 }
 
 
@@ -76,30 +197,16 @@ int compare_ptrs(const void *a, const void *b) {
     return 0;
 }
 
-// Helper: Flattens all linked lists in 'sets' into a single sorted array of pointers
+// Helper: Copies the non-NULL lines of the flat array 'sets' (from get_eviction_sets)
+// into a single sorted array of pointers.
 // Returns the array, and sets *out_count to the number of elements.
-void **collect_and_sort_addresses(void **sets, int nsets, size_t *out_count) {
-    size_t capacity = 1024;
+void **collect_and_sort_addresses(void **sets, size_t nlines, size_t *out_count) {
     size_t count = 0;
-    void **flat_array = malloc(capacity * sizeof(void *));
-
-    for (int i = 0; i < nsets; i++) {
-        if (sets[i] == NULL) continue;
+    void **flat_array = malloc((nlines ? nlines : 1) * sizeof(void *));
 
-        void *curr = sets[i];
-        do {
-            // Resize if necessary
-            if (count >= capacity) {
-                capacity *= 2;
-                flat_array = realloc(flat_array, capacity * sizeof(void *));
-            }
-            
-            // Add address
-            flat_array[count++] = curr;
-            
-            // Move to next node
-            curr = LNEXT(curr);
-        } while (curr != sets[i]);
+    for (size_t i = 0; i < nlines; i++) {
+        if (sets[i] != NULL)
+            flat_array[count++] = sets[i];
     }
 
     // Sort the collected addresses
@@ -110,21 +217,21 @@ void **collect_and_sort_addresses(void **sets, int nsets, size_t *out_count) {
 }
 
 /* * Checks if there is any intersection between the addresses in the eviction sets 
- * of l3_a and l3_b.
+ * of l3_a and l3_b.  Handles from prepareL3 share one mapping, so only a
+ * handle prepared on its own mm gives an independent one to compare.
  * Returns: 1 if intersection found, 0 otherwise.
  * Prints the first 10 intersecting addresses found.
  */
-int check_intersection(void **sets_a,void **sets_b, int numOfSets) {
+int check_intersection(void **sets_a,void **sets_b, int numOfSets, int ways) {
     if (!sets_a || !sets_b) return 0;
 
-    int nsets_a = numOfSets;
-    int nsets_b = numOfSets;
+    size_t nlines = (size_t)numOfSets * ways;
 
 
     // 2. Flatten and sort
     size_t count_a, count_b;
-    void **flat_a = collect_and_sort_addresses(sets_a, nsets_a, &count_a);
-    void **flat_b = collect_and_sort_addresses(sets_b, nsets_b, &count_b);
+    void **flat_a = collect_and_sort_addresses(sets_a, nlines, &count_a);
+    void **flat_b = collect_and_sort_addresses(sets_b, nlines, &count_b);
 
     // 3. Find intersection (linear scan of two sorted arrays)
     size_t i = 0, j = 0;
@@ -166,11 +273,327 @@ int check_intersection(void **sets_a,void **sets_b, int numOfSets) {
 
 
 
+//------------------ Set ids ------------------//
+
+static int *logged_ids = NULL;
+static int num_logged_ids = 0;
+static char mapping[32] = "";
+
+static uint64_t splitmix64(uint64_t *state);
+
+void setup_set_ids(l3pp_t l3) {
+    if (!l3)
+        return;
+    mm_t mm = l3_getmm(l3);
+    int nsets = l3_getSets(l3);
+    int *ids = malloc(nsets * sizeof(int));
+    char *taken = calloc(nsets, 1);
+    int canonical = ids && taken;
+    for (int s = 0; s < nsets && canonical; s++) {
+        void *line = mm_requestline(mm, L3, s);
+        ids[s] = line ? mm_llcset(mm, line) : -1;
+        if (line)
+            mm_returnline(mm, line);
+        // Two sets on one id would be a broken map, not a canonical one
+        if (ids[s] < 0 || ids[s] >= nsets || taken[ids[s]])
+            canonical = 0;
+        else
+            taken[ids[s]] = 1;
+    }
+    free(taken);
+    if (canonical) {
+        logged_ids = ids;
+        num_logged_ids = nsets;
+        snprintf(mapping, sizeof(mapping), "phys");
+    } else {
+        free(ids);
+        uint64_t state = (uint64_t)time(NULL) << 20 ^ (uint64_t)getpid();
+        snprintf(mapping, sizeof(mapping), "run-%016llx", (unsigned long long)splitmix64(&state));
+    }
+    printf("Sets logged by %s\n", canonical ? "physical set" : "index of this run's mapping");
+}
+
+int set_id(int set) {
+    return set < num_logged_ids ? logged_ids[set] : set;
+}
+
+const char *mapping_id(void) {
+    return mapping;
+}
+
+//------------------ Checkpointing ------------------//
+
+static int write_progress(checkpoint_t *cp, long offset) {
+    char tmp[520];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", cp->progress_path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        perror(tmp);
+        return 0;
+    }
+    int ok = offset >= 0;
+    ok = fprintf(f, "group %d groupLine %d offset %ld done %d mapping %s\n",
+                 cp->group, cp->line, offset, cp->done, cp->mapping) > 0 && ok;
+    ok = fflush(f) == 0 && ok;
+    ok = fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        perror(tmp);
+        unlink(tmp);
+        return 0;
+    }
+    // rename is atomic, so a crash leaves either the old or the new record
+    if (rename(tmp, cp->progress_path) != 0) {
+        perror(cp->progress_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Reads the progress record of cp, returns 0 if there is none
+static int read_progress(checkpoint_t *cp, long *offset, char *logged) {
+    FILE *f = fopen(cp->progress_path, "r");
+    if (!f)
+        return 0;
+    int n = fscanf(f, "group %d groupLine %d offset %ld done %d mapping %31s",
+                   &cp->group, &cp->line, offset, &cp->done, logged);
+    fclose(f);
+    return n == 4 || n == 5;
+}
+
+static void checkpoint_paths(checkpoint_t *cp, const char *output_dir, const char *name) {
+    memset(cp, 0, sizeof(*cp));
+    cp->group = -1;
+    cp->line = -1;
+    snprintf(cp->results_path, sizeof(cp->results_path), "%s/%s.jsonl", output_dir, name);
+    snprintf(cp->progress_path, sizeof(cp->progress_path), "%s/%s.progress", output_dir, name);
+    snprintf(cp->mapping, sizeof(cp->mapping), "%s", mapping_id());
+}
+
+// Appending under another mapping would mix two numberings of the sets
+static int mapping_matches(const checkpoint_t *cp, const char *logged) {
+    if (cp->done || strcmp(logged, cp->mapping) == 0)
+        return 1;
+    fprintf(stderr, "Cannot resume %s: its sets are numbered by mapping %s, this run by %s. "
+            "Delete %s to start over.\n", cp->results_path, logged, cp->mapping, cp->progress_path);
+    return 0;
+}
+
+int checkpoint_resumable(const char *output_dir, const char *name) {
+    checkpoint_t cp;
+    long offset = 0;
+    char logged[32] = "none";
+    checkpoint_paths(&cp, output_dir, name);
+    return !read_progress(&cp, &offset, logged) || mapping_matches(&cp, logged);
+}
+
+FILE *checkpoint_open(checkpoint_t *cp, const char *output_dir, const char *name) {
+    long offset = 0;
+    char logged[32] = "none";
+    checkpoint_paths(cp, output_dir, name);
+    int resumed = read_progress(cp, &offset, logged);
+    if (resumed && !mapping_matches(cp, logged))
+        return NULL;
+    // Drop whatever was written after the last completed unit
+    if (resumed && truncate(cp->results_path, offset) != 0) {
+        fprintf(stderr, "Cannot resume %s, starting over\n", cp->results_path);
+        resumed = 0;
+    }
+    if (!resumed) {
+        cp->group = cp->line = -1;
+        cp->done = 0;
+    }
+
+    cp->log = fopen(cp->results_path, resumed ? "a" : "w");
+    if (!cp->log)
+        return NULL;
+    if (cp->done)
+        printf("%s already completed\n", name);
+    else if (resumed)
+        printf("Resuming %s after group %d, line %d\n", name, cp->group, cp->line);
+    return cp->log;
+}
+
+int checkpoint_completed(const checkpoint_t *cp, int group, int line) {
+    return cp->done || group < cp->group || (group == cp->group && line <= cp->line);
+}
+
+// Call after the results of a unit are written.  Returns 0 if they or
+// the progress record could not be written.
+int checkpoint_commit(checkpoint_t *cp, int group, int line) {
+    if (ferror(cp->log) || fflush(cp->log) != 0 || fsync(fileno(cp->log)) != 0) {
+        perror(cp->results_path);
+        return 0;
+    }
+    cp->group = group;
+    cp->line = line;
+    return write_progress(cp, ftell(cp->log));
+}
+
+void checkpoint_close(checkpoint_t *cp, int done) {
+    if (!cp->log)
+        return;
+    if (done && !cp->done) {
+        fflush(cp->log);
+        fsync(fileno(cp->log));
+        cp->done = 1;
+        write_progress(cp, ftell(cp->log));
+    }
+    fclose(cp->log);
+    cp->log = NULL;
+}
+
+//------------------ Sharding ------------------//
+
+int shard_parse(shard_t *shard, const char *spec) {
+    shard->index = 0;
+    shard->count = 1;
+    if (!spec || !*spec)
+        return 1;
+    int index, count;
+    char end;
+    if (sscanf(spec, "%d/%d%c", &index, &count, &end) != 2 ||
+        count < 1 || index < 0 || index >= count)
+        return 0;
+    shard->index = index;
+    shard->count = count;
+    return 1;
+}
+
+// Lines [*first, *end) of a group of nlines lines belong to the shard
+void shard_range(const shard_t *shard, int nlines, int *first, int *end) {
+    *first = (int)((int64_t)nlines * shard->index / shard->count);
+    *end = (int)((int64_t)nlines * (shard->index + 1) / shard->count);
+}
+
+// Per-shard name of an experiment's output.  Unsharded runs keep the
+// plain name, so their checkpoints still resume.
+void shard_name(const shard_t *shard, const char *name, char *buf, size_t len) {
+    if (shard->count == 1)
+        snprintf(buf, len, "%s", name);
+    else
+        snprintf(buf, len, "%s.shard-%d-of-%d", name, shard->index, shard->count);
+}
+
+// Writes s as a JSON string, dropping characters that would need escapes
+static void put_json_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++)
+        if (*s != '"' && *s != '\\' && (unsigned char)*s >= ' ')
+            fputc(*s, f);
+    fputc('"', f);
+}
+
+static void cpu_model(char *buf, size_t len) {
+    snprintf(buf, len, "unknown");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f)
+        return;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon) {
+            snprintf(buf, len, "%s", colon + 2);
+            buf[strcspn(buf, "\n")] = '\0';
+            break;
+        }
+    }
+    fclose(f);
+}
+
+// Mean slow-line count of an idle set, the noise floor the shard measured
+static double idle_misses(l3pp_t l3) {
+    uint16_t res = 0;
+    int nsets = l3_getSets(l3) < 64 ? l3_getSets(l3) : 64;
+    uint64_t total = 0;
+    for (int set = 0; set < nsets; set++) {
+        for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
+            l3_unmonitorall(l3);
+            l3_monitor(l3, set);
+            l3_bprobecount(l3, &res);
+            l3_probecount(l3, &res);
+            total += res;
+        }
+    }
+    l3_unmonitorall(l3);
+    return nsets ? (double)total / (nsets * NUM_ITERATIONS) : 0.0;
+}
+
+// Writes <output_dir>/shard-<index>-of-<count>.meta.json describing the
+// shard's host, cache geometry, set ids, calibration and plan.
+// tools/merge_shards refuses to join shards whose geometry, mapping id or
+// plan differ.  Call setup_set_ids first.
+int shard_write_meta(const shard_t *shard, l3pp_t l3, size_t arena_mb,
+                     experiment_config_t *experiments, int num_experiments,
+                     const char *output_dir) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/shard-%d-of-%d.meta.json",
+             output_dir, shard->index, shard->count);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    char model[256];
+    cpu_model(model, sizeof(model));
+    union cpuid c;
+    memset(&c, 0, sizeof(c));
+    c.regs.eax = 1;
+    cpuid(&c);
+    char started[32];
+    time_t now = time(NULL);
+    strftime(started, sizeof(started), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(f, "{\n\"shard\":%d,\n\"shards\":%d,\n\"host\":", shard->index, shard->count);
+    put_json_str(f, host);
+    fprintf(f, ",\n\"cpu_model\":");
+    put_json_str(f, model);
+    fprintf(f, ",\n\"cpu_signature\":\"%08x\",\n", c.regs.eax);
+    fprintf(f, "\"sets\":%d,\n\"slices\":%d,\n\"associativity\":%d,\n\"mapping\":",
+            l3_getSets(l3), l3_getSlices(l3), l3_getAssociativity(l3));
+    put_json_str(f, mapping_id());
+    fprintf(f, ",\n");
+    fprintf(f, "\"arena_mb\":%zu,\n\"iterations\":%d,\n\"simulated\":%d,\n",
+            arena_mb, NUM_ITERATIONS, SIMULATE_LLC);
+    fprintf(f, "\"l3_threshold\":%d,\n\"clock_hz\":%.0f,\n\"idle_misses\":%.4f,\n",
+            L3_THRESHOLD, CLCOCK_SPEED, idle_misses(l3));
+    fprintf(f, "\"plan\":\"");
+    for (int exp = 0; exp < num_experiments; exp++)
+        fprintf(f, "%s%s:%d:%d:%d", exp ? "," : "", experiments[exp].name,
+                experiments[exp].num_groups, experiments[exp].prime_enabled,
+                experiments[exp].prime_chains);
+    fprintf(f, "\",\n\"started\":\"%s\"\n}\n", started);
+
+    int ok = fflush(f) == 0;
+    fclose(f);
+    return ok;
+}
+
+// splitmix64, for shuffles that do not depend on how much of the libc
+// random() stream Mastik has used
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Seed for shuffling group g of a configuration with num_groups groups.
+// Every shuffle has its own seed so a resumed run shuffles exactly like
+// the original one, whichever experiments it skips.
+uint64_t shuffle_seed(int num_groups, int g) {
+    uint64_t state = SHUFFLE_SEED ^ ((uint64_t)num_groups << 32) ^ (uint32_t)g;
+    return splitmix64(&state);
+}
+
 // Fisher-Yates shuffle algorithm
-void shuffle_array(uint8_t **array, size_t n) {
+void shuffle_array(uint8_t **array, size_t n, uint64_t seed) {
     if (n > 1) {
         for (size_t i = n - 1; i > 0; i--) {
-            size_t j = rand() % (i + 1);
+            size_t j = splitmix64(&seed) % (i + 1);
             uint8_t *temp = array[i];
             array[i] = array[j];
             array[j] = temp;
@@ -180,15 +603,29 @@ void shuffle_array(uint8_t **array, size_t n) {
 
 
 void prepareL3(l3pp_t *l3) {
-    l3info_t l3i = (l3info_t)malloc(sizeof(struct l3info));
+    l3info_t l3i = (l3info_t)calloc(1, sizeof(struct l3info));
     if (!l3i) {
         fprintf(stderr, "Failed to allocate l3info\n");
         return;
     }
+    // Reuse the slice hash learnt on earlier runs to skip the timing-based mapping
+    const char *slicehash = getenv("L3_SLICEHASH");
+    if (slicehash && atoi(slicehash))
+        l3i->flags = L3FLAG_SLICEHASH;
     
     uint64_t start_cycles = 0;
     uint64_t end_cycles = 0;
 
+    if (SIMULATE_LLC && !llc_sim) {
+        struct siminfo si = {0};
+        si.slices = SIM_SLICES;
+        si.setsperslice = SIM_SETS_PER_SLICE;
+        si.associativity = SIM_ASSOCIATIVITY;
+        llc_sim = sim_new(&si);
+    }
+    if (llc_sim)
+        sim_resetstats(llc_sim);
+
     // Free any existing L3 instance before the loop
     if (*l3) {
         l3_release(*l3);
@@ -200,16 +637,23 @@ void prepareL3(l3pp_t *l3) {
     while (!(*l3) || l3_getSets(*l3) != EXPECTED_NUM_SETS) {
         printf("Preparing L3...\n");
         
-        // Release previous attempt if it exists
+        // Release previous attempt if it exists.  Its mapping is wrong, so
+        // start over with a fresh mm; instances already handed out keep theirs.
         if (*l3) {
             l3_release(*l3);
             *l3 = NULL;
+            mm_release(shared_mm);
+            shared_mm = NULL;
         }
         
-        *l3 = l3_prepare(l3i, NULL);
+        if (!shared_mm)
+            shared_mm = new_shared_mm(l3i);
+        *l3 = shared_mm ? l3_prepare(l3i, shared_mm) : NULL;
         
         if (!(*l3)) {
             fprintf(stderr, "l3_prepare failed\n");
+            mm_release(shared_mm);
+            shared_mm = NULL;
             break;
         }
     }
@@ -224,6 +668,12 @@ void prepareL3(l3pp_t *l3) {
         printf("L3 Cache Slices: %d\n", l3_getSlices(*l3));
         printf("L3 Cache num of lines: %d\n", l3_getAssociativity(*l3));
     }
+    if (llc_sim) {
+        struct simstats stats;
+        sim_getstats(llc_sim, &stats);
+        printf("Simulated mapping: %lu timed walks, %lu accesses, %lu misses\n",
+               stats.timedwalks, stats.accesses, stats.misses);
+    }
 
     free(l3i);
 }
@@ -323,9 +773,6 @@ group_t* initialize_groups(size_t arena_mb, void **arena_ptr, size_t *num_pages_
     const size_t MB = 1024 * 1024;
     size_t arena_size = arena_mb * MB;
 
-    // Seed random number generator
-    srand(42);
-
     void *arena = NULL;
     if (posix_memalign(&arena, PAGE_SIZE, arena_size) != 0) {
         perror("posix_memalign");
@@ -416,7 +863,7 @@ group_t* initialize_groups(size_t arena_mb, void **arena_ptr, size_t *num_pages_
     // so the prefetcher is stressed in a uniform way.
     printf("Randomizing group lists...\n");
     for (int g = 0; g < MAX_NUM_GROUPS; g++) {
-        randomize_group_list(&groups[g]);
+        randomize_group_list(&groups[g], shuffle_seed(MAX_NUM_GROUPS, g));
     }
 
     *arena_ptr = arena;
@@ -479,7 +926,7 @@ group_t* merge_groups_create_new(group_t *orig, int num_groups) {
         }
 
         // Randomize the merged group
-        randomize_group_list(&merged[ng]);
+        randomize_group_list(&merged[ng], shuffle_seed(num_groups, ng));
     }
 
     return merged;
@@ -519,8 +966,129 @@ void cleanup_merged_groups(group_t *groups, int num_groups) {
     }
 }
 
+// Pattern of the group primers, see setup_prime_pattern
+static struct primeinfo group_prime = {
+    .repeats = PRIME_REPEATS,
+    .touches = PRIME_TOUCHES,
+    .direction = PRIME_DIRECTION
+};
+
+// Sets the first associativity lines of l3's eviction set for set, topped
+// up with lines from the mm to nlines.  The mm keeps its eviction sets, so
+// the two do not overlap.  The caller returns lines[assoc..] to the mm.
+static int policy_lines(l3pp_t l3, int set, void **lines, int nlines) {
+    int es = l3_getAssociativity(l3);
+    if (l3_getevictionset(l3, set, lines, es) < es)
+        return 0;
+    mm_requestlines(l3_getmm(l3), L3, set, lines + es, nlines - es);
+    if (lines[nlines - 1] == NULL) {
+        for (int i = es; i < nlines && lines[i]; i++)
+            mm_returnline(l3_getmm(l3), lines[i]);
+        return 0;
+    }
+    return es;
+}
+
+// Infers the policy on PRIME_LEARN_SETS sets spread over the cache and
+// returns the pattern of the policy seen that needs the most accesses.
+// On the hardware, lines of other sets at the same page offset push the
+// experiments past L1.
+static int learn_prime_pattern(l3pp_t l3, struct primeinfo *pattern) {
+    int assoc = l3_getAssociativity(l3);
+    int nsets = l3_getSets(l3);
+    int nlines = assoc * 2;
+    void **lines = malloc(nlines * sizeof(void *));
+    void **scrub = malloc(PRIME_LEARN_SCRUB * sizeof(void *));
+    struct policyinfo info = {0};
+    info.associativity = assoc;
+    info.sim = llc_sim;
+    info.scrub = scrub;
+    int cost = 0;
+    for (int i = 0; i < PRIME_LEARN_SETS; i++) {
+        int set = (int)((long)i * nsets / PRIME_LEARN_SETS) + i;
+        int es = policy_lines(l3, set, lines, nlines);
+        if (!es)
+            continue;
+        info.nscrub = 0;
+        for (int s = set % L3_SETS_PER_PAGE; !llc_sim && s < nsets &&
+             info.nscrub + assoc <= PRIME_LEARN_SCRUB; s += L3_SETS_PER_PAGE) {
+            if (s != set) {
+                int len = l3_getevictionset(l3, s, scrub + info.nscrub, assoc);
+                info.nscrub += len < assoc ? len : assoc;
+            }
+        }
+        struct policyresult res;
+        pl_infer(lines, nlines, &info, &res);
+        mm_returnlines(l3_getmm(l3), lines + es, nlines - es);
+
+        struct primeinfo pi = *pattern;
+        int rel = pl_primepattern(res.policy, assoc, PRIME_TARGET, &pi);
+        printf("Set %d: %s (agreement %d/1000), prime repeats %d touches %d, reliability %d/1000\n",
+               set, pl_name(res.policy), res.agreement, pi.repeats, pi.touches, rel);
+        if (rel > 0 && pi.repeats * pi.touches > cost) {
+            cost = pi.repeats * pi.touches;
+            *pattern = pi;
+        }
+    }
+    free(lines);
+    free(scrub);
+    return cost > 0;
+}
+
+void setup_prime_pattern(l3pp_t l3) {
+    const char *spec = getenv("PRIME_PATTERN");
+    if (!spec || !l3)
+        return;
+    struct primeinfo pi = group_prime;
+    int ok;
+    if (strcmp(spec, "learn") == 0) {
+        ok = learn_prime_pattern(l3, &pi);
+    } else {
+        policy_e policy = pl_parse(spec);
+        ok = policy != POLICY_UNKNOWN &&
+             pl_primepattern(policy, l3_getAssociativity(l3), PRIME_TARGET, &pi) > 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "No prime pattern for PRIME_PATTERN=%s, keeping the defaults\n", spec);
+        return;
+    }
+    group_prime = pi;
+    printf("Prime pattern: repeats %d touches %d %s\n", pi.repeats, pi.touches,
+           pi.direction == PRIMEDIR_ZIGZAG ? "zigzag" : "forward");
+}
+
+// Builds one primer per group, walking the group's lines in list order
+// split into chains that run in lockstep.
+primer_t *group_primers(group_t *groups, int num_groups, int chains) {
+    primer_t *primers = calloc(num_groups, sizeof(primer_t));
+    if (!primers) {
+        perror("calloc primers");
+        return NULL;
+    }
+    struct primeinfo pi = group_prime;
+    pi.chains = chains;
+    pi.sim = SIMULATE_LLC ? llc_sim : NULL;
+
+    for (int g = 0; g < num_groups; g++) {
+        void **lines = malloc((groups[g].count + 1) * sizeof(void *));
+        int n = 0;
+        for (addr_node_t *current = groups[g].head; current != NULL; current = current->next)
+            lines[n++] = current->addr;
+        primers[g] = pr_prepare(lines, n, &pi);
+        free(lines);
+    }
+    return primers;
+}
+
+void release_group_primers(primer_t *primers, int num_groups) {
+    if (!primers) return;
+    for (int g = 0; g < num_groups; g++)
+        pr_release(primers[g]);
+    free(primers);
+}
+
 // Convert linked list to randomized order
-void randomize_group_list(group_t *group) {
+void randomize_group_list(group_t *group, uint64_t seed) {
     if (group->count == 0) return;
 
     // Create temporary array with all addresses
@@ -539,7 +1107,7 @@ void randomize_group_list(group_t *group) {
     }
 
     // Shuffle the array
-    shuffle_array(temp_array, group->count);
+    shuffle_array(temp_array, group->count, seed);
 
     // Rebuild the linked list with shuffled order
     current = group->head;
@@ -552,101 +1120,91 @@ void randomize_group_list(group_t *group) {
     free(temp_array);
 }
 
-
+// Appends a line to its group.  Bits 6-11 are the 64 sets of a 4KB page;
+// bits 7-11 keep the adjacent lines of the L2 prefetcher in one group.
+static void add_to_group(group_t *groups, void *line) {
+    int group_idx = ((uintptr_t)line >> 7) & 0x1F;
+    if (group_idx >= MAX_NUM_GROUPS)
+        return;
+    addr_node_t *new_node = (addr_node_t *)malloc(sizeof(addr_node_t));
+    if (!new_node)
+        return;
+    new_node->addr = line;
+    new_node->next = NULL;
+    if (groups[group_idx].head == NULL)
+        groups[group_idx].head = new_node;
+    else
+        groups[group_idx].tail->next = new_node;
+    groups[group_idx].tail = new_node;
+    groups[group_idx].count++;
+}
 
 /*
- * Converts an array of Mastik eviction sets into a group_t array.
- * Groups are determined by bits 7-11 of the address (merging adjacent lines).
- * * e_sets: Array of pointers to linked lists (from get_eviction_sets_via_offsets)
- * num_sets: Size of the e_sets array (e.g., from l3_getSets)
+ * Converts the eviction sets of l3 into a group_t array.
+ * The sets are read from Mastik's map of the cache, so nothing is monitored.
+ * Each set adds the lines lx_monitor would take: its first associativity
+ * lines that no handle of l3's mm holds, topped up with lines the mm hands
+ * out for the set.  They are claimed in the mm, so no handle sharing it
+ * monitors them, until release_set_groups.  Sets the mm cannot fill are
+ * skipped.
  */
-group_t* eviction_sets_to_groups(void **e_sets, int num_sets) {
-    if (!e_sets) return NULL;
+group_t* eviction_sets_to_groups(l3pp_t l3) {
+    if (!l3) return NULL;
 
-    // 1. Allocate groups array
-    // We assume MAX_NUM_GROUPS is defined in utils.h (usually 32 or 64)
-    group_t *groups = (group_t *)malloc(MAX_NUM_GROUPS * sizeof(group_t));
+    group_t *groups = (group_t *)calloc(MAX_NUM_GROUPS, sizeof(group_t));
     if (!groups) {
-        perror("malloc groups");
+        perror("calloc groups");
         return NULL;
     }
 
-    // Initialize groups
-    for (int g = 0; g < MAX_NUM_GROUPS; g++) {
-        groups[g].head = NULL;
-        groups[g].tail = NULL;
-        groups[g].count = 0;
-    }
-
-    // 2. Iterate through all eviction sets
-    for (int i = 0; i < num_sets; i++) {
-        if (e_sets[i] == NULL) continue;
-
-        void *curr = e_sets[i];
-        
-        // Traverse the circular linked list of the eviction set
-        do {
-            // 3. Calculate Group ID
-            // We want 32 groups max.
-            // Bits 6-11 define the 64 sets in a standard 4KB page view.
-            // To group adjacent lines (Bit 6=0 and Bit 6=1) together, we use Bits 7-11.
-            // Shift right by 7, mask 5 bits (0x1F = 31).
-            uintptr_t addr_val = (uintptr_t)curr;
-            int group_idx = (addr_val >> 7) & 0x1F;
-
-            // Safety check against MAX_NUM_GROUPS
-            if (group_idx < MAX_NUM_GROUPS) {
-                // 4. Create new node for the group
-                addr_node_t *new_node = (addr_node_t *)malloc(sizeof(addr_node_t));
-                if (new_node) {
-                    new_node->addr = curr;
-                    new_node->next = NULL;
-
-                    // Append to group
-                    if (groups[group_idx].head == NULL) {
-                        groups[group_idx].head = new_node;
-                        groups[group_idx].tail = new_node;
-                    } else {
-                        groups[group_idx].tail->next = new_node;
-                        groups[group_idx].tail = new_node;
-                    }
-                    groups[group_idx].count++;
-                }
-            }
-
-            curr = LNEXT(curr); // Move to next in circular list
-        } while (curr != e_sets[i]);
+    mm_t mm = l3_getmm(l3);
+    int assoc = l3_getAssociativity(l3);
+    int maxlen = assoc;
+    void **lines = malloc(maxlen * sizeof(void *));
+    for (int set = 0; set < l3_getSets(l3); set++) {
+        int len = l3_getevictionset(l3, set, NULL, 0);
+        if (len > maxlen) {
+            maxlen = len;
+            lines = realloc(lines, maxlen * sizeof(void *));
+        }
+        len = l3_getevictionset(l3, set, lines, len);
+
+        int nclaimed = 0;
+        for (int i = 0; i < len && nclaimed < assoc; i++)
+            if (mm_claimline(mm, lines[i]))
+                lines[nclaimed++] = lines[i];
+        if (nclaimed < assoc) {
+            mm_requestlines(mm, L3, set, lines + nclaimed, assoc - nclaimed);
+            while (nclaimed < assoc && lines[nclaimed])
+                nclaimed++;
+        }
+        if (nclaimed < assoc) {
+            mm_returnlines(mm, lines, nclaimed);
+            continue;
+        }
+        for (int i = 0; i < assoc; i++)
+            add_to_group(groups, lines[i]);
     }
+    free(lines);
 
-    // 5. Print final sizes and Randomize
+    // Randomize to avoid stride patterns during priming
     printf("Eviction Set Groups Created (Mapping bits 7-11):\n");
     for (int g = 0; g < MAX_NUM_GROUPS; g++) {
-        // Only print/randomize if the group is relevant (indices 0-31)
-        if (g < 32) {
-            printf("Group %2d: %4zu lines\n", g, groups[g].count);
-            
-            // Randomize to avoid stride patterns during priming
-            if (groups[g].count > 0) {
-                randomize_group_list(&groups[g]);
-            }
-        }
+        printf("Group %2d: %4zu lines\n", g, groups[g].count);
+        if (groups[g].count > 0)
+            randomize_group_list(&groups[g], shuffle_seed(0, g));
     }
 
     return groups;
 }
 
-
-
-
-
-
-
-
-
-
-
-
-
+void release_set_groups(l3pp_t l3, group_t *groups) {
+    if (!l3 || !groups) return;
+    for (int g = 0; g < MAX_NUM_GROUPS; g++)
+        for (addr_node_t *current = groups[g].head; current != NULL; current = current->next)
+            mm_returnline(l3_getmm(l3), current->addr);
+    cleanup_groups(groups, NULL);
+}
 
 /**
  * Gets minimum values for each set across all iterations
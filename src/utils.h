@@ -2,14 +2,52 @@
 #define UTILS_H
 
 #include <stddef.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <mastik/l3.h>
+#include <mastik/prime.h>
+#include <mastik/stream.h>
+#include <mastik/rt.h>
 
 #define MAX_NUM_GROUPS 32 // 64 original we use 32 because of L2 adjacent cache line prefetcher
 #define LINE_SIZE 64
 #define CLCOCK_SPEED 3.1e9 // 3.1 GHz
 #define NUM_ITERATIONS 30
 #define EXPECTED_NUM_SETS 16384
+#define SHUFFLE_SEED 42 // Group shuffles are seeded per group, see shuffle_seed
+
+// Simulated LLC, see README.md
+#ifndef SIMULATE_LLC
+#define SIMULATE_LLC 0
+#endif
+#define SIM_SLICES 8
+#define SIM_SETS_PER_SLICE 2048
+#define SIM_ASSOCIATIVITY 12
+
+// Group priming, see mastik/prime.h and README.md
+#ifndef PRIME_CHAINS
+#define PRIME_CHAINS 8
+#endif
+#define PRIME_REPEATS 1
+#define PRIME_TOUCHES 3
+#define PRIME_DIRECTION PRIMEDIR_FORWARD
+
+// Prime patterns chosen by PRIME_PATTERN
+#define PRIME_TARGET 990
+#define PRIME_LEARN_SETS 4
+#define PRIME_LEARN_SCRUB 256
+
+// Per-set LLC miss counts in old_experiment, see README.md
+#ifndef PMU_COUNTS
+#define PMU_COUNTS 0
+#endif
+
+// Live view of the experiment loops published on STREAM_SOCKET
+#define STREAM_SLOTS 256
+#ifndef STREAM_DECIMATE
+#define STREAM_DECIMATE 1
+#endif
+#define STREAM_TAG(group, n) ((uint32_t)(group) << 16 | ((uint32_t)(n) & 0xffff))
 
 // Linked list node for addresses
 typedef struct addr_node {
@@ -29,6 +67,7 @@ typedef struct {
     const char *name;
     int num_groups;
     int prime_enabled;
+    int prime_chains;      // Group primer chains, 0 for the serial walk
 } experiment_config_t;
 
 typedef struct {
@@ -36,21 +75,78 @@ typedef struct {
     uint16_t min_value;
 } set_min_pair_t;
 
+extern sim_t llc_sim;
+extern stream_t live_stream;
+
 static inline void maccessMy(void *p) {
+    if (SIMULATE_LLC && llc_sim) {
+        sim_access(llc_sim, p);
+        return;
+    }
     __asm__ volatile("movb (%0), %%al" : : "r"(p) : "eax", "memory");
 }
 
+// Checkpoint of a long experiment, <dir>/<name>.jsonl and .progress
+typedef struct {
+    char results_path[512];
+    char progress_path[512];
+    FILE *log;
+    int group;      // Last completed unit, -1 if none
+    int line;
+    int done;       // The whole experiment completed
+    char mapping[32];
+} checkpoint_t;
+
+// One shard of a prime_by_group_line campaign, selected by SHARD
+typedef struct {
+    int index;
+    int count;      // 1 when not sharded
+} shard_t;
+
 // Function declarations
-void **get_eviction_sets_via_offsets(l3pp_t l3);
-int check_intersection(void **sets_a,void **sets_b, int numOfSets);
+void **get_eviction_sets(l3pp_t l3, int *ways);
+int check_intersection(void **sets_a,void **sets_b, int numOfSets, int ways);
+// Environment knobs of these setup functions are described in README.md
 void prepareL3(l3pp_t *l3);
+void report_footprint(l3pp_t l3);
+void setup_taint(l3pp_t l3);
+// Returns 1 while a record with an interrupted probe should be redone
+int taint_redo(l3pp_t l3, uint16_t *res, int tries);
+void report_taint(l3pp_t l3);
+void setup_tlb(l3pp_t l3);
+void report_tlb(l3pp_t l3);
+void setup_capture(l3pp_t l3);
+void capture_buffer(void *buf, size_t size);
+void capture_kick(void);
+void end_capture(void);
 group_t* initialize_groups(size_t arena_mb, void **arena_ptr, size_t *num_pages_ptr);
 group_t* merge_groups_create_new(group_t *orig, int num_groups);
 void cleanup_groups(group_t *groups, void *arena);
 void cleanup_merged_groups(group_t *groups, int num_groups);
-void randomize_group_list(group_t *group);
-void shuffle_array(uint8_t **array, size_t n);
-group_t* eviction_sets_to_groups(void **e_sets, int num_sets);
+primer_t *group_primers(group_t *groups, int num_groups, int chains);
+void release_group_primers(primer_t *primers, int num_groups);
+void setup_prime_pattern(l3pp_t l3);
+// Physical set ids of the logs when the mm knows them, see README.md
+void setup_set_ids(l3pp_t l3);
+int set_id(int set);
+const char *mapping_id(void);
+// Whether checkpoint_open can resume or start name, reports why not
+int checkpoint_resumable(const char *output_dir, const char *name);
+FILE *checkpoint_open(checkpoint_t *cp, const char *output_dir, const char *name);
+int checkpoint_completed(const checkpoint_t *cp, int group, int line);
+int checkpoint_commit(checkpoint_t *cp, int group, int line);
+void checkpoint_close(checkpoint_t *cp, int done);
+int shard_parse(shard_t *shard, const char *spec);
+void shard_range(const shard_t *shard, int nlines, int *first, int *end);
+void shard_name(const shard_t *shard, const char *name, char *buf, size_t len);
+int shard_write_meta(const shard_t *shard, l3pp_t l3, size_t arena_mb,
+                     experiment_config_t *experiments, int num_experiments,
+                     const char *output_dir);
+uint64_t shuffle_seed(int num_groups, int g);
+void randomize_group_list(group_t *group, uint64_t seed);
+void shuffle_array(uint8_t **array, size_t n, uint64_t seed);
+group_t* eviction_sets_to_groups(l3pp_t l3);
+void release_set_groups(l3pp_t l3, group_t *groups);
 
 
 set_min_pair_t* get_min_values(uint16_t** res_mat, int num_sets, int* out_count);
@@ -0,0 +1,749 @@
+// Native version of the analysis in analysis/heatmap.ipynb.
+//
+//   ./tools/analyze [-o dir] [-t threshold] [-z] [-c cos_threshold] [-j threads] file.jsonl...
+//
+// For each experiment output it:
+//  - reduces the records of every group to one vector per group: the
+//    minimum of the probe_counts vectors (new/old experiments), skipping
+//    flagged interrupted probes, or the sum of the missed_sets entries
+//    (prime_by_group_line),
+//  - orders the columns with the hierarchical group sort,
+//  - computes the group-vs-group cosine similarity matrix and the notebook's
+//    1 - mean similarity score,
+//  - assigns each set to the group with the most misses in it,
+//  - reports the coverage score of every group,
+// and writes <dir>/<name>.png (or .ppm with -f ppm), <name>.order.csv,
+// <name>.similarity.csv and <name>.assign.csv.
+//
+// Files are memory-mapped and parsed in parallel chunks; each thread
+// reduces into its own vectors and the partial results are combined.
+// The notebook settings are the defaults for the single-group files; use
+// -t 5 -z for the multi-group ones.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_GROUPS 4096
+#define DEFAULT_SETS 16384
+#define DEFAULT_WAYS 12
+#define DEFAULT_IMAGE_WIDTH 2048
+#define DEFAULT_IMAGE_HEIGHT 512
+
+// Probe counts of interrupted probes, as in Mastik's mastik/taint.h
+#define TAINT_FLAGGED 0xfffe
+
+typedef enum { REDUCE_MIN, REDUCE_SUM } reduce_e;
+
+typedef struct {
+    const char *out_dir;
+    float threshold;        // hierarchical sort threshold
+    int override;           // zero values below threshold before sorting
+    float cos_threshold;
+    int sets;               // width of missed_sets vectors
+    int ways;
+    int threads;
+    int ppm;
+    int image_width;
+    int image_height;
+} options_t;
+
+//------------------ Parsing ------------------//
+
+// Per-thread partial reduction
+typedef struct {
+    const char *begin;
+    const char *end;
+    reduce_e mode;
+    int width;
+    uint32_t *acc[MAX_GROUPS];      // allocated on first use
+    uint64_t records[MAX_GROUPS];
+    uint64_t dropped;               // malformed lines and out-of-range sets
+} chunk_t;
+
+static uint32_t *chunk_vector(chunk_t *c, int group) {
+    if (!c->acc[group]) {
+        c->acc[group] = malloc(c->width * sizeof(uint32_t));
+        uint32_t init = c->mode == REDUCE_MIN ? UINT32_MAX : 0;
+        for (int i = 0; i < c->width; i++)
+            c->acc[group][i] = init;
+    }
+    return c->acc[group];
+}
+
+static inline const char *skip_to_digit(const char *p, const char *end) {
+    while (p < end && (*p < '0' || *p > '9') && *p != ']' && *p != '\n')
+        p++;
+    return p;
+}
+
+static inline const char *parse_uint(const char *p, const char *end, uint32_t *v) {
+    uint32_t x = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        x = x * 10 + (*p++ - '0');
+    *v = x;
+    return p;
+}
+
+static const char *find_key(const char *p, const char *end, const char *key, size_t keylen) {
+    while (p + keylen <= end && *p != '\n') {
+        if (*p == '"' && memcmp(p, key, keylen) == 0)
+            return p + keylen;
+        p++;
+    }
+    return NULL;
+}
+
+// Parses one record, returns the start of the next line
+static const char *parse_line(chunk_t *c, const char *p, const char *end) {
+    const char *eol = memchr(p, '\n', end - p);
+    if (!eol)
+        eol = end;
+    const char *q = find_key(p, eol, "\"group\":", 8);
+    uint32_t group = MAX_GROUPS;
+    if (q)
+        q = parse_uint(q, eol, &group);
+    if (group >= MAX_GROUPS) {
+        if (eol > p)
+            c->dropped++;
+        return eol + 1;
+    }
+
+    if (c->mode == REDUCE_MIN) {
+        q = find_key(q, eol, "\"probe_counts\":[", 16);
+        if (!q) {
+            c->dropped++;
+            return eol + 1;
+        }
+        uint32_t *v = chunk_vector(c, group);
+        for (int i = 0; i < c->width; i++) {
+            q = skip_to_digit(q, eol);
+            if (q >= eol || *q == ']')
+                break;
+            uint32_t x;
+            q = parse_uint(q, eol, &x);
+            if (x < v[i] && x != TAINT_FLAGGED)
+                v[i] = x;
+        }
+    } else {
+        q = find_key(q, eol, "\"missed_sets\":[", 15);
+        if (!q) {
+            c->dropped++;
+            return eol + 1;
+        }
+        uint32_t *v = chunk_vector(c, group);
+        // [[set,misses],...]
+        for (;;) {
+            while (q < eol && *q != '[' && *q != '\n')
+                q++;
+            if (q >= eol || *q != '[')
+                break;
+            uint32_t set, misses;
+            q = parse_uint(skip_to_digit(q, eol), eol, &set);
+            q = parse_uint(skip_to_digit(q, eol), eol, &misses);
+            if (set < (uint32_t)c->width)
+                v[set] += misses;
+            else
+                c->dropped++;
+        }
+    }
+    c->records[group]++;
+    return eol + 1;
+}
+
+static void *parse_chunk(void *arg) {
+    chunk_t *c = arg;
+    for (const char *p = c->begin; p < c->end;)
+        p = parse_line(c, p, c->end);
+    return NULL;
+}
+
+//------------------ Kernels ------------------//
+
+typedef float v8f __attribute__((vector_size(32)));
+typedef int32_t v8i __attribute__((vector_size(32)));
+typedef uint32_t v8u __attribute__((vector_size(32)));
+
+// The kernels are also built for AVX2, where each 8-wide vector is one
+// register, and the loader picks the build the CPU supports
+#define KERNEL __attribute__((target_clones("avx2", "default")))
+
+KERNEL
+static float dot(const float *a, const float *b, int n) {
+    v8f acc0 = {0}, acc1 = {0};
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        v8f a0, a1, b0, b1;
+        memcpy(&a0, a + i, sizeof(v8f));
+        memcpy(&a1, a + i + 8, sizeof(v8f));
+        memcpy(&b0, b + i, sizeof(v8f));
+        memcpy(&b1, b + i + 8, sizeof(v8f));
+        acc0 += a0 * b0;
+        acc1 += a1 * b1;
+    }
+    acc0 += acc1;
+    float s = 0;
+    for (int k = 0; k < 8; k++)
+        s += acc0[k];
+    for (; i < n; i++)
+        s += a[i] * b[i];
+    return s;
+}
+
+// Merges a thread's partial histogram into dst
+KERNEL
+static void combine(uint32_t *restrict dst, const uint32_t *restrict src, int n, reduce_e mode) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        v8u d, s;
+        memcpy(&d, dst + i, sizeof(v8u));
+        memcpy(&s, src + i, sizeof(v8u));
+        if (mode == REDUCE_MIN) {
+            v8u less = (v8u)(s < d);
+            d = (s & less) | (d & ~less);
+        } else {
+            d += s;
+        }
+        memcpy(dst + i, &d, sizeof(v8u));
+    }
+    for (; i < n; i++)
+        dst[i] = mode == REDUCE_MIN ? (src[i] < dst[i] ? src[i] : dst[i]) : dst[i] + src[i];
+}
+
+// dst[i] = src[i], or 0 below threshold
+KERNEL
+static void clip(float *restrict dst, const float *restrict src, int n, float threshold) {
+    v8f t = (v8f){0} + threshold;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        v8f v;
+        memcpy(&v, src + i, sizeof(v8f));
+        v = (v8f)((v8i)v & (v >= t));
+        memcpy(dst + i, &v, sizeof(v8f));
+    }
+    for (; i < n; i++)
+        dst[i] = src[i] < threshold ? 0.0f : src[i];
+}
+
+//------------------ Analysis ------------------//
+
+typedef struct {
+    int ngroups;
+    int width;
+    int group_ids[MAX_GROUPS];
+    uint64_t records;
+    float *m;                   // ngroups x width, row per present group
+} reduced_t;
+
+static float *row(reduced_t *r, int g) {
+    return r->m + (size_t)g * r->width;
+}
+
+static int reduce_file(const char *path, const options_t *opt, reduced_t *r) {
+    memset(r, 0, sizeof(*r));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: empty\n", path);
+        close(fd);
+        return 0;
+    }
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    const char *end = data + st.st_size;
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    // The first record decides the format and, for probe_counts, the width
+    const char *eol = memchr(data, '\n', st.st_size);
+    if (!eol)
+        eol = end;
+    reduce_e mode = REDUCE_SUM;
+    int width = opt->sets;
+    const char *q = find_key(data, eol, "\"probe_counts\":[", 16);
+    if (q) {
+        mode = REDUCE_MIN;
+        width = 1;
+        for (; q < eol && *q != ']'; q++)
+            width += *q == ',';
+    } else if (!find_key(data, eol, "\"missed_sets\":[", 15)) {
+        fprintf(stderr, "%s: no probe_counts or missed_sets records\n", path);
+        munmap((void *)data, st.st_size);
+        return 0;
+    }
+
+    // Split at line boundaries, one chunk per thread
+    int nthreads = opt->threads;
+    if (nthreads > 1 + st.st_size / 65536)
+        nthreads = 1 + st.st_size / 65536;
+    chunk_t *chunks = calloc(nthreads, sizeof(chunk_t));
+    pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+    const char *p = data;
+    for (int t = 0; t < nthreads; t++) {
+        const char *stop = t == nthreads - 1 ? end : data + st.st_size * (t + 1) / nthreads;
+        if (stop < p)
+            stop = p;
+        const char *nl = stop < end ? memchr(stop, '\n', end - stop) : NULL;
+        stop = nl ? nl + 1 : end;
+        chunks[t] = (chunk_t){.begin = p, .end = stop, .mode = mode, .width = width};
+        p = stop;
+        pthread_create(&tids[t], NULL, parse_chunk, &chunks[t]);
+    }
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+
+    // Combine the partial reductions of the groups that appear
+    uint64_t dropped = 0;
+    r->width = width;
+    for (int t = 0; t < nthreads; t++)
+        dropped += chunks[t].dropped;
+    for (int g = 0; g < MAX_GROUPS; g++) {
+        uint64_t records = 0;
+        for (int t = 0; t < nthreads; t++)
+            records += chunks[t].records[g];
+        if (records)
+            r->group_ids[r->ngroups++] = g;
+        r->records += records;
+    }
+    r->m = calloc((size_t)(r->ngroups ? r->ngroups : 1) * width, sizeof(float));
+    uint32_t *tmp = malloc(width * sizeof(uint32_t));
+    for (int i = 0; i < r->ngroups; i++) {
+        int g = r->group_ids[i];
+        uint32_t init = mode == REDUCE_MIN ? UINT32_MAX : 0;
+        for (int k = 0; k < width; k++)
+            tmp[k] = init;
+        for (int t = 0; t < nthreads; t++)
+            if (chunks[t].acc[g])
+                combine(tmp, chunks[t].acc[g], width, mode);
+        float *out = row(r, i);
+        for (int k = 0; k < width; k++)
+            out[k] = tmp[k] == UINT32_MAX ? 0.0f : (float)tmp[k];
+    }
+    free(tmp);
+    for (int t = 0; t < nthreads; t++)
+        for (int g = 0; g < MAX_GROUPS; g++)
+            free(chunks[t].acc[g]);
+    free(chunks);
+    free(tids);
+    munmap((void *)data, st.st_size);
+
+    if (dropped)
+        fprintf(stderr, "%s: skipped %lu malformed or out-of-range entries\n", path, (unsigned long)dropped);
+    return r->ngroups > 0;
+}
+
+// Hierarchical group sort.  For each group in turn, the columns not yet
+// claimed are sorted by that group's values, descending, and the ones at
+// or above threshold are claimed.  Stops when a group claims nothing or
+// all columns are claimed.  Ties keep their previous order.
+static const float *sort_key;
+
+static int by_key_desc(const void *a, const void *b) {
+    int ia = *(const int *)a, ib = *(const int *)b;
+    float va = sort_key[ia], vb = sort_key[ib];
+    if (va != vb)
+        return va < vb ? 1 : -1;
+    return ia < ib ? -1 : ia > ib;
+}
+
+static void hierarchical_order(reduced_t *r, float threshold, int *order) {
+    int width = r->width;
+    int *pos = malloc(width * sizeof(int));
+    for (int i = 0; i < width; i++)
+        order[i] = i;
+    int next_start = 0;
+    for (int g = 0; g < r->ngroups && next_start < width; g++) {
+        // Sort suffix positions by this group's values, keeping ties in
+        // their current positions' order
+        const float *v = row(r, g);
+        float *key = malloc(width * sizeof(float));
+        int n = width - next_start;
+        for (int i = 0; i < n; i++) {
+            pos[i] = i;
+            key[i] = v[order[next_start + i]];
+        }
+        sort_key = key;
+        qsort(pos, n, sizeof(int), by_key_desc);
+        int *sorted = malloc(n * sizeof(int));
+        int claimed = 0;
+        for (int i = 0; i < n; i++) {
+            sorted[i] = order[next_start + pos[i]];
+            claimed += key[pos[i]] >= threshold;
+        }
+        memcpy(order + next_start, sorted, n * sizeof(int));
+        free(sorted);
+        free(key);
+        if (claimed == 0)
+            break;
+        next_start += claimed;
+    }
+    free(pos);
+}
+
+// Cosine similarity of the thresholded group vectors.  Returns the
+// notebook's score, 1 - mean of the off-diagonal similarities.
+static double similarity(reduced_t *r, float threshold, float *sim) {
+    int n = r->ngroups, width = r->width;
+    float *t = malloc((size_t)n * width * sizeof(float));
+    float *norm = malloc(n * sizeof(float));
+    for (int g = 0; g < n; g++) {
+        float *tv = t + (size_t)g * width;
+        clip(tv, row(r, g), width, threshold);
+        norm[g] = sqrtf(dot(tv, tv, width));
+    }
+    double total = 0;
+    int pairs = 0;
+    for (int a = 0; a < n; a++) {
+        for (int b = a; b < n; b++) {
+            float s = 0;
+            if (norm[a] > 0 && norm[b] > 0)
+                s = dot(t + (size_t)a * width, t + (size_t)b * width, width) / (norm[a] * norm[b]);
+            sim[a * n + b] = sim[b * n + a] = s;
+            if (b != a) {
+                total += s;
+                pairs++;
+            }
+        }
+    }
+    free(norm);
+    free(t);
+    return pairs ? 1.0 - total / pairs : NAN;
+}
+
+// Group (row) with the most misses in each set, -1 if none reaches threshold
+static void assign_sets(reduced_t *r, float threshold, int *assign, float *best) {
+    for (int i = 0; i < r->width; i++) {
+        assign[i] = -1;
+        best[i] = threshold;
+    }
+    for (int g = 0; g < r->ngroups; g++) {
+        const float *v = row(r, g);
+        for (int i = 0; i < r->width; i++) {
+            if (v[i] > best[i] || (assign[i] < 0 && v[i] >= threshold)) {
+                best[i] = v[i];
+                assign[i] = g;
+            }
+        }
+    }
+}
+
+//------------------ Images ------------------//
+
+// viridis, sampled every 1/8
+static const uint8_t viridis[9][3] = {
+    {68, 1, 84}, {71, 44, 122}, {59, 81, 139}, {44, 113, 142}, {33, 144, 141},
+    {39, 173, 129}, {92, 200, 99}, {170, 220, 50}, {253, 231, 37}
+};
+
+static void colour(float x, uint8_t *rgb) {
+    if (!(x > 0))
+        x = 0;
+    if (x > 1)
+        x = 1;
+    float f = x * 8;
+    int i = (int)f;
+    if (i > 7)
+        i = 7;
+    f -= i;
+    for (int k = 0; k < 3; k++)
+        rgb[k] = (uint8_t)(viridis[i][k] + (viridis[i + 1][k] - viridis[i][k]) * f + 0.5f);
+}
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t *p, size_t n) {
+    if (!crc_table[1])
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+    crc = ~crc;
+    while (n--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len) {
+    uint8_t hdr[8];
+    put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    fwrite(hdr, 1, 8, f);
+    fwrite(data, 1, len, f);
+    uint32_t crc = crc32(crc32(0, (const uint8_t *)type, 4), data, len);
+    put_be32(hdr, crc);
+    fwrite(hdr, 1, 4, f);
+}
+
+// PNG with stored (uncompressed) deflate blocks, so no zlib is needed
+static int write_png(const char *path, const uint8_t *rgb, int w, int h) {
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return 0;
+    static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(sig, 1, 8, f);
+    uint8_t ihdr[13];
+    put_be32(ihdr, w);
+    put_be32(ihdr + 4, h);
+    ihdr[8] = 8;        // bit depth
+    ihdr[9] = 2;        // RGB
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    png_chunk(f, "IHDR", ihdr, 13);
+
+    size_t stride = (size_t)w * 3 + 1;
+    size_t raw_len = stride * h;
+    size_t nblocks = (raw_len + 65534) / 65535;
+    size_t z_len = 2 + raw_len + nblocks * 5 + 4;
+    uint8_t *z = malloc(z_len);
+    uint8_t *o = z;
+    *o++ = 0x78;
+    *o++ = 0x01;
+    uint32_t a = 1, b = 0;
+    size_t left = raw_len, done = 0;
+    while (left) {
+        uint16_t n = left > 65535 ? 65535 : left;
+        left -= n;
+        *o++ = left == 0;
+        *o++ = n & 0xff;
+        *o++ = n >> 8;
+        *o++ = ~n & 0xff;
+        *o++ = (uint16_t)~n >> 8;
+        for (uint16_t i = 0; i < n; i++, done++) {
+            size_t y = done / stride, x = done % stride;
+            uint8_t byte = x == 0 ? 0 : rgb[y * (stride - 1) + x - 1];
+            *o++ = byte;
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    put_be32(o, (b << 16) | a);
+    png_chunk(f, "IDAT", z, z_len);
+    free(z);
+    png_chunk(f, "IEND", NULL, 0);
+    return fclose(f) == 0;
+}
+
+static int write_ppm(const char *path, const uint8_t *rgb, int w, int h) {
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return 0;
+    fprintf(f, "P6\n%d %d\n255\n", w, h);
+    fwrite(rgb, 3, (size_t)w * h, f);
+    return fclose(f) == 0;
+}
+
+// Heatmap of the ordered matrix, one band of rows per group.  Columns are
+// binned to the image width by their maximum so isolated misses survive.
+static int render(reduced_t *r, const int *order, const options_t *opt, const char *path) {
+    int w = r->width < opt->image_width ? r->width : opt->image_width;
+    int band = opt->image_height / r->ngroups;
+    if (band < 1)
+        band = 1;
+    int h = band * r->ngroups;
+    float vmax = 0;
+    for (size_t i = 0; i < (size_t)r->ngroups * r->width; i++)
+        if (r->m[i] > vmax)
+            vmax = r->m[i];
+    uint8_t *rgb = malloc((size_t)w * h * 3);
+    for (int g = 0; g < r->ngroups; g++) {
+        const float *v = row(r, g);
+        for (int x = 0; x < w; x++) {
+            int c0 = (int)((int64_t)x * r->width / w);
+            int c1 = (int)((int64_t)(x + 1) * r->width / w);
+            float m = 0;
+            for (int c = c0; c < c1; c++)
+                if (v[order[c]] > m)
+                    m = v[order[c]];
+            uint8_t px[3];
+            colour(vmax > 0 ? m / vmax : 0, px);
+            for (int y = g * band; y < (g + 1) * band; y++)
+                memcpy(rgb + ((size_t)y * w + x) * 3, px, 3);
+        }
+    }
+    int ok = opt->ppm ? write_ppm(path, rgb, w, h) : write_png(path, rgb, w, h);
+    free(rgb);
+    return ok;
+}
+
+//------------------ Driver ------------------//
+
+static int analyze(const char *path, const options_t *opt) {
+    reduced_t r;
+    if (!reduce_file(path, opt, &r)) {
+        free(r.m);
+        return 0;
+    }
+
+    char *copy = strdup(path);
+    char *name = basename(copy);
+    char *dot_pos = strrchr(name, '.');
+    if (dot_pos)
+        *dot_pos = '\0';
+    char out[1024];
+
+    printf("%s: %lu records, %d groups, %d sets\n", path, (unsigned long)r.records, r.ngroups, r.width);
+
+    // Coverage of each group over the whole cache
+    double cov_sum = 0;
+    for (int g = 0; g < r.ngroups; g++) {
+        const float *v = row(&r, g);
+        double misses = 0;
+        for (int i = 0; i < r.width; i++)
+            misses += v[i];
+        double score = misses / ((double)r.width * opt->ways);
+        cov_sum += score;
+        printf("  group %d coverage %.6f\n", r.group_ids[g], score);
+    }
+    printf("  mean coverage %.6f\n", cov_sum / r.ngroups);
+
+    float *sim = malloc((size_t)r.ngroups * r.ngroups * sizeof(float));
+    double score = similarity(&r, opt->cos_threshold, sim);
+    printf("  cosine score %.6f\n", score);
+    snprintf(out, sizeof(out), "%s/%s.similarity.csv", opt->out_dir, name);
+    FILE *f = fopen(out, "w");
+    if (f) {
+        for (int g = 0; g < r.ngroups; g++)
+            fprintf(f, ",%d", r.group_ids[g]);
+        fprintf(f, "\n");
+        for (int a = 0; a < r.ngroups; a++) {
+            fprintf(f, "%d", r.group_ids[a]);
+            for (int b = 0; b < r.ngroups; b++)
+                fprintf(f, ",%.6f", sim[a * r.ngroups + b]);
+            fprintf(f, "\n");
+        }
+        fclose(f);
+    }
+    free(sim);
+
+    int *assign = malloc(r.width * sizeof(int));
+    float *best = malloc(r.width * sizeof(float));
+    assign_sets(&r, opt->threshold, assign, best);
+    int unassigned = 0;
+    snprintf(out, sizeof(out), "%s/%s.assign.csv", opt->out_dir, name);
+    f = fopen(out, "w");
+    if (f) {
+        fprintf(f, "set,group,value\n");
+        for (int i = 0; i < r.width; i++) {
+            if (assign[i] < 0) {
+                unassigned++;
+                continue;
+            }
+            fprintf(f, "%d,%d,%g\n", i, r.group_ids[assign[i]], best[i]);
+        }
+        fclose(f);
+    }
+    printf("  %d sets assigned, %d below threshold\n", r.width - unassigned, unassigned);
+    free(assign);
+    free(best);
+
+    // Like the notebook, the override only affects the ordering and the heatmap
+    if (opt->override)
+        for (size_t i = 0; i < (size_t)r.ngroups * r.width; i++)
+            if (r.m[i] < opt->threshold)
+                r.m[i] = 0;
+
+    int *order = malloc(r.width * sizeof(int));
+    hierarchical_order(&r, opt->threshold, order);
+    snprintf(out, sizeof(out), "%s/%s.order.csv", opt->out_dir, name);
+    f = fopen(out, "w");
+    if (f) {
+        for (int i = 0; i < r.width; i++)
+            fprintf(f, "%d\n", order[i]);
+        fclose(f);
+    }
+
+    snprintf(out, sizeof(out), "%s/%s.%s", opt->out_dir, name, opt->ppm ? "ppm" : "png");
+    if (!render(&r, order, opt, out))
+        fprintf(stderr, "%s: %s\n", out, strerror(errno));
+    else
+        printf("  heatmap %s\n", out);
+
+    free(order);
+    free(r.m);
+    free(copy);
+    return 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] file.jsonl...\n"
+            "  -o dir        output directory (heatmaps)\n"
+            "  -t threshold  hierarchical sort and assignment threshold (3)\n"
+            "  -z            zero values below the threshold first\n"
+            "  -c threshold  cosine similarity threshold (1)\n"
+            "  -s sets       width of missed_sets vectors (%d)\n"
+            "  -w ways       ways per set, for the coverage score (%d)\n"
+            "  -j threads    parser threads (online CPUs)\n"
+            "  -W width      image width (%d)\n"
+            "  -H height     image height (%d)\n"
+            "  -f png|ppm    image format (png)\n",
+            prog, DEFAULT_SETS, DEFAULT_WAYS, DEFAULT_IMAGE_WIDTH, DEFAULT_IMAGE_HEIGHT);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    options_t opt = {
+        .out_dir = "heatmaps",
+        .threshold = 3,
+        .cos_threshold = 1,
+        .sets = DEFAULT_SETS,
+        .ways = DEFAULT_WAYS,
+        .threads = sysconf(_SC_NPROCESSORS_ONLN),
+        .image_width = DEFAULT_IMAGE_WIDTH,
+        .image_height = DEFAULT_IMAGE_HEIGHT,
+    };
+    int c;
+    while ((c = getopt(argc, argv, "o:t:zc:s:w:j:W:H:f:")) != -1) {
+        switch (c) {
+            case 'o': opt.out_dir = optarg; break;
+            case 't': opt.threshold = atof(optarg); break;
+            case 'z': opt.override = 1; break;
+            case 'c': opt.cos_threshold = atof(optarg); break;
+            case 's': opt.sets = atoi(optarg); break;
+            case 'w': opt.ways = atoi(optarg); break;
+            case 'j': opt.threads = atoi(optarg); break;
+            case 'W': opt.image_width = atoi(optarg); break;
+            case 'H': opt.image_height = atoi(optarg); break;
+            case 'f': opt.ppm = strcmp(optarg, "ppm") == 0; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc || opt.sets < 1 || opt.ways < 1 || opt.image_width < 1 || opt.image_height < 1)
+        usage(argv[0]);
+    if (opt.threads < 1)
+        opt.threads = 1;
+
+    if (mkdir(opt.out_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: %s\n", opt.out_dir, strerror(errno));
+        return 1;
+    }
+    int failed = 0;
+    for (int i = optind; i < argc; i++)
+        failed += !analyze(argv[i], &opt);
+    return failed != 0;
+}
@@ -0,0 +1,311 @@
+// Joins the outputs of a sharded prime_by_group_line campaign.
+//
+//   ./tools/merge_shards -o data/merged hostA/shard-0-of-2.meta.json hostB/shard-1-of-2.meta.json
+//
+// Each meta file is read together with the per-experiment results next to
+// it.  All shards of the plan must be given, must have finished, and must
+// agree on the CPU model, cache geometry, mapping and plan; anything else
+// is rejected.  The mapping is the set ids of the records: shards only
+// agree on it when they logged physical sets, see setup_set_ids in
+// src/utils.c, as a Mastik set index means nothing outside its run.  Each experiment's records are merged in (group, groupLine)
+// order into <out>/<name>.jsonl with the shard that produced them, and
+// <out>/shards.json keeps the metadata of every shard.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+typedef struct {
+    const char *path;
+    char *dir;
+    char *text;        // The meta file as written by shard_write_meta
+    int shard;
+    int shards;
+} shard_meta_t;
+
+// Fields that must match across shards
+static const char *geometry_keys[] = {
+    "shards", "cpu_signature", "sets", "slices", "associativity",
+    "mapping", "arena_mb", "iterations", "simulated", "plan"
+};
+#define NUM_GEOMETRY_KEYS (int)(sizeof(geometry_keys) / sizeof(geometry_keys[0]))
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    char *text = NULL;
+    size_t len = 0;
+    ssize_t n = getdelim(&text, &len, '\0', f);
+    fclose(f);
+    if (n <= 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+// Copies the raw value of "key" in a flat JSON object into buf, without
+// the quotes of a string.  Returns 0 if the key is missing.
+static int meta_get(const char *text, const char *key, char *buf, size_t len) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(text, pattern);
+    if (!p)
+        return 0;
+    p += strlen(pattern);
+    size_t n;
+    if (*p == '"') {
+        p++;
+        n = strcspn(p, "\"");
+    } else {
+        n = strcspn(p, ",\n}");
+    }
+    if (n >= len)
+        n = len - 1;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    return 1;
+}
+
+static int meta_int(const char *text, const char *key) {
+    char buf[32];
+    return meta_get(text, key, buf, sizeof(buf)) ? atoi(buf) : -1;
+}
+
+static int load_meta(shard_meta_t *m, const char *path) {
+    m->path = path;
+    m->text = read_file(path);
+    if (!m->text) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    char *copy = strdup(path);
+    m->dir = strdup(dirname(copy));
+    free(copy);
+    m->shard = meta_int(m->text, "shard");
+    m->shards = meta_int(m->text, "shards");
+    if (m->shards < 1 || m->shard < 0 || m->shard >= m->shards) {
+        fprintf(stderr, "%s: not a shard meta file\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Results file of an experiment, named as by shard_name in src/utils.c
+static void results_path(const shard_meta_t *m, const char *name, const char *ext,
+                         char *buf, size_t len) {
+    if (m->shards == 1)
+        snprintf(buf, len, "%s/%s.%s", m->dir, name, ext);
+    else
+        snprintf(buf, len, "%s/%s.shard-%d-of-%d.%s", m->dir, name, m->shard, m->shards, ext);
+}
+
+static int check_done(const shard_meta_t *m, const char *name) {
+    char path[1024];
+    results_path(m, name, "progress", path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    int group, line, done = 0;
+    long offset;
+    if (f) {
+        if (fscanf(f, "group %d groupLine %d offset %ld done %d", &group, &line, &offset, &done) != 4)
+            done = 0;
+        fclose(f);
+    }
+    if (!done)
+        fprintf(stderr, "%s: shard %d has not finished %s\n", m->path, m->shard, name);
+    return done;
+}
+
+typedef struct {
+    FILE *f;
+    char *line;
+    size_t cap;
+    int group;
+    int group_line;
+    int valid;
+} cursor_t;
+
+static void cursor_next(cursor_t *c) {
+    c->valid = 0;
+    while (getline(&c->line, &c->cap, c->f) > 0) {
+        if (sscanf(c->line, "{\"group\":%d,\"groupLine\":%d", &c->group, &c->group_line) == 2) {
+            c->valid = 1;
+            return;
+        }
+    }
+}
+
+// Merges one experiment.  Returns the number of records, -1 on error.
+static long merge_experiment(shard_meta_t *metas, int nshards, const char *name, const char *out_dir) {
+    cursor_t *cursors = calloc(nshards, sizeof(cursor_t));
+    char path[1024];
+    long records = -1;
+    FILE *out = NULL;
+
+    for (int i = 0; i < nshards; i++) {
+        results_path(&metas[i], name, "jsonl", path, sizeof(path));
+        cursors[i].f = fopen(path, "r");
+        if (!cursors[i].f) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            goto done;
+        }
+        cursor_next(&cursors[i]);
+    }
+    snprintf(path, sizeof(path), "%s/%s.jsonl", out_dir, name);
+    out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        goto done;
+    }
+
+    records = 0;
+    int last_group = -1, last_line = -1;
+    for (;;) {
+        int best = -1;
+        for (int i = 0; i < nshards; i++) {
+            cursor_t *c = &cursors[i];
+            if (c->valid && (best < 0 || c->group < cursors[best].group ||
+                             (c->group == cursors[best].group && c->group_line < cursors[best].group_line)))
+                best = i;
+        }
+        if (best < 0)
+            break;
+        cursor_t *c = &cursors[best];
+        if (c->group == last_group && c->group_line == last_line) {
+            fprintf(stderr, "%s: group %d line %d is in more than one shard\n",
+                    name, c->group, c->group_line);
+            records = -1;
+            goto done;
+        }
+        last_group = c->group;
+        last_line = c->group_line;
+        fprintf(out, "{\"shard\":%d,%s", metas[best].shard, c->line + 1);
+        records++;
+        cursor_next(c);
+    }
+
+done:
+    if (out && fclose(out) != 0)
+        records = -1;
+    for (int i = 0; i < nshards; i++) {
+        if (cursors[i].f)
+            fclose(cursors[i].f);
+        free(cursors[i].line);
+    }
+    free(cursors);
+    return records;
+}
+
+static int by_shard(const void *a, const void *b) {
+    return ((const shard_meta_t *)a)->shard - ((const shard_meta_t *)b)->shard;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -o out_dir shard-meta.json...\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *out_dir = NULL;
+    int argi = 1;
+    if (argi + 1 < argc && strcmp(argv[argi], "-o") == 0) {
+        out_dir = argv[argi + 1];
+        argi += 2;
+    }
+    int nshards = argc - argi;
+    if (!out_dir || nshards < 1)
+        usage(argv[0]);
+
+    shard_meta_t *metas = calloc(nshards, sizeof(shard_meta_t));
+    for (int i = 0; i < nshards; i++)
+        if (!load_meta(&metas[i], argv[argi + i]))
+            return 1;
+    qsort(metas, nshards, sizeof(shard_meta_t), by_shard);
+
+    // Every shard exactly once, all from the same geometry and plan
+    if (metas[0].shards != nshards) {
+        fprintf(stderr, "Plan has %d shards, %d given\n", metas[0].shards, nshards);
+        return 1;
+    }
+    for (int i = 0; i < nshards; i++) {
+        if (metas[i].shard != i) {
+            fprintf(stderr, "%s: shard %d given twice\n", metas[i].path, metas[i].shard);
+            return 1;
+        }
+        for (int k = 0; k < NUM_GEOMETRY_KEYS; k++) {
+            char want[1024], got[1024];
+            int have_want = meta_get(metas[0].text, geometry_keys[k], want, sizeof(want));
+            int have_got = meta_get(metas[i].text, geometry_keys[k], got, sizeof(got));
+            if (!have_want || !have_got || strcmp(want, got) != 0) {
+                fprintf(stderr, "%s: %s is %s, %s has %s; rejecting\n",
+                        metas[i].path, geometry_keys[k], have_got ? got : "missing",
+                        metas[0].path, have_want ? want : "missing");
+                return 1;
+            }
+        }
+    }
+
+    // The plan is "name:groups:prime:chains,..."
+    char plan[1024];
+    meta_get(metas[0].text, "plan", plan, sizeof(plan));
+    int nexp = 0;
+    char *names[64];
+    for (char *save, *tok = strtok_r(plan, ",", &save); tok && nexp < 64;
+         tok = strtok_r(NULL, ",", &save)) {
+        tok[strcspn(tok, ":")] = '\0';
+        names[nexp++] = tok;
+    }
+    for (int e = 0; e < nexp; e++)
+        for (int i = 0; i < nshards; i++)
+            if (!check_done(&metas[i], names[e]))
+                return 1;
+
+    if (mkdir(out_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: %s\n", out_dir, strerror(errno));
+        return 1;
+    }
+    long *records = calloc(nexp, sizeof(long));
+    for (int e = 0; e < nexp; e++) {
+        records[e] = merge_experiment(metas, nshards, names[e], out_dir);
+        if (records[e] < 0)
+            return 1;
+        printf("%s: %ld records\n", names[e], records[e]);
+    }
+
+    // Provenance: the merge and the metadata of every shard
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/shards.json", out_dir);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    char merged[32];
+    time_t now = time(NULL);
+    strftime(merged, sizeof(merged), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(f, "{\"merged\":\"%s\",\n\"experiments\":[", merged);
+    for (int e = 0; e < nexp; e++)
+        fprintf(f, "%s{\"name\":\"%s\",\"records\":%ld}", e ? "," : "", names[e], records[e]);
+    fprintf(f, "],\n\"shards\":[\n");
+    for (int i = 0; i < nshards; i++) {
+        size_t len = strlen(metas[i].text);
+        while (len > 0 && metas[i].text[len - 1] == '\n')
+            len--;
+        fprintf(f, "%s%.*s", i ? ",\n" : "", (int)len, metas[i].text);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    for (int i = 0; i < nshards; i++) {
+        free(metas[i].text);
+        free(metas[i].dir);
+    }
+    free(metas);
+    free(records);
+    return 0;
+}